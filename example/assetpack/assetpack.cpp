@@ -0,0 +1,26 @@
+//
+// Builds an asset pack from a directory of static files.
+//
+
+#include "tinycore/tinycore.h"
+
+
+// Packs a directory of front-end assets for AssetPackHandler: assetpack <directory> <output>
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <directory> <output>" << std::endl;
+        return 1;
+    }
+    try {
+        AssetPackBuilder builder;
+        builder.addDirectory(argv[1]);
+        builder.write(argv[2]);
+        AssetPack pack(argv[2]);
+        std::cout << "Packed " << pack.getCount() << " assets into " << argv[2] << " (" << pack.getSize()
+                  << " bytes)" << std::endl;
+    } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+//
+// Compares radix-tree routing against a linear regex scan.
+//
+
+#include "tinycore/tinycore.h"
+
+
+// Compares URL dispatch through URLRouter with the linear regex scan it replaced: routerbench [routes] [iterations]
+int main(int argc, char **argv) {
+    size_t routeCount = argc > 1 ? std::stoul(argv[1]) : 300;
+    size_t iterations = argc > 2 ? std::stoul(argv[2]) : 200000;
+    Application::HandlersType specs;
+    for (size_t i = 0; specs.size() < routeCount; ++i) {
+        std::string prefix = "/api/v1/resource" + std::to_string(i);
+        specs.push_back(url<RequestHandler>(prefix));
+        specs.push_back(url<RequestHandler>(prefix + "/([0-9]+)"));
+        specs.push_back(url<RequestHandler>(prefix + "/([0-9]+)/items/([^/]+)"));
+        specs.push_back(url<RequestHandler>("/static" + std::to_string(i) + "/(.*)"));
+        if (i % 10 == 0) {
+            specs.push_back(url<RequestHandler>(prefix + "/search(?:/(\\w+))?"));
+        }
+    }
+    URLRouter router;
+    for (auto &spec: specs) {
+        router.add(&spec);
+    }
+    size_t groups = specs.size() / 4;
+    StringVector paths;
+    for (size_t i = 0; i != 64; ++i) {
+        std::string prefix = "/api/v1/resource" + std::to_string(i * 7919 % groups);
+        switch (i % 5) {
+            case 0: paths.push_back(prefix); break;
+            case 1: paths.push_back(prefix + "/" + std::to_string(i)); break;
+            case 2: paths.push_back(prefix + "/" + std::to_string(i) + "/items/item%20" + std::to_string(i)); break;
+            case 3: paths.push_back("/static" + std::to_string(i * 31 % groups) + "/js/app.js"); break;
+            default: paths.push_back("/missing/" + std::to_string(i)); break;
+        }
+    }
+
+    auto linear = [&specs](const std::string &path, StringVector &args) -> URLSpec* {
+        boost::xpressive::smatch match;
+        for (auto &spec: specs) {
+            if (boost::xpressive::regex_match(path, match, spec.getRegex())) {
+                for (size_t i = 1; i < match.size(); ++i) {
+                    args.push_back(URLParse::unquote(match[i].str()));
+                }
+                return &spec;
+            }
+        }
+        return nullptr;
+    };
+    for (auto &path: paths) {
+        StringVector linearArgs, routerArgs;
+        if (linear(path, linearArgs) != router.match(path, routerArgs) || linearArgs != routerArgs) {
+            std::cerr << "Mismatch for " << path << std::endl;
+            return 1;
+        }
+    }
+
+    auto run = [&paths, iterations](const char *name, std::function<URLSpec* (const std::string &, StringVector &)> dispatch) {
+        size_t matched = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i != iterations; ++i) {
+            StringVector args;
+            matched += dispatch(paths[i % paths.size()], args) != nullptr;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << name << ": " << elapsed.count() / iterations << " ns/dispatch (" << matched << " matched)"
+                  << std::endl;
+    };
+    std::cout << specs.size() << " routes, " << router.getRegexRouteCount() << " on the regex fallback" << std::endl;
+    run("linear regex", linear);
+    run("radix router", [&router](const std::string &path, StringVector &args) {
+        return router.match(path, args);
+    });
+    return 0;
+}
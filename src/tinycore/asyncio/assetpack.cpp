@@ -0,0 +1,305 @@
+//
+// Memory-mapped asset pack with a perfect hash index.
+//
+
+#include "tinycore/asyncio/assetpack.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <numeric>
+#include <boost/filesystem.hpp>
+#include "tinycore/asyncio/staticfile.h"
+#include "tinycore/compress/gzip.h"
+#include "tinycore/crypto/hashlib.h"
+
+
+static const char ASSET_PACK_MAGIC[4] = {'T', 'C', 'A', 'P'};
+static constexpr uint32_t ASSET_PACK_VERSION = 2;
+
+
+AssetPack::AssetPack(const std::string &fileName)
+        : _fileName(fileName) {
+    _fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0) {
+        ThrowException(IOError, String::format("Open asset pack %s failed: %d", fileName.c_str(), errno));
+    }
+    struct stat st;
+    if (::fstat(_fd, &st) != 0 || (size_t)st.st_size < sizeof(AssetPackHeader)) {
+        ::close(_fd);
+        ThrowException(ValueError, String::format("%s is not an asset pack", fileName.c_str()));
+    }
+    _size = (size_t)st.st_size;
+    void *data = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (data == MAP_FAILED) {
+        ::close(_fd);
+        ThrowException(IOError, String::format("Map asset pack %s failed: %d", fileName.c_str(), errno));
+    }
+    _data = (const Byte *)data;
+    _header = (const AssetPackHeader *)_data;
+    try {
+        validate();
+    } catch (...) {
+        ::munmap((void *)_data, _size);
+        ::close(_fd);
+        throw;
+    }
+    _seeds = (const uint32_t *)(_data + _header->seedsOffset);
+    _entries = (const AssetPackEntry *)(_data + _header->entriesOffset);
+}
+
+AssetPack::~AssetPack() {
+    ::munmap((void *)_data, _size);
+    ::close(_fd);
+}
+
+const AssetPackEntry* AssetPack::find(const char *path, size_t length) const {
+    if (_header->assetCount == 0) {
+        return nullptr;
+    }
+    uint32_t seed = _seeds[hashPath(path, length, 0) % _header->bucketCount];
+    const AssetPackEntry *entry = _entries + hashPath(path, length, seed) % _header->assetCount;
+    if (entry->path.length != length || memcmp(getData(entry->path), path, length) != 0) {
+        return nullptr;
+    }
+    return entry;
+}
+
+uint64_t AssetPack::hashPath(const char *path, size_t length, uint32_t seed) {
+    // FNV-1a with the seed folded into the basis, then the murmur3 finalizer to spread the low bits used for modulo
+    uint64_t hash = 14695981039346656037ULL ^ ((uint64_t)seed * 0x9E3779B97F4A7C15ULL);
+    for (size_t i = 0; i != length; ++i) {
+        hash ^= (uint8_t)path[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb93e77b7c5e3ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+void AssetPack::validate() const {
+    auto within = [this](uint64_t offset, uint64_t length) {
+        return offset <= _size && length <= _size - offset;
+    };
+    if (memcmp(_header->magic, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC)) != 0) {
+        ThrowException(ValueError, String::format("%s is not an asset pack", _fileName.c_str()));
+    }
+    if (_header->version != ASSET_PACK_VERSION) {
+        ThrowException(ValueError, String::format("Unsupported asset pack version %u", _header->version));
+    }
+    if (_header->size != _size || _header->bucketCount == 0
+        || _header->seedsOffset % alignof(uint32_t) != 0 || _header->entriesOffset % alignof(AssetPackEntry) != 0
+        || !within(_header->seedsOffset, (uint64_t)_header->bucketCount * sizeof(uint32_t))
+        || !within(_header->entriesOffset, (uint64_t)_header->assetCount * sizeof(AssetPackEntry))) {
+        ThrowException(ValueError, String::format("Corrupted asset pack %s", _fileName.c_str()));
+    }
+    // Checked once here so that serving never has to
+    auto entries = (const AssetPackEntry *)(_data + _header->entriesOffset);
+    for (uint32_t i = 0; i != _header->assetCount; ++i) {
+        const AssetPackEntry &entry = entries[i];
+        bool valid = within(entry.path.offset, entry.path.length)
+                     && within(entry.contentType.offset, entry.contentType.length);
+        for (size_t i = 0; i != 3; ++i) {
+            valid = valid && within(entry.etags[i].offset, entry.etags[i].length)
+                    && within(entry.bodies[i].offset, entry.bodies[i].length);
+        }
+        if (!valid) {
+            ThrowException(ValueError, String::format("Corrupted asset pack %s", _fileName.c_str()));
+        }
+    }
+}
+
+
+void AssetPackBuilder::add(std::string path, std::string contentType, ByteArray body, ByteArray gzipBody,
+                           ByteArray brotliBody) {
+    if (!_paths.insert(path).second) {
+        ThrowException(DuplicateKey, String::format("Duplicate asset %s", path.c_str()));
+    }
+    Asset asset;
+    asset.path = std::move(path);
+    asset.contentType = std::move(contentType);
+    if (gzipBody.empty() && !body.empty()) {
+        auto buffer = std::make_shared<std::stringstream>();
+        GzipFile gzipFile;
+        gzipFile.initWithOutputStream(buffer);
+        gzipFile.write(body);
+        gzipFile.close();
+        std::string compressed = buffer->str();
+        // Already compressed formats barely shrink; serving them as is spares the client the inflate
+        if (compressed.size() < body.size() - body.size() / 10) {
+            gzipBody.assign(compressed.begin(), compressed.end());
+        }
+    }
+    asset.bodies[AssetPack::IDENTITY] = std::move(body);
+    asset.bodies[AssetPack::GZIP] = std::move(gzipBody);
+    asset.bodies[AssetPack::BROTLI] = std::move(brotliBody);
+    for (size_t i = 0; i != 3; ++i) {
+        if (i == AssetPack::IDENTITY || !asset.bodies[i].empty()) {
+            SHA1Object hasher;
+            hasher.update(asset.bodies[i]);
+            asset.etags[i] = "\"" + hasher.hex() + "\"";
+        }
+    }
+    _assets.push_back(std::move(asset));
+}
+
+void AssetPackBuilder::addDirectory(const std::string &directory) {
+    namespace fs = boost::filesystem;
+    auto readFile = [](const fs::path &path) {
+        std::ifstream file(path.string(), std::ios::binary);
+        if (!file) {
+            ThrowException(IOError, "Read file failed: " + path.string());
+        }
+        return ByteArray(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    };
+    fs::path root(directory);
+    std::vector<fs::path> files;
+    for (fs::recursive_directory_iterator iter(root), end; iter != end; ++iter) {
+        if (fs::is_regular_file(iter->status())) {
+            files.push_back(iter->path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    std::set<fs::path> fileSet(files.begin(), files.end());
+    for (auto &file: files) {
+        std::string extension = file.extension().string();
+        if ((extension == ".gz" || extension == ".br") && fileSet.count(fs::path(file).replace_extension())) {
+            continue;
+        }
+        std::string path = file.lexically_relative(root).generic_string();
+        fs::path gzipFile = file.string() + ".gz", brotliFile = file.string() + ".br";
+        add(path, StaticFile::guessContentType(path), readFile(file),
+            fileSet.count(gzipFile) ? readFile(gzipFile) : ByteArray(),
+            fileSet.count(brotliFile) ? readFile(brotliFile) : ByteArray());
+    }
+}
+
+void AssetPackBuilder::write(const std::string &fileName) const {
+    uint32_t bucketCount;
+    std::vector<size_t> slots;
+    std::vector<uint32_t> seeds = buildIndex(bucketCount, slots);
+
+    AssetPackHeader header;
+    memcpy(header.magic, ASSET_PACK_MAGIC, sizeof(ASSET_PACK_MAGIC));
+    header.version = ASSET_PACK_VERSION;
+    header.assetCount = (uint32_t)_assets.size();
+    header.bucketCount = bucketCount;
+    header.seedsOffset = sizeof(AssetPackHeader);
+    header.entriesOffset = header.seedsOffset + seeds.size() * sizeof(uint32_t);
+    header.entriesOffset += (alignof(AssetPackEntry) - header.entriesOffset % alignof(AssetPackEntry))
+                            % alignof(AssetPackEntry);
+    uint64_t offset = header.entriesOffset + _assets.size() * sizeof(AssetPackEntry);
+    auto place = [&offset](size_t length) {
+        AssetPackSpan span{length ? offset : 0, length};
+        offset += length;
+        return span;
+    };
+    std::vector<AssetPackEntry> entries(slots.size());
+    for (size_t slot = 0; slot != slots.size(); ++slot) {
+        const Asset &asset = _assets[slots[slot]];
+        AssetPackEntry &entry = entries[slot];
+        entry.path = place(asset.path.size());
+        entry.contentType = place(asset.contentType.size());
+        for (size_t i = 0; i != 3; ++i) {
+            entry.etags[i] = place(asset.etags[i].size());
+            entry.bodies[i] = place(asset.bodies[i].size());
+        }
+    }
+    header.size = offset;
+
+    // Truncating a pack in place would fault every server that has it mapped; a rename swaps the inode instead
+    std::string tempName = fileName + ".XXXXXX";
+    int fd = ::mkstemp(&tempName[0]);
+    if (fd < 0) {
+        ThrowException(IOError, "Open file failed: " + tempName);
+    }
+    ::fchmod(fd, 0644);
+    ::close(fd);
+    std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        ::unlink(tempName.c_str());
+        ThrowException(IOError, "Open file failed: " + tempName);
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)seeds.data(), seeds.size() * sizeof(uint32_t));
+    file.write("\0\0\0\0\0\0\0\0", header.entriesOffset - header.seedsOffset - seeds.size() * sizeof(uint32_t));
+    file.write((const char *)entries.data(), entries.size() * sizeof(AssetPackEntry));
+    for (size_t index: slots) {
+        const Asset &asset = _assets[index];
+        file.write(asset.path.data(), asset.path.size());
+        file.write(asset.contentType.data(), asset.contentType.size());
+        for (size_t i = 0; i != 3; ++i) {
+            file.write(asset.etags[i].data(), asset.etags[i].size());
+            file.write((const char *)asset.bodies[i].data(), asset.bodies[i].size());
+        }
+    }
+    file.close();
+    if (!file || ::rename(tempName.c_str(), fileName.c_str()) != 0) {
+        ::unlink(tempName.c_str());
+        ThrowException(IOError, "Write file failed: " + fileName);
+    }
+}
+
+std::vector<uint32_t> AssetPackBuilder::buildIndex(uint32_t &bucketCount, std::vector<size_t> &slots) const {
+    // Hash and displace: assets are spread over buckets of about four, then the largest buckets pick first a seed
+    // that sends all their assets to free slots
+    constexpr uint32_t maxSeed = 1u << 20;
+    size_t count = _assets.size();
+    bucketCount = (uint32_t)std::max<size_t>(1, (count + 3) / 4);
+    while (true) {
+        std::vector<std::vector<size_t>> buckets(bucketCount);
+        for (size_t i = 0; i != count; ++i) {
+            const std::string &path = _assets[i].path;
+            buckets[AssetPack::hashPath(path.data(), path.size(), 0) % bucketCount].push_back(i);
+        }
+        std::vector<uint32_t> order(bucketCount);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t lhs, uint32_t rhs) {
+            return buckets[lhs].size() > buckets[rhs].size();
+        });
+        std::vector<uint32_t> seeds(bucketCount, 0);
+        std::vector<bool> taken(count, false);
+        slots.assign(count, 0);
+        bool built = true;
+        std::vector<size_t> positions;
+        for (uint32_t bucket: order) {
+            const auto &members = buckets[bucket];
+            if (members.empty()) {
+                break;
+            }
+            uint32_t seed = 1;
+            for (; seed != maxSeed; ++seed) {
+                positions.clear();
+                for (size_t index: members) {
+                    const std::string &path = _assets[index].path;
+                    size_t position = AssetPack::hashPath(path.data(), path.size(), seed) % count;
+                    if (taken[position] || std::find(positions.begin(), positions.end(), position) != positions.end()) {
+                        break;
+                    }
+                    positions.push_back(position);
+                }
+                if (positions.size() == members.size()) {
+                    break;
+                }
+            }
+            if (seed == maxSeed) {
+                built = false;
+                break;
+            }
+            seeds[bucket] = seed;
+            for (size_t i = 0; i != members.size(); ++i) {
+                taken[positions[i]] = true;
+                slots[positions[i]] = members[i];
+            }
+        }
+        if (built) {
+            return seeds;
+        }
+        bucketCount *= 2;
+    }
+}
@@ -0,0 +1,146 @@
+//
+// Memory-mapped asset pack with a perfect hash index.
+//
+
+#ifndef TINYCORE_ASSETPACK_H
+#define TINYCORE_ASSETPACK_H
+
+#include "tinycore/common/common.h"
+
+
+// On-disk layout of an asset pack, all integers in host byte order:
+//   AssetPackHeader | uint32_t seeds[bucketCount] | AssetPackEntry entries[assetCount] | strings and bodies
+// An entry for a path lives in slot hash(path, seeds[hash(path, 0) % bucketCount]) % assetCount, so a lookup is two
+// hashes and one compare whatever the number of assets.
+struct AssetPackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t assetCount;
+    uint32_t bucketCount;
+    uint64_t seedsOffset;
+    uint64_t entriesOffset;
+    // Size of the whole file, so a truncated pack is refused
+    uint64_t size;
+};
+
+
+struct AssetPackSpan {
+    uint64_t offset;
+    uint64_t length;
+};
+
+
+struct AssetPackEntry {
+    AssetPackSpan path;
+    AssetPackSpan contentType;
+    // Both indexed by AssetPack::Encoding; an empty body span means the variant was not packed. Every variant carries
+    // its own strong etag since their bytes differ
+    AssetPackSpan etags[3];
+    AssetPackSpan bodies[3];
+};
+
+
+// Read-only view of a pack mapped into memory; entries and bodies point straight into the mapping. The descriptor stays
+// open so bodies can also be sent from the file itself
+class TC_COMMON_API AssetPack {
+public:
+    enum Encoding {
+        IDENTITY = 0,
+        GZIP = 1,
+        BROTLI = 2,
+    };
+
+    explicit AssetPack(const std::string &fileName);
+
+    ~AssetPack();
+
+    AssetPack(const AssetPack &) = delete;
+
+    AssetPack &operator=(const AssetPack &) = delete;
+
+    // Returns null when the pack holds no asset for path
+    const AssetPackEntry* find(const char *path, size_t length) const;
+
+    const AssetPackEntry* find(const std::string &path) const {
+        return find(path.data(), path.size());
+    }
+
+    int getFd() const {
+        return _fd;
+    }
+
+    const Byte* getData(const AssetPackSpan &span) const {
+        return _data + span.offset;
+    }
+
+    std::string getString(const AssetPackSpan &span) const {
+        return std::string((const char *)getData(span), span.length);
+    }
+
+    size_t getCount() const {
+        return _header->assetCount;
+    }
+
+    size_t getSize() const {
+        return _size;
+    }
+
+    const std::string& getFileName() const {
+        return _fileName;
+    }
+
+    static uint64_t hashPath(const char *path, size_t length, uint32_t seed);
+
+    template <typename ...Args>
+    static std::shared_ptr<AssetPack> create(Args&& ...args) {
+        return std::make_shared<AssetPack>(std::forward<Args>(args)...);
+    }
+protected:
+    void validate() const;
+
+    std::string _fileName;
+    int _fd{-1};
+    const Byte *_data{nullptr};
+    size_t _size{0};
+    const AssetPackHeader *_header{nullptr};
+    const uint32_t *_seeds{nullptr};
+    const AssetPackEntry *_entries{nullptr};
+};
+
+
+// Collects assets and writes them out as a pack, building the perfect hash index on the way
+class TC_COMMON_API AssetPackBuilder {
+public:
+    // Adds an asset under path, e.g. "js/app.js". Etags are derived from the bodies and a gzip variant is generated
+    // unless one is given or compressing does not pay
+    void add(std::string path, std::string contentType, ByteArray body, ByteArray gzipBody={},
+             ByteArray brotliBody={});
+
+    // Adds every regular file below directory, keyed by its relative path. Existing .gz and .br siblings are packed as
+    // the variants of the file they sit next to rather than as assets of their own
+    void addDirectory(const std::string &directory);
+
+    // Writes to a temporary file next to fileName and renames it into place, so servers that still map the old pack
+    // keep reading intact pages
+    void write(const std::string &fileName) const;
+
+    size_t getCount() const {
+        return _assets.size();
+    }
+protected:
+    struct Asset {
+        std::string path;
+        std::string contentType;
+        std::string etags[3];
+        ByteArray bodies[3];
+    };
+
+    // Returns the hash seed of every bucket; slots receives the asset index stored at each slot
+    std::vector<uint32_t> buildIndex(uint32_t &bucketCount, std::vector<size_t> &slots) const;
+
+    std::vector<Asset> _assets;
+    StringSet _paths;
+};
+
+
+#endif //TINYCORE_ASSETPACK_H
@@ -0,0 +1,79 @@
+//
+// Coalesces identical concurrent requests into a single flight.
+//
+
+#include "tinycore/asyncio/coalescer.h"
+
+
+RequestCoalescer::RequestCoalescer(size_t maxWaiters, size_t maxFlights)
+        : _maxWaiters(maxWaiters)
+        , _maxFlights(maxFlights) {
+
+}
+
+std::string RequestCoalescer::makeKey(const HTTPServerRequest &request) const {
+    std::string key;
+    key.reserve(128);
+    key.append(request.getMethod());
+    key.push_back(' ');
+    key.append(request.getVersion());
+    key.push_back(' ');
+    key.append(request.getHost());
+    key.append(request.getURI());
+    const HTTPHeaders *headers = request.getHTTPHeaders();
+    if (!request.supportsHTTP11()) {
+        // Whether the response says Keep-Alive depends on the request's Connection header
+        key.push_back('\n');
+        key.append(headers->get(HTTPHeaderField::CONNECTION));
+    }
+    for (auto &name: _keyHeaders) {
+        key.push_back('\n');
+        key.append(headers->get(name));
+    }
+    return key;
+}
+
+bool RequestCoalescer::attach(const std::string &key, std::shared_ptr<HTTPServerRequest> request) {
+    auto iter = _flights.find(key);
+    if (iter == _flights.end() || iter->second->waiters.size() >= _maxWaiters) {
+        return false;
+    }
+    iter->second->waiters.push_back(std::move(request));
+    return true;
+}
+
+std::shared_ptr<RequestCoalescer::Flight> RequestCoalescer::begin(std::string key) {
+    if (_flights.size() >= _maxFlights || _flights.find(key) != _flights.end()) {
+        return nullptr;
+    }
+    auto flight = std::make_shared<Flight>();
+    flight->key = std::move(key);
+    _flights[flight->key] = flight;
+    return flight;
+}
+
+RequestCoalescer::WaitersType RequestCoalescer::land(std::shared_ptr<Flight> flight) {
+    auto iter = _flights.find(flight->key);
+    if (iter != _flights.end() && iter->second == flight) {
+        _flights.erase(iter);
+    }
+    if (!flight->shareable) {
+        return std::move(flight->waiters);
+    }
+    for (auto &request: flight->waiters) {
+        request->writeHeaders(flight->statusCode, flight->headers, flight->response, flight->headLength);
+        request->finish();
+    }
+    _coalescedCount += flight->waiters.size();
+    return {};
+}
+
+bool RequestCoalescer::defaultBypass(const HTTPServerRequest &request) {
+    const std::string &method = request.getMethod();
+    if (method != "GET" && method != "HEAD") {
+        return true;
+    }
+    const HTTPHeaders *headers = request.getHTTPHeaders();
+    return headers->has(HTTPHeaderField::AUTHORIZATION) || headers->has(HTTPHeaderField::COOKIE)
+           || headers->has(HTTPHeaderField::IF_NONE_MATCH) || headers->has(HTTPHeaderField::IF_MODIFIED_SINCE);
+}
@@ -0,0 +1,136 @@
+//
+// Coalesces identical concurrent requests into a single flight.
+//
+
+#ifndef TINYCORE_COALESCER_H
+#define TINYCORE_COALESCER_H
+
+#include "tinycore/common/common.h"
+#include <unordered_map>
+#include "tinycore/asyncio/httpserver.h"
+
+
+constexpr size_t DEFAULT_COALESCER_MAX_WAITERS = 256;
+constexpr size_t DEFAULT_COALESCER_MAX_FLIGHTS = 1024;
+constexpr size_t DEFAULT_COALESCER_MAX_RESPONSE_SIZE = 4 * 1024 * 1024;
+
+
+// Single flight for identical concurrent requests: the first request for a key runs its handler as the leader while
+// the ones arriving before it finishes wait on its flight, and are all answered with the leader's serialized response.
+// Requests are only coalesced while the flight and its waiter list are under their caps. Not thread safe: give each
+// IOLoop its own coalescer.
+class TC_COMMON_API RequestCoalescer {
+public:
+    typedef std::function<bool (const HTTPServerRequest &)> BypassType;
+    typedef std::vector<std::shared_ptr<HTTPServerRequest>> WaitersType;
+
+    struct Flight {
+        std::string key;
+        WaitersType waiters;
+        // Everything the leader wrote, status line included; the head is its first headLength bytes
+        std::string response;
+        int statusCode{0};
+        HTTPHeaders headers;
+        size_t headLength{0};
+        // Cleared when the response is personal to the leader (cookies) or outgrew the buffer limit
+        bool shareable{true};
+    };
+
+    explicit RequestCoalescer(size_t maxWaiters=DEFAULT_COALESCER_MAX_WAITERS,
+                              size_t maxFlights=DEFAULT_COALESCER_MAX_FLIGHTS);
+
+    RequestCoalescer(const RequestCoalescer &) = delete;
+
+    RequestCoalescer &operator=(const RequestCoalescer &) = delete;
+
+    void setMaxWaiters(size_t maxWaiters) {
+        _maxWaiters = maxWaiters;
+    }
+
+    size_t getMaxWaiters() const {
+        return _maxWaiters;
+    }
+
+    void setMaxFlights(size_t maxFlights) {
+        _maxFlights = maxFlights;
+    }
+
+    size_t getMaxFlights() const {
+        return _maxFlights;
+    }
+
+    void setMaxResponseSize(size_t maxResponseSize) {
+        _maxResponseSize = maxResponseSize;
+    }
+
+    size_t getMaxResponseSize() const {
+        return _maxResponseSize;
+    }
+
+    // Request headers that become part of the key besides the method, version and url
+    void setKeyHeaders(StringVector keyHeaders) {
+        _keyHeaders = std::move(keyHeaders);
+    }
+
+    const StringVector& getKeyHeaders() const {
+        return _keyHeaders;
+    }
+
+    // Requests the function returns true for always run their own handler; defaults to defaultBypass
+    void setBypass(BypassType bypass) {
+        _bypass = std::move(bypass);
+    }
+
+    bool isBypassed(const HTTPServerRequest &request) const {
+        return _bypass && _bypass(request);
+    }
+
+    std::string makeKey(const HTTPServerRequest &request) const;
+
+    // Returns true when the request was attached as a waiter to the flight in progress for key
+    bool attach(const std::string &key, std::shared_ptr<HTTPServerRequest> request);
+
+    // Opens a flight for the leader; returns null once the flight cap is reached
+    std::shared_ptr<Flight> begin(std::string key);
+
+    // Captures a chunk the leader wrote
+    void record(Flight &flight, const std::string &chunk) {
+        if (flight.shareable) {
+            if (flight.response.size() + chunk.size() > _maxResponseSize) {
+                flight.shareable = false;
+                flight.response.clear();
+            } else {
+                flight.response.append(chunk);
+            }
+        }
+    }
+
+    // Closes the flight and answers its waiters; returns the ones that could not share the response
+    WaitersType land(std::shared_ptr<Flight> flight);
+
+    size_t getFlightCount() const {
+        return _flights.size();
+    }
+
+    size_t getCoalescedCount() const {
+        return _coalescedCount;
+    }
+
+    static bool defaultBypass(const HTTPServerRequest &request);
+
+    template <typename ...Args>
+    static std::shared_ptr<RequestCoalescer> create(Args&& ...args) {
+        return std::make_shared<RequestCoalescer>(std::forward<Args>(args)...);
+    }
+protected:
+    size_t _maxWaiters;
+    size_t _maxFlights;
+    size_t _maxResponseSize{DEFAULT_COALESCER_MAX_RESPONSE_SIZE};
+    StringVector _keyHeaders{"Accept-Encoding"};
+    BypassType _bypass{defaultBypass};
+    std::unordered_map<std::string, std::shared_ptr<Flight>> _flights;
+    size_t _coalescedCount{0};
+};
+
+
+#endif //TINYCORE_COALESCER_H
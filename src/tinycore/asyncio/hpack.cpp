@@ -0,0 +1,415 @@
+//
+// HPACK header compression for HTTP/2 (RFC 7541).
+//
+
+#include "tinycore/asyncio/hpack.h"
+
+
+static const std::array<std::pair<const char *, const char *>, HPACK_STATIC_TABLE_SIZE> STATIC_TABLE = {{
+        {":authority", ""},
+        {":method", "GET"},
+        {":method", "POST"},
+        {":path", "/"},
+        {":path", "/index.html"},
+        {":scheme", "http"},
+        {":scheme", "https"},
+        {":status", "200"},
+        {":status", "204"},
+        {":status", "206"},
+        {":status", "304"},
+        {":status", "400"},
+        {":status", "404"},
+        {":status", "500"},
+        {"accept-charset", ""},
+        {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""},
+        {"accept-ranges", ""},
+        {"accept", ""},
+        {"access-control-allow-origin", ""},
+        {"age", ""},
+        {"allow", ""},
+        {"authorization", ""},
+        {"cache-control", ""},
+        {"content-disposition", ""},
+        {"content-encoding", ""},
+        {"content-language", ""},
+        {"content-length", ""},
+        {"content-location", ""},
+        {"content-range", ""},
+        {"content-type", ""},
+        {"cookie", ""},
+        {"date", ""},
+        {"etag", ""},
+        {"expect", ""},
+        {"expires", ""},
+        {"from", ""},
+        {"host", ""},
+        {"if-match", ""},
+        {"if-modified-since", ""},
+        {"if-none-match", ""},
+        {"if-range", ""},
+        {"if-unmodified-since", ""},
+        {"last-modified", ""},
+        {"link", ""},
+        {"location", ""},
+        {"max-forwards", ""},
+        {"proxy-authenticate", ""},
+        {"proxy-authorization", ""},
+        {"range", ""},
+        {"referer", ""},
+        {"refresh", ""},
+        {"retry-after", ""},
+        {"server", ""},
+        {"set-cookie", ""},
+        {"strict-transport-security", ""},
+        {"transfer-encoding", ""},
+        {"user-agent", ""},
+        {"vary", ""},
+        {"via", ""},
+        {"www-authenticate", ""},
+}};
+
+
+// Code lengths of the RFC 7541 Appendix B code, symbols 0..255 followed by EOS. The code is canonical, so the
+// codes themselves are rebuilt from the lengths.
+static const std::array<uint8_t, 257> HUFFMAN_LENGTHS = {{
+        13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+        28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+        6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+        5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+        13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+        15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+        6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+        20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+        24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+        22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+        21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+        26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+        19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+        20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+        26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+        30,
+}};
+
+
+constexpr size_t HUFFMAN_MAX_LENGTH = 30;
+constexpr unsigned HUFFMAN_EOS = 256;
+
+
+struct HuffmanCode {
+    HuffmanCode() {
+        std::array<uint16_t, 257> order;
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [](uint16_t lhs, uint16_t rhs) {
+            return HUFFMAN_LENGTHS[lhs] < HUFFMAN_LENGTHS[rhs];
+        });
+        counts.fill(0);
+        for (auto length: HUFFMAN_LENGTHS) {
+            ++counts[length];
+        }
+        uint32_t code = 0;
+        size_t offset = 0;
+        for (size_t length = 1; length <= HUFFMAN_MAX_LENGTH; ++length) {
+            firstCodes[length] = code;
+            offsets[length] = offset;
+            code = (code + counts[length]) << 1;
+            offset += counts[length];
+        }
+        std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> next = firstCodes;
+        for (size_t i = 0; i != order.size(); ++i) {
+            uint16_t symbol = order[i];
+            symbols[i] = symbol;
+            codes[symbol] = next[HUFFMAN_LENGTHS[symbol]]++;
+        }
+    }
+
+    std::array<uint32_t, 257> codes;
+    std::array<uint16_t, 257> symbols;
+    std::array<uint32_t, HUFFMAN_MAX_LENGTH + 1> firstCodes;
+    std::array<size_t, HUFFMAN_MAX_LENGTH + 1> offsets;
+    std::array<size_t, HUFFMAN_MAX_LENGTH + 1> counts;
+};
+
+
+static const HuffmanCode& getHuffmanCode() {
+    static const HuffmanCode huffmanCode;
+    return huffmanCode;
+}
+
+
+size_t HPACKHuffman::encodedLength(const std::string &value) {
+    size_t bits = 0;
+    for (char c: value) {
+        bits += HUFFMAN_LENGTHS[(unsigned char)c];
+    }
+    return (bits + 7) / 8;
+}
+
+void HPACKHuffman::encode(const std::string &value, ByteArray &block) {
+    const HuffmanCode &huffmanCode = getHuffmanCode();
+    uint64_t bits = 0;
+    size_t count = 0;
+    for (char c: value) {
+        auto symbol = (unsigned char)c;
+        bits = (bits << HUFFMAN_LENGTHS[symbol]) | huffmanCode.codes[symbol];
+        count += HUFFMAN_LENGTHS[symbol];
+        while (count >= 8) {
+            count -= 8;
+            block.push_back((Byte)(bits >> count));
+        }
+    }
+    if (count > 0) {
+        // Pad with the most significant bits of EOS, which are all ones
+        block.push_back((Byte)((bits << (8 - count)) | (0xFF >> count)));
+    }
+}
+
+bool HPACKHuffman::decode(const Byte *data, size_t length, std::string &value) {
+    const HuffmanCode &huffmanCode = getHuffmanCode();
+    uint32_t code = 0;
+    size_t codeLength = 0;
+    for (const Byte *end = data + length; data != end; ++data) {
+        for (int shift = 7; shift >= 0; --shift) {
+            code = (code << 1) | ((*data >> shift) & 1);
+            ++codeLength;
+            if (code - huffmanCode.firstCodes[codeLength] < huffmanCode.counts[codeLength]) {
+                uint16_t symbol = huffmanCode.symbols[huffmanCode.offsets[codeLength] + code
+                                                      - huffmanCode.firstCodes[codeLength]];
+                if (symbol == HUFFMAN_EOS) {
+                    return false;
+                }
+                value.push_back((char)symbol);
+                code = 0;
+                codeLength = 0;
+            } else if (codeLength == HUFFMAN_MAX_LENGTH) {
+                return false;
+            }
+        }
+    }
+    // Padding is at most 7 bits and must be a prefix of EOS
+    return codeLength < 8 && code == (1u << codeLength) - 1;
+}
+
+
+const HPACKTable::HeaderType* HPACKTable::get(size_t index) const {
+    static const std::vector<HeaderType> staticEntries = []() {
+        std::vector<HeaderType> entries;
+        for (auto &entry: STATIC_TABLE) {
+            entries.emplace_back(entry.first, entry.second);
+        }
+        return entries;
+    }();
+    if (index == 0) {
+        return nullptr;
+    }
+    if (index <= HPACK_STATIC_TABLE_SIZE) {
+        return &staticEntries[index - 1];
+    }
+    index -= HPACK_STATIC_TABLE_SIZE + 1;
+    return index < _entries.size() ? &_entries[index] : nullptr;
+}
+
+size_t HPACKTable::find(const std::string &name, const std::string &value, bool &nameOnly) const {
+    size_t nameIndex = 0;
+    for (size_t i = 0; i != STATIC_TABLE.size(); ++i) {
+        if (name == STATIC_TABLE[i].first) {
+            if (value == STATIC_TABLE[i].second) {
+                nameOnly = false;
+                return i + 1;
+            }
+            if (nameIndex == 0) {
+                nameIndex = i + 1;
+            }
+        }
+    }
+    for (size_t i = 0; i != _entries.size(); ++i) {
+        if (_entries[i].first == name) {
+            if (_entries[i].second == value) {
+                nameOnly = false;
+                return i + HPACK_STATIC_TABLE_SIZE + 1;
+            }
+            if (nameIndex == 0) {
+                nameIndex = i + HPACK_STATIC_TABLE_SIZE + 1;
+            }
+        }
+    }
+    nameOnly = true;
+    return nameIndex;
+}
+
+void HPACKTable::add(std::string name, std::string value) {
+    size_t size = entrySize(name, value);
+    evict(size);
+    if (size <= _maxSize) {
+        _entries.emplace_front(std::move(name), std::move(value));
+        _size += size;
+    }
+}
+
+void HPACKTable::evict(size_t required) {
+    while (!_entries.empty() && _size + required > _maxSize) {
+        _size -= entrySize(_entries.back().first, _entries.back().second);
+        _entries.pop_back();
+    }
+}
+
+
+static bool decodeInteger(const Byte *&data, const Byte *end, unsigned prefixBits, size_t &value) {
+    if (data == end) {
+        return false;
+    }
+    size_t mask = (1u << prefixBits) - 1;
+    value = *data++ & mask;
+    if (value < mask) {
+        return true;
+    }
+    for (unsigned shift = 0; data != end; shift += 7) {
+        // Anything above 2^28 is far beyond every limit we enforce; reject it instead of risking overflow
+        if (shift > 21) {
+            return false;
+        }
+        Byte b = *data++;
+        value += (size_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool HPACKDecoder::decode(const Byte *data, size_t length, HeaderListType &headers, size_t &listSize) {
+    const Byte *end = data + length;
+    bool first = true;
+    listSize = 0;
+    while (data != end) {
+        Byte b = *data;
+        if (b & 0x80) {
+            size_t index;
+            if (!decodeInteger(data, end, 7, index)) {
+                return false;
+            }
+            const HeaderType *header = _table.get(index);
+            if (!header) {
+                return false;
+            }
+            headers.push_back(*header);
+        } else if ((b & 0xE0) == 0x20) {
+            size_t maxSize;
+            if (!first || !decodeInteger(data, end, 5, maxSize) || maxSize > _maxTableSize) {
+                return false;
+            }
+            _table.setMaxSize(maxSize);
+            continue;
+        } else {
+            bool indexing = (b & 0xC0) == 0x40;
+            size_t index;
+            if (!decodeInteger(data, end, indexing ? 6 : 4, index)) {
+                return false;
+            }
+            HeaderType header;
+            if (index != 0) {
+                const HeaderType *indexed = _table.get(index);
+                if (!indexed) {
+                    return false;
+                }
+                header.first = indexed->first;
+            } else if (!decodeString(data, end, header.first)) {
+                return false;
+            }
+            if (!decodeString(data, end, header.second)) {
+                return false;
+            }
+            if (indexing) {
+                _table.add(header.first, header.second);
+            }
+            headers.emplace_back(std::move(header));
+        }
+        first = false;
+        listSize += HPACKTable::entrySize(headers.back().first, headers.back().second);
+    }
+    return true;
+}
+
+bool HPACKDecoder::decodeString(const Byte *&data, const Byte *end, std::string &value) {
+    if (data == end) {
+        return false;
+    }
+    bool huffman = (*data & 0x80) != 0;
+    size_t length;
+    if (!decodeInteger(data, end, 7, length) || length > (size_t)(end - data)) {
+        return false;
+    }
+    if (huffman) {
+        if (!HPACKHuffman::decode(data, length, value)) {
+            return false;
+        }
+    } else {
+        value.assign((const char *)data, length);
+    }
+    data += length;
+    return true;
+}
+
+
+void HPACKEncoder::encode(const HeaderListType &headers, ByteArray &block) {
+    if (_sizeUpdatePending) {
+        if (_minPendingSize < _table.getMaxSize()) {
+            encodeInteger(_minPendingSize, 5, 0x20, block);
+        }
+        encodeInteger(_table.getMaxSize(), 5, 0x20, block);
+        _sizeUpdatePending = false;
+        _minPendingSize = std::numeric_limits<size_t>::max();
+    }
+    for (auto &header: headers) {
+        bool nameOnly;
+        size_t index = _table.find(header.first, header.second, nameOnly);
+        if (index != 0 && !nameOnly) {
+            encodeInteger(index, 7, 0x80, block);
+            continue;
+        }
+        // Values that change on nearly every response would only churn the dynamic table
+        const std::string &name = header.first;
+        bool volatileValue = name == "content-length" || name == "date" || name == "etag" || name == "age"
+                             || name == "last-modified" || name == "set-cookie" || name == "location";
+        if (volatileValue) {
+            encodeInteger(index, 4, 0x00, block);
+        } else {
+            encodeInteger(index, 6, 0x40, block);
+        }
+        if (index == 0) {
+            encodeString(header.first, block);
+        }
+        encodeString(header.second, block);
+        if (!volatileValue) {
+            _table.add(header.first, header.second);
+        }
+    }
+}
+
+void HPACKEncoder::encodeInteger(size_t value, unsigned prefixBits, Byte flags, ByteArray &block) {
+    size_t mask = (1u << prefixBits) - 1;
+    if (value < mask) {
+        block.push_back((Byte)(flags | value));
+        return;
+    }
+    block.push_back((Byte)(flags | mask));
+    value -= mask;
+    while (value >= 0x80) {
+        block.push_back((Byte)(0x80 | (value & 0x7F)));
+        value >>= 7;
+    }
+    block.push_back((Byte)value);
+}
+
+void HPACKEncoder::encodeString(const std::string &value, ByteArray &block) {
+    size_t length = HPACKHuffman::encodedLength(value);
+    if (length < value.size()) {
+        encodeInteger(length, 7, 0x80, block);
+        HPACKHuffman::encode(value, block);
+    } else {
+        encodeInteger(value.size(), 7, 0x00, block);
+        block.insert(block.end(), value.begin(), value.end());
+    }
+}
@@ -0,0 +1,131 @@
+//
+// HPACK header compression for HTTP/2 (RFC 7541).
+//
+
+#ifndef TINYCORE_HPACK_H
+#define TINYCORE_HPACK_H
+
+#include "tinycore/common/common.h"
+
+
+constexpr size_t HPACK_DEFAULT_TABLE_SIZE = 4096;
+constexpr size_t HPACK_STATIC_TABLE_SIZE = 61;
+
+
+class TC_COMMON_API HPACKHuffman {
+public:
+    static size_t encodedLength(const std::string &value);
+    static void encode(const std::string &value, ByteArray &block);
+    static bool decode(const Byte *data, size_t length, std::string &value);
+};
+
+
+class TC_COMMON_API HPACKTable {
+public:
+    typedef std::pair<std::string, std::string> HeaderType;
+
+    explicit HPACKTable(size_t maxSize=HPACK_DEFAULT_TABLE_SIZE)
+            : _maxSize(maxSize) {
+
+    }
+
+    // index follows RFC 7541: 1..61 is the static table, the dynamic table starts at 62 with the newest entry
+    const HeaderType* get(size_t index) const;
+
+    // Returns the index of an exact match, or of the first entry with the same name (nameOnly is then set);
+    // 0 when neither exists
+    size_t find(const std::string &name, const std::string &value, bool &nameOnly) const;
+
+    void add(std::string name, std::string value);
+
+    void setMaxSize(size_t maxSize) {
+        _maxSize = maxSize;
+        evict(0);
+    }
+
+    size_t getMaxSize() const {
+        return _maxSize;
+    }
+
+    size_t getSize() const {
+        return _size;
+    }
+
+    size_t getCount() const {
+        return _entries.size();
+    }
+
+    static size_t entrySize(const std::string &name, const std::string &value) {
+        return name.size() + value.size() + 32;
+    }
+protected:
+    void evict(size_t required);
+
+    size_t _maxSize;
+    size_t _size{0};
+    std::deque<HeaderType> _entries;
+};
+
+
+class TC_COMMON_API HPACKDecoder {
+public:
+    typedef HPACKTable::HeaderType HeaderType;
+    typedef std::vector<HeaderType> HeaderListType;
+
+    explicit HPACKDecoder(size_t maxTableSize=HPACK_DEFAULT_TABLE_SIZE)
+            : _table(maxTableSize)
+            , _maxTableSize(maxTableSize) {
+
+    }
+
+    // Decodes a complete header block; returns false on any COMPRESSION_ERROR, after which the decoder must not
+    // be used again. listSize receives the RFC 7540 header list size (name + value + 32 per field).
+    bool decode(const Byte *data, size_t length, HeaderListType &headers, size_t &listSize);
+
+    const HPACKTable& getTable() const {
+        return _table;
+    }
+protected:
+    bool decodeString(const Byte *&data, const Byte *end, std::string &value);
+
+    HPACKTable _table;
+    size_t _maxTableSize;
+};
+
+
+class TC_COMMON_API HPACKEncoder {
+public:
+    typedef HPACKTable::HeaderType HeaderType;
+    typedef std::vector<HeaderType> HeaderListType;
+
+    explicit HPACKEncoder(size_t maxTableSize=HPACK_DEFAULT_TABLE_SIZE)
+            : _table(maxTableSize) {
+
+    }
+
+    void encode(const HeaderListType &headers, ByteArray &block);
+
+    // Follows the peer's SETTINGS_HEADER_TABLE_SIZE; the change is announced at the start of the next block
+    void setMaxTableSize(size_t maxTableSize) {
+        maxTableSize = std::min(maxTableSize, HPACK_DEFAULT_TABLE_SIZE);
+        if (maxTableSize != _table.getMaxSize()) {
+            _minPendingSize = std::min(_minPendingSize, maxTableSize);
+            _table.setMaxSize(maxTableSize);
+            _sizeUpdatePending = true;
+        }
+    }
+
+    const HPACKTable& getTable() const {
+        return _table;
+    }
+protected:
+    static void encodeInteger(size_t value, unsigned prefixBits, Byte flags, ByteArray &block);
+    static void encodeString(const std::string &value, ByteArray &block);
+
+    HPACKTable _table;
+    bool _sizeUpdatePending{false};
+    size_t _minPendingSize{std::numeric_limits<size_t>::max()};
+};
+
+
+#endif //TINYCORE_HPACK_H
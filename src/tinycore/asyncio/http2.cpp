@@ -0,0 +1,848 @@
+//
+// HTTP/2 server connection (RFC 7540).
+//
+
+#include "tinycore/asyncio/http2.h"
+#include <boost/algorithm/string.hpp>
+#include "tinycore/asyncio/logutil.h"
+#include "tinycore/asyncio/stackcontext.h"
+#include "tinycore/utilities/string.h"
+
+
+const char * const HTTP2_CONNECTION_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+
+static inline uint32_t readUInt32(const Byte *data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static inline void writeUInt32(Byte *data, uint32_t value) {
+    data[0] = (Byte)(value >> 24);
+    data[1] = (Byte)(value >> 16);
+    data[2] = (Byte)(value >> 8);
+    data[3] = (Byte)value;
+}
+
+static inline bool isHopByHopHeader(const std::string &name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding"
+           || name == "upgrade";
+}
+
+
+void HTTP2Connection::start() {
+    auto wrapper = makePooledShared<CloseCallbackWrapper>(shared_from_this());
+    _stream->setCloseCallback(std::bind(&CloseCallbackWrapper::operator(), std::move(wrapper)));
+    // Control frames are tiny and latency bound; Nagle would stall every WINDOW_UPDATE and SETTINGS ack
+    _stream->setNodelay(true);
+    sendSettings();
+    NullContext ctx;
+    if (_http2SettingsTimeout > 0.0f) {
+        std::weak_ptr<HTTPConnection> connection = shared_from_this();
+        _settingsTimeout = _stream->ioloop()->addTimeout(_http2SettingsTimeout, [this, connection]() {
+            if (connection.lock()) {
+                onSettingsTimeout();
+            }
+        });
+    }
+    _stream->readBytes(strlen(HTTP2_CONNECTION_PREFACE) - _prefaceReceived,
+                       [this, self=shared_from_this()](ByteArray data) {
+        onPreface(std::move(data));
+    });
+}
+
+void HTTP2Connection::setCloseCallback(const HTTPServerRequest *request, CloseCallbackType callback) {
+    auto stream = findStream(request);
+    if (stream) {
+        stream->closeCallback = StackContext::wrap(std::move(callback));
+    }
+}
+
+void HTTP2Connection::write(const HTTPServerRequest *request, const Byte *chunk, size_t length,
+                            WriteCallbackType callback) {
+    auto stream = findStream(request);
+    if (!stream || _stream->closed()) {
+        return;
+    }
+    if (!stream->headersSent) {
+        LOG_WARNING(gGenLog, "HTTP/2 stream %u written to before its response header", stream->id);
+        streamError(stream->id, HTTP2ErrorCode::INTERNAL_ERROR);
+        return;
+    }
+    stream->writeCallback = StackContext::wrap(std::move(callback));
+    stream->pending.insert(stream->pending.end(), chunk, chunk + length);
+    flushStream(stream);
+}
+
+void HTTP2Connection::writeHeaders(const HTTPServerRequest *request, int statusCode, const HTTPHeaders &headers,
+                                   const Byte *data, size_t headLength, size_t length, WriteCallbackType callback) {
+    auto stream = findStream(request);
+    if (!stream || _stream->closed()) {
+        return;
+    }
+    stream->writeCallback = StackContext::wrap(std::move(callback));
+    stream->headersSent = true;
+    sendHeaders(stream, std::to_string(statusCode), headers);
+    stream->pending.insert(stream->pending.end(), data + headLength, data + length);
+    flushStream(stream);
+}
+
+void HTTP2Connection::finish(const HTTPServerRequest *request) {
+    auto stream = findStream(request);
+    if (!stream || _stream->closed()) {
+        return;
+    }
+    stream->finished = true;
+    if (!stream->headersSent) {
+        LOG_WARNING(gGenLog, "HTTP/2 stream %u finished without a complete response header", stream->id);
+        streamError(stream->id, HTTP2ErrorCode::INTERNAL_ERROR);
+        return;
+    }
+    flushStream(stream);
+}
+
+void HTTP2Connection::pauseBody(const HTTPServerRequest *request) {
+    auto stream = findStream(request);
+    if (stream) {
+        stream->paused = true;
+    }
+}
+
+void HTTP2Connection::resumeBody(const HTTPServerRequest *request) {
+    auto stream = findStream(request);
+    if (!stream || !stream->paused) {
+        return;
+    }
+    stream->paused = false;
+    if (stream->unackedBytes && !stream->remoteClosed) {
+        sendWindowUpdate(stream->id, stream->unackedBytes);
+        stream->recvWindow += stream->unackedBytes;
+        stream->unackedBytes = 0;
+    }
+}
+
+void HTTP2Connection::onConnectionClose() {
+    untrack();
+    _stream->ioloop()->removeTimeout(_settingsTimeout);
+    std::map<uint32_t, StreamPtr> streams;
+    streams.swap(_streams);
+    for (auto &kv: streams) {
+        auto &stream = kv.second;
+        stream->closed = true;
+        if (stream->closeCallback) {
+            CloseCallbackType callback(std::move(stream->closeCallback));
+            stream->closeCallback = nullptr;
+            callback();
+        }
+        auto request = stream->observer.lock();
+        if (request) {
+            request->clearBodyCallbacks();
+        }
+    }
+    _drainCallbacks.clear();
+}
+
+void HTTP2Connection::onPreface(ByteArray data) {
+    if (memcmp(data.data(), HTTP2_CONNECTION_PREFACE + _prefaceReceived, data.size()) != 0) {
+        LOG_INFO(gGenLog, "Invalid HTTP/2 connection preface from %s", _address.c_str());
+        close();
+        return;
+    }
+    readFrame();
+}
+
+void HTTP2Connection::readFrame() {
+    if (_closing || _stream->closed()) {
+        return;
+    }
+    NullContext ctx;
+    _stream->readBytes(HTTP2_FRAME_HEADER_SIZE, [this, self=shared_from_this()](ByteArray data) {
+        onFrameHeader(std::move(data));
+    });
+}
+
+void HTTP2Connection::onFrameHeader(ByteArray data) {
+    size_t length = ((size_t)data[0] << 16) | ((size_t)data[1] << 8) | (size_t)data[2];
+    _frameType = (HTTP2FrameType)data[3];
+    _frameFlags = data[4];
+    _frameStreamId = readUInt32(data.data() + 5) & 0x7FFFFFFF;
+    if (length > HTTP2_DEFAULT_MAX_FRAME_SIZE) {
+        connectionError(HTTP2ErrorCode::FRAME_SIZE_ERROR, "Frame too large");
+        return;
+    }
+    if (_continuationStreamId != 0
+        && (_frameType != HTTP2FrameType::CONTINUATION || _frameStreamId != _continuationStreamId)) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Expected CONTINUATION frame");
+        return;
+    }
+    if (length == 0) {
+        handleFrame({});
+        return;
+    }
+    NullContext ctx;
+    _stream->readBytes(length, [this, self=shared_from_this()](ByteArray data) {
+        onFramePayload(std::move(data));
+    });
+}
+
+void HTTP2Connection::onFramePayload(ByteArray data) {
+    handleFrame(std::move(data));
+}
+
+void HTTP2Connection::handleFrame(ByteArray payload) {
+    switch (_frameType) {
+        case HTTP2FrameType::DATA: {
+            onDataFrame(payload);
+            break;
+        }
+        case HTTP2FrameType::HEADERS: {
+            onHeadersFrame(payload);
+            break;
+        }
+        case HTTP2FrameType::PRIORITY: {
+            // Responses are written as soon as handlers produce them, so priorities are accepted but not used
+            if (_frameStreamId == 0) {
+                connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "PRIORITY frame on stream 0");
+            } else if (payload.size() != 5) {
+                streamError(_frameStreamId, HTTP2ErrorCode::FRAME_SIZE_ERROR);
+            }
+            break;
+        }
+        case HTTP2FrameType::RST_STREAM: {
+            onRstStreamFrame(payload);
+            break;
+        }
+        case HTTP2FrameType::SETTINGS: {
+            onSettingsFrame(payload);
+            break;
+        }
+        case HTTP2FrameType::PUSH_PROMISE: {
+            connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "PUSH_PROMISE from client");
+            break;
+        }
+        case HTTP2FrameType::PING: {
+            onPingFrame(payload);
+            break;
+        }
+        case HTTP2FrameType::GOAWAY: {
+            onGoAwayFrame(payload);
+            break;
+        }
+        case HTTP2FrameType::WINDOW_UPDATE: {
+            onWindowUpdateFrame(payload);
+            break;
+        }
+        case HTTP2FrameType::CONTINUATION: {
+            onContinuationFrame(payload);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+    readFrame();
+}
+
+void HTTP2Connection::onDataFrame(ByteArray &payload) {
+    if (_frameStreamId == 0) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "DATA frame on stream 0");
+        return;
+    }
+    const Byte *data = payload.data();
+    size_t length = payload.size();
+    if (_frameFlags & FLAG_PADDED) {
+        if (length == 0 || data[0] >= length) {
+            connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Invalid padding");
+            return;
+        }
+        length -= 1 + data[0];
+        ++data;
+    }
+    // Padding counts against the windows as much as the data does
+    _recvWindow -= (int64_t)payload.size();
+    if (_recvWindow < 0) {
+        connectionError(HTTP2ErrorCode::FLOW_CONTROL_ERROR, "Connection window exceeded");
+        return;
+    }
+    // Bodies are buffered or handed to the handler right here, so the connection window only waits for batching;
+    // stream windows are what holds back a paused body
+    creditConnection(payload.size());
+    auto iter = _streams.find(_frameStreamId);
+    if (iter == _streams.end()) {
+        if (_frameStreamId > _lastStreamId) {
+            connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "DATA frame on idle stream");
+        } else {
+            sendRstStream(_frameStreamId, HTTP2ErrorCode::STREAM_CLOSED);
+        }
+        return;
+    }
+    StreamPtr stream = iter->second;
+    if (stream->remoteClosed) {
+        streamError(stream->id, HTTP2ErrorCode::STREAM_CLOSED);
+        return;
+    }
+    stream->recvWindow -= (int64_t)payload.size();
+    if (stream->recvWindow < 0) {
+        streamError(stream->id, HTTP2ErrorCode::FLOW_CONTROL_ERROR);
+        return;
+    }
+    if (length) {
+        if (stream->streaming) {
+            auto request = stream->observer.lock();
+            if (request) {
+                request->dataReceived(ByteArray(data, data + length));
+            }
+        } else if (stream->body.size() + length > _stream->getMaxBufferSize()) {
+            LOG_INFO(gGenLog, "HTTP/2 request body too long from %s", _address.c_str());
+            streamError(stream->id, HTTP2ErrorCode::REFUSED_STREAM);
+            return;
+        } else {
+            stream->body.append((const char *)data, length);
+        }
+    }
+    if (_frameFlags & FLAG_END_STREAM) {
+        endRemote(stream);
+    } else if (!payload.empty() && !stream->closed) {
+        creditStream(stream, payload.size());
+    }
+}
+
+void HTTP2Connection::onHeadersFrame(ByteArray &payload) {
+    if (_frameStreamId == 0) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "HEADERS frame on stream 0");
+        return;
+    }
+    const Byte *data = payload.data();
+    size_t length = payload.size(), padding = 0;
+    if (_frameFlags & FLAG_PADDED) {
+        if (length == 0) {
+            connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Invalid padding");
+            return;
+        }
+        padding = data[0];
+        ++data;
+        --length;
+    }
+    if (_frameFlags & FLAG_PRIORITY) {
+        if (length < 5) {
+            connectionError(HTTP2ErrorCode::FRAME_SIZE_ERROR, "Truncated HEADERS frame");
+            return;
+        }
+        data += 5;
+        length -= 5;
+    }
+    if (padding > length) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Invalid padding");
+        return;
+    }
+    _headerBlock.assign(data, data + length - padding);
+    if (_frameFlags & FLAG_END_HEADERS) {
+        onHeaderBlock(_frameStreamId, (_frameFlags & FLAG_END_STREAM) != 0);
+    } else {
+        _continuationStreamId = _frameStreamId;
+        _continuationEndStream = (_frameFlags & FLAG_END_STREAM) != 0;
+    }
+}
+
+void HTTP2Connection::onContinuationFrame(ByteArray &payload) {
+    if (_continuationStreamId == 0) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Unexpected CONTINUATION frame");
+        return;
+    }
+    if (_headerBlock.size() + payload.size() > 2 * _parser.getMaxHeaderSize()) {
+        connectionError(HTTP2ErrorCode::ENHANCE_YOUR_CALM, "Header block too large");
+        return;
+    }
+    _headerBlock.insert(_headerBlock.end(), payload.begin(), payload.end());
+    if (_frameFlags & FLAG_END_HEADERS) {
+        uint32_t streamId = _continuationStreamId;
+        _continuationStreamId = 0;
+        onHeaderBlock(streamId, _continuationEndStream);
+    }
+}
+
+void HTTP2Connection::onRstStreamFrame(ByteArray &payload) {
+    if (_frameStreamId == 0 || _frameStreamId > _lastStreamId) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "RST_STREAM frame on idle stream");
+        return;
+    }
+    if (payload.size() != 4) {
+        connectionError(HTTP2ErrorCode::FRAME_SIZE_ERROR, "Invalid RST_STREAM frame");
+        return;
+    }
+    closeStream(_frameStreamId, true);
+}
+
+void HTTP2Connection::onSettingsFrame(ByteArray &payload) {
+    if (_frameStreamId != 0) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "SETTINGS frame on a stream");
+        return;
+    }
+    if (_frameFlags & FLAG_ACK) {
+        if (!payload.empty()) {
+            connectionError(HTTP2ErrorCode::FRAME_SIZE_ERROR, "SETTINGS ack with payload");
+            return;
+        }
+        _stream->ioloop()->removeTimeout(_settingsTimeout);
+        _settingsTimeout.reset();
+        return;
+    }
+    if (payload.size() % 6 != 0) {
+        connectionError(HTTP2ErrorCode::FRAME_SIZE_ERROR, "Invalid SETTINGS frame");
+        return;
+    }
+    for (size_t i = 0; i != payload.size(); i += 6) {
+        auto identifier = (HTTP2Settings)(((uint16_t)payload[i] << 8) | payload[i + 1]);
+        uint32_t value = readUInt32(payload.data() + i + 2);
+        switch (identifier) {
+            case HTTP2Settings::HEADER_TABLE_SIZE: {
+                _encoder.setMaxTableSize(value);
+                break;
+            }
+            case HTTP2Settings::ENABLE_PUSH: {
+                if (value > 1) {
+                    connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Invalid SETTINGS_ENABLE_PUSH");
+                    return;
+                }
+                break;
+            }
+            case HTTP2Settings::INITIAL_WINDOW_SIZE: {
+                if (value > HTTP2_MAX_WINDOW_SIZE) {
+                    connectionError(HTTP2ErrorCode::FLOW_CONTROL_ERROR, "Invalid SETTINGS_INITIAL_WINDOW_SIZE");
+                    return;
+                }
+                int64_t delta = (int64_t)value - _initialSendWindow;
+                for (auto &kv: _streams) {
+                    kv.second->sendWindow += delta;
+                }
+                _initialSendWindow = value;
+                break;
+            }
+            case HTTP2Settings::MAX_FRAME_SIZE: {
+                if (value < HTTP2_DEFAULT_MAX_FRAME_SIZE || value > HTTP2_MAX_FRAME_SIZE) {
+                    connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Invalid SETTINGS_MAX_FRAME_SIZE");
+                    return;
+                }
+                _peerMaxFrameSize = value;
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+    sendFrame(HTTP2FrameType::SETTINGS, FLAG_ACK, 0, nullptr, 0);
+    flushStreams();
+}
+
+void HTTP2Connection::onPingFrame(ByteArray &payload) {
+    if (_frameStreamId != 0) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "PING frame on a stream");
+    } else if (payload.size() != 8) {
+        connectionError(HTTP2ErrorCode::FRAME_SIZE_ERROR, "Invalid PING frame");
+    } else if ((_frameFlags & FLAG_ACK) == 0) {
+        sendFrame(HTTP2FrameType::PING, FLAG_ACK, 0, payload.data(), payload.size());
+    }
+}
+
+void HTTP2Connection::onGoAwayFrame(ByteArray &payload) {
+    if (_frameStreamId != 0) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "GOAWAY frame on a stream");
+        return;
+    }
+    _goAway = true;
+    if (_streams.empty() && !_closing) {
+        _closing = true;
+        whenDrained([this]() {
+            close();
+        });
+    }
+}
+
+void HTTP2Connection::onWindowUpdateFrame(ByteArray &payload) {
+    if (payload.size() != 4) {
+        connectionError(HTTP2ErrorCode::FRAME_SIZE_ERROR, "Invalid WINDOW_UPDATE frame");
+        return;
+    }
+    uint32_t increment = readUInt32(payload.data()) & 0x7FFFFFFF;
+    if (_frameStreamId == 0) {
+        if (increment == 0) {
+            connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Zero WINDOW_UPDATE increment");
+        } else if (_sendWindow + increment > (int64_t)HTTP2_MAX_WINDOW_SIZE) {
+            connectionError(HTTP2ErrorCode::FLOW_CONTROL_ERROR, "Connection window overflow");
+        } else {
+            _sendWindow += increment;
+            flushStreams();
+        }
+        return;
+    }
+    auto iter = _streams.find(_frameStreamId);
+    if (iter == _streams.end()) {
+        return;
+    }
+    StreamPtr stream = iter->second;
+    if (increment == 0) {
+        streamError(stream->id, HTTP2ErrorCode::PROTOCOL_ERROR);
+    } else if (stream->sendWindow + increment > (int64_t)HTTP2_MAX_WINDOW_SIZE) {
+        streamError(stream->id, HTTP2ErrorCode::FLOW_CONTROL_ERROR);
+    } else {
+        stream->sendWindow += increment;
+        flushStream(stream);
+    }
+}
+
+void HTTP2Connection::onHeaderBlock(uint32_t streamId, bool endStream) {
+    HPACKDecoder::HeaderListType fields;
+    size_t listSize;
+    bool decoded = _decoder.decode(_headerBlock.data(), _headerBlock.size(), fields, listSize);
+    _headerBlock.clear();
+    if (!decoded) {
+        connectionError(HTTP2ErrorCode::COMPRESSION_ERROR, "Invalid header block");
+        return;
+    }
+    auto iter = _streams.find(streamId);
+    if (iter != _streams.end()) {
+        // Trailers only end the body; there is nowhere to expose them on HTTPServerRequest
+        StreamPtr stream = iter->second;
+        if (!endStream || stream->remoteClosed) {
+            streamError(streamId, HTTP2ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        endRemote(stream);
+        return;
+    }
+    if (streamId % 2 == 0 || streamId <= _lastStreamId) {
+        connectionError(HTTP2ErrorCode::PROTOCOL_ERROR, "Invalid stream id");
+        return;
+    }
+    _lastStreamId = streamId;
+    if (_goAway) {
+        return;
+    }
+    if (_streams.size() >= _maxConcurrentStreams || listSize > _parser.getMaxHeaderSize()
+        || fields.size() > _parser.getMaxHeaderCount()) {
+        sendRstStream(streamId, HTTP2ErrorCode::REFUSED_STREAM);
+        return;
+    }
+    createStream(streamId, fields, endStream);
+}
+
+void HTTP2Connection::createStream(uint32_t streamId, HPACKDecoder::HeaderListType &fields, bool endStream) {
+    std::string method, path, scheme, authority;
+    StringVector cookies;
+    auto headers = HTTPHeaders::create();
+    bool regular = false, malformed = false;
+    for (auto &field: fields) {
+        const std::string &name = field.first;
+        if (!name.empty() && name[0] == ':') {
+            std::string *target = nullptr;
+            if (name == ":method") {
+                target = &method;
+            } else if (name == ":path") {
+                target = &path;
+            } else if (name == ":scheme") {
+                target = &scheme;
+            } else if (name == ":authority") {
+                target = &authority;
+            }
+            if (regular || !target || !target->empty()) {
+                malformed = true;
+                break;
+            }
+            *target = std::move(field.second);
+            continue;
+        }
+        regular = true;
+        if (name.empty() || std::any_of(name.begin(), name.end(), [](char c) { return c >= 'A' && c <= 'Z'; })
+            || isHopByHopHeader(name) || (name == "te" && field.second != "trailers")) {
+            malformed = true;
+            break;
+        }
+        if (name == "cookie") {
+            cookies.emplace_back(std::move(field.second));
+        } else {
+            headers->add(name, field.second);
+        }
+    }
+    if (malformed || method.empty() || path.empty() || scheme.empty()) {
+        LOG_INFO(gGenLog, "Malformed HTTP/2 request from %s", _address.c_str());
+        sendRstStream(streamId, HTTP2ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    if (!cookies.empty()) {
+        headers->add(HTTPHeaderField::COOKIE, boost::join(cookies, "; "));
+    }
+    if (!authority.empty() && !headers->has(HTTPHeaderField::HOST)) {
+        headers->add(HTTPHeaderField::HOST, authority);
+    }
+    bool expectContinue = !endStream && headers->get(HTTPHeaderField::EXPECT) == "100-continue";
+    auto request = HTTPServerRequest::create(shared_from_this(), std::move(method), std::move(path), "HTTP/2.0",
+                                             std::move(headers), std::string(), _address, _protocol);
+    auto stream = std::make_shared<Stream>();
+    stream->id = streamId;
+    stream->request = request.get();
+    stream->observer = request;
+    stream->pendingRequest = request;
+    stream->sendWindow = _initialSendWindow;
+    _streams[streamId] = stream;
+    setPhase(HTTPConnectionTracker::P_ACTIVE);
+    if (expectContinue) {
+        sendHeaders(stream, "100", HTTPHeaders());
+    }
+    if (endStream) {
+        stream->remoteClosed = true;
+        dispatchStream(stream);
+    } else if (_streamBodyCallback && _streamBodyCallback(request)) {
+        stream->streaming = true;
+        request->setBodyStreaming(true);
+        dispatchStream(stream);
+    }
+}
+
+void HTTP2Connection::dispatchStream(const StreamPtr &stream) {
+    auto request = std::move(stream->pendingRequest);
+    stream->pendingRequest.reset();
+    request->setConnection(shared_from_this());
+    if (!stream->body.empty()) {
+        request->setBody(std::move(stream->body));
+        std::string().swap(stream->body);
+    }
+    _requestCallback(std::move(request));
+}
+
+void HTTP2Connection::endRemote(const StreamPtr &stream) {
+    stream->remoteClosed = true;
+    if (stream->streaming) {
+        auto request = stream->observer.lock();
+        if (request) {
+            request->bodyFinished();
+        }
+    } else if (stream->pendingRequest) {
+        dispatchStream(stream);
+    }
+}
+
+void HTTP2Connection::sendHeaders(const StreamPtr &stream, const std::string &status, const HTTPHeaders &headers) {
+    HPACKEncoder::HeaderListType fields;
+    fields.emplace_back(":status", status);
+    headers.getAll([&fields](const std::string &name, const std::string &value) {
+        std::string lowerName = boost::to_lower_copy(name);
+        if (!isHopByHopHeader(lowerName)) {
+            fields.emplace_back(std::move(lowerName), value);
+        }
+    });
+    ByteArray block;
+    _encoder.encode(fields, block);
+    HTTP2FrameType type = HTTP2FrameType::HEADERS;
+    size_t offset = 0;
+    do {
+        size_t length = std::min(block.size() - offset, _peerMaxFrameSize);
+        uint8_t flags = offset + length == block.size() ? FLAG_END_HEADERS : 0;
+        sendFrame(type, flags, stream->id, block.data() + offset, length);
+        offset += length;
+        type = HTTP2FrameType::CONTINUATION;
+    } while (offset < block.size());
+}
+
+void HTTP2Connection::flushStream(const StreamPtr &stream) {
+    if (stream->closed || _stream->closed()) {
+        return;
+    }
+    while (stream->pendingOffset < stream->pending.size()) {
+        int64_t window = std::min(_sendWindow, stream->sendWindow);
+        if (window <= 0) {
+            return;
+        }
+        size_t offset = stream->pendingOffset;
+        size_t length = std::min({(size_t)window, _peerMaxFrameSize, stream->pending.size() - offset});
+        stream->pendingOffset += length;
+        bool last = stream->finished && stream->pendingOffset == stream->pending.size();
+        sendFrame(HTTP2FrameType::DATA, last ? FLAG_END_STREAM : 0, stream->id, stream->pending.data() + offset,
+                  length);
+        _sendWindow -= length;
+        stream->sendWindow -= length;
+        stream->endSent = last;
+    }
+    stream->pending.clear();
+    stream->pendingOffset = 0;
+    if (stream->writeCallback) {
+        WriteCallbackType callback(std::move(stream->writeCallback));
+        stream->writeCallback = nullptr;
+        whenDrained(std::move(callback));
+    }
+    if (stream->finished && !stream->endSent) {
+        sendFrame(HTTP2FrameType::DATA, FLAG_END_STREAM, stream->id, nullptr, 0);
+        stream->endSent = true;
+    }
+    if (stream->endSent) {
+        if (!stream->remoteClosed) {
+            // The response is complete; the rest of the request body is not wanted
+            sendRstStream(stream->id, HTTP2ErrorCode::NO_ERROR);
+        }
+        closeStream(stream->id, false);
+    }
+}
+
+void HTTP2Connection::flushStreams() {
+    if (_streams.empty()) {
+        return;
+    }
+    std::vector<StreamPtr> streams;
+    streams.reserve(_streams.size());
+    for (auto &kv: _streams) {
+        streams.push_back(kv.second);
+    }
+    for (auto &stream: streams) {
+        flushStream(stream);
+    }
+}
+
+void HTTP2Connection::closeStream(uint32_t streamId, bool notify) {
+    auto iter = _streams.find(streamId);
+    if (iter == _streams.end()) {
+        return;
+    }
+    StreamPtr stream = std::move(iter->second);
+    _streams.erase(iter);
+    if (_streams.empty()) {
+        setPhase(HTTPConnectionTracker::P_IDLE);
+    }
+    stream->closed = true;
+    if (notify) {
+        if (stream->closeCallback) {
+            CloseCallbackType callback(std::move(stream->closeCallback));
+            stream->closeCallback = nullptr;
+            callback();
+        }
+        auto request = stream->observer.lock();
+        if (request) {
+            request->clearBodyCallbacks();
+        }
+    }
+    if (stream->writeCallback) {
+        // A reset stream never drains; answer the write so the handler can finish and release what it holds
+        WriteCallbackType callback(std::move(stream->writeCallback));
+        stream->writeCallback = nullptr;
+        whenDrained(std::move(callback));
+    }
+    if (_goAway && _streams.empty() && !_closing) {
+        _closing = true;
+        whenDrained([this]() {
+            close();
+        });
+    }
+}
+
+void HTTP2Connection::sendFrame(HTTP2FrameType type, uint8_t flags, uint32_t streamId, const Byte *payload,
+                                size_t length) {
+    if (_stream->closed()) {
+        return;
+    }
+    _frameBuffer.resize(HTTP2_FRAME_HEADER_SIZE + length);
+    Byte *header = _frameBuffer.data();
+    header[0] = (Byte)(length >> 16);
+    header[1] = (Byte)(length >> 8);
+    header[2] = (Byte)length;
+    header[3] = (Byte)type;
+    header[4] = flags;
+    writeUInt32(header + 5, streamId);
+    if (length) {
+        memcpy(header + HTTP2_FRAME_HEADER_SIZE, payload, length);
+    }
+    if (_drainCallbacks.empty()) {
+        _stream->write(_frameBuffer.data(), _frameBuffer.size());
+    } else {
+        _stream->write(_frameBuffer.data(), _frameBuffer.size(), [this, self=shared_from_this()]() {
+            onFramesWritten();
+        });
+    }
+}
+
+void HTTP2Connection::sendSettings() {
+    Byte payload[12];
+    const std::pair<HTTP2Settings, size_t> settings[] = {
+            {HTTP2Settings::MAX_CONCURRENT_STREAMS, _maxConcurrentStreams},
+            {HTTP2Settings::MAX_HEADER_LIST_SIZE, _parser.getMaxHeaderSize()},
+    };
+    Byte *iter = payload;
+    for (auto &setting: settings) {
+        iter[0] = (Byte)((uint16_t)setting.first >> 8);
+        iter[1] = (Byte)setting.first;
+        writeUInt32(iter + 2, (uint32_t)setting.second);
+        iter += 6;
+    }
+    sendFrame(HTTP2FrameType::SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+void HTTP2Connection::sendWindowUpdate(uint32_t streamId, size_t increment) {
+    Byte payload[4];
+    writeUInt32(payload, (uint32_t)increment);
+    sendFrame(HTTP2FrameType::WINDOW_UPDATE, 0, streamId, payload, sizeof(payload));
+}
+
+void HTTP2Connection::creditConnection(size_t length) {
+    _unackedBytes += length;
+    if (_unackedBytes >= HTTP2_DEFAULT_WINDOW_SIZE / 2) {
+        sendWindowUpdate(0, _unackedBytes);
+        _recvWindow += (int64_t)_unackedBytes;
+        _unackedBytes = 0;
+    }
+}
+
+void HTTP2Connection::creditStream(const StreamPtr &stream, size_t length) {
+    stream->unackedBytes += length;
+    if (!stream->paused && stream->unackedBytes >= HTTP2_DEFAULT_WINDOW_SIZE / 2) {
+        sendWindowUpdate(stream->id, stream->unackedBytes);
+        stream->recvWindow += (int64_t)stream->unackedBytes;
+        stream->unackedBytes = 0;
+    }
+}
+
+void HTTP2Connection::onSettingsTimeout() {
+    _settingsTimeout.reset();
+    connectionError(HTTP2ErrorCode::SETTINGS_TIMEOUT, "SETTINGS not acknowledged");
+}
+
+void HTTP2Connection::sendRstStream(uint32_t streamId, HTTP2ErrorCode errorCode) {
+    Byte payload[4];
+    writeUInt32(payload, (uint32_t)errorCode);
+    sendFrame(HTTP2FrameType::RST_STREAM, 0, streamId, payload, sizeof(payload));
+}
+
+void HTTP2Connection::streamError(uint32_t streamId, HTTP2ErrorCode errorCode) {
+    sendRstStream(streamId, errorCode);
+    closeStream(streamId, true);
+}
+
+void HTTP2Connection::connectionError(HTTP2ErrorCode errorCode, const char *reason) {
+    LOG_INFO(gGenLog, "HTTP/2 connection error from %s: %s", _address.c_str(), reason);
+    if (_closing || _stream->closed()) {
+        return;
+    }
+    Byte payload[8];
+    writeUInt32(payload, _lastStreamId);
+    writeUInt32(payload + 4, (uint32_t)errorCode);
+    sendFrame(HTTP2FrameType::GOAWAY, 0, 0, payload, sizeof(payload));
+    _goAway = true;
+    _closing = true;
+    whenDrained([this]() {
+        close();
+    });
+}
+
+void HTTP2Connection::whenDrained(WriteCallbackType callback) {
+    if (_stream->closed()) {
+        return;
+    }
+    _drainCallbacks.emplace_back(std::move(callback));
+    _stream->write(nullptr, 0, [this, self=shared_from_this()]() {
+        onFramesWritten();
+    });
+}
+
+void HTTP2Connection::onFramesWritten() {
+    std::vector<WriteCallbackType> callbacks;
+    callbacks.swap(_drainCallbacks);
+    for (auto &callback: callbacks) {
+        callback();
+    }
+}
@@ -0,0 +1,245 @@
+//
+// HTTP/2 server connection (RFC 7540).
+//
+
+#ifndef TINYCORE_HTTP2_H
+#define TINYCORE_HTTP2_H
+
+#include "tinycore/common/common.h"
+#include "tinycore/asyncio/hpack.h"
+#include "tinycore/asyncio/httpserver.h"
+
+
+constexpr size_t DEFAULT_HTTP2_MAX_CONCURRENT_STREAMS = 100;
+constexpr size_t HTTP2_DEFAULT_WINDOW_SIZE = 65535;
+constexpr size_t HTTP2_MAX_WINDOW_SIZE = 0x7FFFFFFF;
+constexpr size_t HTTP2_DEFAULT_MAX_FRAME_SIZE = 16384;
+constexpr size_t HTTP2_MAX_FRAME_SIZE = 0xFFFFFF;
+constexpr size_t HTTP2_FRAME_HEADER_SIZE = 9;
+
+extern const char * const HTTP2_CONNECTION_PREFACE;
+
+
+enum class HTTP2FrameType: uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9,
+};
+
+
+enum class HTTP2Settings: uint16_t {
+    HEADER_TABLE_SIZE = 0x1,
+    ENABLE_PUSH = 0x2,
+    MAX_CONCURRENT_STREAMS = 0x3,
+    INITIAL_WINDOW_SIZE = 0x4,
+    MAX_FRAME_SIZE = 0x5,
+    MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+
+enum class HTTP2ErrorCode: uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    SETTINGS_TIMEOUT = 0x4,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+    CONNECT_ERROR = 0xa,
+    ENHANCE_YOUR_CALM = 0xb,
+    INADEQUATE_SECURITY = 0xc,
+    HTTP_1_1_REQUIRED = 0xd,
+};
+
+
+class TC_COMMON_API HTTP2Connection: public HTTPConnection {
+public:
+    enum Flags: uint8_t {
+        FLAG_END_STREAM = 0x1,
+        FLAG_ACK = 0x1,
+        FLAG_END_HEADERS = 0x4,
+        FLAG_PADDED = 0x8,
+        FLAG_PRIORITY = 0x20,
+    };
+
+    using HTTPConnection::HTTPConnection;
+
+    void start() override;
+
+    void setCloseCallback(const HTTPServerRequest *request, CloseCallbackType callback) override;
+
+    void write(const HTTPServerRequest *request, const Byte *chunk, size_t length,
+               WriteCallbackType callback= nullptr) override;
+
+    void writeHeaders(const HTTPServerRequest *request, int statusCode, const HTTPHeaders &headers, const Byte *data,
+                      size_t headLength, size_t length, WriteCallbackType callback= nullptr) override;
+
+    void finish(const HTTPServerRequest *request) override;
+
+    bool canWriteFile(const HTTPServerRequest *request) const override {
+        return false;
+    }
+
+    void pauseBody(const HTTPServerRequest *request) override;
+
+    void resumeBody(const HTTPServerRequest *request) override;
+
+    // Number of preface bytes already consumed by whoever handed the stream over (h2c prior knowledge)
+    void setPrefaceReceived(size_t prefaceReceived) {
+        _prefaceReceived = prefaceReceived;
+    }
+
+    void setMaxConcurrentStreams(size_t maxConcurrentStreams) {
+        _maxConcurrentStreams = maxConcurrentStreams;
+    }
+
+    size_t getMaxConcurrentStreams() const {
+        return _maxConcurrentStreams;
+    }
+
+    size_t getStreamCount() const {
+        return _streams.size();
+    }
+
+    template <typename ...Args>
+    static std::shared_ptr<HTTP2Connection> create(Args&& ...args) {
+        return std::make_shared<HTTP2Connection>(std::forward<Args>(args)...);
+    }
+protected:
+    struct Stream {
+        uint32_t id;
+        const HTTPServerRequest *request{nullptr};
+        std::weak_ptr<HTTPServerRequest> observer;
+        std::shared_ptr<HTTPServerRequest> pendingRequest;
+        std::string body;
+        bool streaming{false};
+        bool remoteClosed{false};
+        bool finished{false};
+        bool headersSent{false};
+        bool endSent{false};
+        bool paused{false};
+        bool closed{false};
+        ByteArray pending;
+        size_t pendingOffset{0};
+        int64_t sendWindow{0};
+        // What the peer may still send us, and what the handler took in since the window was last credited
+        int64_t recvWindow{HTTP2_DEFAULT_WINDOW_SIZE};
+        size_t unackedBytes{0};
+        WriteCallbackType writeCallback;
+        CloseCallbackType closeCallback;
+    };
+
+    typedef std::shared_ptr<Stream> StreamPtr;
+
+    void onConnectionClose() override;
+
+    void onPreface(ByteArray data);
+
+    void readFrame();
+
+    void onFrameHeader(ByteArray data);
+
+    void onFramePayload(ByteArray data);
+
+    void handleFrame(ByteArray payload);
+
+    void onDataFrame(ByteArray &payload);
+
+    void onHeadersFrame(ByteArray &payload);
+
+    void onContinuationFrame(ByteArray &payload);
+
+    void onRstStreamFrame(ByteArray &payload);
+
+    void onSettingsFrame(ByteArray &payload);
+
+    void onPingFrame(ByteArray &payload);
+
+    void onGoAwayFrame(ByteArray &payload);
+
+    void onWindowUpdateFrame(ByteArray &payload);
+
+    void onHeaderBlock(uint32_t streamId, bool endStream);
+
+    void createStream(uint32_t streamId, HPACKDecoder::HeaderListType &fields, bool endStream);
+
+    void dispatchStream(const StreamPtr &stream);
+
+    void endRemote(const StreamPtr &stream);
+
+    void sendHeaders(const StreamPtr &stream, const std::string &status, const HTTPHeaders &headers);
+
+    void flushStream(const StreamPtr &stream);
+
+    void flushStreams();
+
+    void closeStream(uint32_t streamId, bool notify);
+
+    void sendFrame(HTTP2FrameType type, uint8_t flags, uint32_t streamId, const Byte *payload, size_t length);
+
+    void sendSettings();
+
+    void sendWindowUpdate(uint32_t streamId, size_t increment);
+
+    // Hands consumed bytes back to the peer once half a window has built up, rather than one update per DATA frame
+    void creditConnection(size_t length);
+
+    void creditStream(const StreamPtr &stream, size_t length);
+
+    void onSettingsTimeout();
+
+    void sendRstStream(uint32_t streamId, HTTP2ErrorCode errorCode);
+
+    void streamError(uint32_t streamId, HTTP2ErrorCode errorCode);
+
+    void connectionError(HTTP2ErrorCode errorCode, const char *reason);
+
+    void whenDrained(WriteCallbackType callback);
+
+    void onFramesWritten();
+
+    StreamPtr findStream(const HTTPServerRequest *request) const {
+        for (auto &kv: _streams) {
+            if (kv.second->request == request) {
+                return kv.second;
+            }
+        }
+        return nullptr;
+    }
+
+    std::map<uint32_t, StreamPtr> _streams;
+    HPACKDecoder _decoder;
+    HPACKEncoder _encoder;
+    size_t _prefaceReceived{0};
+    size_t _maxConcurrentStreams{DEFAULT_HTTP2_MAX_CONCURRENT_STREAMS};
+    uint32_t _lastStreamId{0};
+    bool _goAway{false};
+    bool _closing{false};
+    int64_t _sendWindow{HTTP2_DEFAULT_WINDOW_SIZE};
+    int64_t _initialSendWindow{HTTP2_DEFAULT_WINDOW_SIZE};
+    int64_t _recvWindow{HTTP2_DEFAULT_WINDOW_SIZE};
+    size_t _unackedBytes{0};
+    Timeout _settingsTimeout;
+    size_t _peerMaxFrameSize{HTTP2_DEFAULT_MAX_FRAME_SIZE};
+    HTTP2FrameType _frameType{HTTP2FrameType::DATA};
+    uint8_t _frameFlags{0};
+    uint32_t _frameStreamId{0};
+    uint32_t _continuationStreamId{0};
+    bool _continuationEndStream{false};
+    ByteArray _headerBlock;
+    std::vector<WriteCallbackType> _drainCallbacks;
+    ByteArray _frameBuffer;
+};
+
+
+#endif //TINYCORE_HTTP2_H
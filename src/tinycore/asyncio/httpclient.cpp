@@ -243,16 +243,16 @@ void _HTTPConnection::onConnect() {
         ThrowException(NotImplementedError, "ProxyPassword not supported");
     }
     auto &headers = _request->headers();
-    if (!headers.has("Connection")) {
-        headers["Connection"] = "close";
+    if (!headers.has(HTTPHeaderField::CONNECTION)) {
+        headers[HTTPHeaderField::CONNECTION] = "close";
     }
-    if (!headers.has("Host")) {
+    if (!headers.has(HTTPHeaderField::HOST)) {
         if (_parsed.getNetloc().find('@') != std::string::npos) {
             std::string host;
             std::tie(std::ignore, std::ignore, host) = String::rpartition(_parsed.getNetloc(), "@");
-            headers["Host"] = host;
+            headers[HTTPHeaderField::HOST] = host;
         } else {
-            headers["Host"] = _parsed.getNetloc();
+            headers[HTTPHeaderField::HOST] = _parsed.getNetloc();
         }
     }
     std::string userName, password;
@@ -270,11 +270,11 @@ void _HTTPConnection::onConnect() {
         }
         std::string auth = userName + ":" + password;
         auth = "Basic " + Base64::b64encode(auth);
-        headers["Authorization"] = auth;
+        headers[HTTPHeaderField::AUTHORIZATION] = auth;
     }
     auto userAgent = _request->getUserAgent();
     if (userAgent) {
-        headers["User-Agent"] = *userAgent;
+        headers[HTTPHeaderField::USER_AGENT] = *userAgent;
     }
     auto requestBody = _request->getBody();
     if (!_request->isAllowNonstandardMethods()) {
@@ -285,13 +285,13 @@ void _HTTPConnection::onConnect() {
         }
     }
     if (requestBody) {
-        headers["Content-Length"] = std::to_string(requestBody->size());
+        headers[HTTPHeaderField::CONTENT_LENGTH] = std::to_string(requestBody->size());
     }
-    if (method == "POST" && !headers.has("Content-Type")) {
-        headers["Content-Type"] = "application/x-www-form-urlencoded";
+    if (method == "POST" && !headers.has(HTTPHeaderField::CONTENT_TYPE)) {
+        headers[HTTPHeaderField::CONTENT_TYPE] = "application/x-www-form-urlencoded";
     }
     if (_request->isUseGzip()) {
-        headers["Accept-Encoding"] = "gzip";
+        headers[HTTPHeaderField::ACCEPT_ENCODING] = "gzip";
     }
     const std::string &parsedPath = _parsed.getPath();
     const std::string &parsedQuery = _parsed.getQuery();
@@ -400,21 +400,21 @@ void _HTTPConnection::onHeaders(ByteArray data) {
         _reason = match[2];
     }
     boost::optional<size_t> contentLength;
-    if (_headers->has("Content-Length")) {
-        if (_headers->at("Content-Length").find(',') != std::string::npos) {
-            StringVector pieces = String::split(_headers->at("Content-Length"), ',');
+    if (_headers->has(HTTPHeaderField::CONTENT_LENGTH)) {
+        if (_headers->at(HTTPHeaderField::CONTENT_LENGTH).find(',') != std::string::npos) {
+            StringVector pieces = String::split(_headers->at(HTTPHeaderField::CONTENT_LENGTH), ',');
             for (auto &piece: pieces) {
                 boost::trim(piece);
             }
             for (auto &piece: pieces) {
                 if (piece != pieces[0]) {
                     ThrowException(ValueError, String::format("Multiple unequal Content-Lengths: %s",
-                                                              _headers->at("Content-Length").c_str()));
+                                                              _headers->at(HTTPHeaderField::CONTENT_LENGTH).c_str()));
                 }
             }
             (*_headers)["Content-Length"] = pieces[0];
         }
-        contentLength = std::stoul(_headers->at("Content-Length"));
+        contentLength = std::stoul(_headers->at(HTTPHeaderField::CONTENT_LENGTH));
     }
     auto &headerCallback = _request->getHeaderCallback();
     if (headerCallback) {
@@ -429,16 +429,16 @@ void _HTTPConnection::onHeaders(ByteArray data) {
         return;
     }
     if ((100 <= _code && _code < 200) || _code == 204) {
-        if (_headers->has("Transfer-Encoding") || (contentLength && *contentLength != 0)) {
+        if (_headers->has(HTTPHeaderField::TRANSFER_ENCODING) || (contentLength && *contentLength != 0)) {
             ThrowException(ValueError, String::format("Response with code %d should not have body", *_code));
         }
         onBody({});
         return;
     }
-    if (_request->isUseGzip() && _headers->get("Content-Encoding") == "gzip") {
+    if (_request->isUseGzip() && _headers->get(HTTPHeaderField::CONTENT_ENCODING) == "gzip") {
         _decompressor = make_unique<GzipDecompressor>();
     }
-    if (_headers->get("Transfer-Encoding") == "chunked") {
+    if (_headers->get(HTTPHeaderField::TRANSFER_ENCODING) == "chunked") {
         _chunks = ByteArray();
         _stream->readUntil("\r\n", std::bind(&_HTTPConnection::onChunkLength, this, std::placeholders::_1));
     } else if (contentLength) {
@@ -461,7 +461,7 @@ void _HTTPConnection::onBody(ByteArray data) {
         && (_code == 301 || _code == 302 || _code == 303 || _code == 307)) {
         auto newRequest= HTTPRequest::create(_request);
         std::string url = _request->getURL();
-        url = URLParse::urlJoin(url, _headers->at("Location"));
+        url = URLParse::urlJoin(url, _headers->at(HTTPHeaderField::LOCATION));
         newRequest->setURL(std::move(url));
         newRequest->setMaxRedirects(_request->getMaxRedirects() - 1);
         newRequest->headers().erase("Host");
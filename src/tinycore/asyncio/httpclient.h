@@ -28,7 +28,7 @@ public:
         _headers = args[opts::_headers | HTTPHeaders()];
         boost::optional<DateTime> ifModifiedSince = args[opts::_ifModifiedSince | boost::none];
         if (ifModifiedSince) {
-            _headers["If-Modified-Since"] = HTTPUtil::formatTimestamp(ifModifiedSince.get());
+            _headers[HTTPHeaderField::IF_MODIFIED_SINCE] = HTTPUtil::formatTimestamp(ifModifiedSince.get());
         }
 //        if (!_headers.has("Pragma")) {
 //            _headers["Pragma"] = "";
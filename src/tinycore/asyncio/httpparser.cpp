@@ -0,0 +1,272 @@
+//
+// Incremental HTTP/1.x request parser.
+//
+
+#include "tinycore/asyncio/httpparser.h"
+
+#if defined(__GNUC__) && defined(__AVX2__)
+#define TC_HTTP_PARSER_USE_AVX2
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__SSE2__)
+#define TC_HTTP_PARSER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+static const std::array<bool, 256> TOKEN_CHARS = []() {
+    std::array<bool, 256> table{};
+    for (int c = '0'; c <= '9'; ++c) {
+        table[c] = true;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        table[c] = true;
+        table[c - 'a' + 'A'] = true;
+    }
+    for (char c: std::string("!#$%&'*+-.^_`|~")) {
+        table[(unsigned char)c] = true;
+    }
+    return table;
+}();
+
+
+static inline bool isToken(const char *first, const char *last) {
+    for (; first != last; ++first) {
+        if (!TOKEN_CHARS[(unsigned char)*first]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+HTTPRequestParser::Result HTTPRequestParser::parse(const char *data, size_t length) {
+    _data = data;
+    if (_state == S_DONE) {
+        return Result::COMPLETE;
+    } else if (_state == S_ERROR) {
+        return Result::FAILED;
+    }
+    while (true) {
+        const char *lf = findChar(data + std::max(_pos, _scanned), data + length, '\n');
+        if (!lf) {
+            _scanned = length;
+            if (_state == S_REQUEST_LINE && length - _pos > _maxStartLineSize) {
+                return fail(HTTPParseError::START_LINE_TOO_LONG);
+            }
+            if (length > _maxHeaderSize) {
+                return fail(HTTPParseError::HEADER_TOO_LARGE);
+            }
+            return Result::INCOMPLETE;
+        }
+        size_t next = (size_t)(lf - data) + 1;
+        size_t first = _pos, last = next - 1;
+        if (last > first && data[last - 1] == '\r') {
+            --last;
+        }
+        if (_state == S_REQUEST_LINE && last - first > _maxStartLineSize) {
+            return fail(HTTPParseError::START_LINE_TOO_LONG);
+        }
+        if (next > _maxHeaderSize) {
+            return fail(HTTPParseError::HEADER_TOO_LARGE);
+        }
+        _pos = next;
+        if (_state == S_REQUEST_LINE) {
+            if (first == last) {
+                continue;
+            }
+            HTTPParseError error = parseRequestLine(first, last);
+            if (error != HTTPParseError::NONE) {
+                return fail(error);
+            }
+            _state = S_HEADER_LINE;
+        } else {
+            if (first == last) {
+                _state = S_DONE;
+                return Result::COMPLETE;
+            }
+            HTTPParseError error = parseHeaderLine(first, last);
+            if (error != HTTPParseError::NONE) {
+                return fail(error);
+            }
+        }
+    }
+}
+
+HTTPRequestParser::StringRefType HTTPRequestParser::getHeader(StringRefType name) const {
+    size_t index = findHeader(name);
+    if (index == _headers.size()) {
+        return {};
+    }
+    return getHeaderValue(index);
+}
+
+std::string HTTPRequestParser::getHeaderString(StringRefType name, const std::string &defaultValue) const {
+    std::string value;
+    bool found = false;
+    for (auto &header: _headers) {
+        if (iequals(view(header.name), name)) {
+            if (found) {
+                value.push_back(',');
+            }
+            found = true;
+            appendValue(header, value);
+        }
+    }
+    return found ? value : defaultValue;
+}
+
+std::unique_ptr<HTTPHeaders> HTTPRequestParser::getHTTPHeaders() const {
+    auto headers = HTTPHeaders::create();
+    std::string name, value;
+    for (auto &header: _headers) {
+        name.assign(_data + header.name.offset, header.name.length);
+        value.clear();
+        appendValue(header, value);
+        headers->add(name, value);
+    }
+    return headers;
+}
+
+bool HTTPRequestParser::iequals(StringRefType lhs, StringRefType rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i != lhs.size(); ++i) {
+        // Only ASCII letters differ by 0x20 between cases; header names are tokens so this is enough
+        if (lhs[i] != rhs[i] && ((lhs[i] | 0x20) != (rhs[i] | 0x20) || !std::isalpha((unsigned char)lhs[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char* HTTPRequestParser::findChar(const char *first, const char *last, char c) {
+#if defined(TC_HTTP_PARSER_USE_AVX2)
+    const __m256i needle = _mm256_set1_epi8(c);
+    while (last - first >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)first);
+        auto mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask) {
+            return first + __builtin_ctz(mask);
+        }
+        first += 32;
+    }
+#elif defined(TC_HTTP_PARSER_USE_SSE2)
+    const __m128i needle = _mm_set1_epi8(c);
+    while (last - first >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)first);
+        auto mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask) {
+            return first + __builtin_ctz(mask);
+        }
+        first += 16;
+    }
+#endif
+    for (; first != last; ++first) {
+        if (*first == c) {
+            return first;
+        }
+    }
+    return nullptr;
+}
+
+void HTTPRequestParser::appendValue(const Header &header, std::string &value) const {
+    if (!header.folded) {
+        value.append(_data + header.value.offset, header.value.length);
+        return;
+    }
+    const char *iter = _data + header.value.offset, *end = iter + header.value.length;
+    while (iter != end) {
+        if (*iter == '\r' || *iter == '\n') {
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+                value.pop_back();
+            }
+            while (iter != end && (*iter == '\r' || *iter == '\n' || *iter == ' ' || *iter == '\t')) {
+                ++iter;
+            }
+            value.push_back(' ');
+        } else {
+            value.push_back(*iter++);
+        }
+    }
+}
+
+size_t HTTPRequestParser::findHeader(StringRefType name) const {
+    size_t index = 0;
+    for (; index != _headers.size(); ++index) {
+        if (iequals(getHeaderName(index), name)) {
+            break;
+        }
+    }
+    return index;
+}
+
+HTTPParseError HTTPRequestParser::parseRequestLine(size_t first, size_t last) {
+    const char *begin = _data + first, *end = _data + last;
+    const char *space = findChar(begin, end, ' ');
+    if (!space || space == begin || !isToken(begin, space)) {
+        return HTTPParseError::BAD_REQUEST_LINE;
+    }
+    _method = {first, (size_t)(space - begin)};
+    begin = space;
+    while (begin != end && *begin == ' ') {
+        ++begin;
+    }
+    space = findChar(begin, end, ' ');
+    if (!space || space == begin) {
+        return HTTPParseError::BAD_REQUEST_LINE;
+    }
+    _uri = {(size_t)(begin - _data), (size_t)(space - begin)};
+    begin = space;
+    while (begin != end && *begin == ' ') {
+        ++begin;
+    }
+    while (end != begin && *(end - 1) == ' ') {
+        --end;
+    }
+    if (begin == end || findChar(begin, end, ' ')) {
+        return HTTPParseError::BAD_REQUEST_LINE;
+    }
+    _version = {(size_t)(begin - _data), (size_t)(end - begin)};
+    if (!getVersion().starts_with("HTTP/")) {
+        return HTTPParseError::BAD_VERSION;
+    }
+    return HTTPParseError::NONE;
+}
+
+HTTPParseError HTTPRequestParser::parseHeaderLine(size_t first, size_t last) {
+    const char *begin = _data + first, *end = _data + last;
+    while (end != begin && (*(end - 1) == ' ' || *(end - 1) == '\t')) {
+        --end;
+    }
+    if (*begin == ' ' || *begin == '\t') {
+        if (_headers.empty()) {
+            return HTTPParseError::BAD_HEADER;
+        }
+        auto &header = _headers.back();
+        if (end != begin) {
+            if (header.value.length == 0) {
+                while (*begin == ' ' || *begin == '\t') {
+                    ++begin;
+                }
+                header.value.offset = (size_t)(begin - _data);
+            }
+            header.value.length = (size_t)(end - _data) - header.value.offset;
+            header.folded = true;
+        }
+        return HTTPParseError::NONE;
+    }
+    const char *colon = findChar(begin, end, ':');
+    if (!colon || colon == begin || !isToken(begin, colon)) {
+        return HTTPParseError::BAD_HEADER;
+    }
+    if (_headers.size() >= _maxHeaderCount) {
+        return HTTPParseError::TOO_MANY_HEADERS;
+    }
+    const char *value = colon + 1;
+    while (value != end && (*value == ' ' || *value == '\t')) {
+        ++value;
+    }
+    _headers.push_back({{first, (size_t)(colon - begin)}, {(size_t)(value - _data), (size_t)(end - value)}, false});
+    return HTTPParseError::NONE;
+}
@@ -0,0 +1,194 @@
+//
+// Incremental HTTP/1.x request parser.
+//
+
+#ifndef TINYCORE_HTTPPARSER_H
+#define TINYCORE_HTTPPARSER_H
+
+#include "tinycore/common/common.h"
+#include <boost/utility/string_ref.hpp>
+#include "tinycore/asyncio/httputil.h"
+
+
+constexpr size_t DEFAULT_MAX_HEADER_COUNT = 100;
+constexpr size_t DEFAULT_MAX_HEADER_SIZE = 65536;
+constexpr size_t DEFAULT_MAX_START_LINE_SIZE = 8192;
+
+
+enum class HTTPParseError {
+    NONE,
+    BAD_REQUEST_LINE,
+    BAD_VERSION,
+    BAD_HEADER,
+    TOO_MANY_HEADERS,
+    HEADER_TOO_LARGE,
+    START_LINE_TOO_LONG,
+};
+
+
+class TC_COMMON_API HTTPRequestParser {
+public:
+    typedef boost::string_ref StringRefType;
+    typedef std::function<void (StringRefType, StringRefType)> CallbackType;
+
+    enum class Result {
+        COMPLETE,
+        INCOMPLETE,
+        FAILED,
+    };
+
+    explicit HTTPRequestParser(size_t maxHeaderCount=DEFAULT_MAX_HEADER_COUNT,
+                               size_t maxHeaderSize=DEFAULT_MAX_HEADER_SIZE)
+            : _maxHeaderCount(maxHeaderCount)
+            , _maxHeaderSize(maxHeaderSize) {
+        _headers.reserve(16);
+    }
+
+    void setMaxHeaderCount(size_t maxHeaderCount) {
+        _maxHeaderCount = maxHeaderCount;
+    }
+
+    size_t getMaxHeaderCount() const {
+        return _maxHeaderCount;
+    }
+
+    void setMaxHeaderSize(size_t maxHeaderSize) {
+        _maxHeaderSize = maxHeaderSize;
+    }
+
+    size_t getMaxHeaderSize() const {
+        return _maxHeaderSize;
+    }
+
+    void setMaxStartLineSize(size_t maxStartLineSize) {
+        _maxStartLineSize = maxStartLineSize;
+    }
+
+    size_t getMaxStartLineSize() const {
+        return _maxStartLineSize;
+    }
+
+    // data must always point at the start of the request; it may grow (or move) between calls, already scanned
+    // bytes are not looked at again
+    Result parse(const char *data, size_t length);
+
+    // Points the parsed spans at another copy of the same bytes without scanning them again
+    void rebind(const char *data) {
+        _data = data;
+    }
+
+    void reset() {
+        _data = nullptr;
+        _state = S_REQUEST_LINE;
+        _pos = 0;
+        _scanned = 0;
+        _error = HTTPParseError::NONE;
+        _headers.clear();
+    }
+
+    bool isComplete() const {
+        return _state == S_DONE;
+    }
+
+    HTTPParseError getError() const {
+        return _error;
+    }
+
+    size_t getConsumed() const {
+        return _pos;
+    }
+
+    StringRefType getMethod() const {
+        return view(_method);
+    }
+
+    StringRefType getURI() const {
+        return view(_uri);
+    }
+
+    StringRefType getVersion() const {
+        return view(_version);
+    }
+
+    size_t getHeaderCount() const {
+        return _headers.size();
+    }
+
+    StringRefType getHeaderName(size_t index) const {
+        return view(_headers[index].name);
+    }
+
+    StringRefType getHeaderValue(size_t index) const {
+        return view(_headers[index].value);
+    }
+
+    StringRefType getHeader(StringRefType name) const;
+
+    // Same value HTTPHeaders::get would return: folded lines unfolded and repeated fields joined with ','
+    std::string getHeaderString(StringRefType name, const std::string &defaultValue="") const;
+
+    bool hasHeader(StringRefType name) const {
+        return findHeader(name) != _headers.size();
+    }
+
+    void getAll(const CallbackType &callback) const {
+        for (size_t i = 0; i != _headers.size(); ++i) {
+            callback(getHeaderName(i), getHeaderValue(i));
+        }
+    }
+
+    std::unique_ptr<HTTPHeaders> getHTTPHeaders() const;
+
+    static bool iequals(StringRefType lhs, StringRefType rhs);
+
+    static const char* findChar(const char *first, const char *last, char c);
+protected:
+    enum State {
+        S_REQUEST_LINE,
+        S_HEADER_LINE,
+        S_DONE,
+        S_ERROR,
+    };
+
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+
+    struct Header {
+        Span name;
+        Span value;
+        bool folded;
+    };
+
+    StringRefType view(const Span &span) const {
+        return {_data + span.offset, span.length};
+    }
+
+    Result fail(HTTPParseError error) {
+        _state = S_ERROR;
+        _error = error;
+        return Result::FAILED;
+    }
+
+    size_t findHeader(StringRefType name) const;
+    void appendValue(const Header &header, std::string &value) const;
+    HTTPParseError parseRequestLine(size_t first, size_t last);
+    HTTPParseError parseHeaderLine(size_t first, size_t last);
+
+    size_t _maxHeaderCount;
+    size_t _maxHeaderSize;
+    size_t _maxStartLineSize{DEFAULT_MAX_START_LINE_SIZE};
+    const char *_data{nullptr};
+    State _state{S_REQUEST_LINE};
+    size_t _pos{0};
+    size_t _scanned{0};
+    HTTPParseError _error{HTTPParseError::NONE};
+    Span _method{0, 0};
+    Span _uri{0, 0};
+    Span _version{0, 0};
+    std::vector<Header> _headers;
+};
+
+
+#endif //TINYCORE_HTTPPARSER_H
@@ -4,16 +4,181 @@
 
 #include "tinycore/asyncio/httpserver.h"
 #include <boost/utility/string_ref.hpp>
+#include "tinycore/asyncio/http2.h"
 #include "tinycore/asyncio/ioloop.h"
 #include "tinycore/asyncio/stackcontext.h"
 #include "tinycore/debugging/trace.h"
 #include "tinycore/debugging/watcher.h"
+#include "tinycore/httputils/httplib.h"
 #include "tinycore/httputils/urlparse.h"
 #include "tinycore/utilities/string.h"
 #include "tinycore/common/errors.h"
 #include "tinycore/logging/logging.h"
 
 
+HTTPConnectionTracker::HTTPConnectionTracker(IOLoop *ioloop)
+        : _ioloop(ioloop ? ioloop : IOLoop::current()) {
+    _timeouts.fill(0.0f);
+    _minDataRates.fill(0);
+    _gracePeriods.fill(0.0f);
+}
+
+HTTPConnectionTracker::~HTTPConnectionTracker() {
+    if (_reaper) {
+        _reaper->stop();
+    }
+}
+
+void HTTPConnectionTracker::setTimeout(Phase phase, float timeout) {
+    ASSERT(phase != P_ACTIVE);
+    _timeouts[phase] = std::max(timeout, 0.0f);
+    updateReaper();
+}
+
+void HTTPConnectionTracker::setMinDataRate(Phase phase, size_t bytesPerSecond, float gracePeriod) {
+    ASSERT(phase == P_HEADER || phase == P_BODY);
+    _minDataRates[phase] = bytesPerSecond;
+    _gracePeriods[phase] = std::max(gracePeriod, 0.0f);
+    updateReaper();
+}
+
+HTTPConnectionTracker::HandleType HTTPConnectionTracker::add(std::weak_ptr<HTTPConnection> connection, Phase phase,
+                                                             size_t bytesReceived) {
+    auto &entries = _entries[phase];
+    Timestamp now = TimestampClock::now();
+    entries.push_back({std::move(connection), phase, getDeadline(phase, now), now, bytesReceived});
+    ++_count;
+    return std::prev(entries.end());
+}
+
+void HTTPConnectionTracker::update(HandleType handle, Phase phase, size_t bytesReceived) {
+    auto &entries = _entries[phase];
+    entries.splice(entries.end(), _entries[handle->phase], handle);
+    Timestamp now = TimestampClock::now();
+    handle->phase = phase;
+    handle->deadline = getDeadline(phase, now);
+    handle->since = now;
+    handle->bytesReceived = bytesReceived;
+}
+
+void HTTPConnectionTracker::remove(HandleType handle) {
+    _entries[handle->phase].erase(handle);
+    --_count;
+    if (_removeCallback) {
+        _removeCallback();
+    }
+}
+
+bool HTTPConnectionTracker::closeOldestIdle() {
+    auto &entries = _entries[P_IDLE];
+    for (auto iter = entries.begin(); iter != entries.end(); ++iter) {
+        auto connection = iter->connection.lock();
+        if (connection && connection->getStream()->getReadBufferSize() == 0) {
+            update(iter, P_ACTIVE);
+            ++_evictedCount;
+            connection->close();
+            return true;
+        }
+    }
+    return false;
+}
+
+Timestamp HTTPConnectionTracker::getDeadline(Phase phase, Timestamp now) const {
+    if (phase == P_ACTIVE || _timeouts[phase] == 0.0f) {
+        return Timestamp::max();
+    }
+    return now + std::chrono::duration_cast<Timestamp::duration>(std::chrono::duration<float>(_timeouts[phase]));
+}
+
+void HTTPConnectionTracker::updateReaper() {
+    if (_reaper) {
+        _reaper->stop();
+        _reaper.reset();
+    }
+    float interval = 0.0f;
+    for (auto phase: {P_IDLE, P_HEADER, P_BODY}) {
+        float phaseInterval = _timeouts[phase];
+        if (_minDataRates[phase] != 0) {
+            // Data rates are sampled at least once a second
+            phaseInterval = phaseInterval > 0.0f ? std::min(phaseInterval, 1.0f) : 1.0f;
+            if (_gracePeriods[phase] > 0.0f) {
+                phaseInterval = std::min(phaseInterval, _gracePeriods[phase]);
+            }
+        }
+        if (phaseInterval > 0.0f && (interval == 0.0f || phaseInterval < interval)) {
+            interval = phaseInterval;
+        }
+    }
+    if (interval > 0.0f) {
+        // Expiry is checked a few times per timeout so a connection never outlives its deadline by much
+        interval = std::min(std::max(interval / 4, 0.01f), 1.0f);
+        std::weak_ptr<HTTPConnectionTracker> tracker = shared_from_this();
+        _reaper = PeriodicCallback::create([tracker]() {
+            auto self = tracker.lock();
+            if (self) {
+                self->reap();
+            }
+        }, interval, _ioloop);
+        _reaper->start();
+    }
+}
+
+void HTTPConnectionTracker::reap() {
+    Timestamp now = TimestampClock::now();
+    for (auto phase: {P_IDLE, P_HEADER, P_BODY}) {
+        auto &entries = _entries[phase];
+        while (!entries.empty() && entries.front().deadline <= now) {
+            auto handle = entries.begin();
+            auto connection = handle->connection.lock();
+            if (phase == P_IDLE && connection && _timeouts[P_HEADER] > 0.0f
+                && connection->getStream()->getReadBufferSize() != 0) {
+                // The client has started its next request; give it the header timeout to finish
+                update(handle, P_HEADER, connection->getStream()->getBytesReceived()
+                                         - connection->getStream()->getReadBufferSize());
+                continue;
+            }
+            timeout(handle, connection, phase == P_IDLE ? "idle" : (phase == P_HEADER ? "slow header" : "slow body"));
+        }
+    }
+    for (auto phase: {P_HEADER, P_BODY}) {
+        if (_minDataRates[phase] == 0) {
+            continue;
+        }
+        auto &entries = _entries[phase];
+        auto iter = entries.begin();
+        // Entries are kept in the order they entered the phase, so the first one still in its grace period ends
+        // the scan
+        while (iter != entries.end()) {
+            auto handle = iter++;
+            float elapsed = std::chrono::duration<float>(now - handle->since).count();
+            if (elapsed <= _gracePeriods[phase]) {
+                break;
+            }
+            auto connection = handle->connection.lock();
+            if (!connection) {
+                continue;
+            }
+            size_t received = connection->getStream()->getBytesReceived() - handle->bytesReceived;
+            if ((float)received < (float)_minDataRates[phase] * elapsed) {
+                timeout(handle, connection, phase == P_HEADER ? "header below minimum rate" :
+                                            "body below minimum rate");
+            }
+        }
+    }
+}
+
+void HTTPConnectionTracker::timeout(HandleType handle, const std::shared_ptr<HTTPConnection> &connection,
+                                    const char *reason) {
+    Phase phase = handle->phase;
+    update(handle, P_ACTIVE);
+    if (connection) {
+        ++_timedOutCount;
+        LOG_INFO(gGenLog, "Timing out connection from %s: %s", connection->getAddress().c_str(), reason);
+        connection->onTimeout(phase);
+    }
+}
+
+
 HTTPServer::HTTPServer(RequestCallbackType requestCallback,
                        bool noKeepAlive,
                        IOLoop *ioloop,
@@ -25,20 +190,75 @@ HTTPServer::HTTPServer(RequestCallbackType requestCallback,
         , _requestCallback(std::move(requestCallback))
         , _noKeepAlive(noKeepAlive)
         , _xheaders(xheaders)
-        , _protocol(protocol) {
-
+        , _protocol(protocol)
+        , _tracker(HTTPConnectionTracker::create(_ioloop)) {
+    _tracker->setRemoveCallback([this]() {
+        onConnectionRemoved();
+    });
 }
 
 HTTPServer::~HTTPServer() {
-
+    _tracker->setRemoveCallback(nullptr);
 }
 
 void HTTPServer::handleStream(std::shared_ptr<BaseIOStream> stream, std::string address) {
-    auto connection = HTTPConnection::create(std::move(stream), std::move(address), _requestCallback, _noKeepAlive,
+    if (_maxConnections != 0 && _tracker->getConnectionCount() >= _maxConnections) {
+        if (_overflowPolicy != ConnectionOverflowPolicy::CLOSE_IDLE || !_tracker->closeOldestIdle()) {
+            _tracker->noteRejected();
+            LOG_WARNING(gGenLog, "Too many connections, rejecting connection from %s", address.c_str());
+            stream->close();
+            if (_overflowPolicy == ConnectionOverflowPolicy::STOP_ACCEPTING) {
+                pauseAccepting();
+            }
+            return;
+        }
+    }
+    if (_http2Enabled) {
+        auto sslStream = std::dynamic_pointer_cast<SSLIOStream>(stream);
+        if (sslStream) {
+            sslStream->setALPNProtocols({"h2", "http/1.1"});
+            // The negotiated protocol is only known once the handshake is done
+            sslStream->waitForHandshake([this, sslStream, address]() {
+                startConnection(sslStream, address, sslStream->getSelectedProtocol() == "h2");
+            });
+            return;
+        }
+    }
+    startConnection(std::move(stream), std::move(address), false);
+}
+
+void HTTPServer::startConnection(std::shared_ptr<BaseIOStream> stream, std::string address, bool http2) {
+    std::shared_ptr<HTTPConnection> connection;
+    if (http2) {
+        connection = HTTP2Connection::create(std::move(stream), std::move(address), _requestCallback, _noKeepAlive,
                                              _xheaders, _protocol);
+    } else {
+        connection = HTTPConnection::create(std::move(stream), std::move(address), _requestCallback, _noKeepAlive,
+                                            _xheaders, _protocol);
+    }
+    connection->setHeaderLimits(_maxHeaderCount, _maxHeaderSize, _maxStartLineSize);
+    connection->setMaxBodySize(_maxBodySize);
+    connection->setMaxPipelineDepth(_maxPipelineDepth);
+    connection->setMaxPipelineBufferSize(_maxPipelineBufferSize);
+    if (_streamBodyCallback) {
+        connection->setStreamBodyCallback(_streamBodyCallback, _bodyChunkSize);
+    }
+    connection->setHTTP2Enabled(_http2Enabled);
+    connection->setHTTP2SettingsTimeout(_http2SettingsTimeout);
+    connection->setTracker(_tracker);
+    if (_maxConnections != 0 && _tracker->getConnectionCount() >= _maxConnections
+        && _overflowPolicy == ConnectionOverflowPolicy::STOP_ACCEPTING) {
+        pauseAccepting();
+    }
     connection->start();
 }
 
+void HTTPServer::onConnectionRemoved() {
+    if (isAcceptPaused() && (_maxConnections == 0 || _tracker->getConnectionCount() < _maxConnections)) {
+        resumeAccepting();
+    }
+}
+
 
 class _BadRequestException: public std::runtime_error {
 public:
@@ -64,22 +284,54 @@ HTTPConnection::HTTPConnection(std::shared_ptr<BaseIOStream> stream,
 }
 
 HTTPConnection::~HTTPConnection() {
+    untrack();
 #ifndef NDEBUG
     sWatcher->dec(SYS_HTTPCONNECTION_COUNT);
 #endif
 }
 
+void HTTPConnection::setTracker(const std::shared_ptr<HTTPConnectionTracker> &tracker) {
+    untrack();
+    _trackerHandle = tracker->add(shared_from_this(), HTTPConnectionTracker::P_IDLE, _stream->getBytesReceived());
+    _tracker = tracker;
+    _phase = HTTPConnectionTracker::P_IDLE;
+}
+
+void HTTPConnection::onTimeout(HTTPConnectionTracker::Phase phase) {
+    _phase = HTTPConnectionTracker::P_ACTIVE;
+    if (phase == HTTPConnectionTracker::P_IDLE) {
+        close();
+    } else {
+        reject(408);
+    }
+}
+
+void HTTPConnection::untrack() {
+    auto tracker = _tracker.lock();
+    if (tracker) {
+        _tracker.reset();
+        tracker->remove(_trackerHandle);
+    }
+}
+
 void HTTPConnection::start() {
     BaseIOStream::ReadCallbackType callback = std::bind(&HTTPConnection::onHeaders, this, std::placeholders::_1);
     _headerCallback = StackContext::wrap<ByteArray>(std::move(callback));
 
-    auto wrapper = std::make_shared<CloseCallbackWrapper>(shared_from_this());
+    auto wrapper = makePooledShared<CloseCallbackWrapper>(shared_from_this());
     _stream->setCloseCallback(std::bind(&CloseCallbackWrapper::operator(), std::move(wrapper)));
+    readNextRequest();
+}
 
-    NullContext ctx;
-    _stream->readUntil("\r\n\r\n", [this, self=shared_from_this()](ByteArray data) {
-        _headerCallback(std::move(data));
-    });
+void HTTPConnection::setCloseCallback(const HTTPServerRequest *request, CloseCallbackType callback) {
+    if (request == _activeRequest) {
+        setCloseCallback(std::move(callback));
+    } else {
+        auto response = findPipelined(request);
+        if (response) {
+            response->closeCallback = StackContext::wrap(std::move(callback));
+        }
+    }
 }
 
 void HTTPConnection::write(const Byte *chunk, size_t length, WriteCallbackType callback) {
@@ -87,7 +339,7 @@ void HTTPConnection::write(const Byte *chunk, size_t length, WriteCallbackType c
     if (!_stream->closed()) {
         _writeCallback = StackContext::wrap(std::move(callback));
         if (_writeCallback) {
-            auto wrapper = std::make_shared<WriteCallbackWrapper>(shared_from_this());
+            auto wrapper = makePooledShared<WriteCallbackWrapper>(shared_from_this());
             _stream->write(chunk, length, std::bind(&WriteCallbackWrapper::operator(), std::move(wrapper)));
         } else {
             _stream->write(chunk, length, std::bind(&HTTPConnection::onWriteComplete, shared_from_this()));
@@ -95,6 +347,41 @@ void HTTPConnection::write(const Byte *chunk, size_t length, WriteCallbackType c
     }
 }
 
+void HTTPConnection::write(const HTTPServerRequest *request, const Byte *chunk, size_t length,
+                           WriteCallbackType callback) {
+    if (request == _activeRequest) {
+        write(chunk, length, std::move(callback));
+    } else {
+        auto response = findPipelined(request);
+        if (response) {
+            response->buffer.insert(response->buffer.end(), chunk, chunk + length);
+            _pipelineBufferSize += length;
+            if (callback) {
+                response->writeCallbacks.push_back(StackContext::wrap(std::move(callback)));
+            }
+        }
+    }
+}
+
+void HTTPConnection::writeHeaders(const HTTPServerRequest *request, int statusCode, const HTTPHeaders &headers,
+                                  const Byte *data, size_t headLength, size_t length, WriteCallbackType callback) {
+    write(request, data, length, std::move(callback));
+}
+
+void HTTPConnection::writeFile(const HTTPServerRequest *request, int fd, size_t offset, size_t count,
+                               WriteCallbackType callback) {
+    ASSERT(canWriteFile(request));
+    if (!_stream->closed()) {
+        _writeCallback = StackContext::wrap(std::move(callback));
+        if (_writeCallback) {
+            auto wrapper = makePooledShared<WriteCallbackWrapper>(shared_from_this());
+            _stream->writeFile(fd, offset, count, std::bind(&WriteCallbackWrapper::operator(), std::move(wrapper)));
+        } else {
+            _stream->writeFile(fd, offset, count, std::bind(&HTTPConnection::onWriteComplete, shared_from_this()));
+        }
+    }
+}
+
 void HTTPConnection::finish() {
 //    ASSERT(!_requestObserver.expired(), "Request closed");
     _request = _requestObserver.lock();
@@ -105,12 +392,55 @@ void HTTPConnection::finish() {
     }
 }
 
+void HTTPConnection::finish(const HTTPServerRequest *request) {
+    if (request == _activeRequest) {
+        finish();
+    } else {
+        auto response = findPipelined(request);
+        if (response) {
+            response->finishedRequest = response->observer.lock();
+        }
+    }
+}
+
+void HTTPConnection::resumeBody(const HTTPServerRequest *request) {
+    if (!_bodyPaused) {
+        return;
+    }
+    _bodyPaused = false;
+    setPhase(HTTPConnectionTracker::P_BODY);
+    try {
+        readBody();
+    } catch (StreamClosedError &e) {
+        close();
+    }
+}
+
 void HTTPConnection::onConnectionClose() {
+    untrack();
     if (_closeCallback) {
         CloseCallbackType callback(std::move(_closeCallback));
         _closeCallback = nullptr;
         callback();
     }
+    if (_bodyRequest) {
+        _bodyRequest->clearBodyCallbacks();
+        _bodyRequest.reset();
+    }
+    _bodyState = BS_NONE;
+    _bodyBuffer.clear();
+    _deferredRequest.reset();
+    _pipelineBufferSize = 0;
+    std::deque<PipelinedResponse> pipeline;
+    pipeline.swap(_pipeline);
+    for (auto &response: pipeline) {
+        if (response.closeCallback) {
+            response.closeCallback();
+        }
+        if (response.bodyMemory) {
+            _stream->releaseMemory(response.bodyMemory);
+        }
+    }
     clearRequestState();
 }
 
@@ -130,14 +460,13 @@ void HTTPConnection::finishRequest() {
     if (_noKeepAlive || !_request) {
         disconnect = true;
     } else {
-        auto headers = _request->getHTTPHeaders();
-        std::string connectionHeader = headers->get("Connection");
+        std::string connectionHeader = _request->getHeader(HTTPHeaderField::CONNECTION);
         if (!connectionHeader.empty()) {
             boost::to_lower(connectionHeader);
         }
         if (_request->supportsHTTP11()) {
             disconnect = connectionHeader == "close";
-        } else if (headers->has("Content-Length")
+        } else if (_request->hasHeader(HTTPHeaderField::CONTENT_LENGTH)
                    || _request->getMethod() == "HEAD"
                    || _request->getMethod() == "GET") {
             disconnect = connectionHeader != "keep-alive";
@@ -150,83 +479,483 @@ void HTTPConnection::finishRequest() {
         close();
         return;
     }
+    if (!_pipeline.empty()) {
+        promoteRequest();
+        return;
+    }
+    if (resumeDeferred()) {
+        return;
+    }
+    if (!_pendingRequest && _bodyState == BS_NONE) {
+        setPhase(HTTPConnectionTracker::P_IDLE);
+    }
+    _readBlocked = false;
     try {
-        NullContext ctx;
-        _stream->readUntil("\r\n\r\n", [this, self=shared_from_this()](ByteArray data) {
-            _headerCallback(std::move(data));
-        });
+        readNextRequest();
         _stream->setNodelay(false);
     } catch (StreamClosedError &e) {
         close();
     }
 }
 
+void HTTPConnection::readNextRequest() {
+    if (_reading || _stream->closed()) {
+        return;
+    }
+    _reading = true;
+    _parser.reset();
+    NullContext ctx;
+    auto self = shared_from_this();
+    _stream->readUntilMatch([this, self](const Byte *data, size_t length) {
+        return matchHeaders(data, length);
+    }, [this, self](ByteArray data) {
+        _headerCallback(std::move(data));
+    });
+}
+
+size_t HTTPConnection::matchHeaders(const Byte *data, size_t length) {
+    if (_rejecting) {
+        return 0;
+    }
+    if (_phase == HTTPConnectionTracker::P_IDLE) {
+        setPhase(HTTPConnectionTracker::P_HEADER);
+    }
+    // The parser enforces the limits as bytes arrive, so an oversized head is cut off at the first read past them
+    switch (_parser.parse((const char *)data, length)) {
+        case HTTPRequestParser::Result::COMPLETE:
+            return _parser.getConsumed();
+        case HTTPRequestParser::Result::FAILED:
+            return length;
+        default:
+            return 0;
+    }
+}
+
+void HTTPConnection::dispatchRequest(std::shared_ptr<HTTPServerRequest> request, size_t bodyMemory) {
+    request->setConnection(shared_from_this());
+    setPhase(HTTPConnectionTracker::P_ACTIVE);
+    if (!canPipeline(*request)) {
+        _readBlocked = true;
+    }
+    if (_activeRequest) {
+        _pipeline.push_back({request.get(), request, nullptr, {}, {}, nullptr, bodyMemory});
+    } else {
+        _activeRequest = request.get();
+        _requestObserver = request;
+        _bodyMemory = bodyMemory;
+    }
+    _requestCallback(std::move(request));
+    if (canReadAhead()) {
+        try {
+            readNextRequest();
+        } catch (StreamClosedError &e) {
+            close();
+        }
+    }
+}
+
+void HTTPConnection::promoteRequest() {
+    PipelinedResponse response(std::move(_pipeline.front()));
+    _pipeline.pop_front();
+    _activeRequest = response.request;
+    _requestObserver = response.observer;
+    _closeCallback = std::move(response.closeCallback);
+    _bodyMemory = response.bodyMemory;
+    if (!response.buffer.empty()) {
+        _pipelineBufferSize -= response.buffer.size();
+        WriteCallbackType callback;
+        if (!response.writeCallbacks.empty()) {
+            // Each buffered write asked to hear when its data was flushed; it all goes out in one write
+            callback = [callbacks = std::move(response.writeCallbacks)]() {
+                for (auto &writeCallback: callbacks) {
+                    writeCallback();
+                }
+            };
+        }
+        NullContext ctx;
+        write(response.buffer.data(), response.buffer.size(), std::move(callback));
+    }
+    if (response.finishedRequest) {
+        _request = std::move(response.finishedRequest);
+        _requestFinished = true;
+        _stream->setNodelay(true);
+        if (!_stream->writing()) {
+            finishRequest();
+            return;
+        }
+    }
+    if (canReadAhead()) {
+        try {
+            readNextRequest();
+        } catch (StreamClosedError &e) {
+            close();
+        }
+    }
+}
+
+bool HTTPConnection::resumeDeferred() {
+    if (!_deferredReject.empty()) {
+        std::string response;
+        response.swap(_deferredReject);
+        writeReject(response);
+        return true;
+    }
+    if (!_deferredRequest) {
+        return false;
+    }
+    _readBlocked = false;
+    beginRequest(std::move(_deferredRequest));
+    return true;
+}
+
+bool HTTPConnection::canPipeline(const HTTPServerRequest &request) const {
+    if (_noKeepAlive || !request.supportsHTTP11() || !isSafeMethod(request.getMethod())) {
+        return false;
+    }
+    if (request.hasHeader(HTTPHeaderField::UPGRADE)) {
+        return false;
+    }
+    return boost::to_lower_copy(request.getHeader(HTTPHeaderField::CONNECTION)) != "close";
+}
+
 void HTTPConnection::onHeaders(ByteArray data) {
+    _reading = false;
+    if (_rejecting) {
+        return;
+    }
     try {
-        const char *eol = StrNStr((char *)data.data(), data.size(), "\r\n");
-        std::string startLine, rest;
-        if (eol) {
-            startLine.assign((const char *)data.data(), eol);
-            rest.assign(eol, (const char *)data.data() + data.size());
-        } else {
-            startLine.assign((char *)data.data(), data.size());
+        // The head was already parsed in place on the read buffer by matchHeaders; data holds the same bytes
+        _parser.rebind((const char *)data.data());
+        if (!_parser.isComplete()) {
+            switch (_parser.getError()) {
+                case HTTPParseError::TOO_MANY_HEADERS:
+                case HTTPParseError::HEADER_TOO_LARGE: {
+                    LOG_INFO(gGenLog, "Request headers from %s exceed limits", _address.c_str());
+                    reject(431);
+                    return;
+                }
+                case HTTPParseError::START_LINE_TOO_LONG: {
+                    LOG_INFO(gGenLog, "Request line from %s exceeds limit", _address.c_str());
+                    reject(414);
+                    return;
+                }
+                case HTTPParseError::BAD_VERSION:
+                    throw _BadRequestException("Malformed HTTP version in HTTP Request-Line");
+                case HTTPParseError::BAD_HEADER:
+                    throw _BadRequestException("Malformed HTTP headers");
+                default:
+                    throw _BadRequestException("Malformed HTTP request line");
+            }
         }
-        StringVector requestLineComponents = String::split(startLine);
-        if (requestLineComponents.size() != 3) {
-            throw _BadRequestException("Malformed HTTP request line");
+        if (_http2Enabled && !_activeRequest && _parser.getMethod() == "PRI" && _parser.getURI() == "*"
+            && _parser.getVersion() == "HTTP/2.0") {
+            upgradeToHTTP2(data.size());
+            return;
         }
-        std::string method = std::move(requestLineComponents[0]);
-        std::string uri = std::move(requestLineComponents[1]);
-        std::string version = std::move(requestLineComponents[2]);
-        if (!boost::starts_with(version, "HTTP/")) {
-            throw _BadRequestException("Malformed HTTP version in HTTP Request-Line");
+        auto request = HTTPServerRequest::create(shared_from_this(), std::move(data), _parser, _address, _protocol);
+        if (_activeRequest && (!isSafeMethod(request->getMethod())
+                               || request->getHeader(HTTPHeaderField::EXPECT) == "100-continue")) {
+            // Runs only once every earlier response is finished, which is also when its 100 can be sent
+            _deferredRequest = std::move(request);
+            _readBlocked = true;
+            setPhase(HTTPConnectionTracker::P_ACTIVE);
+            return;
         }
-        std::unique_ptr<HTTPHeaders> headers;
-        try {
-            headers = HTTPHeaders::parse(rest);
-        } catch (Exception &e) {
-            throw _BadRequestException("Malformed HTTP headers");
-        }
-        _request = HTTPServerRequest::create(shared_from_this(), std::move(method), std::move(uri), std::move(version),
-                                             std::move(headers), std::string(), _address, _protocol);
-        _requestObserver = _request;
-        auto requestHeaders = _request->getHTTPHeaders();
-        std::string contentLengthValue = requestHeaders->get("Content-Length");
-        if (!contentLengthValue.empty()) {
-            size_t contentLength = (size_t) std::stoi(contentLengthValue);
-            if (contentLength > _stream->getMaxBufferSize()) {
-                throw _BadRequestException("Content-Length too long");
+        beginRequest(std::move(request));
+    } catch (_BadRequestException &e) {
+        LOG_INFO(gGenLog, "Malformed HTTP request from %s: %s", _address.c_str(), e.what());
+        close();
+    }
+}
+
+void HTTPConnection::beginRequest(std::shared_ptr<HTTPServerRequest> pendingRequest) {
+    _pendingRequest = std::move(pendingRequest);
+    try {
+        auto &request = *_pendingRequest;
+        bool chunked = false;
+        if (request.hasHeader(HTTPHeaderField::TRANSFER_ENCODING)) {
+            if (!boost::iequals(request.getHeader(HTTPHeaderField::TRANSFER_ENCODING), "chunked")) {
+                throw _BadRequestException("Unsupported Transfer-Encoding");
+            }
+            chunked = true;
+        }
+        std::string contentLengthValue;
+        if (!chunked) {
+            contentLengthValue = request.getHeader(HTTPHeaderField::CONTENT_LENGTH);
+        }
+        if (chunked || !contentLengthValue.empty()) {
+            size_t contentLength = 0;
+            if (!chunked) {
+                if (contentLengthValue.size() > 18
+                    || contentLengthValue.find_first_not_of("0123456789") != std::string::npos) {
+                    throw _BadRequestException("Malformed Content-Length");
+                }
+                contentLength = std::stoull(contentLengthValue);
+            }
+            bool streaming = _streamBodyCallback && _streamBodyCallback(_pendingRequest);
+            if (contentLength > getMaxBodySize(streaming)) {
+                LOG_INFO(gGenLog, "Request body of %u bytes from %s exceeds limit", (unsigned)contentLength,
+                         _address.c_str());
+                reject(413);
+                return;
+            }
+            _bodyLength = 0;
+            bool expectContinue = request.getHeader(HTTPHeaderField::EXPECT) == "100-continue";
+            if (streaming) {
+                if (expectContinue) {
+                    const char *continueLine = "HTTP/1.1 100 (Continue)\r\n\r\n";
+                    _stream->write((const Byte *)continueLine, strlen(continueLine));
+                }
+                _bodyRequest = _pendingRequest;
+                _bodyRequest->setBodyStreaming(true);
+                _bodyState = chunked ? BS_CHUNK_SIZE : BS_LENGTH;
+                _bodyRemaining = contentLength;
+                _reading = true;
+                dispatchRequest(std::move(_pendingRequest), 0);
+                setPhase(HTTPConnectionTracker::P_BODY);
+                readBody();
+                return;
             }
-            if (requestHeaders->get("Expect") == "100-continue") {
+            auto accountant = _stream->getMemoryAccountant();
+            if (accountant && !accountant->canAdmit(contentLength)) {
+                accountant->noteRejected();
+                LOG_WARNING(gGenLog, "Memory budget exhausted, rejecting %u bytes request body from %s",
+                            (unsigned)contentLength, _address.c_str());
+                reject(503);
+                return;
+            }
+            if (expectContinue) {
                 const char *continueLine = "HTTP/1.1 100 (Continue)\r\n\r\n";
                 _stream->write((const Byte *)continueLine, strlen(continueLine));
             }
-            _stream->readBytes(contentLength, [this, self=shared_from_this()](ByteArray data) {
-                onRequestBody(std::move(data));
-            });
+            _reading = true;
+            setPhase(HTTPConnectionTracker::P_BODY);
+            if (chunked) {
+                _bodyState = BS_CHUNK_SIZE;
+                readBody();
+            } else {
+                _stream->readBytes(contentLength, [this, self=shared_from_this()](ByteArray data) {
+                    onRequestBody(std::move(data));
+                });
+            }
             return;
         }
-        _request->setConnection(shared_from_this());
-        _requestCallback(std::move(_request));
+        dispatchRequest(std::move(_pendingRequest), 0);
     } catch (_BadRequestException &e) {
         LOG_INFO(gGenLog, "Malformed HTTP request from %s: %s", _address.c_str(), e.what());
         close();
     }
 }
 
-void HTTPConnection::onRequestBody(ByteArray data) {
-    _request->setBody(std::string((const char *)data.data(), data.size()));
-    auto headers = _request->getHTTPHeaders();
-    const std::string &method = _request->getMethod();
-    if (method == "POST" || method == "PATCH" || method == "PUT") {
-        HTTPUtil::parseBodyArguments(headers->get("Content-Type", ""), _request->getBody(), _request->bodyArguments(),
-                                     _request->files());
-        for (const auto &kv: _request->getBodyArguments()) {
-            _request->addArguments(kv.first, kv.second);
+void HTTPConnection::reject(int statusCode) {
+    // Answer in the client's own version; HTTP/1.0 clients may not parse an HTTP/1.1 status line
+    const char *version = _pendingRequest && _pendingRequest->getVersion() == "HTTP/1.0" ? "HTTP/1.0" : "HTTP/1.1";
+    _pendingRequest.reset();
+    _bodyState = BS_NONE;
+    if (_rejecting || _bodyRequest) {
+        // Either this response could not be delivered in time or the request is already with its handler
+        close();
+        return;
+    }
+    _rejecting = true;
+    _reading = true;
+    auto iter = HTTP_RESPONSES.find(statusCode);
+    std::string response = std::string(version) + " " + std::to_string(statusCode) + " "
+                           + (iter != HTTP_RESPONSES.end() ? iter->second : "Unknown")
+                           + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    if (_activeRequest) {
+        // Earlier responses are still being written; this one follows them
+        _deferredReject = std::move(response);
+        return;
+    }
+    writeReject(response);
+}
+
+void HTTPConnection::writeReject(const std::string &response) {
+    try {
+        _stream->write((const Byte *)response.data(), response.size());
+        _stream->closeAfterDrain(REJECT_LINGER_TIMEOUT);
+    } catch (StreamClosedError &e) {
+        close();
+    }
+}
+
+void HTTPConnection::readBody() {
+    if (_bodyPaused || _bodyReadPending || _rejecting || _stream->closed()) {
+        return;
+    }
+    NullContext ctx;
+    switch (_bodyState) {
+        case BS_LENGTH:
+        case BS_CHUNK_DATA: {
+            if (_bodyRemaining == 0) {
+                onBodyEnd();
+                break;
+            }
+            _bodyReadPending = true;
+            size_t numBytes = std::min(_bodyRemaining, _bodyChunkSize);
+            _stream->readBytes(numBytes, [this, self=shared_from_this()](ByteArray data) {
+                onBodyData(std::move(data));
+            });
+            break;
+        }
+        case BS_CHUNK_SIZE: {
+            _bodyReadPending = true;
+            _stream->readUntil("\r\n", [this, self=shared_from_this()](ByteArray data) {
+                onChunkSize(std::move(data));
+            }, _parser.getMaxHeaderSize());
+            break;
+        }
+        case BS_CHUNK_END: {
+            _bodyReadPending = true;
+            _stream->readBytes(2, [this, self=shared_from_this()](ByteArray data) {
+                onChunkEnd(std::move(data));
+            });
+            break;
+        }
+        case BS_TRAILER: {
+            _bodyReadPending = true;
+            _stream->readUntil("\r\n", [this, self=shared_from_this()](ByteArray data) {
+                onChunkTrailer(std::move(data));
+            }, _parser.getMaxHeaderSize());
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+void HTTPConnection::onBodyData(ByteArray data) {
+    _bodyReadPending = false;
+    _bodyRemaining -= data.size();
+    if (_bodyState == BS_CHUNK_DATA && _bodyRemaining == 0) {
+        _bodyState = BS_CHUNK_END;
+    }
+    if (_bodyRequest) {
+        _bodyRequest->dataReceived(std::move(data));
+    } else {
+        _bodyBuffer.insert(_bodyBuffer.end(), data.begin(), data.end());
+    }
+    readBody();
+}
+
+void HTTPConnection::onChunkSize(ByteArray data) {
+    _bodyReadPending = false;
+    const char *iter = (const char *)data.data(), *end = iter + data.size() - 2;
+    size_t chunkSize = 0, digits = 0;
+    for (; iter != end && std::isxdigit((unsigned char)*iter); ++iter, ++digits) {
+        chunkSize = chunkSize * 16 + (std::isdigit((unsigned char)*iter) ? *iter - '0' : (*iter | 0x20) - 'a' + 10);
+    }
+    if (digits == 0 || digits > 15 || (iter != end && *iter != ';' && *iter != ' ' && *iter != '\t')) {
+        LOG_INFO(gGenLog, "Malformed chunked request body from %s", _address.c_str());
+        close();
+        return;
+    }
+    if (chunkSize == 0) {
+        _bodyState = BS_TRAILER;
+        _trailerCount = 0;
+    } else {
+        _bodyLength += chunkSize;
+        if (_bodyLength > getMaxBodySize(static_cast<bool>(_bodyRequest))) {
+            LOG_INFO(gGenLog, "Chunked request body from %s exceeds limit", _address.c_str());
+            reject(413);
+            return;
+        }
+        if (!_bodyRequest) {
+            auto accountant = _stream->getMemoryAccountant();
+            if (accountant && !accountant->canAdmit(_bodyLength)) {
+                accountant->noteRejected();
+                LOG_WARNING(gGenLog, "Memory budget exhausted, rejecting %u bytes chunked request body from %s",
+                            (unsigned)_bodyLength, _address.c_str());
+                reject(503);
+                return;
+            }
+        }
+        _bodyState = BS_CHUNK_DATA;
+        _bodyRemaining = chunkSize;
+    }
+    readBody();
+}
+
+void HTTPConnection::onChunkEnd(ByteArray data) {
+    _bodyReadPending = false;
+    if (data[0] != '\r' || data[1] != '\n') {
+        LOG_INFO(gGenLog, "Malformed chunked request body from %s", _address.c_str());
+        close();
+        return;
+    }
+    _bodyState = BS_CHUNK_SIZE;
+    readBody();
+}
+
+void HTTPConnection::onChunkTrailer(ByteArray data) {
+    _bodyReadPending = false;
+    if (data.size() == 2) {
+        onBodyEnd();
+        return;
+    }
+    if (++_trailerCount > _parser.getMaxHeaderCount()) {
+        LOG_INFO(gGenLog, "Too many trailers in chunked request body from %s", _address.c_str());
+        close();
+        return;
+    }
+    readBody();
+}
+
+void HTTPConnection::onBodyEnd() {
+    _bodyState = BS_NONE;
+    _bodyPaused = false;
+    if (!_bodyRequest) {
+        ByteArray body;
+        body.swap(_bodyBuffer);
+        onRequestBody(std::move(body));
+        return;
+    }
+    auto request = std::move(_bodyRequest);
+    _reading = false;
+    setPhase(_activeRequest ? HTTPConnectionTracker::P_ACTIVE : HTTPConnectionTracker::P_IDLE);
+    request->bodyFinished();
+    if (canReadAhead()) {
+        try {
+            readNextRequest();
+        } catch (StreamClosedError &e) {
+            close();
         }
     }
-    _request->setConnection(shared_from_this());
-    _requestCallback(std::move(_request));
+}
+
+void HTTPConnection::onRequestBody(ByteArray data) {
+    if (_rejecting) {
+        return;
+    }
+    _reading = false;
+    auto &request = _pendingRequest;
+    request->setBody(std::string((const char *)data.data(), data.size()));
+    size_t bodyMemory = 0;
+    if (_stream->getMemoryAccountant()) {
+        bodyMemory = data.size();
+        _stream->chargeMemory(bodyMemory);
+    }
+    dispatchRequest(std::move(_pendingRequest), bodyMemory);
+}
+
+void HTTPConnection::upgradeToHTTP2(size_t prefaceReceived) {
+    auto connection = HTTP2Connection::create(_stream, _address, _requestCallback, _noKeepAlive, _xheaders,
+                                              _protocol);
+    connection->setHeaderLimits(_parser.getMaxHeaderCount(), _parser.getMaxHeaderSize(),
+                                _parser.getMaxStartLineSize());
+    if (_streamBodyCallback) {
+        connection->setStreamBodyCallback(_streamBodyCallback, _bodyChunkSize);
+    }
+    connection->setPrefaceReceived(prefaceReceived);
+    connection->setHTTP2SettingsTimeout(_http2SettingsTimeout);
+    auto tracker = _tracker.lock();
+    if (tracker) {
+        untrack();
+        connection->setTracker(tracker);
+    }
+    connection->start();
 }
 
 
@@ -249,6 +978,27 @@ HTTPServerRequest::HTTPServerRequest(std::shared_ptr<HTTPConnection> connection,
 //        , _connection(std::move(connection))
         , _startTime(TimestampClock::now())
         , _finishTime(Timestamp::min()) {
+    init(connection, std::move(remoteIp), std::move(protocol), std::move(host));
+}
+
+HTTPServerRequest::HTTPServerRequest(std::shared_ptr<HTTPConnection> connection,
+                                     ByteArray head,
+                                     HTTPRequestParser &parser,
+                                     std::string remoteIp,
+                                     std::string protocol)
+        : _method(parser.getMethod().to_string())
+        , _uri(parser.getURI().to_string())
+        , _version(parser.getVersion().to_string())
+        , _head(std::move(head))
+        , _headParser(std::move(parser))
+        , _startTime(TimestampClock::now())
+        , _finishTime(Timestamp::min()) {
+    _headParser.rebind((const char *)_head.data());
+    init(connection, std::move(remoteIp), std::move(protocol), {});
+}
+
+void HTTPServerRequest::init(const std::shared_ptr<HTTPConnection> &connection, std::string remoteIp,
+                             std::string protocol, std::string host) {
     _remoteIp = std::move(remoteIp);
     if (!protocol.empty()) {
         _protocol = std::move(protocol);
@@ -258,14 +1008,14 @@ HTTPServerRequest::HTTPServerRequest(std::shared_ptr<HTTPConnection> connection,
         _protocol = "http";
     }
     if (connection && connection->getXHeaders()) {
-        std::string ip = _headers->get("X-Forwarded-For", _remoteIp);
+        std::string ip = getHeader(HTTPHeaderField::X_FORWARDED_FOR, _remoteIp);
         ip = boost::trim_copy(String::split(ip, ',').back());
-        ip = _headers->get("X-Real-Ip", ip);
+        ip = getHeader(HTTPHeaderField::X_REAL_IP, ip);
         if (NetUtil::isValidIP(ip)) {
             _remoteIp = std::move(ip);
         }
-        std::string proto = _headers->get("X-Forwarded-Proto", _protocol);
-        proto = _headers->get("X-Scheme", proto);
+        std::string proto = getHeader(HTTPHeaderField::X_FORWARDED_PROTO, _protocol);
+        proto = getHeader(HTTPHeaderField::X_SCHEME, proto);
         if (proto == "http" || proto == "https") {
             _protocol = std::move(proto);
         }
@@ -273,11 +1023,15 @@ HTTPServerRequest::HTTPServerRequest(std::shared_ptr<HTTPConnection> connection,
     if (!host.empty()) {
         _host = std::move(host);
     } else {
-        _host = _headers->get("Host", "127.0.0.1");
+        _host = getHeader(HTTPHeaderField::HOST, "127.0.0.1");
+    }
+    size_t pos = _uri.find('?');
+    if (pos == std::string::npos) {
+        _path = _uri;
+    } else {
+        _path.assign(_uri, 0, pos);
+        _query.assign(_uri, pos + 1, std::string::npos);
     }
-    std::tie(_path, std::ignore, _query) = String::partition(_uri, "?");
-    _arguments = URLParse::parseQS(_query, true);
-    _queryArguments = _arguments;
 #ifndef NDEBUG
     sWatcher->inc(SYS_HTTPSERVERREQUEST_COUNT);
 #endif
@@ -292,9 +1046,9 @@ HTTPServerRequest::~HTTPServerRequest() {
 const SimpleCookie& HTTPServerRequest::cookies() const {
     if (!_cookies) {
         _cookies.emplace();
-        if (_headers->has("Cookie")) {
+        if (hasHeader(HTTPHeaderField::COOKIE)) {
             try {
-                _cookies->load(_headers->at("Cookie"));
+                _cookies->load(getHeader(HTTPHeaderField::COOKIE));
             } catch (...) {
                 _cookies->clear();
             }
@@ -305,16 +1059,125 @@ const SimpleCookie& HTTPServerRequest::cookies() const {
 
 void HTTPServerRequest::write(const Byte *chunk, size_t length, WriteCallbackType callback) {
     ASSERT(_connection);
-    _connection->write(chunk, length, std::move(callback));
+    _connection->write(this, chunk, length, std::move(callback));
+}
+
+void HTTPServerRequest::writeHeaders(int statusCode, const HTTPHeaders &headers, const Byte *data, size_t headLength,
+                                     size_t length, WriteCallbackType callback) {
+    ASSERT(_connection);
+    _connection->writeHeaders(this, statusCode, headers, data, headLength, length, std::move(callback));
+}
+
+void HTTPServerRequest::writeFile(int fd, size_t offset, size_t count, WriteCallbackType callback) {
+    ASSERT(_connection);
+    _connection->writeFile(this, fd, offset, count, std::move(callback));
 }
 
 void HTTPServerRequest::finish() {
     ASSERT(_connection);
     auto connection = std::move(_connection);
-    connection->finish();
+    connection->finish(this);
     _finishTime = TimestampClock::now();
 }
 
+void HTTPServerRequest::setCloseCallback(HTTPConnection::CloseCallbackType callback) {
+    ASSERT(_connection);
+    _connection->setCloseCallback(this, std::move(callback));
+}
+
+void HTTPServerRequest::setBodyCallbacks(DataCallbackType dataCallback, EndCallbackType endCallback) {
+    _dataCallback = StackContext::wrap<ByteArray>(std::move(dataCallback));
+    _endCallback = StackContext::wrap(std::move(endCallback));
+}
+
+void HTTPServerRequest::pauseBody() {
+    ASSERT(_connection);
+    _connection->pauseBody(this);
+}
+
+void HTTPServerRequest::resumeBody() {
+    ASSERT(_connection);
+    _connection->resumeBody(this);
+}
+
+bool HTTPServerRequest::hasArgument(const std::string &name) const {
+    if (_argumentsMerged) {
+        return _arguments.find(name) != _arguments.end();
+    }
+    parseBodyArguments();
+    if (_bodyArguments.find(name) != _bodyArguments.end()) {
+        return true;
+    }
+    parseQueryArguments();
+    return _queryArguments.find(name) != _queryArguments.end();
+}
+
+const std::string* HTTPServerRequest::getLastArgument(const std::string &name) const {
+    if (_argumentsMerged) {
+        auto iter = _arguments.find(name);
+        return iter != _arguments.end() && !iter->second.empty() ? &iter->second.back() : nullptr;
+    }
+    parseBodyArguments();
+    auto iter = _bodyArguments.find(name);
+    if (iter != _bodyArguments.end() && !iter->second.empty()) {
+        return &iter->second.back();
+    }
+    parseQueryArguments();
+    iter = _queryArguments.find(name);
+    return iter != _queryArguments.end() && !iter->second.empty() ? &iter->second.back() : nullptr;
+}
+
+StringVector HTTPServerRequest::getArgumentValues(const std::string &name) const {
+    StringVector values;
+    if (_argumentsMerged) {
+        auto iter = _arguments.find(name);
+        if (iter != _arguments.end()) {
+            values = iter->second;
+        }
+        return values;
+    }
+    parseQueryArguments();
+    auto iter = _queryArguments.find(name);
+    if (iter != _queryArguments.end()) {
+        values = iter->second;
+    }
+    parseBodyArguments();
+    iter = _bodyArguments.find(name);
+    if (iter != _bodyArguments.end()) {
+        values.insert(values.end(), iter->second.begin(), iter->second.end());
+    }
+    return values;
+}
+
+void HTTPServerRequest::parseBodyArguments() const {
+    if (_bodyParsed) {
+        return;
+    }
+    _bodyParsed = true;
+    if (_bodyStreaming || _body.empty()) {
+        return;
+    }
+    if (_method == "POST" || _method == "PATCH" || _method == "PUT") {
+        _bodyArguments.clear();
+        HTTPUtil::parseBodyArguments(getHeader(HTTPHeaderField::CONTENT_TYPE), _body, _bodyArguments,
+                                     _files);
+    }
+}
+
+QueryArgListMap& HTTPServerRequest::mergeArguments() const {
+    if (!_argumentsMerged) {
+        _argumentsMerged = true;
+        parseQueryArguments();
+        parseBodyArguments();
+        _arguments = _queryArguments;
+        for (const auto &kv: _bodyArguments) {
+            auto &values = _arguments[kv.first];
+            values.insert(values.end(), kv.second.begin(), kv.second.end());
+        }
+    }
+    return _arguments;
+}
+
 double HTTPServerRequest::requestTime() const {
     std::chrono::microseconds elapse;
     if (_finishTime == Timestamp::min()) {
@@ -336,7 +1199,7 @@ std::string HTTPServerRequest::dump() const {
 //    argsList.emplace_back("body=" + _body);
     std::string args = boost::join(argsList, ",");
     StringVector headersList;
-    _headers->getAll([&headersList](const std::string &name, const std::string &value){
+    getHTTPHeaders()->getAll([&headersList](const std::string &name, const std::string &value){
          headersList.emplace_back("\"" + name + "\": \"" + value + "\"");
     });
     std::string headers = boost::join(headersList, ", ");
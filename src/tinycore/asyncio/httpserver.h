@@ -7,17 +7,147 @@
 
 #include "tinycore/common/common.h"
 #include <chrono>
+#include "tinycore/asyncio/httpparser.h"
 #include "tinycore/asyncio/httputil.h"
 #include "tinycore/asyncio/tcpserver.h"
 #include "tinycore/httputils/cookie.h"
 #include "tinycore/httputils/urlparse.h"
+#include "tinycore/utilities/memorypool.h"
 
 
+constexpr size_t DEFAULT_MAX_PIPELINE_DEPTH = 16;
+constexpr size_t DEFAULT_MAX_PIPELINE_BUFFER_SIZE = 1024 * 1024;
+constexpr size_t DEFAULT_BODY_CHUNK_SIZE = 65536;
+// Seconds a rejected client gets to stop sending before its connection is closed
+constexpr float REJECT_LINGER_TIMEOUT = 2.0f;
+// Seconds an HTTP/2 client has to acknowledge the server's SETTINGS
+constexpr float DEFAULT_HTTP2_SETTINGS_TIMEOUT = 10.0f;
+
+
+class HTTPConnection;
 class HTTPServerRequest;
 
+
+enum class ConnectionOverflowPolicy {
+    STOP_ACCEPTING,
+    CLOSE_IDLE,
+};
+
+
+// Keeps the server's connections in one list per phase. Each phase has a single timeout, so appending on every
+// phase change keeps a list ordered by deadline and the reaper only ever looks at the heads.
+class HTTPConnectionTracker: public std::enable_shared_from_this<HTTPConnectionTracker> {
+public:
+    enum Phase {
+        P_IDLE,
+        P_HEADER,
+        P_BODY,
+        P_ACTIVE,
+        P_COUNT,
+    };
+
+    struct Entry {
+        std::weak_ptr<HTTPConnection> connection;
+        Phase phase;
+        Timestamp deadline;
+        Timestamp since;
+        size_t bytesReceived;
+    };
+
+    typedef std::list<Entry>::iterator HandleType;
+    typedef std::function<void ()> RemoveCallbackType;
+
+    explicit HTTPConnectionTracker(IOLoop *ioloop);
+
+    ~HTTPConnectionTracker();
+
+    HTTPConnectionTracker(const HTTPConnectionTracker &) = delete;
+
+    HTTPConnectionTracker &operator=(const HTTPConnectionTracker &) = delete;
+
+    // Zero disables the timeout of the phase
+    void setTimeout(Phase phase, float timeout);
+
+    float getTimeout(Phase phase) const {
+        return _timeouts[phase];
+    }
+
+    // Once gracePeriod has passed since a connection entered the phase, it must have averaged at least
+    // bytesPerSecond or it is timed out. Zero disables the check.
+    void setMinDataRate(Phase phase, size_t bytesPerSecond, float gracePeriod);
+
+    size_t getMinDataRate(Phase phase) const {
+        return _minDataRates[phase];
+    }
+
+    void setRemoveCallback(RemoveCallbackType removeCallback) {
+        _removeCallback = std::move(removeCallback);
+    }
+
+    // bytesReceived is what the connection's stream had received when entering the phase
+    HandleType add(std::weak_ptr<HTTPConnection> connection, Phase phase, size_t bytesReceived=0);
+
+    void update(HandleType handle, Phase phase, size_t bytesReceived=0);
+
+    void remove(HandleType handle);
+
+    bool closeOldestIdle();
+
+    void noteRejected() {
+        ++_rejectedCount;
+    }
+
+    size_t getConnectionCount() const {
+        return _count;
+    }
+
+    size_t getCount(Phase phase) const {
+        return _entries[phase].size();
+    }
+
+    size_t getTimedOutCount() const {
+        return _timedOutCount;
+    }
+
+    size_t getEvictedCount() const {
+        return _evictedCount;
+    }
+
+    size_t getRejectedCount() const {
+        return _rejectedCount;
+    }
+
+    template <typename ...Args>
+    static std::shared_ptr<HTTPConnectionTracker> create(Args&& ...args) {
+        return std::make_shared<HTTPConnectionTracker>(std::forward<Args>(args)...);
+    }
+protected:
+    Timestamp getDeadline(Phase phase, Timestamp now) const;
+
+    void updateReaper();
+
+    void reap();
+
+    void timeout(HandleType handle, const std::shared_ptr<HTTPConnection> &connection, const char *reason);
+
+    IOLoop *_ioloop;
+    std::array<std::list<Entry>, P_COUNT> _entries;
+    std::array<float, P_COUNT> _timeouts;
+    std::array<size_t, P_COUNT> _minDataRates;
+    std::array<float, P_COUNT> _gracePeriods;
+    size_t _count{0};
+    size_t _timedOutCount{0};
+    size_t _evictedCount{0};
+    size_t _rejectedCount{0};
+    std::shared_ptr<PeriodicCallback> _reaper;
+    RemoveCallbackType _removeCallback;
+};
+
+
 class HTTPServer: public TCPServer {
 public:
     typedef std::function<void(std::shared_ptr<HTTPServerRequest>)> RequestCallbackType;
+    typedef std::function<bool(std::shared_ptr<HTTPServerRequest>)> StreamBodyCallbackType;
 
     HTTPServer(const HTTPServer &) = delete;
 
@@ -33,18 +163,174 @@ public:
 
     virtual ~HTTPServer();
 
+    void setMaxHeaderCount(size_t maxHeaderCount) {
+        _maxHeaderCount = maxHeaderCount;
+    }
+
+    size_t getMaxHeaderCount() const {
+        return _maxHeaderCount;
+    }
+
+    void setMaxHeaderSize(size_t maxHeaderSize) {
+        _maxHeaderSize = maxHeaderSize;
+    }
+
+    size_t getMaxHeaderSize() const {
+        return _maxHeaderSize;
+    }
+
+    void setMaxStartLineSize(size_t maxStartLineSize) {
+        _maxStartLineSize = maxStartLineSize;
+    }
+
+    size_t getMaxStartLineSize() const {
+        return _maxStartLineSize;
+    }
+
+    // Zero limits buffered bodies to the stream's max buffer size and leaves streamed bodies unlimited
+    void setMaxBodySize(size_t maxBodySize) {
+        _maxBodySize = maxBodySize;
+    }
+
+    size_t getMaxBodySize() const {
+        return _maxBodySize;
+    }
+
+    void setMaxPipelineDepth(size_t maxPipelineDepth) {
+        _maxPipelineDepth = maxPipelineDepth;
+    }
+
+    size_t getMaxPipelineDepth() const {
+        return _maxPipelineDepth;
+    }
+
+    // Bytes of responses to pipelined requests a connection may hold back; past it no further requests are read
+    void setMaxPipelineBufferSize(size_t maxPipelineBufferSize) {
+        _maxPipelineBufferSize = maxPipelineBufferSize;
+    }
+
+    size_t getMaxPipelineBufferSize() const {
+        return _maxPipelineBufferSize;
+    }
+
+    void setStreamBodyCallback(StreamBodyCallbackType streamBodyCallback) {
+        _streamBodyCallback = std::move(streamBodyCallback);
+    }
+
+    void setBodyChunkSize(size_t bodyChunkSize) {
+        _bodyChunkSize = bodyChunkSize;
+    }
+
+    size_t getBodyChunkSize() const {
+        return _bodyChunkSize;
+    }
+
+    // Accept HTTP/2 negotiated through ALPN on SSL streams and h2c with prior knowledge on plain ones. ALPN is offered
+    // per connection, so an SSLOption shared with other servers is left as it is
+    void setHTTP2Enabled(bool http2Enabled) {
+        _http2Enabled = http2Enabled;
+    }
+
+    bool isHTTP2Enabled() const {
+        return _http2Enabled;
+    }
+
+    // Time an HTTP/2 client has to acknowledge the server's SETTINGS; zero waits forever
+    void setHTTP2SettingsTimeout(float http2SettingsTimeout) {
+        _http2SettingsTimeout = http2SettingsTimeout;
+    }
+
+    float getHTTP2SettingsTimeout() const {
+        return _http2SettingsTimeout;
+    }
+
+    // Time a keep-alive connection may wait for its next request
+    void setIdleTimeout(float idleTimeout) {
+        _tracker->setTimeout(HTTPConnectionTracker::P_IDLE, idleTimeout);
+    }
+
+    float getIdleTimeout() const {
+        return _tracker->getTimeout(HTTPConnectionTracker::P_IDLE);
+    }
+
+    // Extra time granted once an idle connection has started sending a request head
+    void setHeaderTimeout(float headerTimeout) {
+        _tracker->setTimeout(HTTPConnectionTracker::P_HEADER, headerTimeout);
+    }
+
+    float getHeaderTimeout() const {
+        return _tracker->getTimeout(HTTPConnectionTracker::P_HEADER);
+    }
+
+    // Time allowed to receive a request body, not counting the time the handler keeps it paused
+    void setBodyTimeout(float bodyTimeout) {
+        _tracker->setTimeout(HTTPConnectionTracker::P_BODY, bodyTimeout);
+    }
+
+    float getBodyTimeout() const {
+        return _tracker->getTimeout(HTTPConnectionTracker::P_BODY);
+    }
+
+    // Request heads arriving slower than this, once gracePeriod has passed, are answered with 408
+    void setMinHeaderDataRate(size_t bytesPerSecond, float gracePeriod) {
+        _tracker->setMinDataRate(HTTPConnectionTracker::P_HEADER, bytesPerSecond, gracePeriod);
+    }
+
+    // Same for request bodies; a paused body is not measured
+    void setMinBodyDataRate(size_t bytesPerSecond, float gracePeriod) {
+        _tracker->setMinDataRate(HTTPConnectionTracker::P_BODY, bytesPerSecond, gracePeriod);
+    }
+
+    void setMaxConnections(size_t maxConnections) {
+        _maxConnections = maxConnections;
+    }
+
+    size_t getMaxConnections() const {
+        return _maxConnections;
+    }
+
+    void setOverflowPolicy(ConnectionOverflowPolicy overflowPolicy) {
+        _overflowPolicy = overflowPolicy;
+    }
+
+    ConnectionOverflowPolicy getOverflowPolicy() const {
+        return _overflowPolicy;
+    }
+
+    const HTTPConnectionTracker& getConnectionTracker() const {
+        return *_tracker;
+    }
+
     void handleStream(std::shared_ptr<BaseIOStream> stream, std::string address) override;
 protected:
+    void startConnection(std::shared_ptr<BaseIOStream> stream, std::string address, bool http2);
+
+    void onConnectionRemoved();
+
     RequestCallbackType _requestCallback;
     bool _noKeepAlive;
     bool _xheaders;
     std::string _protocol;
+    size_t _maxHeaderCount{DEFAULT_MAX_HEADER_COUNT};
+    size_t _maxHeaderSize{DEFAULT_MAX_HEADER_SIZE};
+    size_t _maxStartLineSize{DEFAULT_MAX_START_LINE_SIZE};
+    size_t _maxBodySize{0};
+    size_t _maxPipelineDepth{DEFAULT_MAX_PIPELINE_DEPTH};
+    size_t _maxPipelineBufferSize{DEFAULT_MAX_PIPELINE_BUFFER_SIZE};
+    StreamBodyCallbackType _streamBodyCallback;
+    size_t _bodyChunkSize{DEFAULT_BODY_CHUNK_SIZE};
+    bool _http2Enabled{false};
+    float _http2SettingsTimeout{DEFAULT_HTTP2_SETTINGS_TIMEOUT};
+    std::shared_ptr<HTTPConnectionTracker> _tracker;
+    size_t _maxConnections{0};
+    ConnectionOverflowPolicy _overflowPolicy{ConnectionOverflowPolicy::STOP_ACCEPTING};
 };
 
 
 class HTTPConnection : public std::enable_shared_from_this<HTTPConnection> {
 public:
     typedef HTTPServer::RequestCallbackType RequestCallbackType;
+    typedef HTTPServer::StreamBodyCallbackType StreamBodyCallbackType;
     typedef std::function<void ()> WriteCallbackType;
     typedef BaseIOStream::CloseCallbackType CloseCallbackType;
     typedef std::function<void (ByteArray)> HeaderCallbackType;
@@ -131,7 +417,7 @@ public:
                    bool xheaders = false,
                    const std::string &protocol="");
 
-    ~HTTPConnection();
+    virtual ~HTTPConnection();
 
     void clearCallbacks() {
         _writeCallback = nullptr;
@@ -142,17 +428,37 @@ public:
         _closeCallback = StackContext::wrap(std::move(callback));
     }
 
+    virtual void setCloseCallback(const HTTPServerRequest *request, CloseCallbackType callback);
+
     void close() {
         _stream->close();
         clearRequestState();
     }
 
-    void start();
+    virtual void start();
 
     void write(const Byte *chunk, size_t length, WriteCallbackType callback= nullptr);
 
+    virtual void write(const HTTPServerRequest *request, const Byte *chunk, size_t length,
+                       WriteCallbackType callback= nullptr);
+
+    // Writes a response head and the first body bytes: data holds the HTTP/1.x head in its first headLength bytes,
+    // then the body. Connections with a framing of their own build it from statusCode and headers instead
+    virtual void writeHeaders(const HTTPServerRequest *request, int statusCode, const HTTPHeaders &headers,
+                              const Byte *data, size_t headLength, size_t length, WriteCallbackType callback= nullptr);
+
+    // Whether the request may hand file ranges straight to the stream; pipelined responses are buffered instead
+    virtual bool canWriteFile(const HTTPServerRequest *request) const {
+        return request == _activeRequest;
+    }
+
+    void writeFile(const HTTPServerRequest *request, int fd, size_t offset, size_t count,
+                   WriteCallbackType callback= nullptr);
+
     void finish();
 
+    virtual void finish(const HTTPServerRequest *request);
+
     bool getNoKeepAlive() const {
         return _noKeepAlive;
     }
@@ -161,6 +467,74 @@ public:
         return _xheaders;
     }
 
+    const std::string& getAddress() const {
+        return _address;
+    }
+
+    void setHeaderLimits(size_t maxHeaderCount, size_t maxHeaderSize, size_t maxStartLineSize) {
+        _parser.setMaxHeaderCount(maxHeaderCount);
+        _parser.setMaxHeaderSize(maxHeaderSize);
+        _parser.setMaxStartLineSize(maxStartLineSize);
+    }
+
+    void setMaxBodySize(size_t maxBodySize) {
+        _maxBodySize = maxBodySize;
+    }
+
+    size_t getMaxBodySize(bool streaming) const {
+        if (_maxBodySize != 0) {
+            return _maxBodySize;
+        }
+        return streaming ? std::numeric_limits<size_t>::max() : _stream->getMaxBufferSize();
+    }
+
+    void setMaxPipelineDepth(size_t maxPipelineDepth) {
+        _maxPipelineDepth = maxPipelineDepth;
+    }
+
+    size_t getMaxPipelineDepth() const {
+        return _maxPipelineDepth;
+    }
+
+    size_t getPipelineDepth() const {
+        return _pipeline.size();
+    }
+
+    void setMaxPipelineBufferSize(size_t maxPipelineBufferSize) {
+        _maxPipelineBufferSize = maxPipelineBufferSize;
+    }
+
+    size_t getPipelineBufferSize() const {
+        return _pipelineBufferSize;
+    }
+
+    void setStreamBodyCallback(StreamBodyCallbackType streamBodyCallback, size_t bodyChunkSize) {
+        _streamBodyCallback = std::move(streamBodyCallback);
+        _bodyChunkSize = bodyChunkSize;
+    }
+
+    void setHTTP2Enabled(bool http2Enabled) {
+        _http2Enabled = http2Enabled;
+    }
+
+    void setHTTP2SettingsTimeout(float http2SettingsTimeout) {
+        _http2SettingsTimeout = http2SettingsTimeout;
+    }
+
+    void setTracker(const std::shared_ptr<HTTPConnectionTracker> &tracker);
+
+    // Called by the tracker once the connection has spent too long in phase
+    void onTimeout(HTTPConnectionTracker::Phase phase);
+
+    virtual void pauseBody(const HTTPServerRequest *request) {
+        if (_bodyState != BS_NONE) {
+            _bodyPaused = true;
+            setPhase(HTTPConnectionTracker::P_ACTIVE);
+        }
+    }
+
+    virtual void resumeBody(const HTTPServerRequest *request);
+
     std::shared_ptr<BaseIOStream> getStream() const {
         return _stream;
     }
@@ -174,22 +548,110 @@ public:
         return std::make_shared<HTTPConnection>(std::forward<Args>(args)...);
     }
 protected:
+    struct PipelinedResponse {
+        const HTTPServerRequest *request;
+        std::weak_ptr<HTTPServerRequest> observer;
+        std::shared_ptr<HTTPServerRequest> finishedRequest;
+        ByteArray buffer;
+        std::vector<WriteCallbackType> writeCallbacks;
+        CloseCallbackType closeCallback;
+        size_t bodyMemory;
+    };
+
+    enum BodyState {
+        BS_NONE,
+        BS_LENGTH,
+        BS_CHUNK_SIZE,
+        BS_CHUNK_DATA,
+        BS_CHUNK_END,
+        BS_TRAILER,
+    };
+
+    void setPhase(HTTPConnectionTracker::Phase phase) {
+        _phase = phase;
+        auto tracker = _tracker.lock();
+        if (tracker) {
+            tracker->update(_trackerHandle, phase, _stream->getBytesReceived() - _stream->getReadBufferSize());
+        }
+    }
+
+    void untrack();
+
     void clearRequestState() {
         _request.reset();
+        _activeRequest = nullptr;
         _requestFinished = false;
+        if (_bodyMemory) {
+            _stream->releaseMemory(_bodyMemory);
+            _bodyMemory = 0;
+        }
         clearCallbacks();
     }
 
-    void onConnectionClose();
+    virtual void onConnectionClose();
 
     void onWriteComplete();
 
     void finishRequest();
 
+    size_t matchHeaders(const Byte *data, size_t length);
+
     void onHeaders(ByteArray data);
 
+    // Reads the body of the request just parsed, if it has one, and dispatches it
+    void beginRequest(std::shared_ptr<HTTPServerRequest> request);
+
+    // Answers the request being read with a bare error response, then drains and closes the connection
+    void reject(int statusCode);
+
+    void writeReject(const std::string &response);
+
     void onRequestBody(ByteArray data);
 
+    void upgradeToHTTP2(size_t prefaceReceived);
+
+    void readBody();
+
+    void onBodyData(ByteArray data);
+
+    void onChunkSize(ByteArray data);
+
+    void onChunkEnd(ByteArray data);
+
+    void onChunkTrailer(ByteArray data);
+
+    void onBodyEnd();
+
+    void readNextRequest();
+
+    void dispatchRequest(std::shared_ptr<HTTPServerRequest> request, size_t bodyMemory);
+
+    void promoteRequest();
+
+    bool canPipeline(const HTTPServerRequest &request) const;
+
+    // Only requests with safe methods may run alongside the responses queued ahead of them
+    static bool isSafeMethod(HTTPRequestParser::StringRefType method) {
+        return method == "GET" || method == "HEAD" || method == "OPTIONS";
+    }
+
+    bool canReadAhead() const {
+        return !_readBlocked && _pipeline.size() < _maxPipelineDepth && _pipelineBufferSize < _maxPipelineBufferSize;
+    }
+
+    // Starts the next request once every earlier response is finished: a request held back by onHeaders or a
+    // rejection delayed by reject. Returns false if there was nothing held back.
+    bool resumeDeferred();
+
+    PipelinedResponse* findPipelined(const HTTPServerRequest *request) {
+        for (auto &response: _pipeline) {
+            if (response.request == request) {
+                return &response;
+            }
+        }
+        return nullptr;
+    }
+
     std::shared_ptr<BaseIOStream> _stream;
     std::string _address;
     RequestCallbackType &_requestCallback;
@@ -198,10 +660,39 @@ protected:
     std::string _protocol;
     std::shared_ptr<HTTPServerRequest> _request;
     std::weak_ptr<HTTPServerRequest> _requestObserver;
+    const HTTPServerRequest *_activeRequest{nullptr};
+    std::shared_ptr<HTTPServerRequest> _pendingRequest;
+    std::deque<PipelinedResponse> _pipeline;
+    size_t _maxPipelineDepth{DEFAULT_MAX_PIPELINE_DEPTH};
+    size_t _maxPipelineBufferSize{DEFAULT_MAX_PIPELINE_BUFFER_SIZE};
+    size_t _pipelineBufferSize{0};
+    std::shared_ptr<HTTPServerRequest> _deferredRequest;
+    std::string _deferredReject;
+    bool _reading{false};
+    bool _readBlocked{false};
+    bool _http2Enabled{false};
+    float _http2SettingsTimeout{DEFAULT_HTTP2_SETTINGS_TIMEOUT};
+    StreamBodyCallbackType _streamBodyCallback;
+    size_t _bodyChunkSize{DEFAULT_BODY_CHUNK_SIZE};
+    std::shared_ptr<HTTPServerRequest> _bodyRequest;
+    BodyState _bodyState{BS_NONE};
+    size_t _bodyRemaining{0};
+    size_t _trailerCount{0};
+    ByteArray _bodyBuffer;
+    bool _bodyPaused{false};
+    bool _bodyReadPending{false};
     bool _requestFinished{false};
+    bool _rejecting{false};
+    size_t _bodyMemory{0};
+    size_t _bodyLength{0};
+    size_t _maxBodySize{0};
+    HTTPRequestParser _parser;
     WriteCallbackType _writeCallback;
     CloseCallbackType _closeCallback;
     HeaderCallbackType _headerCallback;
+    std::weak_ptr<HTTPConnectionTracker> _tracker;
+    HTTPConnectionTracker::HandleType _trackerHandle;
+    HTTPConnectionTracker::Phase _phase{HTTPConnectionTracker::P_IDLE};
 };
 
 
@@ -209,6 +700,8 @@ class HTTPServerRequest {
 public:
     typedef HTTPConnection::WriteCallbackType WriteCallbackType;
     typedef boost::optional<SimpleCookie> CookiesType;
+    typedef std::function<void (ByteArray)> DataCallbackType;
+    typedef std::function<void ()> EndCallbackType;
 
     HTTPServerRequest(const HTTPServerRequest &) = delete;
 
@@ -225,6 +718,13 @@ public:
                       std::string host = {},
                       HTTPFileListMap files = {});
 
+    // Takes over the head parsed by parser; header fields stay views into head until they are first asked for
+    HTTPServerRequest(std::shared_ptr<HTTPConnection> connection,
+                      ByteArray head,
+                      HTTPRequestParser &parser,
+                      std::string remoteIp,
+                      std::string protocol);
+
     ~HTTPServerRequest();
 
     bool supportsHTTP11() const {
@@ -247,8 +747,59 @@ public:
         write((const Byte *)chunk.data(), chunk.length(), std::move(callback));
     }
 
+    // Starts the response; see HTTPConnection::writeHeaders
+    void writeHeaders(int statusCode, const HTTPHeaders &headers, const Byte *data, size_t headLength, size_t length,
+                      WriteCallbackType callback= nullptr);
+
+    void writeHeaders(int statusCode, const HTTPHeaders &headers, const std::string &data, size_t headLength,
+                      WriteCallbackType callback= nullptr) {
+        writeHeaders(statusCode, headers, (const Byte *)data.data(), headLength, data.size(), std::move(callback));
+    }
+
+    bool canWriteFile() const {
+        return _connection && _connection->canWriteFile(this);
+    }
+
+    // Only valid when canWriteFile() is true; plain sockets send the range with sendfile
+    void writeFile(int fd, size_t offset, size_t count, WriteCallbackType callback= nullptr);
+
     void finish();
 
+    void setCloseCallback(HTTPConnection::CloseCallbackType callback);
+
+    void setBodyStreaming(bool bodyStreaming) {
+        _bodyStreaming = bodyStreaming;
+    }
+
+    bool isBodyStreaming() const {
+        return _bodyStreaming;
+    }
+
+    void setBodyCallbacks(DataCallbackType dataCallback, EndCallbackType endCallback);
+
+    void clearBodyCallbacks() {
+        _dataCallback = nullptr;
+        _endCallback = nullptr;
+    }
+
+    void dataReceived(ByteArray chunk) {
+        if (_dataCallback) {
+            _dataCallback(std::move(chunk));
+        }
+    }
+
+    void bodyFinished() {
+        EndCallbackType callback(std::move(_endCallback));
+        clearBodyCallbacks();
+        if (callback) {
+            callback();
+        }
+    }
+
+    void pauseBody();
+
+    void resumeBody();
+
     std::string fullURL() const {
         return _protocol + "://" + _host + _uri;
     }
@@ -256,9 +807,27 @@ public:
     double requestTime() const;
 
     const HTTPHeaders* getHTTPHeaders() const {
+        if (!_headers) {
+            _headers = _headParser.getHTTPHeaders();
+        }
         return _headers.get();
     }
 
+    // Looks a single field up without building HTTPHeaders for the whole head
+    std::string getHeader(HTTPHeaderField field, const std::string &defaultValue="") const {
+        if (_headers) {
+            return _headers->get(field, defaultValue);
+        }
+        return _headParser.getHeaderString(HTTPHeaders::getFieldName(field), defaultValue);
+    }
+
+    bool hasHeader(HTTPHeaderField field) const {
+        if (_headers) {
+            return _headers->has(field);
+        }
+        return _headParser.hasHeader(HTTPHeaders::getFieldName(field));
+    }
+
     const std::string& getMethod() const {
         return _method;
     }
@@ -273,6 +842,8 @@ public:
 
     void setBody(std::string body) {
         _body = std::move(body);
+        _bodyParsed = false;
+        _argumentsMerged = false;
     }
 
     const std::string& getBody() const {
@@ -292,6 +863,7 @@ public:
     }
 
     const HTTPFileListMap& getFiles() const {
+        parseBodyArguments();
         return _files;
     }
 
@@ -311,16 +883,24 @@ public:
         return _query;
     }
 
+    // Query and body arguments merged into one map, built on first use. Single lookups should prefer
+    // hasArgument/getLastArgument/getArgumentValues, which read the two sources directly.
     QueryArgListMap& arguments() {
-        return _arguments;
+        return mergeArguments();
     }
 
     const QueryArgListMap& getArguments() const {
-        return _arguments;
+        return mergeArguments();
     }
 
+    bool hasArgument(const std::string &name) const;
+
+    const std::string* getLastArgument(const std::string &name) const;
+
+    StringVector getArgumentValues(const std::string &name) const;
+
     void addArgument(const std::string &name, std::string value) {
-        _arguments[name].emplace_back(std::move(value));
+        mergeArguments()[name].emplace_back(std::move(value));
     }
 
     void addArguments(const std::string &name, StringVector values) {
@@ -330,22 +910,27 @@ public:
     }
 
     QueryArgListMap& queryArguments() {
+        parseQueryArguments();
         return _queryArguments;
     }
 
     const QueryArgListMap& getQueryArguments() const {
+        parseQueryArguments();
         return _queryArguments;
     }
 
     QueryArgListMap& bodyArguments() {
+        parseBodyArguments();
         return _bodyArguments;
     }
 
     const QueryArgListMap& getBodyArguments() const {
+        parseBodyArguments();
         return _bodyArguments;
     }
 
     HTTPFileListMap& files() {
+        parseBodyArguments();
         return _files;
     }
 
@@ -357,27 +942,49 @@ public:
 
     template <typename ...Args>
     static std::shared_ptr<HTTPServerRequest> create(Args&& ...args) {
-        return std::make_shared<HTTPServerRequest>(std::forward<Args>(args)...);
+        return makePooledShared<HTTPServerRequest>(std::forward<Args>(args)...);
     }
 protected:
+    void init(const std::shared_ptr<HTTPConnection> &connection, std::string remoteIp, std::string protocol,
+              std::string host);
+
+    void parseQueryArguments() const {
+        if (!_queryParsed) {
+            _queryParsed = true;
+            _queryArguments = URLParse::parseQS(_query, true);
+        }
+    }
+
+    void parseBodyArguments() const;
+
+    QueryArgListMap& mergeArguments() const;
+
     std::string _method;
     std::string _uri;
     std::string _version;
-    std::unique_ptr<HTTPHeaders> _headers;
+    ByteArray _head;
+    HTTPRequestParser _headParser;
+    mutable std::unique_ptr<HTTPHeaders> _headers;
     std::string _body;
     std::string _remoteIp;
     std::string _protocol;
     std::string _host;
-    HTTPFileListMap _files;
+    mutable HTTPFileListMap _files;
     std::shared_ptr<HTTPConnection> _connection;
     Timestamp _startTime;
     Timestamp _finishTime;
     std::string _path;
     std::string _query;
-    QueryArgListMap _arguments;
-    QueryArgListMap _queryArguments;
-    QueryArgListMap _bodyArguments;
+    mutable QueryArgListMap _arguments;
+    mutable QueryArgListMap _queryArguments;
+    mutable QueryArgListMap _bodyArguments;
+    mutable bool _queryParsed{false};
+    mutable bool _bodyParsed{false};
+    mutable bool _argumentsMerged{false};
     mutable CookiesType _cookies;
+    bool _bodyStreaming{false};
+    DataCallbackType _dataCallback;
+    EndCallbackType _endCallback;
 };
 
 
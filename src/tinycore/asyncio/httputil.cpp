@@ -4,44 +4,79 @@
 
 #include "tinycore/asyncio/httputil.h"
 #include <boost/algorithm/string.hpp>
+#include <boost/utility/string_ref.hpp>
 #include "tinycore/asyncio/logutil.h"
+#include "tinycore/asyncio/multipart.h"
 #include "tinycore/common/errors.h"
 #include "tinycore/utilities/string.h"
 
 
-const boost::regex HTTPHeaders::_normalizedHeader("^[A-Z0-9][a-z0-9]*(-[A-Z0-9][a-z0-9]*)*$");
-
-void HTTPHeaders::add(const std::string &name, const std::string &value) {
-    std::string normName = normalizeName(name);
-    _lastKey = normName;
-    if (has(normName)) {
-        _items[normName] += ',' + value;
-        _asList[normName].emplace_back(value);
-    } else {
-        (*this)[normName] = value;
-    }
+static const std::array<std::string, (size_t)HTTPHeaderField::UNKNOWN + 1>& getHeaderFieldNames() {
+    static const std::array<std::string, (size_t)HTTPHeaderField::UNKNOWN + 1> names = {
+            "Accept",
+            "Accept-Encoding",
+            "Accept-Language",
+            "Authorization",
+            "Cache-Control",
+            "Connection",
+            "Content-Encoding",
+            "Content-Length",
+            "Content-Type",
+            "Cookie",
+            "Date",
+            "Etag",
+            "Expect",
+            "Host",
+            "If-Modified-Since",
+            "If-None-Match",
+            "Last-Modified",
+            "Location",
+            "Origin",
+            "Sec-Websocket-Accept",
+            "Sec-Websocket-Key",
+            "Sec-Websocket-Protocol",
+            "Sec-Websocket-Version",
+            "Server",
+            "Set-Cookie",
+            "Transfer-Encoding",
+            "Upgrade",
+            "User-Agent",
+            "Vary",
+            "X-Forwarded-For",
+            "X-Forwarded-Proto",
+            "X-Real-Ip",
+            "X-Scheme",
+            "",
+    };
+    return names;
 }
 
-StringVector HTTPHeaders::getList(const std::string &name) const {
-    std::string normName = normalizeName(name);
-    auto iter = _asList.find(normName);
-    if (iter != _asList.end()) {
-        return iter->second;
-    } else {
-        return {};
+
+static inline bool iequals(const std::string &lhs, const std::string &rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
     }
+    for (size_t i = 0; i != lhs.size(); ++i) {
+        if (std::tolower((unsigned char)lhs[i]) != std::tolower((unsigned char)rhs[i])) {
+            return false;
+        }
+    }
+    return true;
 }
 
+
 void HTTPHeaders::parseLine(const std::string &line) {
     ASSERT(!line.empty());
     if (std::isspace(line[0])) {
+        if (_lastIndex >= _entries.size()) {
+            ThrowException(KeyError, "No header to continue");
+        }
         std::string newPart = " " + boost::trim_left_copy(line);
-        auto &asList = _asList.at(_lastKey);
-        if (asList.empty()) {
-            ThrowException(IndexError, "list index out of range");
+        Entry &entry = _entries[_lastIndex];
+        if (!entry.values.empty()) {
+            entry.values.back() += newPart;
         }
-        asList.back() += newPart;
-        _items.at(_lastKey) += newPart;
+        entry.value += newPart;
     } else {
         size_t pos = line.find(':');
         if (pos == 0 || pos == std::string::npos) {
@@ -54,25 +89,6 @@ void HTTPHeaders::parseLine(const std::string &line) {
     }
 }
 
-void HTTPHeaders::erase(const std::string &name) {
-    std::string normName = HTTPHeaders::normalizeName(name);
-    if (!has(normName)) {
-        ThrowException(KeyError, normName);
-    }
-    _items.erase(normName);
-    _asList.erase(normName);
-}
-
-std::string HTTPHeaders::get(const std::string &name, const std::string &defaultValue) const {
-    std::string normName = HTTPHeaders::normalizeName(name);
-    auto iter = _items.find(normName);
-    if (iter != _items.end()) {
-        return iter->second;
-    } else {
-        return defaultValue;
-    }
-}
-
 void HTTPHeaders::parseLines(const std::string &headers) {
     StringVector lines = String::splitLines(headers);
     for (auto &line: lines) {
@@ -82,32 +98,150 @@ void HTTPHeaders::parseLines(const std::string &headers) {
     }
 }
 
+void HTTPHeaders::serialize(std::string &buffer) const {
+    for (auto &entry: _entries) {
+        if (entry.values.empty()) {
+            buffer.append(entry.name);
+            buffer.append(": ", 2);
+            buffer.append(entry.value);
+            buffer.append("\r\n", 2);
+        } else {
+            for (auto &value: entry.values) {
+                buffer.append(entry.name);
+                buffer.append(": ", 2);
+                buffer.append(value);
+                buffer.append("\r\n", 2);
+            }
+        }
+    }
+}
+
 std::string HTTPHeaders::toString() const {
     std::string headers = "{";
-    for (auto &nameValue: _items) {
+    for (auto &entry: _entries) {
         if (headers.size() == 1) {
             headers.append(1, '\'');
         } else {
             headers.append(", \'");
         }
-        headers.append(nameValue.first);
+        headers.append(entry.name);
         headers.append("\': \'");
-        headers.append(nameValue.second);
-        headers.append(", \'");
+        headers.append(entry.value);
+        headers.append(1, '\'');
     }
     headers.append(1, '}');
     return headers;
 }
 
+const std::string& HTTPHeaders::getFieldName(HTTPHeaderField field) {
+    return getHeaderFieldNames()[(size_t)field];
+}
+
+size_t HTTPHeaders::find(const std::string &name) const {
+    size_t hash = hashName(name), index = 0;
+    for (; index != _entries.size(); ++index) {
+        if (_entries[index].hash == hash && iequals(_entries[index].name, name)) {
+            break;
+        }
+    }
+    return index;
+}
+
+size_t HTTPHeaders::findOrCreate(const std::string &name) {
+    size_t hash = hashName(name), index = 0;
+    for (; index != _entries.size(); ++index) {
+        if (_entries[index].hash == hash && iequals(_entries[index].name, name)) {
+            return index;
+        }
+    }
+    HTTPHeaderField field = lookupField(name, hash);
+    _entries.push_back({field != HTTPHeaderField::UNKNOWN ? getFieldName(field) : normalizeName(name), {}, {}, hash,
+                        field});
+    return index;
+}
+
+size_t HTTPHeaders::findOrCreate(HTTPHeaderField field) {
+    size_t index = find(field);
+    if (index == _entries.size()) {
+        const std::string &name = getFieldName(field);
+        _entries.push_back({name, {}, {}, hashName(name), field});
+    }
+    return index;
+}
+
+void HTTPHeaders::addValue(size_t index, const std::string &value, size_t count) {
+    Entry &entry = _entries[index];
+    if (index == count) {
+        entry.value = value;
+    } else {
+        if (entry.values.empty()) {
+            entry.values.emplace_back(entry.value);
+        }
+        entry.values.emplace_back(value);
+        entry.value += ',';
+        entry.value += value;
+    }
+    _lastIndex = index;
+}
+
+StringVector HTTPHeaders::getList(size_t index) const {
+    if (index == _entries.size()) {
+        return {};
+    }
+    const Entry &entry = _entries[index];
+    if (entry.values.empty()) {
+        return {entry.value, };
+    }
+    return entry.values;
+}
+
+const std::string& HTTPHeaders::at(size_t index, const std::string &name) const {
+    if (index == _entries.size()) {
+        ThrowException(KeyError, name);
+    }
+    return _entries[index].value;
+}
+
+void HTTPHeaders::erase(size_t index, const std::string &name) {
+    if (index == _entries.size()) {
+        ThrowException(KeyError, name);
+    }
+    _entries.erase(_entries.begin() + index);
+    _lastIndex = std::numeric_limits<size_t>::max();
+}
+
+size_t HTTPHeaders::hashName(const std::string &name) {
+    size_t hash = 2166136261u;
+    for (auto c: name) {
+        hash = (hash ^ (size_t)std::tolower((unsigned char)c)) * 16777619u;
+    }
+    return hash;
+}
+
+HTTPHeaderField HTTPHeaders::lookupField(const std::string &name, size_t hash) {
+    static const std::array<size_t, (size_t)HTTPHeaderField::UNKNOWN> hashes = []() {
+        std::array<size_t, (size_t)HTTPHeaderField::UNKNOWN> hashes{};
+        for (size_t i = 0; i != hashes.size(); ++i) {
+            hashes[i] = hashName(getHeaderFieldNames()[i]);
+        }
+        return hashes;
+    }();
+    for (size_t i = 0; i != hashes.size(); ++i) {
+        if (hashes[i] == hash && iequals(getHeaderFieldNames()[i], name)) {
+            return (HTTPHeaderField)i;
+        }
+    }
+    return HTTPHeaderField::UNKNOWN;
+}
+
 std::string HTTPHeaders::normalizeName(const std::string &name) {
-//    if (boost::regex_match(name, HTTPHeaders::_normalizedHeader)) {
-//        return name;
-//    }
-    StringVector nameParts = String::split(name, '-');
-    for (auto &namePart: nameParts) {
-        String::capitalize(namePart);
+    std::string normName(name);
+    bool upper = true;
+    for (auto &c: normName) {
+        c = upper ? (char)std::toupper((unsigned char)c) : (char)std::tolower((unsigned char)c);
+        upper = c == '-';
     }
-    return boost::join(nameParts, "-");
+    return normName;
 }
 
 void HTTPUtil::parseBodyArguments(const std::string &contentType, const std::string &body, QueryArgListMap &arguments,
@@ -127,19 +261,10 @@ void HTTPUtil::parseBodyArguments(const std::string &contentType, const std::str
             }
         }
     } else if (boost::starts_with(contentType, "multipart/form-data")) {
-        StringVector fields = String::split(contentType, ';');
-        bool found = false;
-        std::string k, sep, v;
-        for (auto &field: fields) {
-            boost::trim(field);
-            std::tie(k, sep, v) = String::partition(field, "=");
-            if (k == "boundary" && !v.empty()) {
-                HTTPUtil::parseMultipartFormData(std::move(v), body, arguments, files);
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
+        std::string boundary = MultipartParser::getBoundary(contentType);
+        if (!boundary.empty()) {
+            HTTPUtil::parseMultipartFormData(std::move(boundary), body, arguments, files);
+        } else {
             LOG_WARNING(gGenLog, "Invalid multipart/form-data");
         }
     }
@@ -147,59 +272,22 @@ void HTTPUtil::parseBodyArguments(const std::string &contentType, const std::str
 
 void HTTPUtil::parseMultipartFormData(std::string boundary, const std::string &data, QueryArgListMap &arguments,
                                       HTTPFileListMap &files) {
-    if (boost::starts_with(boundary, "\"") && boost::ends_with(boundary, "\"")) {
-        if (boundary.length() >= 2) {
-            boundary = boundary.substr(1, boundary.length() - 2);
-        } else {
-            boundary.clear();
-        }
-    }
-    size_t finalBoundaryIndex = data.rfind("--" + boundary + "--");
-    if (finalBoundaryIndex == std::string::npos) {
-        LOG_WARNING(gGenLog, "Invalid multipart/form-data: no final boundary");
+    QueryArgListMap partArguments;
+    HTTPFileListMap partFiles;
+    MultipartParser parser(std::move(boundary), partArguments, partFiles, 0);
+    parser.feed(data);
+    if (!parser.finish()) {
         return;
     }
-    StringVector parts = String::split(data.substr(0, finalBoundaryIndex), "--" + boundary + "\r\n");
-    size_t eoh;
-    HTTPHeaders headers;
-    std::string dispHeader, disposition, name, value, ctype;
-    StringMap dispParams;
-    decltype(dispParams.begin()) nameIter, fileNameIter;
-    for (auto &part: parts) {
-        if (part.empty()) {
-            continue;
-        }
-        eoh = part.find("\r\n\r\n");
-        if (eoh == std::string::npos) {
-            LOG_WARNING(gGenLog, "multipart/form-data missing headers");
-            continue;
-        }
-        headers.clear();
-        headers.parseLines(part.substr(0, eoh));
-        dispHeader = headers.get("Content-Disposition");
-        std::tie(disposition, dispParams) = parseHeader(dispHeader);
-        if (disposition != "form-data" || !boost::ends_with(part, "\r\n")) {
-            LOG_WARNING(gGenLog, "Invalid multipart/form-data");
-            continue;
-        }
-        if (part.length() <= eoh + 6) {
-            value.clear();
-        } else {
-            value = part.substr(eoh + 4, part.length() - eoh - 6);
-        }
-        nameIter = dispParams.find("name");
-        if (nameIter == dispParams.end()) {
-            LOG_WARNING(gGenLog, "multipart/form-data value missing name");
-            continue;
-        }
-        name = nameIter->second;
-        fileNameIter = dispParams.find("filename");
-        if (fileNameIter != dispParams.end()) {
-            ctype = headers.get("Content-Type", "application/unknown");
-            files[name].emplace_back(HTTPFile(std::move(fileNameIter->second), std::move(ctype), std::move(value)));
-        } else {
-            arguments[name].emplace_back(std::move(value));
-        }
+    for (auto &nv: partArguments) {
+        auto &values = arguments[nv.first];
+        values.insert(values.end(), std::make_move_iterator(nv.second.begin()),
+                      std::make_move_iterator(nv.second.end()));
+    }
+    for (auto &nv: partFiles) {
+        auto &values = files[nv.first];
+        values.insert(values.end(), std::make_move_iterator(nv.second.begin()),
+                      std::make_move_iterator(nv.second.end()));
     }
 }
 
@@ -211,6 +299,49 @@ void HTTPUtil::parseMultipartFormData(std::string boundary, const std::string &d
 //    return ss.str();
 //}
 
+bool HTTPUtil::etagMatches(const std::string &ifNoneMatch, const std::string &etag) {
+    if (etag.empty()) {
+        return false;
+    }
+    boost::string_ref target(etag);
+    if (target.starts_with("W/")) {
+        target.remove_prefix(2);
+    }
+    size_t pos = 0, size = ifNoneMatch.size();
+    while (pos < size) {
+        char c = ifNoneMatch[pos];
+        if (c == ' ' || c == '\t' || c == ',') {
+            ++pos;
+            continue;
+        }
+        if (c == '*') {
+            return true;
+        }
+        if (ifNoneMatch.compare(pos, 2, "W/") == 0) {
+            pos += 2;
+        }
+        size_t start = pos, end;
+        if (pos < size && ifNoneMatch[pos] == '"') {
+            end = ifNoneMatch.find('"', pos + 1);
+            if (end == std::string::npos) {
+                return false;
+            }
+            pos = ++end;
+        } else {
+            // Unquoted tags are not valid, but compare them as sent
+            end = std::min(ifNoneMatch.find(',', pos), size);
+            pos = end;
+            while (end > start && (ifNoneMatch[end - 1] == ' ' || ifNoneMatch[end - 1] == '\t')) {
+                --end;
+            }
+        }
+        if (target == boost::string_ref(ifNoneMatch.data() + start, end - start)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 StringVector HTTPUtil::parseParam(std::string s) {
     StringVector parts;
     size_t end;
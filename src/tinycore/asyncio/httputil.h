@@ -13,10 +13,47 @@
 #include "tinycore/httputils/urlparse.h"
 
 
+enum class HTTPHeaderField: unsigned char {
+    ACCEPT,
+    ACCEPT_ENCODING,
+    ACCEPT_LANGUAGE,
+    AUTHORIZATION,
+    CACHE_CONTROL,
+    CONNECTION,
+    CONTENT_ENCODING,
+    CONTENT_LENGTH,
+    CONTENT_TYPE,
+    COOKIE,
+    DATE,
+    ETAG,
+    EXPECT,
+    HOST,
+    IF_MODIFIED_SINCE,
+    IF_NONE_MATCH,
+    LAST_MODIFIED,
+    LOCATION,
+    ORIGIN,
+    SEC_WEBSOCKET_ACCEPT,
+    SEC_WEBSOCKET_KEY,
+    SEC_WEBSOCKET_PROTOCOL,
+    SEC_WEBSOCKET_VERSION,
+    SERVER,
+    SET_COOKIE,
+    TRANSFER_ENCODING,
+    UPGRADE,
+    USER_AGENT,
+    VARY,
+    X_FORWARDED_FOR,
+    X_FORWARDED_PROTO,
+    X_REAL_IP,
+    X_SCHEME,
+    UNKNOWN,
+};
+
+
 class HTTPHeaders {
 public:
     typedef std::pair<std::string, std::string> NameValueType;
-    typedef std::map<std::string, StringVector> HeadersContainerType;
     typedef std::function<void (const std::string&, const std::string&)> CallbackType;
 
     class HTTPHeadersSetter {
@@ -28,7 +65,7 @@ public:
 
         HTTPHeadersSetter& operator=(const std::string &value) {
             *_value = value;
-            *_values = {value, };
+            _values->clear();
             return *this;
         }
 
@@ -50,14 +87,32 @@ public:
         update(nameValues);
     }
 
-    void add(const std::string &name, const std::string &value);
-    
-    StringVector getList(const std::string &name) const;
+    void add(const std::string &name, const std::string &value) {
+        size_t count = _entries.size();
+        addValue(findOrCreate(name), value, count);
+    }
+
+    void add(HTTPHeaderField field, const std::string &value) {
+        size_t count = _entries.size();
+        addValue(findOrCreate(field), value, count);
+    }
+
+    StringVector getList(const std::string &name) const {
+        return getList(find(name));
+    }
+
+    StringVector getList(HTTPHeaderField field) const {
+        return getList(find(field));
+    }
 
     void getAll(const CallbackType &callback) const {
-        for (auto &name: _asList) {
-            for (auto &value: name.second) {
-                callback(name.first, value);
+        for (auto &entry: _entries) {
+            if (entry.values.empty()) {
+                callback(entry.name, entry.value);
+            } else {
+                for (auto &value: entry.values) {
+                    callback(entry.name, value);
+                }
             }
         }
     }
@@ -65,21 +120,48 @@ public:
     void parseLine(const std::string &line);
 
     HTTPHeadersSetter operator[](const std::string &name) {
-        std::string normName = HTTPHeaders::normalizeName(name);
-        return {&_items[normName], &_asList[normName]};
+        Entry &entry = _entries[findOrCreate(name)];
+        return {&entry.value, &entry.values};
+    }
+
+    HTTPHeadersSetter operator[](HTTPHeaderField field) {
+        Entry &entry = _entries[findOrCreate(field)];
+        return {&entry.value, &entry.values};
     }
 
     bool has(const std::string &name) const {
-        std::string normName = HTTPHeaders::normalizeName(name);
-        return _items.find(name) != _items.end();
+        return find(name) != _entries.size();
+    }
+
+    bool has(HTTPHeaderField field) const {
+        return find(field) != _entries.size();
     }
 
     const std::string& at(const std::string &name) const {
-        return _items.at(HTTPHeaders::normalizeName(name));
+        return at(find(name), name);
+    }
+
+    const std::string& at(HTTPHeaderField field) const {
+        return at(find(field), getFieldName(field));
+    }
+
+    void erase(const std::string &name) {
+        erase(find(name), name);
+    }
+
+    void erase(HTTPHeaderField field) {
+        erase(find(field), getFieldName(field));
     }
 
-    void erase(const std::string &name);
-    std::string get(const std::string &name, const std::string &defaultValue="") const;
+    std::string get(const std::string &name, const std::string &defaultValue="") const {
+        size_t index = find(name);
+        return index != _entries.size() ? _entries[index].value : defaultValue;
+    }
+
+    std::string get(HTTPHeaderField field, const std::string &defaultValue="") const {
+        size_t index = find(field);
+        return index != _entries.size() ? _entries[index].value : defaultValue;
+    }
 
     void update(std::initializer_list<NameValueType> nameValues) {
         for(auto &nameValue: nameValues) {
@@ -94,12 +176,19 @@ public:
     }
 
     void clear() {
-        _items.clear();
-        _asList.clear();
+        _entries.clear();
+        _lastIndex = std::numeric_limits<size_t>::max();
+    }
+
+    size_t size() const {
+        return _entries.size();
     }
 
     void parseLines(const std::string &headers);
 
+    // Appends every field as "Name: value\r\n" to the buffer
+    void serialize(std::string &buffer) const;
+
     std::string toString() const;
 
     static std::unique_ptr<HTTPHeaders> parse(const std::string &headers) {
@@ -112,13 +201,47 @@ public:
     static std::unique_ptr<HTTPHeaders> create(Args&& ...args) {
         return make_unique<HTTPHeaders>(std::forward<Args>(args)...);
     }
+
+    static const std::string& getFieldName(HTTPHeaderField field);
+
+    static HTTPHeaderField lookupField(const std::string &name) {
+        return lookupField(name, hashName(name));
+    }
 protected:
+    struct Entry {
+        std::string name;
+        std::string value;
+        // Only filled in once a second value is added; value then holds the comma joined list
+        StringVector values;
+        size_t hash;
+        HTTPHeaderField field;
+    };
+
+    size_t find(const std::string &name) const;
+
+    size_t find(HTTPHeaderField field) const {
+        size_t index = 0;
+        for (; index != _entries.size(); ++index) {
+            if (_entries[index].field == field) {
+                break;
+            }
+        }
+        return index;
+    }
+
+    size_t findOrCreate(const std::string &name);
+    size_t findOrCreate(HTTPHeaderField field);
+    void addValue(size_t index, const std::string &value, size_t count);
+    StringVector getList(size_t index) const;
+    const std::string& at(size_t index, const std::string &name) const;
+    void erase(size_t index, const std::string &name);
+
+    static size_t hashName(const std::string &name);
+    static HTTPHeaderField lookupField(const std::string &name, size_t hash);
     static std::string normalizeName(const std::string &name);
 
-    StringMap _items;
-    HeadersContainerType _asList;
-    std::string _lastKey;
-    static const boost::regex _normalizedHeader;
+    std::vector<Entry> _entries;
+    size_t _lastIndex{std::numeric_limits<size_t>::max()};
 };
 
 
@@ -126,10 +249,14 @@ class HTTPFile {
 public:
     HTTPFile(std::string fileName,
              std::string contentType,
-             std::string body)
+             std::string body,
+             std::shared_ptr<const std::string> tempPath=nullptr,
+             size_t size=0)
             : _fileName(std::move(fileName))
             , _contentType(std::move(contentType))
-            , _body(std::move(body)) {
+            , _body(std::move(body))
+            , _tempPath(std::move(tempPath))
+            , _size(_tempPath ? size : _body.size()) {
 
     }
 
@@ -144,10 +271,26 @@ public:
     const std::string& getBody() const {
         return _body;
     }
+
+    bool isInMemory() const {
+        return !_tempPath;
+    }
+
+    // The temporary file is removed once the last copy of this HTTPFile goes away
+    const std::string& getTempPath() const {
+        ASSERT(_tempPath);
+        return *_tempPath;
+    }
+
+    size_t getSize() const {
+        return _size;
+    }
 protected:
     std::string _fileName;
     std::string _contentType;
     std::string _body;
+    std::shared_ptr<const std::string> _tempPath;
+    size_t _size;
 };
 
 
@@ -156,6 +299,8 @@ using HTTPFileListMap = std::map<std::string, std::vector<HTTPFile>>;
 
 class HTTPUtil {
 public:
+    friend class MultipartParser;
+
     template <typename ArgsType>
     static std::string urlConcat(std::string url, const ArgsType &args) {
         if (args.empty()) {
@@ -183,7 +328,7 @@ public:
     }
 
     static std::string formatTimestamp(time_t ts) {
-        return formatTimestamp(boost::posix_time::from_time_t(ts));
+        return String::formatUTCDate(ts, true);
     }
 
     static std::string formatTimestamp(const tm &ts) {
@@ -193,6 +338,9 @@ public:
     static std::string getHTTPReason(int statusCode) {
         return HTTP_RESPONSES.find(statusCode) != HTTP_RESPONSES.end() ? HTTP_RESPONSES.at(statusCode) : "Unknown";
     }
+
+    // Whether etag weakly matches one of the entity tags listed in an If-None-Match value; "*" matches any
+    static bool etagMatches(const std::string &ifNoneMatch, const std::string &etag);
 protected:
     static StringVector parseParam(std::string s);
     static std::tuple<std::string, StringMap> parseHeader(const std::string &line);
@@ -5,6 +5,7 @@
 #include "tinycore/asyncio/ioloop.h"
 #include "tinycore/common/errors.h"
 #include "tinycore/debugging/watcher.h"
+#include "tinycore/utilities/string.h"
 
 
 _SignalSet::_SignalSet(IOLoop *ioloop)
@@ -140,6 +141,15 @@ void IOLoop::addCallback(CallbackType callback) {
     _ioService.post(std::move(callback));
 }
 
+const std::string& IOLoop::getHTTPDate() {
+    time_t now = time(nullptr);
+    if (now != _httpDateTime) {
+        _httpDateTime = now;
+        _httpDate = String::formatUTCDate(now, true);
+    }
+    return _httpDate;
+}
+
 void IOLoop::runSync(CallbackType func, const Timestamp &deadline) {
     auto timeout = addTimeout(deadline, [this](){
         stop();
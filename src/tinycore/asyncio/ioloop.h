@@ -14,6 +14,7 @@
 
 
 class IOLoop;
+class MemoryAccountant;
 
 class _SignalSet {
 public:
@@ -130,6 +131,17 @@ public:
         return _ioService;
     }
 
+    void setMemoryAccountant(std::shared_ptr<MemoryAccountant> memoryAccountant) {
+        _memoryAccountant = std::move(memoryAccountant);
+    }
+
+    const std::shared_ptr<MemoryAccountant>& getMemoryAccountant() const {
+        return _memoryAccountant;
+    }
+
+    // Value for the HTTP Date header, formatted at most once per second for all responses served by this loop
+    const std::string& getHTTPDate();
+
     static IOLoop * current() {
         return _current;
     }
@@ -144,6 +156,9 @@ protected:
     ServiceType _ioService;
     _SignalSet _signalSet;
     volatile bool _stopped{false};
+    std::shared_ptr<MemoryAccountant> _memoryAccountant;
+    time_t _httpDateTime{0};
+    std::string _httpDate;
     thread_local static IOLoop *_current;
 };
 
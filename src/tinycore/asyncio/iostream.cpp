@@ -3,6 +3,10 @@
 //
 
 #include "tinycore/asyncio/iostream.h"
+#include <unistd.h>
+#if PLATFORM == PLATFORM_UNIX
+#include <sys/sendfile.h>
+#endif
 #include "tinycore/asyncio/httpserver.h"
 #include "tinycore/asyncio/ioloop.h"
 #include "tinycore/asyncio/logutil.h"
@@ -14,18 +18,25 @@ BaseIOStream::BaseIOStream(SocketType &&socket, IOLoop *ioloop, size_t maxBuffer
         : _socket(std::move(socket))
         , _ioloop(ioloop ? ioloop : IOLoop::current())
         , _maxBufferSize(maxBufferSize ? maxBufferSize : DEFAULT_MAX_BUFFER_SIZE)
-        , _readBuffer(readChunkSize) {
+        , _readBuffer(readChunkSize)
+        , _memoryAccountant(_ioloop->getMemoryAccountant()) {
 
 }
 
 
 BaseIOStream::~BaseIOStream() {
-
+    if (_memoryAccountant) {
+        _memoryAccountant->adjust(_memoryUsage.load(), 0);
+        if (_memoryTracked) {
+            _memoryAccountant->untrack(this);
+        }
+    }
 }
 
 void BaseIOStream::clearCallbacks() {
     _readCallback = nullptr;
     _streamingCallback = nullptr;
+    _readMatcher = nullptr;
     _writeCallback = nullptr;
     _closeCallback = nullptr;
     _connectCallback = nullptr;
@@ -43,9 +54,17 @@ void BaseIOStream::readUntilRegex(const std::string &regex, ReadCallbackType cal
     tryInlineRead();
 }
 
-void BaseIOStream::readUntil(std::string delimiter, ReadCallbackType callback) {
+void BaseIOStream::readUntil(std::string delimiter, ReadCallbackType callback, size_t maxBytes) {
     setReadCallback(std::move(callback));
     _readDelimiter = std::move(delimiter);
+    _readDelimiterScanned = 0;
+    _readMaxBytes = maxBytes;
+    tryInlineRead();
+}
+
+void BaseIOStream::readUntilMatch(MatcherType matcher, ReadCallbackType callback) {
+    setReadCallback(std::move(callback));
+    _readMatcher = std::move(matcher);
     tryInlineRead();
 }
 
@@ -113,6 +132,8 @@ void BaseIOStream::write(const Byte *data, size_t length,  WriteCallbackType cal
             packet.write(data, length);
             _writeQueue.push_back(std::move(packet));
         }
+        _writeQueueBytes += length;
+        updateMemoryUsage();
     }
     _writeCallback = StackContext::wrap(std::move(callback));
     if (!_connecting) {
@@ -127,6 +148,24 @@ void BaseIOStream::write(const Byte *data, size_t length,  WriteCallbackType cal
     }
 }
 
+void BaseIOStream::writeFile(int fd, size_t offset, size_t count, WriteCallbackType callback) {
+    constexpr size_t WRITE_FILE_CHUNK_SIZE = 128 * 1024;
+    // Without sendfile the range goes through the write queue one chunk at a time
+    ByteArray chunk(std::min(count, WRITE_FILE_CHUNK_SIZE));
+    ssize_t bytesRead = chunk.empty() ? 0 : ::pread(fd, chunk.data(), chunk.size(), (off_t)offset);
+    if (bytesRead < 0 || (bytesRead == 0 && count != 0)) {
+        ThrowException(IOError, "Read file failed: " + std::to_string(errno));
+    }
+    size_t length = (size_t)bytesRead;
+    if (length == count) {
+        write(chunk.data(), length, std::move(callback));
+    } else {
+        write(chunk.data(), length, [this, fd, offset, length, count, callback]() {
+            writeFile(fd, offset + length, count - length, callback);
+        });
+    }
+}
+
 void BaseIOStream::setCloseCallback(CloseCallbackType callback) {
     _closeCallback = StackContext::wrap(std::move(callback));
 }
@@ -171,6 +210,40 @@ void BaseIOStream::close(std::exception_ptr error) {
     }
 }
 
+void BaseIOStream::closeAfterDrain(float linger) {
+    if (closed()) {
+        return;
+    }
+    if (writing()) {
+        auto self = shared_from_this();
+        _writeCallback = [this, self, linger]() {
+            closeAfterDrain(linger);
+        };
+        return;
+    }
+    boost::system::error_code ec;
+    _socket.shutdown(boost::asio::socket_base::shutdown_send, ec);
+    if (ec) {
+        close();
+        return;
+    }
+    _readCallback = nullptr;
+    _streamingCallback = nullptr;
+    _readDelimiter = boost::none;
+    _readMatcher = nullptr;
+    _readRegex = boost::none;
+    _readBytes = boost::none;
+    _readBuffer.readCompleted(_readBuffer.getActiveSize());
+    std::weak_ptr<BaseIOStream> stream = shared_from_this();
+    _ioloop->addTimeout(linger, [stream]() {
+        auto self = stream.lock();
+        if (self) {
+            self->close();
+        }
+    });
+    readUntilClose([](ByteArray data) {}, [](ByteArray data) {});
+}
+
 void BaseIOStream::onConnect(const boost::system::error_code &ec) {
     _state &= ~S_WRITE;
     if (ec) {
@@ -218,7 +291,7 @@ void BaseIOStream::onRead(const boost::system::error_code &ec, size_t transferre
         return;
     }
     if (reading()) {
-        readFromSocket();
+        maybeReadFromSocket();
     } else {
         maybeAddErrorListener();
     }
@@ -241,6 +314,8 @@ void BaseIOStream::onWrite(const boost::system::error_code &ec, size_t transferr
         if (!_writeQueue.front().getActiveSize()) {
             _writeQueue.pop_front();
         }
+        _writeQueueBytes -= std::min(transferredBytes, _writeQueueBytes);
+        updateMemoryUsage();
     }
     if (_writeQueue.empty() && _writeCallback) {
         WriteCallbackType callback;
@@ -279,6 +354,7 @@ void BaseIOStream::maybeRunCloseCallback() {
             clearCallbacks();
         } else {
             _readCallback = nullptr;
+            _readMatcher = nullptr;
             _writeCallback = nullptr;
         }
         _writeQueue.clear();
@@ -326,6 +402,28 @@ void BaseIOStream::runCallback(CallbackType callback) {
     _ioloop->addCallback(std::bind(&Wrapper1::operator(), std::move(op)));
 }
 
+std::vector<BaseIOStream::EndPointType> BaseIOStream::resolve(const std::string &address, unsigned short port,
+                                                              boost::system::error_code &ec) {
+    std::vector<EndPointType> endpoints;
+    if (NetUtil::isUnixAddress(address)) {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        endpoints.emplace_back(NetUtil::makeUnixEndPoint(address));
+#else
+        ec = boost::asio::error::operation_not_supported;
+#endif
+        return endpoints;
+    }
+    ResolverType resolver(_ioloop->getService());
+    ResolverType::query query(address, std::to_string(port));
+    auto iter = resolver.resolve(query, ec);
+    if (!ec) {
+        for (; iter != ResolverIterator(); ++iter) {
+            endpoints.emplace_back(iter->endpoint());
+        }
+    }
+    return endpoints;
+}
+
 size_t BaseIOStream::readToBuffer(const boost::system::error_code &ec, size_t transferredBytes) {
     if (ec) {
         if (ec != boost::asio::error::operation_aborted) {
@@ -339,6 +437,8 @@ size_t BaseIOStream::readToBuffer(const boost::system::error_code &ec, size_t tr
         return 0;
     }
     _readBuffer.writeCompleted(transferredBytes);
+    _bytesReceived += transferredBytes;
+    updateMemoryUsage();
     if (_readBuffer.getBufferSize() > _maxBufferSize) {
         LOG_ERROR(gGenLog, "Reached maximum read buffer size");
         close();
@@ -388,9 +488,20 @@ bool BaseIOStream::readFromBuffer() {
 #endif
         return true;
     } else if (_readDelimiter) {
-        const char *loc = StrNStr((const char *)_readBuffer.getReadPointer(), _readBuffer.getActiveSize(),
+        size_t activeSize = _readBuffer.getActiveSize();
+        size_t scanned = _readDelimiterScanned >= _readDelimiter->size() ?
+                         _readDelimiterScanned - _readDelimiter->size() + 1 : 0;
+        const char *loc = StrNStr((const char *)_readBuffer.getReadPointer() + scanned, activeSize - scanned,
                                   _readDelimiter->c_str());
-        if (loc) {
+        if (!loc) {
+            _readDelimiterScanned = activeSize;
+            if (_readMaxBytes != 0 && activeSize > _readMaxBytes) {
+                LOG_INFO(gGenLog, "Unsatisfiable read, closing connection: delimiter not found within %u bytes",
+                         (unsigned)_readMaxBytes);
+                close(MakeExceptionPtr(UnsatisfiableReadError, "Delimiter not found within max bytes"));
+                return true;
+            }
+        } else {
             size_t readBytes = loc - (const char *)_readBuffer.getReadPointer() + _readDelimiter->size();
             ReadCallbackType callback(std::move(_readCallback));
             _readCallback = nullptr;
@@ -406,6 +517,27 @@ bool BaseIOStream::readFromBuffer() {
             runCallback(std::bind([](ReadCallbackType &callback, ByteArray &data){
                 callback(std::move(data));
             }, std::move(callback), std::move(data)));
+#endif
+            return true;
+        }
+    } else if (_readMatcher) {
+        size_t readBytes = _readBuffer.getActiveSize() ?
+                           _readMatcher(_readBuffer.getReadPointer(), _readBuffer.getActiveSize()) : 0;
+        if (readBytes != 0) {
+            ReadCallbackType callback(std::move(_readCallback));
+            _readCallback = nullptr;
+            _streamingCallback = nullptr;
+            _readMatcher = nullptr;
+            ByteArray data(_readBuffer.getReadPointer(), _readBuffer.getReadPointer() + readBytes);
+            _readBuffer.readCompleted(readBytes);
+#if !defined(BOOST_NO_CXX14_INITIALIZED_LAMBDA_CAPTURES)
+            runCallback([callback=std::move(callback), data=std::move(data)](){
+                callback(std::move(data));
+            });
+#else
+            runCallback(std::bind([](ReadCallbackType &callback, ByteArray &data){
+                callback(std::move(data));
+            }, std::move(callback), std::move(data)));
 #endif
             return true;
         }
@@ -441,11 +573,41 @@ void BaseIOStream::maybeAddErrorListener() {
         if (closed()) {
             maybeRunCloseCallback();
         } else {
-            readFromSocket();
+            maybeReadFromSocket();
         }
     }
 }
 
+void BaseIOStream::maybeReadFromSocket() {
+    if (_memoryAccountant && _memoryAccountant->isOverBudget()) {
+        if (!_readPaused) {
+            _readPaused = true;
+            _memoryAccountant->pause(shared_from_this());
+        }
+        return;
+    }
+    readFromSocket();
+}
+
+void BaseIOStream::resumeReading() {
+    if (!_readPaused) {
+        return;
+    }
+    _readPaused = false;
+    if (!closed() && (_state & S_READ) == S_NONE && (reading() || (_state == S_NONE && _pendingCallbacks == 0))) {
+        maybeReadFromSocket();
+    }
+}
+
+void BaseIOStream::trackMemoryUsage(size_t oldUsage, size_t usage) {
+    if (!_memoryTracked) {
+        _memoryTracked = true;
+        _memoryAccountant->track(shared_from_this());
+    }
+    _memoryUsage.store(usage, std::memory_order_relaxed);
+    _memoryAccountant->adjust(oldUsage, usage);
+}
+
 
 IOStream::IOStream(SocketType &&socket,
                    IOLoop *ioloop,
@@ -464,10 +626,8 @@ IOStream::~IOStream() {
 }
 
 void IOStream::realConnect(const std::string &address, unsigned short port) {
-    ResolverType resolver(_ioloop->getService());
-    ResolverType::query query(address, std::to_string(port));
     boost::system::error_code ec;
-    auto iter = resolver.resolve(query, ec);
+    auto endpoints = resolve(address, port, ec);
     if (ec) {
         onConnect(ec);
         return;
@@ -475,7 +635,8 @@ void IOStream::realConnect(const std::string &address, unsigned short port) {
     auto op = std::make_shared<Wrapper2>(shared_from_this(), [this](const boost::system::error_code &ec) {
         onConnect(ec);
     });
-    boost::asio::async_connect(_socket, iter, std::bind(&Wrapper2::operator(), std::move(op), std::placeholders::_1));
+    boost::asio::async_connect(_socket, endpoints, std::bind(&Wrapper2::operator(), std::move(op),
+                                                             std::placeholders::_1));
     _state |= S_WRITE;
 }
 
@@ -542,6 +703,70 @@ void IOStream::writeToSocket() {
     _state |= S_WRITE;
 }
 
+void IOStream::writeFile(int fd, size_t offset, size_t count, WriteCallbackType callback) {
+#if PLATFORM == PLATFORM_UNIX && !defined(TC_SOCKET_USE_IOCP)
+    checkClosed();
+    ASSERT(_sendRemaining == 0, "Already sending a file");
+    if (count == 0 || writing()) {
+        if (count == 0) {
+            write(nullptr, 0, std::move(callback));
+        } else {
+            write(nullptr, 0, [this, fd, offset, count, callback]() {
+                writeFile(fd, offset, count, callback);
+            });
+        }
+        return;
+    }
+    _sendFd = fd;
+    _sendOffset = offset;
+    _sendRemaining = count;
+    _writeCallback = StackContext::wrap(std::move(callback));
+    _state |= S_WRITE;
+    sendFileToSocket();
+#else
+    BaseIOStream::writeFile(fd, offset, count, std::move(callback));
+#endif
+}
+
+void IOStream::sendFileToSocket() {
+#if PLATFORM == PLATFORM_UNIX && !defined(TC_SOCKET_USE_IOCP)
+    while (_sendRemaining > 0) {
+        off_t offset = (off_t)_sendOffset;
+        ssize_t bytesSent = ::sendfile(_socket.native_handle(), _sendFd, &offset, _sendRemaining);
+        if (bytesSent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                Wrapper2 op(shared_from_this(), [this](const boost::system::error_code &ec) {
+                    if (ec) {
+                        _sendRemaining = 0;
+                        onWrite(ec, 0);
+                    } else {
+                        sendFileToSocket();
+                    }
+                });
+                _socket.async_wait(SocketType::wait_write, std::move(op));
+                return;
+            }
+            _sendRemaining = 0;
+            onWrite(boost::system::error_code(errno, boost::system::system_category()), 0);
+            return;
+        }
+        if (bytesSent == 0) {
+            // The file was truncated under us, the promised length can no longer be delivered
+            _sendRemaining = 0;
+            _state &= ~S_WRITE;
+            close();
+            return;
+        }
+        _sendOffset += (size_t)bytesSent;
+        _sendRemaining -= (size_t)bytesSent;
+    }
+    onWrite(boost::system::error_code(), 0);
+#endif
+}
+
 void IOStream::closeSocket() {
     boost::system::error_code ec;
     _socket.close(ec);
@@ -555,13 +780,15 @@ SSLIOStream::SSLIOStream(SocketType &&socket,
                          size_t readChunkSize)
         : BaseIOStream(std::move(socket), ioloop, maxBufferSize, readChunkSize)
         , _sslOption(std::move(sslOption))
-        , _sslSocket(_socket, _sslOption->context()) {
+        , _sslSocket(_socket, _sslOption->context())
+        , _recordSizing(_sslOption->getRecordSizing()) {
 #ifndef NDEBUG
     sWatcher->inc(SYS_SSLIOSTREAM_COUNT);
 #endif
 }
 
 SSLIOStream::~SSLIOStream() {
+    _sslOption->addRecordCounts(_smallRecords, _largeRecords, _recordSizeResets);
 #ifndef NDEBUG
     sWatcher->dec(SYS_SSLIOSTREAM_COUNT);
 #endif
@@ -573,10 +800,8 @@ void SSLIOStream::clearCallbacks() {
 }
 
 void SSLIOStream::realConnect(const std::string &address, unsigned short port) {
-    ResolverType resolver(_ioloop->getService());
-    ResolverType::query query(address, std::to_string(port));
     boost::system::error_code ec;
-    auto iter = resolver.resolve(query, ec);
+    auto endpoints = resolve(address, port, ec);
     if (ec) {
         onConnect(ec);
         return;
@@ -586,11 +811,41 @@ void SSLIOStream::realConnect(const std::string &address, unsigned short port) {
     auto op = std::make_shared<Wrapper2>(shared_from_this(), [this](const boost::system::error_code &ec) {
         onConnect(ec);
     });
-    boost::asio::async_connect(_sslSocket.lowest_layer(), iter,
+    boost::asio::async_connect(_sslSocket.lowest_layer(), endpoints,
                                std::bind(&Wrapper2::operator(), std::move(op), std::placeholders::_1));
     _state |= S_WRITE;
 }
 
+void SSLIOStream::waitForHandshake(ConnectCallbackType callback) {
+    checkClosed();
+    if (_sslAccepted) {
+        runCallback(StackContext::wrap(std::move(callback)));
+        return;
+    }
+    _sslConnectCallback = StackContext::wrap(std::move(callback));
+    doHandshake();
+}
+
+std::string SSLIOStream::getSelectedProtocol() {
+    const unsigned char *data = nullptr;
+    unsigned int length = 0;
+    SSL_get0_alpn_selected(_sslSocket.native_handle(), &data, &length);
+    if (!data) {
+        return {};
+    }
+    return std::string((const char *)data, length);
+}
+
+void SSLIOStream::setALPNProtocols(const StringVector &protocols) {
+    _alpnProtocols = SSLOption::encodeALPNProtocols(protocols);
+    if (_sslOption->isServerSide()) {
+        SSL_set_ex_data(_sslSocket.native_handle(), SSLOption::getALPNIndex(), &_alpnProtocols);
+    } else {
+        SSL_set_alpn_protos(_sslSocket.native_handle(), (const unsigned char *)_alpnProtocols.data(),
+                            (unsigned int)_alpnProtocols.size());
+    }
+}
+
 void SSLIOStream::readFromSocket() {
     if (_sslAccepted) {
         doRead();
@@ -620,22 +875,74 @@ void SSLIOStream::closeSocket() {
     }
 }
 
+void SSLIOStream::setNodelay(bool value) {
+    if (_handshakeStrand) {
+        // Applied once the offloaded handshake hands the socket back
+        _pendingNodelay = value ? 1 : 0;
+        return;
+    }
+    BaseIOStream::setNodelay(value);
+}
+
 void SSLIOStream::doHandshake() {
     if (!_sslAccepted && !_sslAccepting) {
-        Wrapper2 op(shared_from_this(), [this](const boost::system::error_code &ec) {
-            onHandshake(ec);
-        });
-        if (_sslOption->isServerSide()) {
-            _sslSocket.async_handshake(boost::asio::ssl::stream_base::server, std::move(op));
-
+        HandshakeType handshakeType = _sslOption->isServerSide() ? boost::asio::ssl::stream_base::server :
+                                      boost::asio::ssl::stream_base::client;
+        auto executor = _sslOption->getHandshakeExecutor();
+        if (executor) {
+            doOffloadedHandshake(executor, handshakeType);
         } else {
-            _sslSocket.async_handshake(boost::asio::ssl::stream_base::client, std::move(op));
+            Wrapper2 op(shared_from_this(), [this](const boost::system::error_code &ec) {
+                onHandshake(ec);
+            });
+            _sslSocket.async_handshake(handshakeType, std::move(op));
         }
         _sslAccepting = true;
         _state |= S_WRITE;
     }
 }
 
+void SSLIOStream::doOffloadedHandshake(SSLHandshakeExecutor *executor, HandshakeType handshakeType) {
+    IOLoop::ServiceType &service = _ioloop->getService();
+    if (!executor->tryAcquire()) {
+        LOG_WARNING(gGenLog, "SSL handshake queue full (%u pending), rejecting connection.",
+                    (unsigned)executor->getPendingCount());
+        auto op = std::make_shared<Wrapper2>(shared_from_this(), [this](const boost::system::error_code &ec) {
+            onHandshake(ec);
+        });
+        auto ec = boost::system::errc::make_error_code(boost::system::errc::resource_unavailable_try_again);
+        service.post(std::bind(&Wrapper2::operator(), std::move(op), ec));
+        return;
+    }
+    // While offloaded the strand is the only owner of the socket and the SSL state: the loop thread never touches
+    // either until the completion has been posted back, which is where ownership returns to the loop.
+    _handshakeStrand = make_unique<StrandType>(executor->getService());
+    _handshakeOffloaded = true;
+    StrandType *strand = _handshakeStrand.get();
+    auto op = std::make_shared<Wrapper2>(shared_from_this(), [this](const boost::system::error_code &ec) {
+        _handshakeStrand.reset();
+        if (_pendingNodelay != -1) {
+            BaseIOStream::setNodelay(_pendingNodelay == 1);
+            _pendingNodelay = -1;
+        }
+        if (_closing) {
+            _state &= ~S_WRITE;
+            _sslAccepting = false;
+            doClose();
+            return;
+        }
+        onHandshake(ec);
+    });
+    strand->post([this, executor, strand, handshakeType, &service, op]() mutable {
+        _sslSocket.async_handshake(handshakeType, strand->wrap(std::bind([this, executor, &service](
+                std::shared_ptr<Wrapper2> &op, const boost::system::error_code &ec) {
+            _handshakeOffloaded = false;
+            executor->release();
+            service.post(std::bind(&Wrapper2::operator(), std::move(op), ec));
+        }, std::move(op), std::placeholders::_1)));
+    });
+}
+
 void SSLIOStream::doRead() {
     _readBuffer.normalize();
     _readBuffer.ensureFreeSpace();
@@ -649,6 +956,8 @@ void SSLIOStream::doRead() {
 
 void SSLIOStream::doWrite() {
     Wrapper3 op(shared_from_this(), [this](const boost::system::error_code &ec, size_t transferredBytes) {
+        _recordBytesSent += transferredBytes;
+        _lastWriteTime = TimestampClock::now();
         onWrite(ec, transferredBytes);
     });
     MessageBuffer& buffer = _writeQueue.front();
@@ -665,17 +974,47 @@ void SSLIOStream::doWrite() {
             _writeQueue.pop_back();
         }
     }
-    _sslSocket.async_write_some(boost::asio::buffer(buffer.getReadPointer(), buffer.getActiveSize()),
+    _sslSocket.async_write_some(boost::asio::buffer(buffer.getReadPointer(), getRecordSize(buffer.getActiveSize())),
                                 std::move(op));
     _state |= S_WRITE;
 }
 
 void SSLIOStream::doClose() {
+    if (_handshakeStrand) {
+        // Only ask the owning strand to abort the handshake; the socket is closed here once it has been handed back.
+        // If the handshake already finished, the cancel finds the flag cleared and the handback is in flight.
+        auto self = shared_from_this();
+        _handshakeStrand->post([this, self]() {
+            if (_handshakeOffloaded) {
+                boost::system::error_code ec;
+                _socket.cancel(ec);
+            }
+        });
+        return;
+    }
     boost::system::error_code ec;
     _socket.close(ec);
     onClose(ec);
 }
 
+size_t SSLIOStream::getRecordSize(size_t pending) {
+    if (!_recordSizing.isEnabled()) {
+        return pending;
+    }
+    // Keep records within a single TCP segment until the connection has warmed up, so the peer can decrypt the first
+    // bytes without waiting for a full 16K record; fall back to small records after the connection goes idle.
+    if (_recordBytesSent != 0 && TimestampClock::now() - _lastWriteTime >= _recordSizing.getIdleTimeout()) {
+        _recordBytesSent = 0;
+        ++_recordSizeResets;
+    }
+    if (_recordBytesSent < _recordSizing.getBoostThreshold()) {
+        ++_smallRecords;
+        return std::min(pending, _recordSizing.getSmallRecordSize());
+    }
+    ++_largeRecords;
+    return std::min(pending, _recordSizing.getLargeRecordSize());
+}
+
 void SSLIOStream::onHandshake(const boost::system::error_code &ec) {
     _state &= ~S_WRITE;
     _sslAccepting = false;
@@ -9,6 +9,7 @@
 #include <boost/optional.hpp>
 #include <boost/regex.hpp>
 #include "tinycore/asyncio/ioloop.h"
+#include "tinycore/asyncio/memoryaccountant.h"
 #include "tinycore/asyncio/netutil.h"
 #include "tinycore/asyncio/stackcontext.h"
 #include "tinycore/common/errors.h"
@@ -22,6 +23,7 @@
 
 
 DECLARE_EXCEPTION(StreamClosedError, IOError);
+DECLARE_EXCEPTION(UnsatisfiableReadError, Exception);
 
 
 constexpr size_t DEFAULT_READ_CHUNK_SIZE = 4096;
@@ -31,14 +33,15 @@ class IOLoop;
 
 class BaseIOStream: public std::enable_shared_from_this<BaseIOStream> {
 public:
-    typedef boost::asio::ip::tcp::socket SocketType;
+    typedef boost::asio::generic::stream_protocol::socket SocketType;
+    typedef boost::asio::generic::stream_protocol::endpoint EndPointType;
     typedef boost::asio::ip::tcp::resolver ResolverType;
-    typedef boost::asio::ip::tcp::endpoint EndPointType;
     typedef ResolverType::iterator ResolverIterator;
 
     typedef IOLoop::CallbackType CallbackType;
     typedef std::function<void (ByteArray)> ReadCallbackType;
     typedef std::function<void (ByteArray)> StreamingCallbackType;
+    typedef std::function<size_t (const Byte *, size_t)> MatcherType;
     typedef std::function<void ()> WriteCallbackType;
     typedef std::function<void ()> CloseCallbackType;
     typedef std::function<void ()> ConnectCallbackType;
@@ -102,13 +105,11 @@ public:
     }
 
     std::string getRemoteAddress() const {
-        auto endpoint = _socket.remote_endpoint();
-        return endpoint.address().to_string();
+        return NetUtil::getAddress(_socket.remote_endpoint());
     }
 
     unsigned short getRemotePort() const {
-        auto endpoint = _socket.remote_endpoint();
-        return endpoint.port();
+        return NetUtil::getPort(_socket.remote_endpoint());
     }
 
     void start() {
@@ -124,12 +125,21 @@ public:
 
     void connect(const std::string &address, unsigned short port, ConnectCallbackType callback= nullptr);
     void readUntilRegex(const std::string &regex, ReadCallbackType callback);
-    void readUntil(std::string delimiter, ReadCallbackType callback);
+    void readUntil(std::string delimiter, ReadCallbackType callback, size_t maxBytes=0);
+    // matcher sees the whole buffered data each time more arrives and returns the length to hand to callback,
+    // or 0 to keep reading
+    void readUntilMatch(MatcherType matcher, ReadCallbackType callback);
     void readBytes(size_t numBytes, ReadCallbackType callback, StreamingCallbackType streamingCallback= nullptr);
     void readUntilClose(ReadCallbackType callback, StreamingCallbackType streamingCallback= nullptr);
     void write(const Byte *data, size_t length, WriteCallbackType callback=nullptr);
+    // Sends count bytes of the file from offset after everything already queued; fd must stay open until callback
+    virtual void writeFile(int fd, size_t offset, size_t count, WriteCallbackType callback=nullptr);
     void setCloseCallback(CloseCallbackType callback);
     void close(std::exception_ptr error= nullptr);
+    // Half-closes the socket once the queued writes are out and discards whatever the peer still sends, closing
+    // when the peer does or after linger seconds. A client still sending its request then reads the response
+    // instead of losing it to a reset.
+    void closeAfterDrain(float linger);
 
     bool reading() const {
         return static_cast<bool>(_readCallback);
@@ -143,10 +153,11 @@ public:
         return _closing || _closed;
     }
 
-    void setNodelay(bool value) {
+    virtual void setNodelay(bool value) {
         if (!closed()) {
             boost::asio::ip::tcp::no_delay option(value);
-            _socket.set_option(option);
+            boost::system::error_code ec;
+            _socket.set_option(option, ec);
         }
     }
 
@@ -154,10 +165,39 @@ public:
         return _maxBufferSize;
     }
 
+    size_t getReadBufferSize() const {
+        return _readBuffer.getActiveSize();
+    }
+
+    // Total bytes received from the socket since the stream was created
+    size_t getBytesReceived() const {
+        return _bytesReceived;
+    }
+
     std::exception_ptr getError() const {
         return _error;
     }
 
+    size_t getMemoryUsage() const {
+        return _memoryUsage.load(std::memory_order_relaxed);
+    }
+
+    const std::shared_ptr<MemoryAccountant>& getMemoryAccountant() const {
+        return _memoryAccountant;
+    }
+
+    void chargeMemory(size_t bytes) {
+        _externalMemory += bytes;
+        updateMemoryUsage();
+    }
+
+    void releaseMemory(size_t bytes) {
+        _externalMemory -= std::min(bytes, _externalMemory);
+        updateMemoryUsage();
+    }
+
+    void resumeReading();
+
     void onConnect(const boost::system::error_code &ec);
     void onRead(const boost::system::error_code &ec, size_t transferredBytes);
     void onWrite(const boost::system::error_code &ec, size_t transferredBytes);
@@ -178,10 +218,26 @@ protected:
         }
         checkClosed();
         if ((_state & S_READ) == S_NONE) {
-            readFromSocket();
+            maybeReadFromSocket();
+        }
+    }
+
+    void maybeReadFromSocket();
+
+    void updateMemoryUsage() {
+        if (_memoryAccountant) {
+            size_t usage = _readBuffer.getBufferSize() + _writeQueueBytes + _externalMemory;
+            size_t oldUsage = _memoryUsage.load(std::memory_order_relaxed);
+            if (usage != oldUsage) {
+                trackMemoryUsage(oldUsage, usage);
+            }
         }
     }
 
+    void trackMemoryUsage(size_t oldUsage, size_t usage);
+
+    std::vector<EndPointType> resolve(const std::string &address, unsigned short port,
+                                      boost::system::error_code &ec);
     size_t readToBuffer(const boost::system::error_code &ec, size_t transferredBytes);
     bool readFromBuffer();
 
@@ -204,6 +260,10 @@ protected:
     MessageBuffer _readBuffer;
     std::deque<MessageBuffer> _writeQueue;
     boost::optional<std::string> _readDelimiter;
+    size_t _readDelimiterScanned{0};
+    size_t _readMaxBytes{0};
+    MatcherType _readMatcher;
+    size_t _bytesReceived{0};
     boost::optional<boost::regex> _readRegex;
     boost::optional<size_t> _readBytes;
     bool _readUntilClose{false};
@@ -217,6 +277,12 @@ protected:
     int _pendingCallbacks{0};
     bool _closing{false};
     bool _closed{false};
+    std::shared_ptr<MemoryAccountant> _memoryAccountant;
+    std::atomic<size_t> _memoryUsage{0};
+    size_t _writeQueueBytes{0};
+    size_t _externalMemory{0};
+    bool _memoryTracked{false};
+    bool _readPaused{false};
 };
 
 
@@ -232,17 +298,26 @@ public:
     void readFromSocket() override;
     void writeToSocket() override;
     void closeSocket() override;
+    void writeFile(int fd, size_t offset, size_t count, WriteCallbackType callback=nullptr) override;
 
     template <typename ...Args>
     static std::shared_ptr<IOStream> create(Args&& ...args) {
         return std::make_shared<IOStream>(std::forward<Args>(args)...);
     }
+protected:
+    void sendFileToSocket();
+
+    int _sendFd{-1};
+    size_t _sendOffset{0};
+    size_t _sendRemaining{0};
 };
 
 
 class SSLIOStream: public BaseIOStream {
 public:
-    typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket&> SSLSocketType;
+    typedef boost::asio::ssl::stream<SocketType&> SSLSocketType;
+    typedef SSLSocketType::handshake_type HandshakeType;
+    typedef SSLHandshakeExecutor::StrandType StrandType;
 
     SSLIOStream(SocketType &&socket,
                 std::shared_ptr<SSLOption> sslOption,
@@ -256,6 +331,35 @@ public:
     void readFromSocket() override;
     void writeToSocket() override;
     void closeSocket() override;
+    void setNodelay(bool value) override;
+
+    void setRecordSizing(const SSLRecordSizing &recordSizing) {
+        _recordSizing = recordSizing;
+    }
+
+    const SSLRecordSizing& getRecordSizing() const {
+        return _recordSizing;
+    }
+
+    size_t getSmallRecordCount() const {
+        return _smallRecords;
+    }
+
+    size_t getLargeRecordCount() const {
+        return _largeRecords;
+    }
+
+    size_t getRecordSizeResetCount() const {
+        return _recordSizeResets;
+    }
+
+    // Runs callback once the handshake has completed, starting it if nothing has yet
+    void waitForHandshake(ConnectCallbackType callback);
+
+    std::string getSelectedProtocol();
+
+    // Protocols to negotiate on this stream in place of the SSLOption's; set before the handshake starts
+    void setALPNProtocols(const StringVector &protocols);
 
     template <typename ...Args>
     static std::shared_ptr<SSLIOStream> create(Args&& ...args) {
@@ -263,17 +367,31 @@ public:
     }
 protected:
     void doHandshake();
+    void doOffloadedHandshake(SSLHandshakeExecutor *executor, HandshakeType handshakeType);
     void doRead();
     void doWrite();
     void doClose();
     void onHandshake(const boost::system::error_code &ec);
     void onShutdown(const boost::system::error_code &ec);
+    size_t getRecordSize(size_t pending);
 
     std::shared_ptr<SSLOption> _sslOption;
+    // Declared before the socket, since the SSL object points at it until it is freed
+    std::string _alpnProtocols;
     SSLSocketType _sslSocket;
     bool _sslAccepting{false};
     bool _sslAccepted{false};
     ConnectCallbackType _sslConnectCallback;
+    std::unique_ptr<StrandType> _handshakeStrand;
+    // Only read and written on the handshake strand while it is set
+    bool _handshakeOffloaded{false};
+    int _pendingNodelay{-1};
+    SSLRecordSizing _recordSizing;
+    size_t _recordBytesSent{0};
+    Timestamp _lastWriteTime;
+    size_t _smallRecords{0};
+    size_t _largeRecords{0};
+    size_t _recordSizeResets{0};
 };
 
 
@@ -14,6 +14,7 @@
 #define SYS_PERIODICCALLBACK_COUNT          "TinyCore.PeriodicCallback.Count"
 #define SYS_IOSTREAM_COUNT                  "TinyCore.IOStream.Count"
 #define SYS_SSLIOSTREAM_COUNT               "TinyCore.SSLIOStream.Count"
+#define SYS_UDPENDPOINT_COUNT               "TinyCore.UDPEndpoint.Count"
 #define SYS_HTTPCONNECTION_COUNT            "TinyCore.HTTPConnection.Count"
 #define SYS_HTTPSERVERREQUEST_COUNT         "TinyCore.HTTPServerRequest.Count"
 #define SYS_REQUESTHANDLER_COUNT            "TinyCore.RequestHandler.Count"
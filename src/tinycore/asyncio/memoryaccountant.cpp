@@ -0,0 +1,178 @@
+//
+// Per-IOLoop accounting of buffered connection memory.
+//
+
+#include "tinycore/asyncio/memoryaccountant.h"
+#include "tinycore/asyncio/ioloop.h"
+#include "tinycore/asyncio/iostream.h"
+#include "tinycore/asyncio/logutil.h"
+
+
+MemoryAccountant::MemoryAccountant(size_t budget)
+        : _budget(budget) {
+
+}
+
+MemoryAccountant::~MemoryAccountant() {
+
+}
+
+void MemoryAccountant::track(std::shared_ptr<BaseIOStream> stream) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    BaseIOStream *key = stream.get();
+    _streams[key] = std::move(stream);
+}
+
+void MemoryAccountant::untrack(BaseIOStream *stream) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _streams.erase(stream);
+    auto iter = _shedding.find(stream);
+    if (iter != _shedding.end()) {
+        _shedPending -= iter->second;
+        _shedding.erase(iter);
+    }
+}
+
+void MemoryAccountant::adjust(size_t oldUsage, size_t newUsage) {
+    if (newUsage >= oldUsage) {
+        size_t usage = (_usage += newUsage - oldUsage);
+        size_t peakUsage = _peakUsage.load();
+        while (usage > peakUsage && !_peakUsage.compare_exchange_weak(peakUsage, usage)) {
+        }
+        if (_shedLimit != 0 && usage > _shedLimit) {
+            maybeShed();
+        }
+    } else {
+        size_t usage = (_usage -= oldUsage - newUsage);
+        if (usage < (size_t)(_budget * _resumeRatio)) {
+            maybeResume();
+        }
+    }
+}
+
+void MemoryAccountant::pause(std::shared_ptr<BaseIOStream> stream) {
+    ++_pauseCount;
+    IOLoop *ioloop = stream->ioloop();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _paused.emplace_back(std::move(stream));
+    }
+    scheduleStallCheck(ioloop);
+}
+
+void MemoryAccountant::dump(Logger *logger) const {
+    if (logger == nullptr) {
+        logger = Logging::getRootLogger();
+    }
+    LOG_INFO(logger, "Memory usage:%u, peak:%u, budget:%u, streams:%u, paused:%u, shed:%u, rejected:%u",
+             (unsigned)getUsage(), (unsigned)getPeakUsage(), (unsigned)_budget, (unsigned)getStreamCount(),
+             (unsigned)getPausedCount(), (unsigned)getShedCount(), (unsigned)getRejectedCount());
+}
+
+void MemoryAccountant::maybeResume() {
+    std::vector<std::weak_ptr<BaseIOStream>> paused;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_paused.empty()) {
+            return;
+        }
+        paused.swap(_paused);
+    }
+    ++_resumeCount;
+    for (auto &observer: paused) {
+        auto stream = observer.lock();
+        if (stream) {
+            NullContext ctx;
+            stream->ioloop()->addCallback([stream]() {
+                stream->resumeReading();
+            });
+        }
+    }
+}
+
+void MemoryAccountant::maybeShed() {
+    std::shared_ptr<BaseIOStream> victim;
+    size_t largest = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Streams already picked still count until they are torn down; don't shed again for the same bytes.
+        if (_usage.load() - _shedPending.load() <= _shedLimit) {
+            return;
+        }
+        for (auto &kv: _streams) {
+            if (_shedding.find(kv.first) != _shedding.end()) {
+                continue;
+            }
+            auto stream = kv.second.lock();
+            if (stream && stream->getMemoryUsage() > largest) {
+                largest = stream->getMemoryUsage();
+                victim = std::move(stream);
+            }
+        }
+        if (!victim) {
+            return;
+        }
+        _shedding[victim.get()] = largest;
+        _shedPending += largest;
+    }
+    LOG_WARNING(gGenLog, "Memory usage %u over shed limit %u, closing connection holding %u bytes",
+                (unsigned)_usage.load(), (unsigned)_shedLimit, (unsigned)largest);
+    shed(std::move(victim));
+}
+
+void MemoryAccountant::scheduleStallCheck(IOLoop *ioloop) {
+    if (_stallTimeout <= 0.0f || _stallCheckScheduled.exchange(true)) {
+        return;
+    }
+    std::weak_ptr<MemoryAccountant> observer = shared_from_this();
+    size_t resumeCount = _resumeCount.load();
+    NullContext ctx;
+    ioloop->addTimeout(_stallTimeout, [observer, ioloop, resumeCount]() {
+        auto accountant = observer.lock();
+        if (accountant) {
+            accountant->checkStall(ioloop, resumeCount);
+        }
+    });
+}
+
+void MemoryAccountant::checkStall(IOLoop *ioloop, size_t resumeCount) {
+    _stallCheckScheduled = false;
+    std::shared_ptr<BaseIOStream> victim;
+    size_t largest = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_paused.empty()) {
+            return;
+        }
+        if (resumeCount == _resumeCount.load()) {
+            // Nothing freed enough memory to resume anyone, the paused streams are likely holding it themselves
+            for (auto &observer: _paused) {
+                auto stream = observer.lock();
+                if (stream && _shedding.find(stream.get()) == _shedding.end()
+                    && stream->getMemoryUsage() > largest) {
+                    largest = stream->getMemoryUsage();
+                    victim = std::move(stream);
+                }
+            }
+            if (victim) {
+                _shedding[victim.get()] = largest;
+                _shedPending += largest;
+            }
+        }
+    }
+    if (victim) {
+        ++_stallShedCount;
+        LOG_WARNING(gGenLog, "Memory usage %u stalled over budget %u, closing paused connection holding %u bytes",
+                    (unsigned)_usage.load(), (unsigned)_budget, (unsigned)largest);
+        shed(std::move(victim));
+    }
+    scheduleStallCheck(ioloop);
+}
+
+void MemoryAccountant::shed(std::shared_ptr<BaseIOStream> victim) {
+    ++_shedCount;
+    NullContext ctx;
+    victim->ioloop()->addCallback([victim]() {
+        victim->close(MakeExceptionPtr(MemoryError, "Memory budget exceeded"));
+    });
+}
@@ -0,0 +1,137 @@
+//
+// Per-IOLoop accounting of buffered connection memory.
+//
+
+#ifndef TINYCORE_MEMORYACCOUNTANT_H
+#define TINYCORE_MEMORYACCOUNTANT_H
+
+#include "tinycore/common/common.h"
+#include <atomic>
+#include <mutex>
+#include "tinycore/logging/logging.h"
+
+
+class BaseIOStream;
+class IOLoop;
+
+
+class TC_COMMON_API MemoryAccountant: public std::enable_shared_from_this<MemoryAccountant> {
+public:
+    explicit MemoryAccountant(size_t budget=0);
+    MemoryAccountant(const MemoryAccountant &) = delete;
+    MemoryAccountant &operator=(const MemoryAccountant &) = delete;
+    ~MemoryAccountant();
+
+    void setBudget(size_t budget) {
+        _budget = budget;
+    }
+
+    size_t getBudget() const {
+        return _budget;
+    }
+
+    void setResumeRatio(float resumeRatio) {
+        _resumeRatio = resumeRatio;
+    }
+
+    float getResumeRatio() const {
+        return _resumeRatio;
+    }
+
+    void setShedLimit(size_t shedLimit) {
+        _shedLimit = shedLimit;
+    }
+
+    size_t getShedLimit() const {
+        return _shedLimit;
+    }
+
+    // Paused streams may be the ones holding the over-budget bytes; if none has been resumed within this many
+    // seconds the largest paused stream is shed so the rest can make progress. 0 disables it.
+    void setStallTimeout(float stallTimeout) {
+        _stallTimeout = stallTimeout;
+    }
+
+    float getStallTimeout() const {
+        return _stallTimeout;
+    }
+
+    bool isOverBudget() const {
+        return _budget != 0 && _usage.load(std::memory_order_relaxed) > _budget;
+    }
+
+    bool canAdmit(size_t bytes) const {
+        return _budget == 0 || _usage.load(std::memory_order_relaxed) + bytes <= _budget;
+    }
+
+    void noteRejected() {
+        ++_rejectedCount;
+    }
+
+    size_t getUsage() const {
+        return _usage.load();
+    }
+
+    size_t getPeakUsage() const {
+        return _peakUsage.load();
+    }
+
+    size_t getStreamCount() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _streams.size();
+    }
+
+    size_t getPausedCount() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _paused.size();
+    }
+
+    size_t getPauseCount() const {
+        return _pauseCount.load();
+    }
+
+    size_t getShedCount() const {
+        return _shedCount.load();
+    }
+
+    size_t getStallShedCount() const {
+        return _stallShedCount.load();
+    }
+
+    size_t getRejectedCount() const {
+        return _rejectedCount.load();
+    }
+
+    void track(std::shared_ptr<BaseIOStream> stream);
+    void untrack(BaseIOStream *stream);
+    void adjust(size_t oldUsage, size_t newUsage);
+    void pause(std::shared_ptr<BaseIOStream> stream);
+    void dump(Logger *logger=nullptr) const;
+protected:
+    void maybeResume();
+    void maybeShed();
+    void scheduleStallCheck(IOLoop *ioloop);
+    void checkStall(IOLoop *ioloop, size_t resumeCount);
+    void shed(std::shared_ptr<BaseIOStream> victim);
+
+    size_t _budget;
+    float _resumeRatio{0.8f};
+    size_t _shedLimit{0};
+    float _stallTimeout{2.0f};
+    std::atomic<size_t> _usage{0};
+    std::atomic<size_t> _peakUsage{0};
+    std::atomic<size_t> _shedPending{0};
+    std::atomic<size_t> _pauseCount{0};
+    std::atomic<size_t> _shedCount{0};
+    std::atomic<size_t> _rejectedCount{0};
+    std::atomic<size_t> _resumeCount{0};
+    std::atomic<size_t> _stallShedCount{0};
+    std::atomic<bool> _stallCheckScheduled{false};
+    mutable std::mutex _mutex;
+    std::map<BaseIOStream *, std::weak_ptr<BaseIOStream>> _streams;
+    std::map<BaseIOStream *, size_t> _shedding;
+    std::vector<std::weak_ptr<BaseIOStream>> _paused;
+};
+
+
+#endif //TINYCORE_MEMORYACCOUNTANT_H
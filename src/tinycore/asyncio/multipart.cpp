@@ -0,0 +1,299 @@
+//
+// Incremental multipart/form-data parser.
+//
+
+#include "tinycore/asyncio/multipart.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <unistd.h>
+#include "tinycore/asyncio/logutil.h"
+#include "tinycore/utilities/string.h"
+
+
+// mkstemp opens with O_CREAT | O_EXCL and mode 0600, so the name cannot be pre-created or symlinked by someone else
+// and the upload is not readable by other users
+static std::shared_ptr<const std::string> makeTempFile(const std::string &tempDir, int &fd) {
+    boost::filesystem::path dir = tempDir.empty() ? boost::filesystem::temp_directory_path() : tempDir;
+    std::string path = (dir / "tinycore-upload-XXXXXX").string();
+    fd = ::mkstemp(&path[0]);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return std::shared_ptr<const std::string>(new std::string(std::move(path)), [](const std::string *path) {
+        ::unlink(path->c_str());
+        delete path;
+    });
+}
+
+
+MultipartParser::MultipartParser(std::string boundary, QueryArgListMap &arguments, HTTPFileListMap &files,
+                                 size_t spillThreshold)
+        : _arguments(arguments)
+        , _files(files)
+        , _spillThreshold(spillThreshold) {
+    if (boost::starts_with(boundary, "\"") && boost::ends_with(boundary, "\"")) {
+        if (boundary.length() >= 2) {
+            boundary = boundary.substr(1, boundary.length() - 2);
+        } else {
+            boundary.clear();
+        }
+    }
+    _delimiter = "\r\n--" + boundary;
+    _skip.fill(_delimiter.size());
+    for (size_t i = 0; i + 1 < _delimiter.size(); ++i) {
+        _skip[(unsigned char)_delimiter[i]] = _delimiter.size() - 1 - i;
+    }
+    // The first boundary may start the body without a preceding line break
+    _buffer = "\r\n";
+}
+
+MultipartParser::~MultipartParser() {
+    abortPart();
+}
+
+void MultipartParser::feed(const char *data, size_t length) {
+    if (_state == S_DONE || _state == S_ERROR) {
+        return;
+    }
+    _buffer.append(data, length);
+    while (process()) {
+    }
+    _buffer.erase(0, _pos);
+    _pos = 0;
+}
+
+bool MultipartParser::finish() {
+    if (_state != S_DONE) {
+        if (_state != S_ERROR) {
+            LOG_WARNING(gGenLog, "Invalid multipart/form-data: no final boundary");
+        }
+        abortPart();
+        return false;
+    }
+    return true;
+}
+
+std::string MultipartParser::getBoundary(const std::string &contentType) {
+    StringVector fields = String::split(contentType, ';');
+    std::string k, sep, v;
+    for (auto &field: fields) {
+        boost::trim(field);
+        std::tie(k, sep, v) = String::partition(field, "=");
+        if (k == "boundary" && !v.empty()) {
+            return v;
+        }
+    }
+    return {};
+}
+
+size_t MultipartParser::search(size_t pos) const {
+    const size_t length = _delimiter.size();
+    const char *data = _buffer.data();
+    while (pos + length <= _buffer.size()) {
+        size_t i = length - 1;
+        while (data[pos + i] == _delimiter[i]) {
+            if (i == 0) {
+                return pos;
+            }
+            --i;
+        }
+        pos += _skip[(unsigned char)data[pos + length - 1]];
+    }
+    return std::string::npos;
+}
+
+bool MultipartParser::process() {
+    switch (_state) {
+        case S_PREAMBLE: {
+            size_t pos = search(_pos);
+            if (pos == std::string::npos) {
+                if (_buffer.size() - _pos >= _delimiter.size()) {
+                    _pos = _buffer.size() - _delimiter.size() + 1;
+                }
+                return false;
+            }
+            _pos = pos + _delimiter.size();
+            _state = S_BOUNDARY;
+            return true;
+        }
+        case S_BOUNDARY: {
+            if (_buffer.size() - _pos < 2) {
+                return false;
+            }
+            if (_buffer.compare(_pos, 2, "--") == 0) {
+                _pos = _buffer.size();
+                _state = S_DONE;
+                return false;
+            }
+            size_t eol = _buffer.find("\r\n", _pos);
+            if (eol == std::string::npos) {
+                if (_buffer.size() - _pos > _maxHeaderSize) {
+                    LOG_WARNING(gGenLog, "Invalid multipart/form-data: malformed boundary");
+                    _state = S_ERROR;
+                }
+                return false;
+            }
+            _pos = eol + 2;
+            _state = S_HEADERS;
+            return true;
+        }
+        case S_HEADERS: {
+            size_t eoh;
+            if (_buffer.compare(_pos, 2, "\r\n") == 0) {
+                eoh = _pos;
+            } else {
+                eoh = _buffer.find("\r\n\r\n", _pos);
+                if (eoh == std::string::npos) {
+                    if (_buffer.size() - _pos > _maxHeaderSize) {
+                        LOG_WARNING(gGenLog, "multipart/form-data headers too large");
+                        _state = S_ERROR;
+                    }
+                    return false;
+                }
+                eoh += 2;
+            }
+            startPart(_buffer.substr(_pos, eoh - _pos));
+            _pos = eoh + 2;
+            _state = S_BODY;
+            return true;
+        }
+        case S_BODY: {
+            size_t pos = search(_pos);
+            if (pos == std::string::npos) {
+                size_t keep = _delimiter.size() - 1;
+                if (_buffer.size() - _pos > keep) {
+                    size_t length = _buffer.size() - _pos - keep;
+                    partData(_buffer.data() + _pos, length);
+                    _pos += length;
+                }
+                return false;
+            }
+            partData(_buffer.data() + _pos, pos - _pos);
+            endPart();
+            _pos = pos + _delimiter.size();
+            _state = S_BOUNDARY;
+            return true;
+        }
+        default: {
+            _pos = _buffer.size();
+            return false;
+        }
+    }
+}
+
+void MultipartParser::startPart(const std::string &headerData) {
+    HTTPHeaders headers;
+    headers.parseLines(headerData);
+    std::string disposition;
+    StringMap dispParams;
+    std::tie(disposition, dispParams) = HTTPUtil::parseHeader(headers.get("Content-Disposition"));
+    _partValid = false;
+    _partIsFile = false;
+    _partData.clear();
+    _partSize = 0;
+    if (disposition != "form-data") {
+        LOG_WARNING(gGenLog, "Invalid multipart/form-data");
+        return;
+    }
+    auto nameIter = dispParams.find("name");
+    if (nameIter == dispParams.end()) {
+        LOG_WARNING(gGenLog, "multipart/form-data value missing name");
+        return;
+    }
+    _partValid = true;
+    _partName = std::move(nameIter->second);
+    auto fileNameIter = dispParams.find("filename");
+    if (fileNameIter != dispParams.end()) {
+        _partIsFile = true;
+        _partFile.reset(new HTTPFile(std::move(fileNameIter->second),
+                                     headers.get("Content-Type", "application/unknown"), {}));
+    }
+}
+
+void MultipartParser::partData(const char *data, size_t length) {
+    if (!_partValid || length == 0) {
+        return;
+    }
+    _partSize += length;
+    if (_partIsFile && _fileSink) {
+        _fileSink(_partName, *_partFile, data, length);
+    } else if (_partPath) {
+        writePart(data, length);
+    } else {
+        _partData.append(data, length);
+        if (_partIsFile && _spillThreshold != 0 && _partData.size() > _spillThreshold) {
+            spill();
+        }
+    }
+}
+
+void MultipartParser::endPart() {
+    if (!_partValid) {
+        return;
+    }
+    _partValid = false;
+    if (!_partIsFile) {
+        _arguments[_partName].emplace_back(std::move(_partData));
+        _partData.clear();
+        return;
+    }
+    if (_fileSink) {
+        _fileSink(_partName, *_partFile, nullptr, 0);
+    }
+    if (_partPath) {
+        int fd = _partFd;
+        _partFd = -1;
+        if (::close(fd) != 0) {
+            LOG_WARNING(gGenLog, "Failed to write multipart/form-data upload to %s", _partPath->c_str());
+            _partPath.reset();
+            _partFile.reset();
+            return;
+        }
+        _files[_partName].emplace_back(_partFile->getFileName(), _partFile->getContentType(), std::string(),
+                                       std::move(_partPath), _partSize);
+    } else {
+        _files[_partName].emplace_back(_partFile->getFileName(), _partFile->getContentType(), std::move(_partData));
+    }
+    _partPath.reset();
+    _partFile.reset();
+    _partData.clear();
+}
+
+void MultipartParser::spill() {
+    _partPath = makeTempFile(_tempDir, _partFd);
+    if (!_partPath) {
+        LOG_WARNING(gGenLog, "Failed to create multipart/form-data upload file %d :%s", errno, strerror(errno));
+        abortPart();
+        return;
+    }
+    writePart(_partData.data(), _partData.size());
+    std::string().swap(_partData);
+}
+
+void MultipartParser::writePart(const char *data, size_t length) {
+    while (length != 0) {
+        ssize_t written = ::write(_partFd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_WARNING(gGenLog, "Failed to write multipart/form-data upload to %s %d :%s", _partPath->c_str(), errno,
+                        strerror(errno));
+            abortPart();
+            return;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+void MultipartParser::abortPart() {
+    if (_partFd != -1) {
+        ::close(_partFd);
+        _partFd = -1;
+    }
+    _partPath.reset();
+    _partFile.reset();
+    _partData.clear();
+    _partValid = false;
+}
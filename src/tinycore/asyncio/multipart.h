@@ -0,0 +1,113 @@
+//
+// Incremental multipart/form-data parser.
+//
+
+#ifndef TINYCORE_MULTIPART_H
+#define TINYCORE_MULTIPART_H
+
+#include "tinycore/common/common.h"
+#include "tinycore/asyncio/httputil.h"
+
+
+constexpr size_t DEFAULT_MULTIPART_SPILL_THRESHOLD = 65536;
+constexpr size_t DEFAULT_MULTIPART_MAX_HEADER_SIZE = 16384;
+
+
+class TC_COMMON_API MultipartParser {
+public:
+    // Called with each piece of a file part as it is parsed, and once more with (nullptr, 0) when the part ends
+    typedef std::function<void (const std::string &, const HTTPFile &, const char *, size_t)> FileSinkType;
+
+    MultipartParser(std::string boundary, QueryArgListMap &arguments, HTTPFileListMap &files,
+                    size_t spillThreshold=DEFAULT_MULTIPART_SPILL_THRESHOLD);
+    MultipartParser(const MultipartParser &) = delete;
+    MultipartParser &operator=(const MultipartParser &) = delete;
+    ~MultipartParser();
+
+    void setSpillThreshold(size_t spillThreshold) {
+        _spillThreshold = spillThreshold;
+    }
+
+    size_t getSpillThreshold() const {
+        return _spillThreshold;
+    }
+
+    void setTempDir(std::string tempDir) {
+        _tempDir = std::move(tempDir);
+    }
+
+    const std::string& getTempDir() const {
+        return _tempDir;
+    }
+
+    void setMaxHeaderSize(size_t maxHeaderSize) {
+        _maxHeaderSize = maxHeaderSize;
+    }
+
+    void setFileSink(FileSinkType fileSink) {
+        _fileSink = std::move(fileSink);
+    }
+
+    void feed(const char *data, size_t length);
+
+    void feed(const ByteArray &data) {
+        feed((const char *)data.data(), data.size());
+    }
+
+    void feed(const std::string &data) {
+        feed(data.data(), data.size());
+    }
+
+    bool finish();
+
+    bool isComplete() const {
+        return _state == S_DONE;
+    }
+
+    bool hasError() const {
+        return _state == S_ERROR;
+    }
+
+    static std::string getBoundary(const std::string &contentType);
+protected:
+    enum State {
+        S_PREAMBLE,
+        S_BOUNDARY,
+        S_HEADERS,
+        S_BODY,
+        S_DONE,
+        S_ERROR,
+    };
+
+    size_t search(size_t pos) const;
+    bool process();
+    void startPart(const std::string &headerData);
+    void partData(const char *data, size_t length);
+    void endPart();
+    void spill();
+    void writePart(const char *data, size_t length);
+    void abortPart();
+
+    std::string _delimiter;
+    std::array<size_t, 256> _skip;
+    QueryArgListMap &_arguments;
+    HTTPFileListMap &_files;
+    size_t _spillThreshold;
+    size_t _maxHeaderSize{DEFAULT_MULTIPART_MAX_HEADER_SIZE};
+    std::string _tempDir;
+    FileSinkType _fileSink;
+    State _state{S_PREAMBLE};
+    std::string _buffer;
+    size_t _pos{0};
+    bool _partValid{false};
+    bool _partIsFile{false};
+    std::string _partName;
+    std::unique_ptr<HTTPFile> _partFile;
+    std::string _partData;
+    size_t _partSize{0};
+    std::shared_ptr<const std::string> _partPath;
+    int _partFd{-1};
+};
+
+
+#endif //TINYCORE_MULTIPART_H
@@ -4,12 +4,46 @@
 
 #include "tinycore/asyncio/netutil.h"
 #include <boost/filesystem.hpp>
+#include "tinycore/asyncio/logutil.h"
 #include "tinycore/common/errors.h"
 
 
+SSLHandshakeExecutor::SSLHandshakeExecutor(size_t threads, size_t maxPending)
+        : _service()
+        , _work(make_unique<WorkType>(_service))
+        , _pending(0)
+        , _rejected(0)
+        , _maxPending(maxPending) {
+    for (size_t i = 0; i != threads; ++i) {
+        _threads.emplace_back([this]() {
+            while (!_service.stopped()) {
+                try {
+                    _service.run();
+                } catch (std::exception &e) {
+                    LOG_ERROR(gGenLog, "Unexpected exception in SSL handshake thread:%s", e.what());
+                }
+            }
+        });
+    }
+}
+
+SSLHandshakeExecutor::~SSLHandshakeExecutor() {
+    _work.reset();
+    _service.stop();
+    for (auto &thread: _threads) {
+        if (thread.get_id() == std::this_thread::get_id()) {
+            thread.detach();
+        } else {
+            thread.join();
+        }
+    }
+}
+
+
 SSLOption::SSLOption(const SSLParams &sslParams)
         : _serverSide(sslParams.isServerSide())
-        , _context(boost::asio::ssl::context::sslv23) {
+        , _context(boost::asio::ssl::context::sslv23)
+        , _recordSizing(sslParams.getRecordSizing()) {
     boost::system::error_code ec;
     _context.set_options(boost::asio::ssl::context::no_sslv3, ec);
     const std::string &certFile = sslParams.getCertFile();
@@ -38,6 +72,54 @@ SSLOption::SSLOption(const SSLParams &sslParams)
             setCheckHost(checkHost);
         }
     }
+    if (sslParams.getHandshakeThreads() > 0) {
+        _handshakeExecutor = make_unique<SSLHandshakeExecutor>(sslParams.getHandshakeThreads(),
+                                                               sslParams.getMaxPendingHandshakes());
+    }
+    if (_serverSide) {
+        // Installed even without protocols of its own, for streams that bring theirs
+        SSL_CTX_set_alpn_select_cb(_context.native_handle(), &SSLOption::selectALPN, this);
+    }
+    if (!sslParams.getALPNProtocols().empty()) {
+        setALPNProtocols(sslParams.getALPNProtocols());
+    }
+}
+
+void SSLOption::setALPNProtocols(const StringVector &protocols) {
+    _alpnProtocols = encodeALPNProtocols(protocols);
+    if (!_serverSide) {
+        SSL_CTX_set_alpn_protos(_context.native_handle(), (const unsigned char *)_alpnProtocols.data(),
+                                (unsigned int)_alpnProtocols.size());
+    }
+}
+
+std::string SSLOption::encodeALPNProtocols(const StringVector &protocols) {
+    std::string encoded;
+    for (auto &protocol: protocols) {
+        encoded.push_back((char)protocol.size());
+        encoded.append(protocol);
+    }
+    return encoded;
+}
+
+int SSLOption::getALPNIndex() {
+    static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+int SSLOption::selectALPN(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in,
+                          unsigned int inlen, void *arg) {
+    auto option = (SSLOption *)arg;
+    auto protocols = (const std::string *)SSL_get_ex_data(ssl, getALPNIndex());
+    if (!protocols) {
+        protocols = &option->_alpnProtocols;
+    }
+    if (protocols->empty()) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    int result = SSL_select_next_proto((unsigned char **)out, outlen, (const unsigned char *)protocols->data(),
+                                       (unsigned int)protocols->size(), in, inlen);
+    return result == OPENSSL_NPN_NEGOTIATED ? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
 }
 
 std::shared_ptr<SSLOption> SSLOption::create(const SSLParams &sslParams) {
@@ -6,6 +6,9 @@
 #define TINYCORE_NETUTIL_H
 
 #include "tinycore/common/common.h"
+#include <atomic>
+#include <thread>
+#include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 
@@ -17,6 +20,61 @@ enum class SSLVerifyMode {
 };
 
 
+constexpr size_t DEFAULT_SSL_SMALL_RECORD_SIZE = 1400;
+constexpr size_t DEFAULT_SSL_LARGE_RECORD_SIZE = 16384;
+constexpr size_t DEFAULT_SSL_RECORD_BOOST_THRESHOLD = 65536;
+
+
+class SSLRecordSizing {
+public:
+    void setEnabled(bool enabled) {
+        _enabled = enabled;
+    }
+
+    bool isEnabled() const {
+        return _enabled;
+    }
+
+    void setSmallRecordSize(size_t smallRecordSize) {
+        _smallRecordSize = smallRecordSize;
+    }
+
+    size_t getSmallRecordSize() const {
+        return _smallRecordSize;
+    }
+
+    void setLargeRecordSize(size_t largeRecordSize) {
+        _largeRecordSize = largeRecordSize;
+    }
+
+    size_t getLargeRecordSize() const {
+        return _largeRecordSize;
+    }
+
+    void setBoostThreshold(size_t boostThreshold) {
+        _boostThreshold = boostThreshold;
+    }
+
+    size_t getBoostThreshold() const {
+        return _boostThreshold;
+    }
+
+    void setIdleTimeout(Duration idleTimeout) {
+        _idleTimeout = idleTimeout;
+    }
+
+    Duration getIdleTimeout() const {
+        return _idleTimeout;
+    }
+protected:
+    bool _enabled{true};
+    size_t _smallRecordSize{DEFAULT_SSL_SMALL_RECORD_SIZE};
+    size_t _largeRecordSize{DEFAULT_SSL_LARGE_RECORD_SIZE};
+    size_t _boostThreshold{DEFAULT_SSL_RECORD_BOOST_THRESHOLD};
+    Duration _idleTimeout{std::chrono::seconds(1)};
+};
+
+
 class SSLParams {
 public:
     explicit SSLParams(bool serverSide)
@@ -71,6 +129,38 @@ public:
         return _checkHost;
     }
 
+    void setHandshakeThreads(size_t handshakeThreads) {
+        _handshakeThreads = handshakeThreads;
+    }
+
+    size_t getHandshakeThreads() const {
+        return _handshakeThreads;
+    }
+
+    void setMaxPendingHandshakes(size_t maxPendingHandshakes) {
+        _maxPendingHandshakes = maxPendingHandshakes;
+    }
+
+    size_t getMaxPendingHandshakes() const {
+        return _maxPendingHandshakes;
+    }
+
+    void setRecordSizing(const SSLRecordSizing &recordSizing) {
+        _recordSizing = recordSizing;
+    }
+
+    const SSLRecordSizing& getRecordSizing() const {
+        return _recordSizing;
+    }
+
+    void setALPNProtocols(StringVector protocols) {
+        _alpnProtocols = std::move(protocols);
+    }
+
+    const StringVector& getALPNProtocols() const {
+        return _alpnProtocols;
+    }
+
     bool isServerSide() const {
         return _serverSide;
     }
@@ -83,6 +173,59 @@ protected:
     std::string _password;
     std::string _verifyFile;
     std::string _checkHost;
+    size_t _handshakeThreads{0};
+    size_t _maxPendingHandshakes{1024};
+    SSLRecordSizing _recordSizing;
+    StringVector _alpnProtocols;
+};
+
+
+class TC_COMMON_API SSLHandshakeExecutor: public boost::noncopyable {
+public:
+    typedef boost::asio::io_service ServiceType;
+    typedef ServiceType::work WorkType;
+    typedef ServiceType::strand StrandType;
+
+    SSLHandshakeExecutor(size_t threads, size_t maxPending);
+    ~SSLHandshakeExecutor();
+
+    bool tryAcquire() {
+        size_t pending = _pending.load();
+        do {
+            if (pending >= _maxPending) {
+                ++_rejected;
+                return false;
+            }
+        } while (!_pending.compare_exchange_weak(pending, pending + 1));
+        return true;
+    }
+
+    void release() {
+        --_pending;
+    }
+
+    size_t getPendingCount() const {
+        return _pending.load();
+    }
+
+    size_t getMaxPending() const {
+        return _maxPending;
+    }
+
+    size_t getRejectedCount() const {
+        return _rejected.load();
+    }
+
+    ServiceType& getService() {
+        return _service;
+    }
+protected:
+    ServiceType _service;
+    std::unique_ptr<WorkType> _work;
+    std::vector<std::thread> _threads;
+    std::atomic<size_t> _pending;
+    std::atomic<size_t> _rejected;
+    size_t _maxPending;
 };
 
 
@@ -100,8 +243,47 @@ public:
         return _context;
     }
 
+    SSLHandshakeExecutor* getHandshakeExecutor() {
+        return _handshakeExecutor.get();
+    }
+
+    const SSLRecordSizing& getRecordSizing() const {
+        return _recordSizing;
+    }
+
+    void addRecordCounts(size_t smallRecords, size_t largeRecords, size_t resets) {
+        _smallRecords += smallRecords;
+        _largeRecords += largeRecords;
+        _recordSizeResets += resets;
+    }
+
+    size_t getSmallRecordCount() const {
+        return _smallRecords.load();
+    }
+
+    size_t getLargeRecordCount() const {
+        return _largeRecords.load();
+    }
+
+    size_t getRecordSizeResetCount() const {
+        return _recordSizeResets.load();
+    }
+
+    // Servers pick the first of their protocols the client offers; clients offer theirs in order. A stream can
+    // override the list with SSLIOStream::setALPNProtocols
+    void setALPNProtocols(const StringVector &protocols);
+
+    // Length prefixed wire format of a protocol list
+    static std::string encodeALPNProtocols(const StringVector &protocols);
+
+    // Index of a stream's own protocol list in the SSL ex data
+    static int getALPNIndex();
+
     static std::shared_ptr<SSLOption> create(const SSLParams &sslParams);
 protected:
+    static int selectALPN(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in,
+                          unsigned int inlen, void *arg);
+
     void setCertFile(const std::string &certFile) {
         _context.use_certificate_chain_file(certFile);
     }
@@ -140,16 +322,75 @@ protected:
 
     bool _serverSide;
     SSLContextType _context;
+    std::unique_ptr<SSLHandshakeExecutor> _handshakeExecutor;
+    SSLRecordSizing _recordSizing;
+    std::atomic<size_t> _smallRecords{0};
+    std::atomic<size_t> _largeRecords{0};
+    std::atomic<size_t> _recordSizeResets{0};
+    std::string _alpnProtocols;
 };
 
 
 class NetUtil {
 public:
+    typedef boost::asio::generic::stream_protocol::endpoint EndPointType;
+
     static bool isValidIP(const std::string &ip) {
         boost::system::error_code ec;
         boost::asio::ip::address::from_string(ip, ec);
         return !ec;
     }
+
+    static bool isUnixAddress(const std::string &address) {
+        return boost::starts_with(address, "unix:");
+    }
+
+    static bool isInetEndPoint(const EndPointType &endpoint) {
+        int family = endpoint.protocol().family();
+        return family == AF_INET || family == AF_INET6;
+    }
+
+    static std::string getAddress(const EndPointType &endpoint) {
+        if (!isInetEndPoint(endpoint)) {
+            return "0.0.0.0";
+        }
+        return toTCPEndPoint(endpoint).address().to_string();
+    }
+
+    static unsigned short getPort(const EndPointType &endpoint) {
+        if (!isInetEndPoint(endpoint)) {
+            return 0;
+        }
+        return toTCPEndPoint(endpoint).port();
+    }
+
+    static boost::asio::ip::tcp::endpoint toTCPEndPoint(const EndPointType &endpoint) {
+        boost::asio::ip::tcp::endpoint result;
+        memcpy(result.data(), endpoint.data(), endpoint.size());
+        result.resize(endpoint.size());
+        return result;
+    }
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    static std::string getUnixPath(const std::string &address) {
+        std::string path = isUnixAddress(address) ? address.substr(5) : address;
+        if (boost::starts_with(path, "//")) {
+            path.erase(0, 2);
+        }
+        if (boost::starts_with(path, "@")) {
+            path[0] = '\0';
+        }
+        return path;
+    }
+
+    static bool isAbstractUnixPath(const std::string &path) {
+        return !path.empty() && path[0] == '\0';
+    }
+
+    static EndPointType makeUnixEndPoint(const std::string &address) {
+        return EndPointType(boost::asio::local::stream_protocol::endpoint(getUnixPath(address)));
+    }
+#endif
 };
 
 
@@ -0,0 +1,87 @@
+//
+// CoDel-style overload controller for shedding requests.
+//
+
+#include "tinycore/asyncio/overload.h"
+#include "tinycore/asyncio/logutil.h"
+#include "tinycore/debugging/trace.h"
+
+
+OverloadController::OverloadController(IOLoop *ioloop)
+        : _ioloop(ioloop ? ioloop : IOLoop::current()) {
+
+}
+
+OverloadController::~OverloadController() {
+    stop();
+}
+
+void OverloadController::start() {
+    stop();
+    // Sampling four times per interval leaves CoDel enough points to tell a burst from a standing queue
+    std::weak_ptr<OverloadController> controller = shared_from_this();
+    _prober = PeriodicCallback::create([controller]() {
+        auto self = controller.lock();
+        if (self) {
+            self->probe();
+        }
+    }, std::max(_interval / 4, 0.001f), _ioloop);
+    _prober->start();
+}
+
+void OverloadController::stop() {
+    if (_prober) {
+        _prober->stop();
+        _prober.reset();
+    }
+}
+
+bool OverloadController::admit(RequestPriority priority) {
+    if (priority != RequestPriority::CRITICAL) {
+        if (_dropping || (_maxInFlight != 0 && _inFlight >= _maxInFlight)
+            || (priority == RequestPriority::LOW && _queueDelay > _targetDelay)) {
+            ++_shedCount;
+            return false;
+        }
+    }
+    ++_inFlight;
+    ++_admittedCount;
+    return true;
+}
+
+void OverloadController::release() {
+    ASSERT(_inFlight > 0);
+    --_inFlight;
+}
+
+void OverloadController::addSample(float delay) {
+    _queueDelay = delay;
+    Timestamp now = TimestampClock::now();
+    if (delay <= _targetDelay) {
+        _firstAboveTime = Timestamp::min();
+        if (_dropping) {
+            _dropping = false;
+            LOG_INFO(gGenLog, "IOLoop queueing delay back under %.1fms, no longer shedding requests",
+                     _targetDelay * 1000);
+        }
+    } else if (_firstAboveTime == Timestamp::min()) {
+        _firstAboveTime = now + std::chrono::duration_cast<Timestamp::duration>(
+                std::chrono::duration<float>(_interval));
+    } else if (!_dropping && now >= _firstAboveTime) {
+        _dropping = true;
+        LOG_WARNING(gGenLog, "IOLoop queueing delay %.1fms above %.1fms for %.0fms, shedding requests",
+                    delay * 1000, _targetDelay * 1000, _interval * 1000);
+    }
+}
+
+void OverloadController::probe() {
+    // A callback queued now runs once everything already waiting on the loop has been served
+    std::weak_ptr<OverloadController> controller = shared_from_this();
+    Timestamp queued = TimestampClock::now();
+    _ioloop->spawnCallback([controller, queued]() {
+        auto self = controller.lock();
+        if (self) {
+            self->addSample(std::chrono::duration<float>(TimestampClock::now() - queued).count());
+        }
+    });
+}
@@ -0,0 +1,119 @@
+//
+// CoDel-style overload controller for shedding requests.
+//
+
+#ifndef TINYCORE_OVERLOAD_H
+#define TINYCORE_OVERLOAD_H
+
+#include "tinycore/common/common.h"
+#include "tinycore/asyncio/ioloop.h"
+
+
+constexpr float DEFAULT_OVERLOAD_TARGET_DELAY = 0.005f;
+constexpr float DEFAULT_OVERLOAD_INTERVAL = 0.1f;
+
+
+enum class RequestPriority {
+    LOW,
+    NORMAL,
+    CRITICAL,
+};
+
+
+// Sheds requests when the IOLoop falls behind, following CoDel: the loop's queueing delay is sampled a few times
+// per interval, and once it has stayed above the target for a whole interval the controller starts rejecting
+// normal requests until a sample comes back under the target. Low priority requests are rejected as soon as a
+// sample is over the target, critical ones (health checks) are never rejected.
+class TC_COMMON_API OverloadController: public std::enable_shared_from_this<OverloadController> {
+public:
+    explicit OverloadController(IOLoop *ioloop=nullptr);
+
+    ~OverloadController();
+
+    OverloadController(const OverloadController &) = delete;
+
+    OverloadController &operator=(const OverloadController &) = delete;
+
+    void setTargetDelay(float targetDelay) {
+        _targetDelay = targetDelay;
+    }
+
+    float getTargetDelay() const {
+        return _targetDelay;
+    }
+
+    void setInterval(float interval) {
+        _interval = interval;
+    }
+
+    float getInterval() const {
+        return _interval;
+    }
+
+    // Zero leaves the number of requests in flight unlimited
+    void setMaxInFlight(size_t maxInFlight) {
+        _maxInFlight = maxInFlight;
+    }
+
+    size_t getMaxInFlight() const {
+        return _maxInFlight;
+    }
+
+    void start();
+
+    void stop();
+
+    bool isRunning() const {
+        return static_cast<bool>(_prober);
+    }
+
+    // Returns false when the request should be shed; an admitted request must be released once it is done
+    bool admit(RequestPriority priority);
+
+    void release();
+
+    // Feeds one queueing delay measurement, in seconds
+    void addSample(float delay);
+
+    bool isOverloaded() const {
+        return _dropping || (_maxInFlight != 0 && _inFlight >= _maxInFlight);
+    }
+
+    float getQueueDelay() const {
+        return _queueDelay;
+    }
+
+    size_t getInFlight() const {
+        return _inFlight;
+    }
+
+    size_t getAdmittedCount() const {
+        return _admittedCount;
+    }
+
+    size_t getShedCount() const {
+        return _shedCount;
+    }
+
+    template <typename ...Args>
+    static std::shared_ptr<OverloadController> create(Args&& ...args) {
+        return std::make_shared<OverloadController>(std::forward<Args>(args)...);
+    }
+protected:
+    void probe();
+
+    IOLoop *_ioloop;
+    float _targetDelay{DEFAULT_OVERLOAD_TARGET_DELAY};
+    float _interval{DEFAULT_OVERLOAD_INTERVAL};
+    size_t _maxInFlight{0};
+    std::shared_ptr<PeriodicCallback> _prober;
+    float _queueDelay{0.0f};
+    Timestamp _firstAboveTime{Timestamp::min()};
+    bool _dropping{false};
+    size_t _inFlight{0};
+    size_t _admittedCount{0};
+    size_t _shedCount{0};
+};
+
+
+#endif //TINYCORE_OVERLOAD_H
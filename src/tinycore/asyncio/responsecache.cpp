@@ -0,0 +1,264 @@
+//
+// In-memory response cache with ETag and Vary support.
+//
+
+#include "tinycore/asyncio/responsecache.h"
+#include <boost/algorithm/string.hpp>
+#include "tinycore/asyncio/ioloop.h"
+
+
+ResponseCache::ResponseCache(size_t maxSize, float ttl)
+        : _maxSize(maxSize)
+        , _ttl(ttl) {
+
+}
+
+void ResponseCache::setMaxSize(size_t maxSize) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _maxSize = maxSize;
+    while (_size > _maxSize) {
+        remove(std::prev(_entries.end()));
+    }
+}
+
+int ResponseCache::serve(std::shared_ptr<HTTPServerRequest> request) {
+    if (!isCacheable(*request)) {
+        return 0;
+    }
+    const HTTPHeaders *requestHeaders = request->getHTTPHeaders();
+    if (requestHeaders->has(HTTPHeaderField::AUTHORIZATION)
+        || requestHeaders->get(HTTPHeaderField::CACHE_CONTROL).find("no-cache") != std::string::npos) {
+        return 0;
+    }
+    EntryPtr entry = lookup(*request);
+    if (!entry) {
+        return 0;
+    }
+    bool notModified = HTTPUtil::etagMatches(requestHeaders->get(HTTPHeaderField::IF_NONE_MATCH), entry->etag);
+    bool gzipping = !entry->gzipBody.empty() && acceptsGzip(*request);
+    const ByteArray &body = gzipping ? entry->gzipBody : entry->body;
+    std::string buffer;
+    buffer.reserve(256 + entry->headers.size() + body.size());
+    buffer.append(request->getVersion());
+    buffer.push_back(' ');
+    HTTPHeaders headers;
+    if (notModified) {
+        buffer.append("304 Not Modified\r\n");
+        buffer.append(entry->headers304);
+        headers = entry->fields304;
+    } else {
+        buffer.append(std::to_string(entry->statusCode));
+        buffer.push_back(' ');
+        buffer.append(entry->reason);
+        buffer.append("\r\n", 2);
+        buffer.append(entry->headers);
+        headers = entry->fields;
+        if (gzipping) {
+            buffer.append("Content-Encoding: gzip\r\n");
+            headers.add(HTTPHeaderField::CONTENT_ENCODING, "gzip");
+        }
+        std::string contentLength = std::to_string(body.size());
+        buffer.append("Content-Length: ");
+        buffer.append(contentLength);
+        buffer.append("\r\n", 2);
+        headers.add(HTTPHeaderField::CONTENT_LENGTH, contentLength);
+    }
+    IOLoop *ioloop = IOLoop::current();
+    std::string date = ioloop ? ioloop->getHTTPDate() : HTTPUtil::formatTimestamp(time(nullptr));
+    std::string age = std::to_string(
+            std::chrono::duration_cast<std::chrono::seconds>(TimestampClock::now() - entry->storeTime).count());
+    buffer.append("Date: ");
+    buffer.append(date);
+    buffer.append("\r\nAge: ");
+    buffer.append(age);
+    buffer.append("\r\n", 2);
+    headers.add(HTTPHeaderField::DATE, date);
+    headers.add("Age", age);
+    if (!request->supportsHTTP11() && !request->getConnection()->getNoKeepAlive()
+        && boost::iequals(requestHeaders->get(HTTPHeaderField::CONNECTION), "keep-alive")) {
+        buffer.append("Connection: Keep-Alive\r\n");
+        headers.add(HTTPHeaderField::CONNECTION, "Keep-Alive");
+    }
+    buffer.append("\r\n", 2);
+    size_t headLength = buffer.size();
+    if (!notModified && request->getMethod() != "HEAD") {
+        buffer.append((const char *)body.data(), body.size());
+    }
+    request->writeHeaders(notModified ? 304 : entry->statusCode, headers, buffer, headLength);
+    request->finish();
+    return notModified ? 304 : entry->statusCode;
+}
+
+ResponseCache::EntryPtr ResponseCache::lookup(const HTTPServerRequest &request) {
+    std::string baseKey = makeBaseKey(request);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto varyIter = _varies.find(baseKey);
+    if (varyIter == _varies.end() || !isCookieSafe(request, varyIter->second.first)) {
+        ++_missCount;
+        return nullptr;
+    }
+    auto iter = _index.find(makeKey(request, baseKey, varyIter->second.first));
+    if (iter == _index.end()) {
+        ++_missCount;
+        return nullptr;
+    }
+    std::shared_ptr<Entry> entry = *iter->second;
+    if (entry->expireTime <= TimestampClock::now()) {
+        remove(iter->second);
+        ++_missCount;
+        return nullptr;
+    }
+    if (entry->gzipBody.empty() && !entry->identityForGzip && acceptsGzip(request)) {
+        // Stored for a client without gzip; let this request refill the entry with the compressed body
+        ++_missCount;
+        return nullptr;
+    }
+    _entries.splice(_entries.begin(), _entries, iter->second);
+    ++_hitCount;
+    return entry;
+}
+
+bool ResponseCache::isStorable(const HTTPServerRequest &request, int statusCode, const HTTPHeaders &headers) const {
+    if (statusCode != 200 || request.getMethod() != "GET"
+        || request.getHTTPHeaders()->has(HTTPHeaderField::AUTHORIZATION)
+        || headers.has(HTTPHeaderField::SET_COOKIE) || headers.has(HTTPHeaderField::TRANSFER_ENCODING)) {
+        return false;
+    }
+    std::string cacheControl = boost::to_lower_copy(headers.get(HTTPHeaderField::CACHE_CONTROL));
+    if (cacheControl.find("no-store") != std::string::npos || cacheControl.find("no-cache") != std::string::npos
+        || cacheControl.find("private") != std::string::npos) {
+        return false;
+    }
+    if (headers.get(HTTPHeaderField::VARY).find('*') != std::string::npos) {
+        return false;
+    }
+    bool varyEncoding;
+    return isCookieSafe(request, parseVary(headers, varyEncoding));
+}
+
+void ResponseCache::store(const HTTPServerRequest &request, int statusCode, const std::string &reason,
+                          const HTTPHeaders &headers, ByteArray body, ByteArray gzipBody) {
+    float ttl = _ttl;
+    std::string cacheControl = boost::to_lower_copy(headers.get(HTTPHeaderField::CACHE_CONTROL));
+    for (const char *directive: {"s-maxage=", "max-age="}) {
+        auto pos = cacheControl.find(directive);
+        if (pos != std::string::npos) {
+            ttl = (float)std::strtol(cacheControl.c_str() + pos + strlen(directive), nullptr, 10);
+            break;
+        }
+    }
+    if (ttl <= 0.0f) {
+        return;
+    }
+    bool varyEncoding;
+    StringVector varyNames = parseVary(headers, varyEncoding);
+
+    auto entry = std::make_shared<Entry>();
+    entry->baseKey = makeBaseKey(request);
+    entry->key = makeKey(request, entry->baseKey, varyNames);
+    entry->statusCode = statusCode;
+    entry->reason = reason;
+    static const StringSet perResponseFields = {"date", "age", "connection", "content-length"};
+    static const StringSet notModifiedFields = {"allow", "content-encoding", "content-language", "content-md5",
+                                                "content-range", "content-type", "last-modified"};
+    bool gzipped = !gzipBody.empty();
+    headers.getAll([entry, gzipped](const std::string &name, const std::string &value) {
+        std::string lowerName = boost::to_lower_copy(name);
+        if (perResponseFields.find(lowerName) != perResponseFields.end()
+            || (gzipped && lowerName == "content-encoding")) {
+            return;
+        }
+        std::string line = name + ": " + value + "\r\n";
+        entry->headers.append(line);
+        entry->fields.add(name, value);
+        if (notModifiedFields.find(lowerName) == notModifiedFields.end()) {
+            entry->headers304.append(line);
+            entry->fields304.add(name, value);
+        }
+    });
+    entry->etag = headers.get(HTTPHeaderField::ETAG);
+    entry->body = std::move(body);
+    entry->gzipBody = std::move(gzipBody);
+    entry->identityForGzip = !varyEncoding || acceptsGzip(request);
+    entry->storeTime = TimestampClock::now();
+    entry->expireTime = entry->storeTime + std::chrono::duration_cast<Timestamp::duration>(
+            std::chrono::duration<float>(ttl));
+    entry->size = sizeof(Entry) + entry->key.size() + entry->headers.size() + entry->headers304.size()
+                  + entry->body.size() + entry->gzipBody.size();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (entry->size > _maxSize) {
+        return;
+    }
+    auto iter = _index.find(entry->key);
+    if (iter != _index.end()) {
+        remove(iter->second);
+    }
+    auto &vary = _varies[entry->baseKey];
+    vary.first = std::move(varyNames);
+    ++vary.second;
+    _entries.push_front(entry);
+    _index[entry->key] = _entries.begin();
+    _size += entry->size;
+    while (_size > _maxSize) {
+        remove(std::prev(_entries.end()));
+    }
+}
+
+void ResponseCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _index.clear();
+    _varies.clear();
+    _size = 0;
+}
+
+std::string ResponseCache::makeKey(const HTTPServerRequest &request, const std::string &baseKey,
+                                   const StringVector &varyNames) {
+    std::string key = baseKey;
+    const HTTPHeaders *headers = request.getHTTPHeaders();
+    for (auto &name: varyNames) {
+        key.push_back('\n');
+        key.append(name);
+        key.push_back(':');
+        key.append(headers->get(name));
+    }
+    return key;
+}
+
+StringVector ResponseCache::parseVary(const HTTPHeaders &headers, bool &varyEncoding) {
+    StringVector varyNames;
+    varyEncoding = false;
+    for (auto &value: headers.getList(HTTPHeaderField::VARY)) {
+        StringVector names;
+        boost::split(names, value, boost::is_any_of(","));
+        for (auto &name: names) {
+            boost::trim(name);
+            boost::to_lower(name);
+            if (name == "accept-encoding") {
+                varyEncoding = true;
+            } else if (!name.empty()) {
+                varyNames.push_back(std::move(name));
+            }
+        }
+    }
+    std::sort(varyNames.begin(), varyNames.end());
+    varyNames.erase(std::unique(varyNames.begin(), varyNames.end()), varyNames.end());
+    return varyNames;
+}
+
+bool ResponseCache::acceptsGzip(const HTTPServerRequest &request) {
+    return request.supportsHTTP11()
+           && request.getHTTPHeaders()->get(HTTPHeaderField::ACCEPT_ENCODING).find("gzip") != std::string::npos;
+}
+
+void ResponseCache::remove(EntryListType::iterator iter) {
+    const Entry &entry = **iter;
+    auto varyIter = _varies.find(entry.baseKey);
+    if (varyIter != _varies.end() && --varyIter->second.second == 0) {
+        _varies.erase(varyIter);
+    }
+    _index.erase(entry.key);
+    _size -= entry.size;
+    _entries.erase(iter);
+}
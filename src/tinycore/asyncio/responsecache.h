@@ -0,0 +1,148 @@
+//
+// In-memory response cache with ETag and Vary support.
+//
+
+#ifndef TINYCORE_RESPONSECACHE_H
+#define TINYCORE_RESPONSECACHE_H
+
+#include "tinycore/common/common.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "tinycore/asyncio/httpserver.h"
+#include "tinycore/asyncio/httputil.h"
+
+
+constexpr size_t DEFAULT_RESPONSE_CACHE_SIZE = 32 * 1024 * 1024;
+constexpr float DEFAULT_RESPONSE_CACHE_TTL = 5.0f;
+
+
+// Size bounded LRU of complete GET responses keyed by host, uri and the request headers named in the response's
+// Vary. Requests carrying a Cookie are only stored and served when the response varies on Cookie. Each entry keeps the identity body and, when the gzip transform produced one, the compressed body, so a hit
+// is written straight to the connection without creating a handler.
+class TC_COMMON_API ResponseCache {
+public:
+    struct Entry {
+        std::string key;
+        std::string baseKey;
+        int statusCode;
+        std::string reason;
+        // Serialized "Name: value\r\n" lines, minus the fields filled in for every hit
+        std::string headers;
+        std::string headers304;
+        // The same fields unserialized, for connections that frame headers themselves
+        HTTPHeaders fields;
+        HTTPHeaders fields304;
+        std::string etag;
+        ByteArray body;
+        ByteArray gzipBody;
+        // Whether gzip capable clients may be served the identity body
+        bool identityForGzip;
+        Timestamp storeTime;
+        Timestamp expireTime;
+        size_t size;
+    };
+
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    explicit ResponseCache(size_t maxSize=DEFAULT_RESPONSE_CACHE_SIZE, float ttl=DEFAULT_RESPONSE_CACHE_TTL);
+
+    ResponseCache(const ResponseCache &) = delete;
+
+    ResponseCache &operator=(const ResponseCache &) = delete;
+
+    void setMaxSize(size_t maxSize);
+
+    size_t getMaxSize() const {
+        return _maxSize;
+    }
+
+    // Used when the response carries no max-age or s-maxage of its own
+    void setTTL(float ttl) {
+        _ttl = ttl;
+    }
+
+    float getTTL() const {
+        return _ttl;
+    }
+
+    // Writes the cached response (or a 304) and returns its status code; returns 0 on a miss
+    int serve(std::shared_ptr<HTTPServerRequest> request);
+
+    EntryPtr lookup(const HTTPServerRequest &request);
+
+    bool isCacheable(const HTTPServerRequest &request) const {
+        return request.getMethod() == "GET" || request.getMethod() == "HEAD";
+    }
+
+    bool isStorable(const HTTPServerRequest &request, int statusCode, const HTTPHeaders &headers) const;
+
+    // gzipBody is left empty unless an output transform compressed body on the way out
+    void store(const HTTPServerRequest &request, int statusCode, const std::string &reason,
+               const HTTPHeaders &headers, ByteArray body, ByteArray gzipBody);
+
+    void clear();
+
+    size_t getSize() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _size;
+    }
+
+    size_t getCount() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _entries.size();
+    }
+
+    size_t getHitCount() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _hitCount;
+    }
+
+    size_t getMissCount() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _missCount;
+    }
+
+    template <typename ...Args>
+    static std::shared_ptr<ResponseCache> create(Args&& ...args) {
+        return std::make_shared<ResponseCache>(std::forward<Args>(args)...);
+    }
+protected:
+    typedef std::list<std::shared_ptr<Entry>> EntryListType;
+    typedef std::unordered_map<std::string, EntryListType::iterator> EntryIndexType;
+    // Vary field names last seen for a host and uri, with the number of entries stored under them
+    typedef std::unordered_map<std::string, std::pair<StringVector, size_t>> VaryIndexType;
+
+    static std::string makeBaseKey(const HTTPServerRequest &request) {
+        return request.getHost() + request.getURI();
+    }
+
+    static std::string makeKey(const HTTPServerRequest &request, const std::string &baseKey,
+                               const StringVector &varyNames);
+
+    static bool acceptsGzip(const HTTPServerRequest &request);
+
+    // Lower cased and sorted field names listed in the response's Vary, apart from Accept-Encoding
+    static StringVector parseVary(const HTTPHeaders &headers, bool &varyEncoding);
+
+    // A response for a request with cookies is only shared with requests carrying the same ones
+    static bool isCookieSafe(const HTTPServerRequest &request, const StringVector &varyNames) {
+        return !request.hasHeader(HTTPHeaderField::COOKIE)
+               || std::binary_search(varyNames.begin(), varyNames.end(), "cookie");
+    }
+
+    void remove(EntryListType::iterator iter);
+
+    size_t _maxSize;
+    float _ttl;
+    mutable std::mutex _mutex;
+    EntryListType _entries;
+    EntryIndexType _index;
+    VaryIndexType _varies;
+    size_t _size{0};
+    size_t _hitCount{0};
+    size_t _missCount{0};
+};
+
+
+#endif //TINYCORE_RESPONSECACHE_H
@@ -0,0 +1,209 @@
+//
+// Radix-tree URL router.
+//
+
+#include "tinycore/asyncio/router.h"
+#include "tinycore/asyncio/web.h"
+#include "tinycore/httputils/urlparse.h"
+
+
+constexpr size_t URLRouter::NO_ROUTE;
+
+
+void URLRouter::add(URLSpec *spec) {
+    size_t route = _routes.size();
+    _routes.push_back(spec);
+    std::vector<Token> tokens;
+    if (!parse(spec->getPattern(), tokens)) {
+        _regexRoutes.push_back(route);
+        return;
+    }
+    Node *node = &_root;
+    node->minRoute = std::min(node->minRoute, route);
+    for (auto &token: tokens) {
+        if (token.kind == -1) {
+            node = insertLiteral(node, token.literal, route);
+        } else {
+            if (!node->params[token.kind]) {
+                node->params[token.kind] = make_unique<Node>();
+            }
+            node = node->params[token.kind].get();
+            node->minRoute = std::min(node->minRoute, route);
+        }
+    }
+    // An earlier spec with the same pattern shadows this one
+    if (node->route == NO_ROUTE) {
+        node->route = route;
+    }
+}
+
+URLSpec* URLRouter::match(const std::string &path, StringVector &args) const {
+    MatchState state;
+    state.end = path.data() + path.size();
+    state.best = NO_ROUTE;
+    matchNode(&_root, path.data(), state);
+    for (size_t route: _regexRoutes) {
+        if (route >= state.best) {
+            break;
+        }
+        boost::xpressive::smatch match;
+        if (boost::xpressive::regex_match(path, match, _routes[route]->getRegex())) {
+            for (size_t i = 1; i < match.size(); ++i) {
+                args.push_back(URLParse::unquote(match[i].str()));
+            }
+            return _routes[route];
+        }
+    }
+    if (state.best == NO_ROUTE) {
+        return nullptr;
+    }
+    for (auto &capture: state.bestCaptures) {
+        args.push_back(URLParse::unquote(std::string(capture.first, capture.second)));
+    }
+    return _routes[state.best];
+}
+
+bool URLRouter::parse(const std::string &pattern, std::vector<Token> &tokens) {
+    static const std::pair<const char *, ParamKind> groups[] = {
+            {"([0-9]+)", PARAM_DIGITS},
+            {"(\\d+)", PARAM_DIGITS},
+            {"([^/]+)", PARAM_SEGMENT},
+            {"(.*)", PARAM_ANY},
+            {"(.+)", PARAM_SOME},
+    };
+    size_t pos = 0, end = pattern.size();
+    if (boost::starts_with(pattern, "^")) {
+        pos = 1;
+    }
+    if (boost::ends_with(pattern, "$")) {
+        if (boost::ends_with(pattern, "\\$")) {
+            return false;
+        }
+        --end;
+    }
+    std::string literal;
+    while (pos < end) {
+        char c = pattern[pos];
+        if (c == '\\') {
+            if (pos + 1 >= end || std::isalnum((unsigned char)pattern[pos + 1])) {
+                return false;
+            }
+            literal.push_back(pattern[pos + 1]);
+            pos += 2;
+        } else if (c == '(') {
+            bool found = false;
+            for (auto &group: groups) {
+                size_t length = strlen(group.first);
+                if (pattern.compare(pos, length, group.first) != 0) {
+                    continue;
+                }
+                pos += length;
+                bool last = pos == end;
+                if (group.second == PARAM_ANY || group.second == PARAM_SOME ? !last : !last && pattern[pos] != '/') {
+                    return false;
+                }
+                if (!literal.empty()) {
+                    tokens.push_back({-1, std::move(literal)});
+                    literal.clear();
+                }
+                tokens.push_back({group.second, {}});
+                found = true;
+                break;
+            }
+            if (!found) {
+                return false;
+            }
+        } else if (strchr(".^$|?*+)[]{}", c)) {
+            return false;
+        } else {
+            literal.push_back(c);
+            ++pos;
+        }
+    }
+    if (!literal.empty()) {
+        tokens.push_back({-1, std::move(literal)});
+    }
+    return true;
+}
+
+URLRouter::Node* URLRouter::insertLiteral(Node *node, const std::string &literal, size_t route) {
+    size_t pos = 0;
+    while (pos < literal.size()) {
+        auto iter = std::find_if(node->children.begin(), node->children.end(), [&](const std::unique_ptr<Node> &child) {
+            return child->prefix[0] == literal[pos];
+        });
+        if (iter == node->children.end()) {
+            auto child = make_unique<Node>();
+            child->prefix = literal.substr(pos);
+            child->minRoute = route;
+            node->children.push_back(std::move(child));
+            return node->children.back().get();
+        }
+        Node *child = iter->get();
+        size_t common = 0;
+        while (common < child->prefix.size() && pos + common < literal.size()
+               && child->prefix[common] == literal[pos + common]) {
+            ++common;
+        }
+        if (common < child->prefix.size()) {
+            auto middle = make_unique<Node>();
+            middle->prefix = child->prefix.substr(0, common);
+            middle->minRoute = child->minRoute;
+            child->prefix.erase(0, common);
+            middle->children.push_back(std::move(*iter));
+            *iter = std::move(middle);
+            child = iter->get();
+        }
+        child->minRoute = std::min(child->minRoute, route);
+        node = child;
+        pos += common;
+    }
+    return node;
+}
+
+void URLRouter::matchNode(const Node *node, const char *pos, MatchState &state) {
+    if (node->minRoute >= state.best) {
+        return;
+    }
+    const char *end = state.end;
+    if (pos == end && node->route < state.best) {
+        state.best = node->route;
+        state.bestCaptures = state.captures;
+    }
+    for (auto &child: node->children) {
+        const std::string &prefix = child->prefix;
+        if ((size_t)(end - pos) >= prefix.size() && memcmp(pos, prefix.data(), prefix.size()) == 0) {
+            matchNode(child.get(), pos + prefix.size(), state);
+            break;
+        }
+    }
+    const Node *param = node->params[PARAM_DIGITS].get();
+    if (param && pos != end) {
+        const char *stop = pos;
+        while (stop != end && std::isdigit((unsigned char)*stop)) {
+            ++stop;
+        }
+        if (stop != pos && (stop == end || *stop == '/')) {
+            state.captures.emplace_back(pos, stop);
+            matchNode(param, stop, state);
+            state.captures.pop_back();
+        }
+    }
+    param = node->params[PARAM_SEGMENT].get();
+    if (param && pos != end) {
+        const char *stop = std::find(pos, end, '/');
+        if (stop != pos) {
+            state.captures.emplace_back(pos, stop);
+            matchNode(param, stop, state);
+            state.captures.pop_back();
+        }
+    }
+    for (int kind: {PARAM_ANY, PARAM_SOME}) {
+        param = node->params[kind].get();
+        if (param && (kind == PARAM_ANY || pos != end) && param->route < state.best) {
+            state.best = param->route;
+            state.bestCaptures = state.captures;
+            state.bestCaptures.emplace_back(pos, end);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+//
+// Radix-tree URL router.
+//
+
+#ifndef TINYCORE_ROUTER_H
+#define TINYCORE_ROUTER_H
+
+#include "tinycore/common/common.h"
+
+
+class URLSpec;
+
+
+// Compiles the URL patterns of a host into a radix tree. Literal text follows compressed edges, and the groups
+// ([0-9]+), (\d+) and ([^/]+) ending at a slash, or (.*) and (.+) ending the pattern, are matched without a regex.
+// Any other pattern keeps its regex and is only tried while it could still beat the best tree match, so the first
+// matching URLSpec wins exactly as with a linear scan.
+class TC_COMMON_API URLRouter {
+public:
+    URLRouter() = default;
+
+    URLRouter(const URLRouter &) = delete;
+
+    URLRouter &operator=(const URLRouter &) = delete;
+
+    // Specs must be added in route order and outlive the router
+    void add(URLSpec *spec);
+
+    // Returns the first spec matching path, or null; args receives its unquoted groups
+    URLSpec* match(const std::string &path, StringVector &args) const;
+
+    size_t getRouteCount() const {
+        return _routes.size();
+    }
+
+    size_t getRegexRouteCount() const {
+        return _regexRoutes.size();
+    }
+protected:
+    enum ParamKind {
+        PARAM_DIGITS = 0,
+        PARAM_SEGMENT,
+        PARAM_ANY,
+        PARAM_SOME,
+        PARAM_KIND_COUNT,
+    };
+
+    struct Token {
+        int kind;
+        std::string literal;
+    };
+
+    struct Node {
+        std::string prefix;
+        std::vector<std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> params[PARAM_KIND_COUNT];
+        size_t route{NO_ROUTE};
+        // Smallest route below this node, to prune subtrees that cannot beat the best match so far
+        size_t minRoute{NO_ROUTE};
+    };
+
+    typedef std::pair<const char *, const char *> CaptureType;
+
+    struct MatchState {
+        const char *end;
+        size_t best;
+        std::vector<CaptureType> captures;
+        std::vector<CaptureType> bestCaptures;
+    };
+
+    // Splits a pattern into literals and parameters; false when it needs the regex
+    static bool parse(const std::string &pattern, std::vector<Token> &tokens);
+
+    static Node* insertLiteral(Node *node, const std::string &literal, size_t route);
+
+    static void matchNode(const Node *node, const char *pos, MatchState &state);
+
+    static constexpr size_t NO_ROUTE = std::numeric_limits<size_t>::max();
+
+    std::vector<URLSpec *> _routes;
+    Node _root;
+    std::vector<size_t> _regexRoutes;
+};
+
+
+#endif //TINYCORE_ROUTER_H
@@ -0,0 +1,127 @@
+//
+// Cache of open static file descriptors.
+//
+
+#include "tinycore/asyncio/staticfile.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+
+
+StaticFile::StaticFile(int fd, std::string realPath, size_t size, time_t modifiedTime)
+        : _fd(fd)
+        , _realPath(std::move(realPath))
+        , _size(size)
+        , _modifiedTime(modifiedTime) {
+    char etag[64];
+    _etag.assign(etag, (size_t)snprintf(etag, sizeof(etag), "\"%llx-%llx\"", (unsigned long long)modifiedTime,
+                                        (unsigned long long)size));
+}
+
+StaticFile::~StaticFile() {
+    ::close(_fd);
+}
+
+std::string StaticFile::guessContentType(const std::string &path) {
+    static const StringMap contentTypes = {
+            {"css", "text/css"},
+            {"csv", "text/csv"},
+            {"gif", "image/gif"},
+            {"htm", "text/html"},
+            {"html", "text/html"},
+            {"ico", "image/x-icon"},
+            {"jpeg", "image/jpeg"},
+            {"jpg", "image/jpeg"},
+            {"js", "application/javascript"},
+            {"json", "application/json"},
+            {"map", "application/json"},
+            {"mjs", "application/javascript"},
+            {"mp4", "video/mp4"},
+            {"otf", "font/otf"},
+            {"pdf", "application/pdf"},
+            {"png", "image/png"},
+            {"svg", "image/svg+xml"},
+            {"ttf", "font/ttf"},
+            {"txt", "text/plain"},
+            {"wasm", "application/wasm"},
+            {"webm", "video/webm"},
+            {"webp", "image/webp"},
+            {"woff", "font/woff"},
+            {"woff2", "font/woff2"},
+            {"xml", "application/xml"},
+    };
+    auto slash = path.rfind('/');
+    auto dot = path.rfind('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        auto iter = contentTypes.find(boost::to_lower_copy(path.substr(dot + 1)));
+        if (iter != contentTypes.end()) {
+            return iter->second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+
+StaticFileCache::StaticFileCache(size_t maxFiles, float checkInterval)
+        : _maxFiles(maxFiles)
+        , _checkInterval(checkInterval) {
+
+}
+
+StaticFileCache::FilePtr StaticFileCache::open(const std::string &path) {
+    Timestamp now = TimestampClock::now();
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto iter = _index.find(path);
+    if (iter != _index.end()) {
+        Entry &entry = *iter->second;
+        if (now - entry.checkTime >= std::chrono::duration<float>(_checkInterval)) {
+            entry.file = load(path, entry.file);
+            entry.checkTime = now;
+        }
+        _entries.splice(_entries.begin(), _entries, iter->second);
+        return entry.file;
+    }
+    FilePtr file = load(path, nullptr);
+    _entries.push_front({path, file, now});
+    _index[path] = _entries.begin();
+    while (_entries.size() > _maxFiles) {
+        _index.erase(_entries.back().path);
+        _entries.pop_back();
+    }
+    return file;
+}
+
+void StaticFileCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+    _index.clear();
+}
+
+StaticFileCache::FilePtr StaticFileCache::load(const std::string &path, const FilePtr &current) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return nullptr;
+    }
+    char *resolved = ::realpath(path.c_str(), nullptr);
+    if (!resolved) {
+        return nullptr;
+    }
+    std::string realPath(resolved);
+    free(resolved);
+    if (current && current->getRealPath() == realPath && current->getSize() == (size_t)st.st_size
+        && current->getModifiedTime() == st.st_mtime) {
+        return current;
+    }
+    // The resolved path has no symlinks left, so the descriptor is for the file getRealPath names
+    int fd = ::open(realPath.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        return nullptr;
+    }
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return nullptr;
+    }
+    return std::make_shared<StaticFile>(fd, std::move(realPath), (size_t)st.st_size, st.st_mtime);
+}
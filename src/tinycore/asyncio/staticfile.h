@@ -0,0 +1,118 @@
+//
+// Cache of open static file descriptors.
+//
+
+#ifndef TINYCORE_STATICFILE_H
+#define TINYCORE_STATICFILE_H
+
+#include "tinycore/common/common.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+
+constexpr size_t DEFAULT_STATIC_FILE_CACHE_SIZE = 1024;
+constexpr float DEFAULT_STATIC_FILE_CHECK_INTERVAL = 1.0f;
+
+
+// An open regular file with the stat results it was opened with; the descriptor is closed with the last reference
+class TC_COMMON_API StaticFile {
+public:
+    StaticFile(int fd, std::string realPath, size_t size, time_t modifiedTime);
+
+    ~StaticFile();
+
+    StaticFile(const StaticFile &) = delete;
+
+    StaticFile &operator=(const StaticFile &) = delete;
+
+    int getFd() const {
+        return _fd;
+    }
+
+    // The path the file was opened through, with every symlink resolved
+    const std::string& getRealPath() const {
+        return _realPath;
+    }
+
+    size_t getSize() const {
+        return _size;
+    }
+
+    time_t getModifiedTime() const {
+        return _modifiedTime;
+    }
+
+    // Built from the modification time and size, so it never needs the content
+    const std::string& getEtag() const {
+        return _etag;
+    }
+
+    static std::string guessContentType(const std::string &path);
+protected:
+    int _fd;
+    std::string _realPath;
+    size_t _size;
+    time_t _modifiedTime;
+    std::string _etag;
+};
+
+
+// LRU of open files keyed by path. Missing paths are remembered too, and an entry is only stat'ed again once it is
+// older than the check interval, so a hot file costs no syscalls to look up.
+class TC_COMMON_API StaticFileCache {
+public:
+    typedef std::shared_ptr<const StaticFile> FilePtr;
+
+    explicit StaticFileCache(size_t maxFiles=DEFAULT_STATIC_FILE_CACHE_SIZE,
+                             float checkInterval=DEFAULT_STATIC_FILE_CHECK_INTERVAL);
+
+    StaticFileCache(const StaticFileCache &) = delete;
+
+    StaticFileCache &operator=(const StaticFileCache &) = delete;
+
+    void setMaxFiles(size_t maxFiles) {
+        _maxFiles = maxFiles;
+    }
+
+    size_t getMaxFiles() const {
+        return _maxFiles;
+    }
+
+    void setCheckInterval(float checkInterval) {
+        _checkInterval = checkInterval;
+    }
+
+    float getCheckInterval() const {
+        return _checkInterval;
+    }
+
+    // Returns null when path does not name a readable regular file
+    FilePtr open(const std::string &path);
+
+    void clear();
+
+    size_t getCount() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _entries.size();
+    }
+protected:
+    struct Entry {
+        std::string path;
+        FilePtr file;
+        Timestamp checkTime;
+    };
+
+    typedef std::list<Entry> EntryListType;
+
+    static FilePtr load(const std::string &path, const FilePtr &current);
+
+    size_t _maxFiles;
+    float _checkInterval;
+    mutable std::mutex _mutex;
+    EntryListType _entries;
+    std::unordered_map<std::string, EntryListType::iterator> _index;
+};
+
+
+#endif //TINYCORE_STATICFILE_H
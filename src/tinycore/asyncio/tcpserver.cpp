@@ -3,7 +3,11 @@
 //
 
 #include "tinycore/asyncio/tcpserver.h"
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "tinycore/asyncio/ioloop.h"
+#include "tinycore/utilities/string.h"
 
 
 TCPServer::TCPServer(IOLoop *ioloop, std::shared_ptr<SSLOption> sslOption, size_t maxBufferSize)
@@ -27,36 +31,158 @@ void TCPServer::listen(unsigned short port, std::string address) {
 void TCPServer::bind(unsigned short port, std::string address) {
     BaseIOStream::ResolverType resolver(_ioloop->getService());
     BaseIOStream::ResolverType::query query(address, std::to_string(port));
-    BaseIOStream::EndPointType endpoint = *resolver.resolve(query);
-    _acceptor.open(endpoint.protocol());
-    _acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    BaseIOStream::EndPointType endpoint = resolver.resolve(query)->endpoint();
+    _protocol = endpoint.protocol();
+    _acceptor.open(_protocol);
+    _acceptor.set_option(AcceptorType::reuse_address(true));
+#ifdef SO_REUSEPORT
+    if (_reusePort) {
+        setSocketOption(SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+    }
+#endif
     _acceptor.bind(endpoint);
-    _acceptor.listen();
+#ifdef TCP_DEFER_ACCEPT
+    if (_deferAccept > 0) {
+        setSocketOption(IPPROTO_TCP, TCP_DEFER_ACCEPT, _deferAccept, "TCP_DEFER_ACCEPT");
+    }
+#endif
+#ifdef TCP_FASTOPEN
+    if (_fastOpen > 0) {
+        setSocketOption(IPPROTO_TCP, TCP_FASTOPEN, _fastOpen, "TCP_FASTOPEN");
+    }
+#endif
+    _acceptor.non_blocking(true);
+    _acceptor.listen(_backlog);
+}
+
+void TCPServer::listenUnix(const std::string &address, int mode) {
+    bindUnix(address, mode);
+    start();
+}
+
+void TCPServer::bindUnix(const std::string &address, int mode) {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    std::string path = NetUtil::getUnixPath(address);
+    bool abstract = NetUtil::isAbstractUnixPath(path);
+    if (!abstract) {
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                ThrowException(ValueError, String::format("File %s exists and is not a socket", path.c_str()));
+            }
+            ::unlink(path.c_str());
+        } else if (errno != ENOENT) {
+            throw boost::system::system_error(errno, boost::system::system_category());
+        }
+    }
+    BaseIOStream::EndPointType endpoint = boost::asio::local::stream_protocol::endpoint(path);
+    _protocol = endpoint.protocol();
+    _acceptor.open(_protocol);
+    _acceptor.bind(endpoint);
+    if (!abstract) {
+        _unixPath = path;
+        if (::chmod(path.c_str(), (mode_t)mode) != 0) {
+            throw boost::system::system_error(errno, boost::system::system_category());
+        }
+    }
+    _acceptor.non_blocking(true);
+    _acceptor.listen(_backlog);
+#else
+    ThrowException(NotImplementedError, "Unix domain sockets not supported");
+#endif
 }
 
 void TCPServer::stop() {
     _acceptor.close();
+    if (!_unixPath.empty()) {
+        ::unlink(_unixPath.c_str());
+        _unixPath.clear();
+    }
+}
+
+void TCPServer::resumeAccepting() {
+    if (_acceptPaused) {
+        _acceptPaused = false;
+        if (!_acceptPending && _acceptor.is_open()) {
+            accept();
+        }
+    }
 }
 
 void TCPServer::onAccept(const boost::system::error_code &ec) {
+    _acceptPending = false;
     if (ec) {
         if (ec != boost::asio::error::operation_aborted) {
             throw boost::system::system_error(ec);
         }
     } else {
-        try {
-            std::shared_ptr<BaseIOStream> stream;
-            if (_sslOption) {
-                stream = SSLIOStream::create(std::move(_socket), _sslOption, _ioloop, _maxBufferSize);
-            } else {
-                stream = IOStream::create(std::move(_socket), _ioloop, _maxBufferSize);
-            }
-            stream->start();
-            std::string remoteAddress = stream->getRemoteAddress();
-            handleStream(std::move(stream), std::move(remoteAddress));
-        } catch (std::exception &e) {
-            LOG_ERROR(gAppLog, "Error in connection callback:%s", e.what());
+        handleAccepted();
+        acceptBurst();
+        if (!_acceptPaused) {
+            accept();
         }
-        accept();
     }
-}
\ No newline at end of file
+}
+
+void TCPServer::acceptBurst() {
+    // The reactor only tells us the backlog is non-empty; drain it directly instead of paying a full async_accept
+    // round trip per connection, but stop after the budget so one storm cannot starve the other handlers.
+    for (size_t i = 1; i < _acceptBudget && _acceptor.is_open() && !_acceptPaused; ++i) {
+        if (!acceptNonBlocking()) {
+            break;
+        }
+        handleAccepted();
+    }
+}
+
+bool TCPServer::acceptNonBlocking() {
+#if defined(__linux__)
+    int fd = ::accept4(_acceptor.native_handle(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR) {
+            LOG_WARNING(gGenLog, "Accept error %d :%s", errno, strerror(errno));
+        }
+        return false;
+    }
+    boost::system::error_code ec;
+    _socket.assign(_protocol, fd, ec);
+    if (ec) {
+        ::close(fd);
+        LOG_WARNING(gGenLog, "Accept error %d :%s", ec.value(), ec.message());
+        return false;
+    }
+    return true;
+#else
+    boost::system::error_code ec;
+    _acceptor.accept(_socket, ec);
+    if (ec) {
+        if (ec != boost::asio::error::would_block && ec != boost::asio::error::try_again) {
+            LOG_WARNING(gGenLog, "Accept error %d :%s", ec.value(), ec.message());
+        }
+        return false;
+    }
+    return true;
+#endif
+}
+
+void TCPServer::handleAccepted() {
+    try {
+        std::shared_ptr<BaseIOStream> stream;
+        if (_sslOption) {
+            stream = SSLIOStream::create(std::move(_socket), _sslOption, _ioloop, _maxBufferSize);
+        } else {
+            stream = IOStream::create(std::move(_socket), _ioloop, _maxBufferSize);
+        }
+        stream->start();
+        std::string remoteAddress = stream->getRemoteAddress();
+        handleStream(std::move(stream), std::move(remoteAddress));
+    } catch (std::exception &e) {
+        LOG_ERROR(gAppLog, "Error in connection callback:%s", e.what());
+    }
+}
+
+void TCPServer::setSocketOption(int level, int name, int value, const char *optionName) {
+    if (::setsockopt(_acceptor.native_handle(), level, name, &value, sizeof(value)) != 0) {
+        LOG_WARNING(gGenLog, "Failed to set %s on listening socket %d :%s", optionName, errno, strerror(errno));
+    }
+}
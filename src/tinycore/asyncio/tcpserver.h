@@ -10,9 +10,13 @@
 #include "tinycore/asyncio/netutil.h"
 
 
+constexpr size_t DEFAULT_ACCEPT_BUDGET = 128;
+
+
 class TC_COMMON_API TCPServer: public std::enable_shared_from_this<TCPServer> {
 public:
-    typedef boost::asio::ip::tcp::acceptor AcceptorType;
+    typedef boost::asio::basic_socket_acceptor<boost::asio::generic::stream_protocol> AcceptorType;
+    typedef AcceptorType::protocol_type ProtocolType;
 
     TCPServer(IOLoop *ioloop = nullptr, std::shared_ptr<SSLOption> sslOption = nullptr, size_t maxBufferSize=0);
     virtual ~TCPServer();
@@ -23,30 +27,98 @@ public:
 
     void bind(unsigned short port, std::string address);
 
+    void listenUnix(const std::string &address, int mode=0600);
+
+    void bindUnix(const std::string &address, int mode=0600);
+
     void start() {
         accept();
     }
 
+    void setBacklog(int backlog) {
+        _backlog = backlog;
+    }
+
+    int getBacklog() const {
+        return _backlog;
+    }
+
+    void setAcceptBudget(size_t acceptBudget) {
+        _acceptBudget = std::max(acceptBudget, (size_t)1);
+    }
+
+    size_t getAcceptBudget() const {
+        return _acceptBudget;
+    }
+
+    void setDeferAccept(int seconds) {
+        _deferAccept = seconds;
+    }
+
+    int getDeferAccept() const {
+        return _deferAccept;
+    }
+
+    void setFastOpen(int queueLength) {
+        _fastOpen = queueLength;
+    }
+
+    int getFastOpen() const {
+        return _fastOpen;
+    }
+
+    void setReusePort(bool reusePort) {
+        _reusePort = reusePort;
+    }
+
+    bool getReusePort() const {
+        return _reusePort;
+    }
+
     unsigned short getLocalPort() const {
-        auto endpoint = _acceptor.local_endpoint();
-        return endpoint.port();
+        return NetUtil::getPort(_acceptor.local_endpoint());
     }
 
     void stop();
 
+    // Leaves new connections in the listen backlog until resumeAccepting is called
+    void pauseAccepting() {
+        _acceptPaused = true;
+    }
+
+    void resumeAccepting();
+
+    bool isAcceptPaused() const {
+        return _acceptPaused;
+    }
+
     virtual void handleStream(std::shared_ptr<BaseIOStream> stream, std::string address) = 0;
 protected:
     void accept() {
+        _acceptPending = true;
         _acceptor.async_accept(_socket, std::bind(&TCPServer::onAccept, shared_from_this(), std::placeholders::_1));
     }
 
     void onAccept(const boost::system::error_code &ec);
+    void acceptBurst();
+    bool acceptNonBlocking();
+    void handleAccepted();
+    void setSocketOption(int level, int name, int value, const char *optionName);
 
     IOLoop *_ioloop;
     std::shared_ptr<SSLOption> _sslOption;
     AcceptorType _acceptor;
     BaseIOStream::SocketType _socket;
     size_t _maxBufferSize;
+    std::string _unixPath;
+    ProtocolType _protocol{AF_INET, IPPROTO_TCP};
+    int _backlog{AcceptorType::max_listen_connections};
+    size_t _acceptBudget{DEFAULT_ACCEPT_BUDGET};
+    int _deferAccept{0};
+    int _fastOpen{0};
+    bool _reusePort{false};
+    bool _acceptPending{false};
+    bool _acceptPaused{false};
 };
 
 #endif //TINYCORE_TCPSERVER_H
@@ -119,8 +119,11 @@ std::shared_ptr<HTTPClient> AsyncHTTPTestCase::getHTTPClient() {
 }
 
 std::shared_ptr<HTTPServer> AsyncHTTPTestCase::getHTTPServer() {
-    return std::make_shared<HTTPServer>(HTTPServerCB(*_app), getHTTPServerNoKeepAlive(), &_ioloop,
-                                        getHTTPServerXHeaders(), getHTTPServerProtocol(), getHTTPServerSSLOption());
+    auto server = std::make_shared<HTTPServer>(HTTPServerCB(*_app), getHTTPServerNoKeepAlive(), &_ioloop,
+                                               getHTTPServerXHeaders(), getHTTPServerProtocol(),
+                                               getHTTPServerSSLOption());
+    server->setStreamBodyCallback(HTTPServerStreamBodyCB(*_app));
+    return server;
 }
 
 bool AsyncHTTPTestCase::getHTTPServerNoKeepAlive() const {
@@ -0,0 +1,392 @@
+//
+// UDP endpoint with batched datagram I/O.
+//
+
+#include "tinycore/asyncio/udpendpoint.h"
+#ifdef TC_UDP_USE_MMSG
+#include <netinet/udp.h>
+#endif
+#include "tinycore/asyncio/logutil.h"
+#include "tinycore/common/errors.h"
+#include "tinycore/debugging/watcher.h"
+
+
+UDPEndpoint::UDPEndpoint(IOLoop *ioloop, size_t batchSize, size_t datagramSize)
+        : _ioloop(ioloop ? ioloop : IOLoop::current())
+        , _socket(_ioloop->getService())
+        , _batchSize(std::max(batchSize, (size_t)1))
+        , _datagramSize(datagramSize) {
+#ifdef TC_UDP_USE_MMSG
+    _msgs.resize(_batchSize);
+    _iovecs.resize(_batchSize);
+    _addresses.resize(_batchSize);
+    _controls.resize(_batchSize * CMSG_SPACE(sizeof(int)));
+    _segments.resize(_batchSize);
+#endif
+#ifndef NDEBUG
+    sWatcher->inc(SYS_UDPENDPOINT_COUNT);
+#endif
+}
+
+UDPEndpoint::~UDPEndpoint() {
+#ifndef NDEBUG
+    sWatcher->dec(SYS_UDPENDPOINT_COUNT);
+#endif
+}
+
+void UDPEndpoint::bind(unsigned short port, std::string address) {
+    ResolverType resolver(_ioloop->getService());
+    ResolverType::query query(address, std::to_string(port));
+    EndPointType endpoint = resolver.resolve(query)->endpoint();
+    _socket.open(endpoint.protocol());
+    _socket.set_option(SocketType::reuse_address(true));
+    _socket.bind(endpoint);
+    _socket.non_blocking(true);
+}
+
+bool UDPEndpoint::setGRO(bool value) {
+#if defined(TC_UDP_USE_MMSG) && defined(UDP_GRO)
+    if (closed()) {
+        return false;
+    }
+    int option = value ? 1 : 0;
+    if (::setsockopt(_socket.native_handle(), SOL_UDP, UDP_GRO, &option, sizeof(option)) != 0) {
+        return false;
+    }
+    _gro = value;
+    _recvBuffer.clear();
+    return true;
+#else
+    return !value;
+#endif
+}
+
+bool UDPEndpoint::setGSO(bool value) {
+#if defined(TC_UDP_USE_MMSG) && defined(UDP_SEGMENT)
+    if (value) {
+        if (closed()) {
+            return false;
+        }
+        int segmentSize = 0;
+        socklen_t length = sizeof(segmentSize);
+        if (::getsockopt(_socket.native_handle(), SOL_UDP, UDP_SEGMENT, &segmentSize, &length) != 0) {
+            return false;
+        }
+    }
+    _gso = value;
+    return true;
+#else
+    return !value;
+#endif
+}
+
+void UDPEndpoint::startReading(BatchCallbackType callback) {
+    if (closed()) {
+        ThrowException(IOError, "Endpoint is not bound");
+    }
+    _batchCallback = StackContext::wrap<const BatchType &>(std::move(callback));
+    if (!_reading) {
+        waitReadable();
+    }
+}
+
+bool UDPEndpoint::sendTo(const Byte *data, size_t length, const EndPointType &destination) {
+    if (closed()) {
+        _socket.open(destination.protocol());
+        _socket.non_blocking(true);
+    }
+    if (_sendHighWaterMark != 0 && getPendingSendBytes() + length > _sendHighWaterMark) {
+        _sendBlocked = true;
+        ++_sendBlockedCount;
+        return false;
+    }
+    _sendQueue.push_back({_sendBuffer.size(), length, destination});
+    _sendBuffer.insert(_sendBuffer.end(), data, data + length);
+    if (_writing) {
+        return true;
+    }
+    if (_sendQueue.size() - _sendIndex >= _batchSize) {
+        flush();
+    } else if (!_flushScheduled) {
+        _flushScheduled = true;
+        _ioloop->addCallback(std::bind(&UDPEndpoint::flush, shared_from_this()));
+    }
+    return true;
+}
+
+void UDPEndpoint::flush() {
+    _flushScheduled = false;
+    if (_writing || closed()) {
+        return;
+    }
+    while (_sendIndex < _sendQueue.size()) {
+        if (!sendBatch()) {
+            waitWritable();
+            return;
+        }
+    }
+    _sendQueue.clear();
+    _sendBuffer.clear();
+    _sendIndex = 0;
+    if (_sendBlocked) {
+        _sendBlocked = false;
+        if (_writableCallback) {
+            _ioloop->addCallback(_writableCallback);
+        }
+    }
+}
+
+void UDPEndpoint::close() {
+    _batchCallback = nullptr;
+    _writableCallback = nullptr;
+    _sendBlocked = false;
+    if (!closed()) {
+        boost::system::error_code ec;
+        _socket.close(ec);
+    }
+    _sendQueue.clear();
+    _sendBuffer.clear();
+    _sendIndex = 0;
+}
+
+void UDPEndpoint::waitReadable() {
+    _socket.async_wait(SocketType::wait_read, std::bind(&UDPEndpoint::onReadable, shared_from_this(),
+                                                        std::placeholders::_1));
+    _reading = true;
+}
+
+void UDPEndpoint::waitWritable() {
+    _socket.async_wait(SocketType::wait_write, std::bind(&UDPEndpoint::onWritable, shared_from_this(),
+                                                         std::placeholders::_1));
+    _writing = true;
+}
+
+void UDPEndpoint::onReadable(const boost::system::error_code &ec) {
+    _reading = false;
+    if (ec) {
+        if (ec != boost::asio::error::operation_aborted) {
+            LOG_WARNING(gGenLog, "Datagram read error %d :%s", ec.value(), ec.message());
+        }
+        return;
+    }
+    // Drain several full batches per wakeup so a burst of packets costs one trip through the reactor.
+    for (size_t i = 0; i != MAX_UDP_BATCHES_PER_WAKEUP && _batchCallback; ++i) {
+        if (receiveBatch() < _batchSize) {
+            break;
+        }
+    }
+    if (_batchCallback && !closed()) {
+        waitReadable();
+    }
+}
+
+void UDPEndpoint::onWritable(const boost::system::error_code &ec) {
+    _writing = false;
+    if (ec) {
+        if (ec != boost::asio::error::operation_aborted) {
+            LOG_WARNING(gGenLog, "Datagram write error %d :%s", ec.value(), ec.message());
+        }
+        return;
+    }
+    flush();
+}
+
+#ifdef TC_UDP_USE_MMSG
+
+size_t UDPEndpoint::receiveBatch() {
+    const size_t bufferSize = getBufferSize();
+    if (_recvBuffer.size() != _batchSize * bufferSize) {
+        _recvBuffer.resize(_batchSize * bufferSize);
+    }
+    const size_t controlSize = CMSG_SPACE(sizeof(int));
+    for (size_t i = 0; i != _batchSize; ++i) {
+        _iovecs[i].iov_base = _recvBuffer.data() + i * bufferSize;
+        _iovecs[i].iov_len = bufferSize;
+        msghdr &header = _msgs[i].msg_hdr;
+        header.msg_name = &_addresses[i];
+        header.msg_namelen = sizeof(sockaddr_storage);
+        header.msg_iov = &_iovecs[i];
+        header.msg_iovlen = 1;
+        header.msg_control = _gro ? _controls.data() + i * controlSize : nullptr;
+        header.msg_controllen = _gro ? controlSize : 0;
+        header.msg_flags = 0;
+        _msgs[i].msg_len = 0;
+    }
+    int count = ::recvmmsg(_socket.native_handle(), _msgs.data(), (unsigned int)_batchSize, MSG_DONTWAIT, nullptr);
+    if (count < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            LOG_WARNING(gGenLog, "recvmmsg error %d :%s", errno, strerror(errno));
+        }
+        return 0;
+    }
+    _batch.clear();
+    EndPointType sender;
+    for (int i = 0; i != count; ++i) {
+        const msghdr &header = _msgs[i].msg_hdr;
+        memcpy(sender.data(), &_addresses[i], header.msg_namelen);
+        sender.resize(header.msg_namelen);
+        const Byte *data = (const Byte *)_iovecs[i].iov_base;
+        size_t length = _msgs[i].msg_len;
+        size_t segmentSize = length;
+        if (_gro) {
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR((msghdr *)&header, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    int gsoSize;
+                    memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+                    if (gsoSize > 0) {
+                        segmentSize = (size_t)gsoSize;
+                    }
+                }
+            }
+        }
+        do {
+            size_t segment = std::min(segmentSize, length);
+            _batch.emplace_back(data, segment, sender);
+            data += segment;
+            length -= segment;
+        } while (length > 0);
+    }
+    ++_receiveBatchCount;
+    _receivedCount += _batch.size();
+    runBatchCallback();
+    return (size_t)count;
+}
+
+bool UDPEndpoint::sendBatch() {
+    size_t count = 0, index = _sendIndex;
+    std::vector<size_t> &segments = _segments;
+    const size_t controlSize = CMSG_SPACE(sizeof(uint16_t));
+    while (count != _batchSize && index != _sendQueue.size()) {
+        const PendingDatagram &first = _sendQueue[index];
+        size_t segmentCount = 1, length = first.length;
+        if (_gso) {
+            // Datagrams queued back to back share one contiguous region of the send buffer, so consecutive ones of
+            // the same size to the same peer go out as a single segmented send; only the last may be shorter.
+            while (index + segmentCount != _sendQueue.size() && segmentCount != MAX_UDP_GSO_SEGMENTS) {
+                const PendingDatagram &next = _sendQueue[index + segmentCount];
+                if (next.destination != first.destination || next.length > first.length ||
+                    length + next.length > MAX_UDP_PAYLOAD_SIZE) {
+                    break;
+                }
+                length += next.length;
+                ++segmentCount;
+                if (next.length < first.length) {
+                    break;
+                }
+            }
+        }
+        _iovecs[count].iov_base = _sendBuffer.data() + first.offset;
+        _iovecs[count].iov_len = length;
+        msghdr &header = _msgs[count].msg_hdr;
+        header.msg_name = (void *)first.destination.data();
+        header.msg_namelen = (socklen_t)first.destination.size();
+        header.msg_iov = &_iovecs[count];
+        header.msg_iovlen = 1;
+        header.msg_control = nullptr;
+        header.msg_controllen = 0;
+        header.msg_flags = 0;
+        if (segmentCount > 1) {
+            header.msg_control = _controls.data() + count * CMSG_SPACE(sizeof(int));
+            header.msg_controllen = controlSize;
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segmentSize = (uint16_t)first.length;
+            memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+        }
+        segments[count] = segmentCount;
+        index += segmentCount;
+        ++count;
+    }
+    int sent = ::sendmmsg(_socket.native_handle(), _msgs.data(), (unsigned int)count, MSG_DONTWAIT);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        if (errno == EINTR) {
+            return true;
+        }
+        if (errno == EIO && segments[0] > 1) {
+            LOG_WARNING(gGenLog, "UDP GSO rejected by the device, falling back to plain sends");
+            _gso = false;
+            return true;
+        }
+        LOG_WARNING(gGenLog, "sendmmsg error %d :%s", errno, strerror(errno));
+        ++_sendErrorCount;
+        _sendIndex += segments[0];
+        return true;
+    }
+    ++_sendBatchCount;
+    for (int i = 0; i != sent; ++i) {
+        _sendIndex += segments[i];
+        _sentCount += segments[i];
+    }
+    return true;
+}
+
+#else
+
+size_t UDPEndpoint::receiveBatch() {
+    const size_t bufferSize = getBufferSize();
+    if (_recvBuffer.size() != _batchSize * bufferSize) {
+        _recvBuffer.resize(_batchSize * bufferSize);
+    }
+    _batch.clear();
+    EndPointType sender;
+    boost::system::error_code ec;
+    for (size_t i = 0; i != _batchSize; ++i) {
+        Byte *data = _recvBuffer.data() + i * bufferSize;
+        size_t length = _socket.receive_from(boost::asio::buffer(data, bufferSize), sender, 0, ec);
+        if (ec) {
+            if (ec != boost::asio::error::would_block) {
+                LOG_WARNING(gGenLog, "Datagram read error %d :%s", ec.value(), ec.message());
+            }
+            break;
+        }
+        _batch.emplace_back(data, length, sender);
+    }
+    if (_batch.empty()) {
+        return 0;
+    }
+    ++_receiveBatchCount;
+    _receivedCount += _batch.size();
+    size_t count = _batch.size();
+    runBatchCallback();
+    return count;
+}
+
+bool UDPEndpoint::sendBatch() {
+    boost::system::error_code ec;
+    size_t end = std::min(_sendQueue.size(), _sendIndex + _batchSize);
+    while (_sendIndex != end) {
+        const PendingDatagram &datagram = _sendQueue[_sendIndex];
+        _socket.send_to(boost::asio::buffer(_sendBuffer.data() + datagram.offset, datagram.length),
+                        datagram.destination, 0, ec);
+        if (ec == boost::asio::error::would_block) {
+            return false;
+        }
+        if (ec) {
+            LOG_WARNING(gGenLog, "Datagram write error %d :%s", ec.value(), ec.message());
+            ++_sendErrorCount;
+        } else {
+            ++_sentCount;
+        }
+        ++_sendIndex;
+    }
+    ++_sendBatchCount;
+    return true;
+}
+
+#endif
+
+void UDPEndpoint::runBatchCallback() {
+    if (_batch.empty() || !_batchCallback) {
+        return;
+    }
+    try {
+        _batchCallback(_batch);
+    } catch (std::exception &e) {
+        LOG_ERROR(gAppLog, "Error in datagram callback:%s", e.what());
+    }
+}
@@ -0,0 +1,204 @@
+//
+// UDP endpoint with batched datagram I/O.
+//
+
+#ifndef TINYCORE_UDPENDPOINT_H
+#define TINYCORE_UDPENDPOINT_H
+
+#include "tinycore/common/common.h"
+#include <boost/asio.hpp>
+#include "tinycore/asyncio/ioloop.h"
+
+#if defined(__linux__)
+#define TC_UDP_USE_MMSG
+#include <sys/socket.h>
+#endif
+
+
+constexpr size_t DEFAULT_UDP_BATCH_SIZE = 64;
+constexpr size_t DEFAULT_UDP_DATAGRAM_SIZE = 2048;
+constexpr size_t MAX_UDP_GRO_BUFFER_SIZE = 65535;
+constexpr size_t MAX_UDP_PAYLOAD_SIZE = 65507;
+constexpr size_t MAX_UDP_GSO_SEGMENTS = 64;
+constexpr size_t MAX_UDP_BATCHES_PER_WAKEUP = 8;
+constexpr size_t DEFAULT_UDP_SEND_HIGH_WATER_MARK = 4 * 1024 * 1024;
+
+
+class UDPDatagram {
+public:
+    typedef boost::asio::ip::udp::endpoint EndPointType;
+
+    UDPDatagram(const Byte *data, size_t length, const EndPointType &sender)
+            : _data(data)
+            , _length(length)
+            , _sender(sender) {
+
+    }
+
+    const Byte* getData() const {
+        return _data;
+    }
+
+    size_t getLength() const {
+        return _length;
+    }
+
+    const EndPointType& getSender() const {
+        return _sender;
+    }
+protected:
+    const Byte *_data;
+    size_t _length;
+    EndPointType _sender;
+};
+
+
+class TC_COMMON_API UDPEndpoint: public std::enable_shared_from_this<UDPEndpoint> {
+public:
+    typedef boost::asio::ip::udp::socket SocketType;
+    typedef boost::asio::ip::udp::resolver ResolverType;
+    typedef boost::asio::ip::udp::endpoint EndPointType;
+    typedef std::vector<UDPDatagram> BatchType;
+    typedef std::function<void (const BatchType &)> BatchCallbackType;
+    typedef std::function<void ()> WritableCallbackType;
+
+    UDPEndpoint(IOLoop *ioloop=nullptr,
+                size_t batchSize=DEFAULT_UDP_BATCH_SIZE,
+                size_t datagramSize=DEFAULT_UDP_DATAGRAM_SIZE);
+    virtual ~UDPEndpoint();
+    UDPEndpoint(const UDPEndpoint &) = delete;
+    UDPEndpoint &operator=(const UDPEndpoint &) = delete;
+
+    void bind(unsigned short port, std::string address = "::");
+
+    bool setGRO(bool value);
+
+    bool setGSO(bool value);
+
+    bool isGROEnabled() const {
+        return _gro;
+    }
+
+    bool isGSOEnabled() const {
+        return _gso;
+    }
+
+    void startReading(BatchCallbackType callback);
+
+    void stopReading() {
+        _batchCallback = nullptr;
+    }
+
+    // Returns false without queueing when the datagram would push the unsent bytes past the high-water mark; the
+    // writable callback then runs once the queue has drained
+    bool sendTo(const Byte *data, size_t length, const EndPointType &destination);
+
+    void setSendHighWaterMark(size_t highWaterMark) {
+        _sendHighWaterMark = highWaterMark;
+    }
+
+    size_t getSendHighWaterMark() const {
+        return _sendHighWaterMark;
+    }
+
+    void setWritableCallback(WritableCallbackType callback) {
+        _writableCallback = callback ? StackContext::wrap(std::move(callback)) : nullptr;
+    }
+
+    size_t getPendingSendBytes() const {
+        return _sendIndex < _sendQueue.size() ? _sendBuffer.size() - _sendQueue[_sendIndex].offset : 0;
+    }
+
+    void flush();
+
+    void close();
+
+    bool closed() const {
+        return !_socket.is_open();
+    }
+
+    unsigned short getLocalPort() const {
+        return _socket.local_endpoint().port();
+    }
+
+    size_t getReceivedCount() const {
+        return _receivedCount;
+    }
+
+    size_t getReceiveBatchCount() const {
+        return _receiveBatchCount;
+    }
+
+    size_t getSentCount() const {
+        return _sentCount;
+    }
+
+    size_t getSendBatchCount() const {
+        return _sendBatchCount;
+    }
+
+    size_t getSendErrorCount() const {
+        return _sendErrorCount;
+    }
+
+    size_t getSendBlockedCount() const {
+        return _sendBlockedCount;
+    }
+
+    template <typename ...Args>
+    static std::shared_ptr<UDPEndpoint> create(Args&& ...args) {
+        return std::make_shared<UDPEndpoint>(std::forward<Args>(args)...);
+    }
+protected:
+    struct PendingDatagram {
+        size_t offset;
+        size_t length;
+        EndPointType destination;
+    };
+
+    void waitReadable();
+    void waitWritable();
+    void onReadable(const boost::system::error_code &ec);
+    void onWritable(const boost::system::error_code &ec);
+    size_t receiveBatch();
+    bool sendBatch();
+    void runBatchCallback();
+
+    size_t getBufferSize() const {
+        return _gro ? MAX_UDP_GRO_BUFFER_SIZE : _datagramSize;
+    }
+
+    IOLoop *_ioloop;
+    SocketType _socket;
+    size_t _batchSize;
+    size_t _datagramSize;
+    bool _gro{false};
+    bool _gso{false};
+    bool _reading{false};
+    bool _writing{false};
+    bool _flushScheduled{false};
+    bool _sendBlocked{false};
+    BatchCallbackType _batchCallback;
+    WritableCallbackType _writableCallback;
+    ByteArray _recvBuffer;
+    BatchType _batch;
+    ByteArray _sendBuffer;
+    std::vector<PendingDatagram> _sendQueue;
+    size_t _sendIndex{0};
+    size_t _sendHighWaterMark{DEFAULT_UDP_SEND_HIGH_WATER_MARK};
+#ifdef TC_UDP_USE_MMSG
+    std::vector<mmsghdr> _msgs;
+    std::vector<iovec> _iovecs;
+    std::vector<sockaddr_storage> _addresses;
+    ByteArray _controls;
+    std::vector<size_t> _segments;
+#endif
+    size_t _receivedCount{0};
+    size_t _receiveBatchCount{0};
+    size_t _sentCount{0};
+    size_t _sendBatchCount{0};
+    size_t _sendErrorCount{0};
+    size_t _sendBlockedCount{0};
+};
+
+#endif //TINYCORE_UDPENDPOINT_H
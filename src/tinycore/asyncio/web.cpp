@@ -3,9 +3,9 @@
 //
 
 #include "tinycore/asyncio/web.h"
+#include <unistd.h>
 #include <boost/regex.hpp>
 #include "tinycore/asyncio/logutil.h"
-#include "tinycore/crypto/hashlib.h"
 #include "tinycore/debugging/trace.h"
 #include "tinycore/debugging/watcher.h"
 
@@ -16,7 +16,11 @@ const boost::regex RequestHandler::_invalidHeaderCharRe(R"([\x00-\x1f])");
 
 RequestHandler::RequestHandler(Application *application, std::shared_ptr<HTTPServerRequest> request)
         : _application(application)
-        , _request(std::move(request)) {
+        , _request(std::move(request))
+        , _autoEtag(application->getAutoEtag())
+        , _etagMaxSize(application->getEtagMaxSize()) {
+    const std::string &method = _request->getMethod();
+    _etagHashing = _autoEtag && (method == "GET" || method == "HEAD");
     clear();
 #ifndef NDEBUG
     sWatcher->inc(SYS_REQUESTHANDLER_COUNT);
@@ -24,13 +28,24 @@ RequestHandler::RequestHandler(Application *application, std::shared_ptr<HTTPSer
 }
 
 RequestHandler::~RequestHandler() {
+    if (_overloadController) {
+        _overloadController->release();
+    }
+    if (_flight) {
+        // The leader went away without finishing, let every waiter run its own handler
+        _flight->shareable = false;
+        Application *application = _application;
+        IOLoop::current()->addCallback([application, flight=std::move(_flight)]() {
+            application->landFlight(std::move(flight));
+        });
+    }
 #ifndef NDEBUG
     sWatcher->dec(SYS_REQUESTHANDLER_COUNT);
 #endif
 }
 
 void RequestHandler::start(ArgsType &args) {
-    _request->getConnection()->setCloseCallback(std::bind(&RequestHandler::onConnectionClose, shared_from_this()));
+    _request->setCloseCallback(std::bind(&RequestHandler::onConnectionClose, shared_from_this()));
     initialize(args);
 }
 
@@ -78,22 +93,27 @@ void RequestHandler::onFinish() {
 
 }
 
+void RequestHandler::dataReceived(ByteArray chunk) {
+    ThrowException(NotImplementedError, "dataReceived");
+}
+
 void RequestHandler::onConnectionClose() {
 
 }
 
 void RequestHandler::clear() {
+    IOLoop *ioloop = IOLoop::current();
     _headers = HTTPHeaders({
             {"Server", TINYCORE_VER },
             {"Content-Type", "text/html; charset=UTF-8"},
-            {"Date", HTTPUtil::formatTimestamp(time(nullptr))},
+            {"Date", ioloop ? ioloop->getHTTPDate() : HTTPUtil::formatTimestamp(time(nullptr))},
     });
     setDefaultHeaders();
     if (!_request->supportsHTTP11() && !_request->getConnection()->getNoKeepAlive()) {
-        auto connHeader = _request->getHTTPHeaders()->get("Connection");
+        auto connHeader = _request->getHTTPHeaders()->get(HTTPHeaderField::CONNECTION);
         if (!connHeader.empty() && boost::to_lower_copy(connHeader) == "keep-alive") {
 //            setHeader("Connection", "Keep-Alive");
-            _headers["Connection"] = "Keep-Alive";
+            _headers[HTTPHeaderField::CONNECTION] = "Keep-Alive";
         }
     }
 //    _writeBuffer.clear();
@@ -168,35 +188,76 @@ void RequestHandler::redirect(const std::string &url, bool permanent, boost::opt
 
 void RequestHandler::flush(bool includeFooters, FlushCallbackType callback) {
     ByteArray chunk = std::move(_writeBuffer);
+    _etagHashing = false;
     std::string headers;
+    size_t headLength = 0;
     if (!_headersWritten) {
         _headersWritten = true;
+        ByteArray body;
+        bool encoded = false;
+        if (_storeResponse) {
+            body = chunk;
+            encoded = _headers.has(HTTPHeaderField::CONTENT_ENCODING);
+        }
         for (auto &transfrom: _transforms) {
             transfrom.transformFirstChunk(_statusCode, _headers, chunk, includeFooters);
         }
+        if (_newCookie) {
+            _newCookie->getAll([this](const std::string &key, const Morsel &cookie) {
+                _headers.add(HTTPHeaderField::SET_COOKIE, cookie.outputString());
+            });
+        }
         headers = generateHeaders();
+        headLength = headers.size();
+        if (_flight) {
+            if (_headers.has(HTTPHeaderField::SET_COOKIE)) {
+                _flight->shareable = false;
+            } else {
+                _flight->statusCode = _statusCode;
+                _flight->headers = _headers;
+                _flight->headLength = headLength;
+            }
+        }
+        if (_storeResponse) {
+            ByteArray gzipBody;
+            if (!encoded && _headers.get(HTTPHeaderField::CONTENT_ENCODING) == "gzip") {
+                gzipBody = chunk;
+            }
+            _responseCache->store(*_request, _statusCode, _reason, _headers, std::move(body), std::move(gzipBody));
+        }
     } else {
         for (auto &transfrom: _transforms) {
             transfrom.transformChunk(chunk, includeFooters);
         }
     }
     if (_request->getMethod() == "HEAD") {
-        if (!headers.empty()) {
-            _request->write(headers, std::move(callback));
+        if (headLength) {
+            if (_flight) {
+                _application->getRequestCoalescer()->record(*_flight, headers);
+            }
+            _request->writeHeaders(_statusCode, _headers, headers, headLength, std::move(callback));
         }
         return;
     }
     if (!chunk.empty()) {
         headers.append((const char *)chunk.data(), chunk.size());
     }
-    _request->write(headers, std::move(callback));
+    if (_flight) {
+        _application->getRequestCoalescer()->record(*_flight, headers);
+    }
+    if (headLength) {
+        _request->writeHeaders(_statusCode, _headers, headers, headLength, std::move(callback));
+    } else {
+        _request->write(headers, std::move(callback));
+    }
 }
 
 void RequestHandler::finish() {
     ASSERT(!_finished);
     if (!_headersWritten) {
         const std::string &method = _request->getMethod();
-        if (_statusCode == 200 && (method == "GET" || method == "HEAD") && !_headers.has("Etag")) {
+        if (_statusCode == 200 && (method == "GET" || method == "HEAD") && !_headers.has(HTTPHeaderField::ETAG)
+            && isEtagWanted()) {
             setEtagHeader();
             if (checkEtagHeader()) {
                 _writeBuffer.clear();
@@ -206,13 +267,22 @@ void RequestHandler::finish() {
         if (_statusCode == 304) {
             ASSERT(_writeBuffer.empty(), "Cannot send body with 304");
             clearHeadersFor304();
-        } else if (!_headers.has("Content-Length")) {
+        } else if (!_headers.has(HTTPHeaderField::CONTENT_LENGTH)) {
             setHeader("Content-Length", _writeBuffer.size());
         }
+        _storeResponse = _responseCache && !_newCookie && _responseCache->isStorable(*_request, _statusCode, _headers);
     }
-    _request->getConnection()->setCloseCallback(nullptr);
+    _request->setCloseCallback(nullptr);
     flush(true);
     _request->finish();
+    if (_overloadController) {
+        // The request stops counting as in flight once it is answered, not when its handler goes away
+        _overloadController->release();
+        _overloadController.reset();
+    }
+    if (_flight) {
+        _application->landFlight(std::move(_flight));
+    }
     log();
     _finished = true;
     onFinish();
@@ -278,16 +348,31 @@ void RequestHandler::requireSetting(const std::string &name, const std::string &
 }
 
 boost::optional<std::string> RequestHandler::computeEtag() const {
-    SHA1Object hasher;
+    if (_etagHashing && _etagHasher.getLength() == _writeBuffer.size()) {
+        return "\"" + _etagHasher.hex() + "\"";
+    }
+    XXHash64 hasher;
     hasher.update(_writeBuffer);
-    std::string etag = "\"" + hasher.hex() + "\"";
-    return etag;
+    return "\"" + hasher.hex() + "\"";
 }
 
 const StringSet RequestHandler::supportedMethods = {
         "GET", "HEAD", "POST", "DELETE", "PATCH", "PUT", "OPTIONS"
 };
 
+std::string RequestHandler::getArgument(const std::string &name, const char *defaultValue, bool strip) const {
+    const std::string *found = _request->getLastArgument(name);
+    if (found == nullptr) {
+        if (defaultValue == nullptr) {
+            ThrowException(MissingArgumentError, name);
+        }
+        return std::string(defaultValue);
+    }
+    std::string value = *found;
+    cleanArgument(value, strip);
+    return value;
+}
+
 std::string RequestHandler::getArgument(const std::string &name, const QueryArgListMap &source,
                                         const char *defaultValue, bool strip) const {
     auto iter = source.find(name);
@@ -298,10 +383,7 @@ std::string RequestHandler::getArgument(const std::string &name, const QueryArgL
         return std::string(defaultValue);
     }
     std::string value = iter->second.back();
-    boost::regex_replace(value, _removeControlCharsRegex, " ");
-    if (strip) {
-        boost::trim(value);
-    }
+    cleanArgument(value, strip);
     return value;
 }
 
@@ -313,14 +395,23 @@ StringVector RequestHandler::getArguments(const std::string &name, const QueryAr
     }
     values = iter->second;
     for (auto &value: values) {
-        boost::regex_replace(value, _removeControlCharsRegex, " ");
-        if (strip) {
-            boost::trim(value);
-        }
+        cleanArgument(value, strip);
     }
     return values;
 }
 
+void RequestHandler::cleanArgument(std::string &value, bool strip) {
+    auto isControl = [](char c) {
+        return (c >= '\x00' && c <= '\x08') || (c >= '\x0e' && c <= '\x1f');
+    };
+    if (std::find_if(value.begin(), value.end(), isControl) != value.end()) {
+        value = boost::regex_replace(value, _removeControlCharsRegex, " ");
+    }
+    if (strip) {
+        boost::trim(value);
+    }
+}
+
 void RequestHandler::execute(TransformsType &transforms, StringVector args) {
     _transforms.transfer(_transforms.end(), transforms);
     std::exception_ptr error;
@@ -331,7 +422,33 @@ void RequestHandler::execute(TransformsType &transforms, StringVector args) {
         }
         _pathArgs = std::move(args);
         prepare();
-        if (_autoFinish) {
+        if (_request->isBodyStreaming()) {
+            if (!_finished) {
+                _request->setBodyCallbacks([this, self=shared_from_this()](ByteArray chunk) {
+                    std::exception_ptr error;
+                    try {
+                        if (!_finished) {
+                            dataReceived(std::move(chunk));
+                        }
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    if (error) {
+                        handleRequestException(error);
+                    }
+                }, [this, self=shared_from_this()]() {
+                    std::exception_ptr error;
+                    try {
+                        executeMethod();
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    if (error) {
+                        handleRequestException(error);
+                    }
+                });
+            }
+        } else if (_autoFinish) {
             executeMethod();
         }
     } catch (...) {
@@ -378,17 +495,17 @@ void RequestHandler::executeMethod() {
 }
 
 std::string RequestHandler::generateHeaders() const {
-    StringVector lines;
-    lines.emplace_back(_request->getVersion() + " " + std::to_string(_statusCode) + " " + _reason);
-    _headers.getAll([&lines](const std::string &name, const std::string &value) {
-        lines.emplace_back(name + ": " + value);
-    });
-    if (_newCookie) {
-        _newCookie->getAll([&lines](const std::string &key, const Morsel &cookie) {
-            lines.emplace_back("Set-Cookie: " + cookie.outputString());
-        });
-    }
-    return boost::join(lines, "\r\n") + "\r\n\r\n";
+    std::string headers;
+    headers.reserve(256);
+    headers.append(_request->getVersion());
+    headers.push_back(' ');
+    char status[16];
+    headers.append(status, (size_t)snprintf(status, sizeof(status), "%d ", _statusCode));
+    headers.append(_reason);
+    headers.append("\r\n", 2);
+    _headers.serialize(headers);
+    headers.append("\r\n", 2);
+    return headers;
 }
 
 void RequestHandler::log() {
@@ -449,6 +566,22 @@ Application::Application(HandlersType &&handlers,
     } else {
         _transforms = std::move(transforms);
     }
+    auto iter = _settings.find("responseCache");
+    if (iter != _settings.end()) {
+        _responseCache = boost::any_cast<std::shared_ptr<ResponseCache>>(iter->second);
+    }
+    iter = _settings.find("requestCoalescer");
+    if (iter != _settings.end()) {
+        _requestCoalescer = boost::any_cast<std::shared_ptr<RequestCoalescer>>(iter->second);
+    }
+    iter = _settings.find("autoEtag");
+    if (iter != _settings.end()) {
+        _autoEtag = boost::any_cast<bool>(iter->second);
+    }
+    iter = _settings.find("etagMaxSize");
+    if (iter != _settings.end()) {
+        _etagMaxSize = boost::any_cast<size_t>(iter->second);
+    }
     if (!handlers.empty()) {
         addHandlers(".*$", std::move(handlers));
     }
@@ -463,9 +596,10 @@ void Application::addHandlers(std::string hostPattern, HandlersType &&hostHandle
         hostPattern.push_back('$');
     }
     std::unique_ptr<HostHandlerType> handler = make_unique<HostHandlerType>();
-    handler->first = hostPattern;
-    HandlersType &handlers = handler->second;
-    if (!_handlers.empty() && _handlers.back().first.str() == ".*$") {
+    handler->hostPattern = hostPattern;
+    HandlersType &handlers = handler->handlers;
+    URLRouter &router = handler->router;
+    if (!_handlers.empty() && _handlers.back().hostPattern.str() == ".*$") {
         auto iter = _handlers.end();
         std::advance(iter, -1);
         _handlers.insert(iter, handler.release());
@@ -474,6 +608,10 @@ void Application::addHandlers(std::string hostPattern, HandlersType &&hostHandle
     }
     handlers.transfer(handlers.end(), hostHandlers);
     for (auto &spec: handlers) {
+        router.add(&spec);
+        if (spec.getStreamRequestBody()) {
+            ++_streamingRoutes;
+        }
         if (!spec.getName().empty()) {
             if (_namedHandlers.find(spec.getName()) != _namedHandlers.end()) {
                 LOG_WARNING(gAppLog, "Multiple handlers named %s; replacing previous value", spec.getName().c_str());
@@ -484,56 +622,106 @@ void Application::addHandlers(std::string hostPattern, HandlersType &&hostHandle
 }
 
 void Application::operator()(std::shared_ptr<HTTPServerRequest> request) {
+    dispatch(std::move(request), true);
+}
+
+void Application::dispatch(std::shared_ptr<HTTPServerRequest> request, bool coalesce) {
+    StringVector args;
+    bool hostMatched;
+    URLSpec *matched;
+    if (_routeMatch.request.lock() == request) {
+        hostMatched = _routeMatch.hostMatched;
+        matched = _routeMatch.spec;
+        args = std::move(_routeMatch.args);
+        _routeMatch.request.reset();
+    } else {
+        auto handlers = getHostHandlers(request);
+        hostMatched = !handlers.empty();
+        matched = findHandler(handlers, request->getPath(), args);
+    }
+    std::shared_ptr<ResponseCache> responseCache;
+    if (matched) {
+        responseCache = matched->getResponseCache() ? matched->getResponseCache() : _responseCache;
+        // Hits are cheap enough to serve even while requests are being shed
+        if (responseCache) {
+            int statusCode = responseCache->serve(request);
+            if (statusCode != 0) {
+                double requestTime = 1000.0 * request->requestTime();
+                LOG_INFO(gAccessLog, "%d %s %s (%s) %.2fms (cached)", statusCode, request->getMethod().c_str(),
+                         request->getURI().c_str(), request->getRemoteIp().c_str(), requestTime);
+                return;
+            }
+        }
+    }
+    std::string flightKey;
+    if (coalesce && matched && _requestCoalescer && !_requestCoalescer->isBypassed(*request)) {
+        flightKey = _requestCoalescer->makeKey(*request);
+        if (_requestCoalescer->attach(flightKey, request)) {
+            return;
+        }
+    }
+    if (_overloadController
+        && !_overloadController->admit(matched ? matched->getPriority() : RequestPriority::NORMAL)) {
+        shedRequest(std::move(request));
+        return;
+    }
     RequestHandler::TransformsType transforms;
     for (auto &transform: _transforms) {
         transforms.push_back(transform(request));
     }
     std::shared_ptr<RequestHandler> handler;
-    StringVector args;
-    auto handlers = getHostHandlers(request);
-    if (handlers.empty()) {
+    if (!hostMatched) {
         RequestHandler::ArgsType handlerArgs = {
                 {"url", "http://" + _defaultHost + "/"}
         };
         handler = RequestHandlerFactory<RedirectHandler>()(this, std::move(request), handlerArgs);
+    } else if (matched) {
+        handler = matched->getHandlerClass()(this, std::move(request), matched->getArgs());
     } else {
-        const std::string &requestPath = request->getPath();
-        boost::xpressive::smatch match;
-        for (auto spec: handlers) {
-            if (boost::xpressive::regex_match(requestPath, match, spec->getRegex())) {
-                handler = spec->getHandlerClass()(this, std::move(request), spec->getArgs());
-                for (size_t i = 1; i < match.size(); ++i) {
-                    args.push_back(match[i].str());
-                }
-                for (auto &s: args) {
-                    s = URLParse::unquote(s);
-                }
-                break;
-            }
-        }
-        if (!handler) {
-            auto iter = _settings.find("defaultHandlerClass");
-            if (iter != _settings.end()) {
-                auto &handlerClass = boost::any_cast<const URLSpec::HandlerClassType&>(iter->second);
-                auto argIter = _settings.find("defaultHandlerArgs");
-                if (argIter != _settings.end()) {
-                    auto &handlerArgs = boost::any_cast<RequestHandler::ArgsType&>(argIter->second);
-                    handler = handlerClass(this, std::move(request), handlerArgs);
-                } else {
-                    RequestHandler::ArgsType handlerArgs;
-                    handler = handlerClass(this, std::move(request), handlerArgs);
-                }
+        auto iter = _settings.find("defaultHandlerClass");
+        if (iter != _settings.end()) {
+            auto &handlerClass = boost::any_cast<const URLSpec::HandlerClassType&>(iter->second);
+            auto argIter = _settings.find("defaultHandlerArgs");
+            if (argIter != _settings.end()) {
+                auto &handlerArgs = boost::any_cast<RequestHandler::ArgsType&>(argIter->second);
+                handler = handlerClass(this, std::move(request), handlerArgs);
             } else {
-                RequestHandler::ArgsType handlerArgs = {
-                        {"statusCode", 404}
-                };
-                handler = RequestHandlerFactory<ErrorHandler>()(this, std::move(request), handlerArgs);
+                RequestHandler::ArgsType handlerArgs;
+                handler = handlerClass(this, std::move(request), handlerArgs);
             }
+        } else {
+            RequestHandler::ArgsType handlerArgs = {
+                    {"statusCode", 404}
+            };
+            handler = RequestHandlerFactory<ErrorHandler>()(this, std::move(request), handlerArgs);
         }
     }
+    handler->_overloadController = _overloadController;
+    handler->_responseCache = std::move(responseCache);
+    if (!flightKey.empty()) {
+        handler->_flight = _requestCoalescer->begin(std::move(flightKey));
+    }
     handler->execute(transforms, std::move(args));
 }
 
+void Application::landFlight(std::shared_ptr<RequestCoalescer::Flight> flight) {
+    for (auto &request: _requestCoalescer->land(std::move(flight))) {
+        dispatch(std::move(request), false);
+    }
+}
+
+bool Application::streamRequestBody(std::shared_ptr<HTTPServerRequest> request) {
+    if (_streamingRoutes == 0) {
+        return false;
+    }
+    auto handlers = getHostHandlers(request);
+    _routeMatch.args.clear();
+    _routeMatch.hostMatched = !handlers.empty();
+    _routeMatch.spec = findHandler(handlers, request->getPath(), _routeMatch.args);
+    _routeMatch.request = request;
+    return _routeMatch.spec && _routeMatch.spec->getStreamRequestBody();
+}
+
 void Application::logRequest(RequestHandler *handler) const {
     auto iter = _settings.find("logFunction");
     if (iter != _settings.end()) {
@@ -556,33 +744,48 @@ void Application::logRequest(RequestHandler *handler) const {
 
 //Application::HandlersType Application::defaultHandlers = {};
 
-std::vector<URLSpec*> Application::getHostHandlers(std::shared_ptr<HTTPServerRequest> request) {
+void Application::shedRequest(std::shared_ptr<HTTPServerRequest> request) {
+    static const std::string response = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+            "Retry-After: 1\r\n\r\n";
+    static const HTTPHeaders headers = {{"Content-Length", "0"}, {"Retry-After", "1"}};
+    request->writeHeaders(503, headers, response, response.size());
+    request->finish();
+}
+
+std::vector<Application::HostHandlerType*> Application::getHostHandlers(std::shared_ptr<HTTPServerRequest> request) {
     std::string host = request->getHost();
     boost::to_lower(host);
     auto pos = host.find(':');
     if (pos != std::string::npos) {
         host = host.substr(0, pos);
     }
-    std::vector<URLSpec *> matches;
+    std::vector<HostHandlerType *> matches;
     for (auto &handler: _handlers) {
-        if (boost::regex_match(host, handler.first)) {
-            for (auto &spec: handler.second) {
-                matches.emplace_back(&spec);
-            }
+        if (!handler.handlers.empty() && boost::regex_match(host, handler.hostPattern)) {
+            matches.emplace_back(&handler);
         }
     }
-    if (matches.empty() && !request->getHTTPHeaders()->has("X-Real-Ip")) {
+    if (matches.empty() && !request->getHTTPHeaders()->has(HTTPHeaderField::X_REAL_IP)) {
         for (auto &handler: _handlers) {
-            if (boost::regex_match(_defaultHost, handler.first)) {
-                for (auto &spec: handler.second) {
-                    matches.emplace_back(&spec);
-                }
+            if (!handler.handlers.empty() && boost::regex_match(_defaultHost, handler.hostPattern)) {
+                matches.emplace_back(&handler);
             }
         }
     }
     return matches;
 }
 
+URLSpec* Application::findHandler(const std::vector<HostHandlerType*> &hostHandlers, const std::string &path,
+                                  StringVector &args) {
+    for (auto handler: hostHandlers) {
+        URLSpec *spec = handler->router.match(path, args);
+        if (spec) {
+            return spec;
+        }
+    }
+    return nullptr;
+}
+
 
 const char* HTTPError::what() const noexcept {
     if (_what.empty()) {
@@ -647,10 +850,284 @@ void FallbackHandler::prepare() {
 }
 
 
+void StaticFileHandler::initialize(ArgsType &args) {
+    _root = boost::any_cast<const std::string&>(args.at("path"));
+    auto iter = args.find("defaultFilename");
+    if (iter != args.end()) {
+        _defaultFilename = boost::any_cast<const std::string&>(iter->second);
+    }
+}
+
+void StaticFileHandler::onHead(const StringVector &args) {
+    serve(args.empty() ? "" : args[0], false);
+}
+
+void StaticFileHandler::onGet(const StringVector &args) {
+    serve(args.empty() ? "" : args[0], true);
+}
+
+StaticFileCache& StaticFileHandler::getFileCache() {
+    static StaticFileCache fileCache;
+    return fileCache;
+}
+
+void StaticFileHandler::serve(const std::string &path, bool includeBody) {
+    StringVector segments;
+    boost::split(segments, path, boost::is_any_of("/"));
+    for (auto &segment: segments) {
+        if (segment == ".." || segment.find('\0') != std::string::npos) {
+            ThrowException(HTTPError, 403, String::format("%s is not in root static directory", path.c_str()));
+        }
+    }
+    std::string absolutePath = _root + "/" + path;
+    if (path.empty() || path.back() == '/') {
+        if (_defaultFilename.empty()) {
+            ThrowException(HTTPError, 403, String::format("%s is a directory", path.c_str()));
+        }
+        absolutePath += _defaultFilename;
+    }
+    StaticFileCache &fileCache = getFileCache();
+    StaticFileCache::FilePtr file = fileCache.open(absolutePath);
+    if (!file) {
+        ThrowException(HTTPError, 404);
+    }
+    // A symlink under the root must not lead out of it
+    std::string root = resolveRoot(_root);
+    if (root.empty()) {
+        ThrowException(HTTPError, 404);
+    }
+    if (root.back() != '/') {
+        root.push_back('/');
+    }
+    auto inRoot = [&root](const StaticFileCache::FilePtr &file) {
+        return file && boost::starts_with(file->getRealPath(), root);
+    };
+    if (!inRoot(file)) {
+        ThrowException(HTTPError, 403, String::format("%s is not in root static directory", path.c_str()));
+    }
+    StaticFileCache::FilePtr brFile = fileCache.open(absolutePath + ".br");
+    if (!inRoot(brFile)) {
+        brFile.reset();
+    }
+    StaticFileCache::FilePtr gzFile = fileCache.open(absolutePath + ".gz");
+    if (!inRoot(gzFile)) {
+        gzFile.reset();
+    }
+    const HTTPHeaders *requestHeaders = _request->getHTTPHeaders();
+    std::string acceptEncoding = requestHeaders->get(HTTPHeaderField::ACCEPT_ENCODING);
+    setHeader("Content-Type", StaticFile::guessContentType(absolutePath));
+    if (brFile || gzFile) {
+        setHeader("Vary", "Accept-Encoding");
+        if (brFile && acceptEncoding.find("br") != std::string::npos) {
+            file = std::move(brFile);
+            setHeader("Content-Encoding", "br");
+        } else if (gzFile && acceptEncoding.find("gzip") != std::string::npos) {
+            file = std::move(gzFile);
+            setHeader("Content-Encoding", "gzip");
+        }
+    }
+    std::string lastModified = HTTPUtil::formatTimestamp(file->getModifiedTime());
+    setHeader("Etag", file->getEtag());
+    setHeader("Last-Modified", lastModified);
+    setHeader("Accept-Ranges", "bytes");
+    if (checkEtagHeader()) {
+        setStatus(304);
+        return;
+    }
+    std::string ifModifiedSince = requestHeaders->get(HTTPHeaderField::IF_MODIFIED_SINCE);
+    if (!ifModifiedSince.empty() && !requestHeaders->has(HTTPHeaderField::IF_NONE_MATCH)) {
+        DateTime since = String::parseUTCDate(ifModifiedSince);
+        if (!since.is_not_a_date_time() && boost::posix_time::from_time_t(file->getModifiedTime()) <= since) {
+            setStatus(304);
+            return;
+        }
+    }
+    size_t size = file->getSize(), start = 0, end = size;
+    std::string range = requestHeaders->get("Range");
+    std::string ifRange = requestHeaders->get("If-Range");
+    if (!range.empty() && (ifRange.empty() || ifRange == file->getEtag() || ifRange == lastModified)) {
+        if (parseRange(range, size, start, end)) {
+            if (start >= end) {
+                setStatus(416);
+                setHeader("Content-Type", "text/plain");
+                setHeader("Content-Range", String::format("bytes */%llu", (unsigned long long)size));
+                return;
+            }
+            setStatus(206);
+            setHeader("Content-Range", String::format("bytes %llu-%llu/%llu", (unsigned long long)start,
+                                                      (unsigned long long)end - 1, (unsigned long long)size));
+        }
+    }
+    setHeader("Content-Length", end - start);
+    if (!includeBody || start == end) {
+        return;
+    }
+    Asynchronous();
+    // The body never passes through flush(), so a coalesced flight could not replay it
+    if (_flight) {
+        _flight->shareable = false;
+    }
+    flush();
+    if (_request->canWriteFile()) {
+        _request->writeFile(file->getFd(), start, end - start, [this, self=shared_from_this(), file]() {
+            finish();
+        });
+    } else {
+        sendChunks(std::move(file), start, end - start);
+    }
+}
+
+std::string StaticFileHandler::resolveRoot(const std::string &root) {
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::string> roots;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = roots.find(root);
+    if (iter != roots.end()) {
+        return iter->second;
+    }
+    char *resolved = ::realpath(root.c_str(), nullptr);
+    if (!resolved) {
+        return "";
+    }
+    std::string realRoot(resolved);
+    free(resolved);
+    roots.emplace(root, realRoot);
+    return realRoot;
+}
+
+bool StaticFileHandler::parseRange(const std::string &range, size_t size, size_t &start, size_t &end) {
+    if (!boost::starts_with(range, "bytes=") || range.find(',') != std::string::npos) {
+        return false;
+    }
+    std::string spec = boost::trim_copy(range.substr(6));
+    auto dash = spec.find('-');
+    if (dash == std::string::npos) {
+        return false;
+    }
+    std::string first = spec.substr(0, dash), last = spec.substr(dash + 1);
+    auto isNumber = [](const std::string &s) {
+        return !s.empty() && s.size() <= 18 && std::all_of(s.begin(), s.end(), ::isdigit);
+    };
+    if (first.empty()) {
+        if (!isNumber(last)) {
+            return false;
+        }
+        // Suffix range: the final N bytes
+        size_t suffix = std::stoull(last);
+        start = size - std::min(suffix, size);
+        end = suffix == 0 ? start : size;
+        return true;
+    }
+    if (!isNumber(first) || (!last.empty() && !isNumber(last))) {
+        return false;
+    }
+    start = std::stoull(first);
+    end = last.empty() ? size : std::min((size_t)std::stoull(last) + 1, size);
+    if (start >= size || (!last.empty() && std::stoull(last) < start)) {
+        start = end = 0;
+    }
+    return true;
+}
+
+void StaticFileHandler::sendChunks(StaticFileCache::FilePtr file, size_t offset, size_t remaining) {
+    constexpr size_t STATIC_FILE_CHUNK_SIZE = 64 * 1024;
+    ByteArray chunk(std::min(remaining, STATIC_FILE_CHUNK_SIZE));
+    ssize_t bytesRead = ::pread(file->getFd(), chunk.data(), chunk.size(), (off_t)offset);
+    if (bytesRead <= 0) {
+        ThrowException(IOError, "Read file failed: " + std::to_string(errno));
+    }
+    chunk.resize((size_t)bytesRead);
+    write(chunk);
+    remaining -= chunk.size();
+    if (remaining == 0) {
+        finish();
+        return;
+    }
+    offset += chunk.size();
+    flush(false, [this, self=shared_from_this(), file, offset, remaining]() {
+        sendChunks(file, offset, remaining);
+    });
+}
+
+
+void AssetPackHandler::initialize(ArgsType &args) {
+    _pack = boost::any_cast<std::shared_ptr<AssetPack>>(args.at("pack"));
+}
+
+void AssetPackHandler::onHead(const StringVector &args) {
+    serve(args.empty() ? "" : args[0], false);
+}
+
+void AssetPackHandler::onGet(const StringVector &args) {
+    serve(args.empty() ? "" : args[0], true);
+}
+
+void AssetPackHandler::serve(const std::string &path, bool includeBody) {
+    const AssetPackEntry *entry = _pack->find(path);
+    if (!entry) {
+        ThrowException(HTTPError, 404);
+    }
+    AssetPack::Encoding encoding = AssetPack::IDENTITY;
+    bool hasBrotli = entry->bodies[AssetPack::BROTLI].length != 0;
+    bool hasGzip = entry->bodies[AssetPack::GZIP].length != 0;
+    if (hasBrotli || hasGzip) {
+        std::string acceptEncoding = _request->getHTTPHeaders()->get(HTTPHeaderField::ACCEPT_ENCODING);
+        setHeader("Vary", "Accept-Encoding");
+        if (hasBrotli && acceptEncoding.find("br") != std::string::npos) {
+            encoding = AssetPack::BROTLI;
+            setHeader("Content-Encoding", "br");
+        } else if (hasGzip && acceptEncoding.find("gzip") != std::string::npos) {
+            encoding = AssetPack::GZIP;
+            setHeader("Content-Encoding", "gzip");
+        }
+    }
+    setHeader("Content-Type", _pack->getString(entry->contentType));
+    setHeader("Etag", _pack->getString(entry->etags[encoding]));
+    if (checkEtagHeader()) {
+        setStatus(304);
+        return;
+    }
+    const AssetPackSpan &body = entry->bodies[encoding];
+    setHeader("Content-Length", body.length);
+    if (!includeBody || body.length == 0) {
+        return;
+    }
+    Asynchronous();
+    // The body never passes through flush(), so a coalesced flight could not replay it
+    if (_flight) {
+        _flight->shareable = false;
+    }
+    flush();
+    if (_request->canWriteFile()) {
+        _request->writeFile(_pack->getFd(), body.offset, body.length, [this, self=shared_from_this()]() {
+            finish();
+        });
+    } else {
+        sendChunks(body.offset, body.length);
+    }
+}
+
+void AssetPackHandler::sendChunks(size_t offset, size_t remaining) {
+    constexpr size_t ASSET_PACK_CHUNK_SIZE = 64 * 1024;
+    size_t length = std::min(remaining, ASSET_PACK_CHUNK_SIZE);
+    remaining -= length;
+    if (remaining == 0) {
+        _request->write(_pack->getData({offset, length}), length, [this, self=shared_from_this()]() {
+            finish();
+        });
+        return;
+    }
+    _request->write(_pack->getData({offset, length}), length,
+                    [this, self=shared_from_this(), offset, length, remaining]() {
+        sendChunks(offset + length, remaining);
+    });
+}
+
+
 GZipContentEncoding::GZipContentEncoding(std::shared_ptr<HTTPServerRequest> request) {
     if (request->supportsHTTP11()) {
         auto headers = request->getHTTPHeaders();
-        std::string acceptEncoding = headers->get("Accept-Encoding");
+        std::string acceptEncoding = headers->get(HTTPHeaderField::ACCEPT_ENCODING);
         _gzipping = acceptEncoding.find("gzip") != std::string::npos;
     } else {
         _gzipping = false;
@@ -658,29 +1135,32 @@ GZipContentEncoding::GZipContentEncoding(std::shared_ptr<HTTPServerRequest> requ
 }
 
 void GZipContentEncoding::transformFirstChunk(int &statusCode, HTTPHeaders &headers, ByteArray &chunk, bool finishing) {
-    if (headers.has("Vary")) {
-        headers["Vary"] = headers.at("Vary") + ", Accept-Encoding";
+    if (headers.has(HTTPHeaderField::VARY)) {
+        const std::string &vary = headers.at(HTTPHeaderField::VARY);
+        if (!boost::icontains(vary, "accept-encoding")) {
+            headers[HTTPHeaderField::VARY] = vary + ", Accept-Encoding";
+        }
     } else {
-        headers["Vary"] = "Accept-Encoding";
+        headers[HTTPHeaderField::VARY] = "Accept-Encoding";
     }
     if (_gzipping) {
-        std::string ctype = headers.get("Content-Type", "");
+        std::string ctype = headers.get(HTTPHeaderField::CONTENT_TYPE, "");
         auto pos = ctype.find(';');
         if (pos != std::string::npos) {
             ctype = ctype.substr(0, pos);
         }
         _gzipping = _contentTypes.find(ctype) != _contentTypes.end()
                     && (!finishing || chunk.size() >= _minLength)
-                    && (finishing || !headers.has("Content-Length"))
-                    && !headers.has("Content-Encoding");
+                    && (finishing || !headers.has(HTTPHeaderField::CONTENT_LENGTH))
+                    && !headers.has(HTTPHeaderField::CONTENT_ENCODING);
     }
     if (_gzipping) {
-        headers["Content-Encoding"] = "gzip";
+        headers[HTTPHeaderField::CONTENT_ENCODING] = "gzip";
         _gzipValue = std::make_shared<std::stringstream>();
         _gzipFile.initWithOutputStream(_gzipValue);
         transformChunk(chunk, finishing);
-        if (headers.has("Content-Length")) {
-            headers["Content-Length"] = std::to_string(chunk.size());
+        if (headers.has(HTTPHeaderField::CONTENT_LENGTH)) {
+            headers[HTTPHeaderField::CONTENT_LENGTH] = std::to_string(chunk.size());
         }
     }
 }
@@ -719,10 +1199,10 @@ const int GZipContentEncoding::_minLength;
 void ChunkedTransferEncoding::transformFirstChunk(int &statusCode, HTTPHeaders &headers, ByteArray &chunk,
                                                   bool finishing) {
     if (_chunking && statusCode != 304) {
-        if (headers.has("Content-Length") || headers.has("Transfer-Encoding")) {
+        if (headers.has(HTTPHeaderField::CONTENT_LENGTH) || headers.has(HTTPHeaderField::TRANSFER_ENCODING)) {
             _chunking = false;
         } else {
-            headers["Transfer-Encoding"] = "chunked";
+            headers[HTTPHeaderField::TRANSFER_ENCODING] = "chunked";
             transformChunk(chunk, finishing);
         }
     }
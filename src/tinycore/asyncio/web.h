@@ -12,12 +12,20 @@
 #include <boost/noncopyable.hpp>
 #include <boost/optional.hpp>
 #include <boost/xpressive/xpressive.hpp>
+#include "tinycore/asyncio/assetpack.h"
+#include "tinycore/asyncio/coalescer.h"
 #include "tinycore/asyncio/httpserver.h"
+#include "tinycore/asyncio/overload.h"
+#include "tinycore/asyncio/responsecache.h"
+#include "tinycore/asyncio/router.h"
+#include "tinycore/asyncio/staticfile.h"
 #include "tinycore/common/errors.h"
 #include "tinycore/compress/gzip.h"
 #include "tinycore/httputils/httplib.h"
 #include "tinycore/utilities/container.h"
+#include "tinycore/utilities/memorypool.h"
 #include "tinycore/utilities/string.h"
+#include "tinycore/utilities/xxhash.h"
 
 
 class Application;
@@ -26,6 +34,9 @@ class OutputTransform;
 class URLSpec;
 
 
+constexpr size_t DEFAULT_ETAG_MAX_SIZE = 1024 * 1024;
+
+
 class TC_COMMON_API RequestHandler: public std::enable_shared_from_this<RequestHandler> {
 public:
     typedef std::map<std::string, boost::any> ArgsType;
@@ -39,6 +50,14 @@ public:
 
     friend class Application;
 
+    static constexpr bool streamRequestBody = false;
+    static constexpr RequestPriority priority = RequestPriority::NORMAL;
+
+    // Cache the handler's GET responses are stored in; the application wide one is used when this returns null
+    static std::shared_ptr<ResponseCache> responseCache() {
+        return nullptr;
+    }
+
     RequestHandler(Application *application, std::shared_ptr<HTTPServerRequest> request);
     virtual ~RequestHandler();
 
@@ -54,6 +73,7 @@ public:
     virtual void onOptions(const StringVector &args);
 
     virtual void prepare();
+    virtual void dataReceived(ByteArray chunk);
     virtual void onFinish();
     virtual void onConnectionClose();
     void clear();
@@ -115,16 +135,17 @@ public:
     }
 
     bool hasArgument(const std::string &name) const {
-        auto &arguments = _request->getArguments();
-        return arguments.find(name) != arguments.end();
+        return _request->hasArgument(name);
     }
 
-    std::string getArgument(const std::string &name, const char *defaultValue= nullptr, bool strip= true) const {
-        return getArgument(name, _request->getArguments(), defaultValue, strip);
-    }
+    std::string getArgument(const std::string &name, const char *defaultValue= nullptr, bool strip= true) const;
 
     StringVector getArguments(const std::string &name, bool strip= true) const {
-        return getArguments(name, _request->getArguments(), strip);
+        StringVector values = _request->getArgumentValues(name);
+        for (auto &value: values) {
+            cleanArgument(value, strip);
+        }
+        return values;
     }
 
     bool hasBodyArgument(const std::string &name) const {
@@ -184,6 +205,13 @@ public:
     void write(const Byte *chunk, size_t length) {
         ASSERT(!_finished);
         _writeBuffer.insert(_writeBuffer.end(), chunk, chunk + length);
+        if (_etagHashing) {
+            if (isEtagWanted()) {
+                _etagHasher.update(chunk, length);
+            } else {
+                _etagHashing = false;
+            }
+        }
     }
 
     void write(const char *chunk) {
@@ -228,6 +256,25 @@ public:
     template <typename... Args>
     std::string reverseURL(const std::string &name, Args&&... args);
 
+    // Whether finish() tags a buffered 200 GET or HEAD response with an ETag; defaults to the application's setting
+    void setAutoEtag(bool autoEtag) {
+        _autoEtag = autoEtag;
+        _etagHashing = _etagHashing && autoEtag;
+    }
+
+    bool getAutoEtag() const {
+        return _autoEtag;
+    }
+
+    // Larger responses only get an automatic ETag when the request carries If-None-Match
+    void setEtagMaxSize(size_t etagMaxSize) {
+        _etagMaxSize = etagMaxSize;
+    }
+
+    size_t getEtagMaxSize() const {
+        return _etagMaxSize;
+    }
+
     virtual boost::optional<std::string> computeEtag() const;
 
     void setEtagHeader() {
@@ -237,10 +284,14 @@ public:
         }
     }
 
+    bool isEtagWanted() const {
+        return _autoEtag && (_writeBuffer.size() <= _etagMaxSize
+                             || _request->getHTTPHeaders()->has(HTTPHeaderField::IF_NONE_MATCH));
+    }
+
     bool checkEtagHeader() const {
-        auto etag = _headers.get("Etag");
-        std::string inm = _request->getHTTPHeaders()->get("If-None-Match");
-        return !etag.empty() && !inm.empty() && inm.find(etag.c_str()) != std::string::npos;
+        auto etag = _headers.get(HTTPHeaderField::ETAG);
+        return HTTPUtil::etagMatches(_request->getHTTPHeaders()->get(HTTPHeaderField::IF_NONE_MATCH), etag);
     }
 
     std::shared_ptr<HTTPServerRequest> getRequest() const {
@@ -284,6 +335,8 @@ protected:
 
     StringVector getArguments(const std::string &name, const QueryArgListMap &source, bool strip= true) const;
 
+    static void cleanArgument(std::string &value, bool strip);
+
     virtual void execute(TransformsType &transforms, StringVector args);
 
 //    void whenComplete();
@@ -329,6 +382,15 @@ protected:
     int _statusCode;
     CookiesType _newCookie;
     std::string _reason;
+    std::shared_ptr<OverloadController> _overloadController;
+    std::shared_ptr<ResponseCache> _responseCache;
+    bool _storeResponse{false};
+    std::shared_ptr<RequestCoalescer::Flight> _flight;
+    bool _autoEtag;
+    size_t _etagMaxSize;
+    // The body is hashed as it is written, so finish() does not have to walk it again
+    bool _etagHashing;
+    XXHash64 _etagHasher;
 
     static const boost::regex _removeControlCharsRegex;
     static const boost::regex _invalidHeaderCharRe;
@@ -342,7 +404,7 @@ public:
 
     std::shared_ptr<RequestHandler> operator()(Application *application, std::shared_ptr<HTTPServerRequest> request,
                                                ArgsType &args) const {
-        auto requestHandler = std::make_shared<T>(application, std::move(request));
+        auto requestHandler = makePooledShared<T>(application, std::move(request));
         requestHandler->start(args);
         return requestHandler;
     }
@@ -397,7 +459,13 @@ class TC_COMMON_API Application {
 public:
     typedef PtrVector<URLSpec> HandlersType;
     typedef boost::regex HostPatternType;
-    typedef std::pair<HostPatternType, HandlersType> HostHandlerType;
+
+    struct HostHandlerType {
+        HostPatternType hostPattern;
+        HandlersType handlers;
+        URLRouter router;
+    };
+
     typedef boost::ptr_vector<HostHandlerType> HostHandlersType;
     typedef std::map<std::string, URLSpec *> NamedHandlersType;
     typedef std::map<std::string, boost::any> SettingsType;
@@ -415,6 +483,9 @@ public:
                 [this](std::shared_ptr<HTTPServerRequest> request) {
                     (*this)(std::move(request));
                 }, std::forward<Args>(args)...);
+        server->setStreamBodyCallback([this](std::shared_ptr<HTTPServerRequest> request) {
+            return streamRequestBody(std::move(request));
+        });
         server->listen(port, std::move(address));
         return server;
     }
@@ -430,6 +501,8 @@ public:
 
     void operator()(std::shared_ptr<HTTPServerRequest> request);
 
+    bool streamRequestBody(std::shared_ptr<HTTPServerRequest> request);
+
     template <typename... Args>
     std::string reverseURL(const std::string &name, Args&&... args);
 
@@ -439,19 +512,95 @@ public:
         return _settings;
     }
 
+    // Requests are admitted through the controller before their handler is created; shed ones get a bare 503.
+    // Starts the controller's sampling.
+    void setOverloadController(std::shared_ptr<OverloadController> overloadController) {
+        _overloadController = std::move(overloadController);
+        if (_overloadController) {
+            _overloadController->start();
+        }
+    }
+
+    const std::shared_ptr<OverloadController>& getOverloadController() const {
+        return _overloadController;
+    }
+
+    // Set from the "responseCache" setting; caches the GET responses of every route without a cache of its own
+    void setResponseCache(std::shared_ptr<ResponseCache> responseCache) {
+        _responseCache = std::move(responseCache);
+    }
+
+    const std::shared_ptr<ResponseCache>& getResponseCache() const {
+        return _responseCache;
+    }
+
+    // Set from the "requestCoalescer" setting; identical concurrent requests then share one handler execution
+    void setRequestCoalescer(std::shared_ptr<RequestCoalescer> requestCoalescer) {
+        _requestCoalescer = std::move(requestCoalescer);
+    }
+
+    const std::shared_ptr<RequestCoalescer>& getRequestCoalescer() const {
+        return _requestCoalescer;
+    }
+
+    // Set from the "autoEtag" setting; handlers may still override it
+    void setAutoEtag(bool autoEtag) {
+        _autoEtag = autoEtag;
+    }
+
+    bool getAutoEtag() const {
+        return _autoEtag;
+    }
+
+    // Set from the "etagMaxSize" setting
+    void setEtagMaxSize(size_t etagMaxSize) {
+        _etagMaxSize = etagMaxSize;
+    }
+
+    size_t getEtagMaxSize() const {
+        return _etagMaxSize;
+    }
+
+    // Answers the requests waiting on a finished leader; the ones that cannot share its response are run on their own
+    void landFlight(std::shared_ptr<RequestCoalescer::Flight> flight);
+
 //    static HandlersType defaultHandlers;
 protected:
-    std::vector<URLSpec*> getHostHandlers(std::shared_ptr<HTTPServerRequest> request);
+    // Route found by streamRequestBody, handed on to dispatch so the request is not routed twice
+    struct RouteMatch {
+        std::weak_ptr<HTTPServerRequest> request;
+        bool hostMatched;
+        URLSpec *spec;
+        StringVector args;
+    };
+
+    void dispatch(std::shared_ptr<HTTPServerRequest> request, bool coalesce);
+
+    // Host groups with handlers for the request's host, falling back to the default host's
+    std::vector<HostHandlerType*> getHostHandlers(std::shared_ptr<HTTPServerRequest> request);
+
+    static URLSpec* findHandler(const std::vector<HostHandlerType*> &hostHandlers, const std::string &path,
+                                StringVector &args);
+
+    void shedRequest(std::shared_ptr<HTTPServerRequest> request);
 
     TransformsType _transforms;
     HostHandlersType _handlers;
     NamedHandlersType _namedHandlers;
     std::string _defaultHost;
     SettingsType _settings;
+    std::shared_ptr<OverloadController> _overloadController;
+    std::shared_ptr<ResponseCache> _responseCache;
+    std::shared_ptr<RequestCoalescer> _requestCoalescer;
+    bool _autoEtag{true};
+    size_t _etagMaxSize{DEFAULT_ETAG_MAX_SIZE};
+    size_t _streamingRoutes{0};
+    RouteMatch _routeMatch;
 };
 
 
 #define HTTPServerCB(app) std::bind(&Application::operator(), pointer(app), std::placeholders::_1)
+#define HTTPServerStreamBodyCB(app) std::bind(&Application::streamRequestBody, pointer(app), std::placeholders::_1)
 
 
 class TC_COMMON_API HTTPError: public Exception {
@@ -538,9 +687,80 @@ protected:
 };
 
 
+// Serves files under the "path" argument, e.g. url<StaticFileHandler>("/static/(.*)", {{"path", root}}). Open files
+// and their stat results are cached, plain HTTP/1.x connections send the body with sendfile, single byte ranges are
+// honoured and a .br or .gz sibling is served instead when the client accepts that encoding.
+class TC_COMMON_API StaticFileHandler: public RequestHandler {
+public:
+    using RequestHandler::RequestHandler;
+
+    void initialize(ArgsType &args) override;
+    void onHead(const StringVector &args) override;
+    void onGet(const StringVector &args) override;
+
+    static StaticFileCache& getFileCache();
+protected:
+    void serve(const std::string &path, bool includeBody);
+
+    // Real path of the root directory, resolved once per root; empty when it does not exist
+    static std::string resolveRoot(const std::string &root);
+
+    // Parses a single "bytes=" range; false when the header should be ignored
+    static bool parseRange(const std::string &range, size_t size, size_t &start, size_t &end);
+
+    void sendChunks(StaticFileCache::FilePtr file, size_t offset, size_t remaining);
+
+    std::string _root;
+    std::string _defaultFilename;
+};
+
+
+// Serves the assets of a pack given as the "pack" argument, e.g.
+// url<AssetPackHandler>("/assets/(.*)", {{"pack", AssetPack::create("assets.pack")}}). The lookup needs no syscall and
+// the body is sent from the pack file with sendfile where the connection allows it, else from the mapping a chunk at a
+// time.
+class TC_COMMON_API AssetPackHandler: public RequestHandler {
+public:
+    using RequestHandler::RequestHandler;
+
+    void initialize(ArgsType &args) override;
+    void onHead(const StringVector &args) override;
+    void onGet(const StringVector &args) override;
+protected:
+    void serve(const std::string &path, bool includeBody);
+
+    void sendChunks(size_t offset, size_t remaining);
+
+    std::shared_ptr<AssetPack> _pack;
+};
+
+
+// Gives a handler class a response cache of its own, e.g. class MyHandler: public ResponseCacheMixin<MyHandler>;
+// tune it through MyHandler::responseCache()
+template <typename DerivedT, typename BaseT=RequestHandler>
+class ResponseCacheMixin: public BaseT {
+public:
+    using BaseT::BaseT;
+
+    static std::shared_ptr<ResponseCache> responseCache() {
+        static std::shared_ptr<ResponseCache> cache = ResponseCache::create();
+        return cache;
+    }
+};
+
+
 class TC_COMMON_API OutputTransform {
 public:
     virtual ~OutputTransform() {}
+
+    static void* operator new(size_t size) {
+        return MemoryPool::allocate(size);
+    }
+
+    static void operator delete(void *block, size_t size) {
+        MemoryPool::deallocate(block, size);
+    }
+
     virtual void transformFirstChunk(int &statusCode, HTTPHeaders &headers, ByteArray &chunk, bool finishing) =0;
     virtual void transformChunk(ByteArray &chunk, bool finishing) =0;
 };
@@ -633,6 +853,30 @@ public:
     ArgsType& getArgs() {
         return _args;
     }
+
+    void setStreamRequestBody(bool streamRequestBody) {
+        _streamRequestBody = streamRequestBody;
+    }
+
+    bool getStreamRequestBody() const {
+        return _streamRequestBody;
+    }
+
+    void setPriority(RequestPriority priority) {
+        _priority = priority;
+    }
+
+    RequestPriority getPriority() const {
+        return _priority;
+    }
+
+    void setResponseCache(std::shared_ptr<ResponseCache> responseCache) {
+        _responseCache = std::move(responseCache);
+    }
+
+    const std::shared_ptr<ResponseCache>& getResponseCache() const {
+        return _responseCache;
+    }
 protected:
     template <typename... Args>
     std::string formats(Args&&... args) {
@@ -681,6 +925,9 @@ protected:
     std::string _name;
     std::string _path;
     int _groupCount;
+    bool _streamRequestBody{false};
+    RequestPriority _priority{RequestPriority::NORMAL};
+    std::shared_ptr<ResponseCache> _responseCache;
 };
 
 
@@ -689,7 +936,11 @@ protected:
 template <typename HandlerClass, typename... Args>
 URLSpec* url(const std::string &pattern, Args&&... args) {
     RequestHandlerFactory<HandlerClass> handlerFactory;
-    return boost::factory<URLSpec*>()(pattern, handlerFactory, std::forward<Args>(args)...);
+    URLSpec *spec = boost::factory<URLSpec*>()(pattern, handlerFactory, std::forward<Args>(args)...);
+    spec->setStreamRequestBody(HandlerClass::streamRequestBody);
+    spec->setPriority(HandlerClass::priority);
+    spec->setResponseCache(HandlerClass::responseCache());
+    return spec;
 }
 
 
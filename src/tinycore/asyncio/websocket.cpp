@@ -87,14 +87,14 @@ void WebSocketHandler::execute(TransformsType &transforms, StringVector args) {
         _stream->close();
         return;
     }
-    if (boost::to_lower_copy(_request->getHTTPHeaders()->get("Upgrade", "")) != "websocket") {
+    if (boost::to_lower_copy(_request->getHTTPHeaders()->get(HTTPHeaderField::UPGRADE, "")) != "websocket") {
         const char *error = "HTTP/1.1 400 Bad Request\r\n\r\nCan \"Upgrade\" only to \"WebSocket\".";
         _stream->write((const Byte *)error, strlen(error));
         _stream->close();
         return;
     }
     auto headers = _request->getHTTPHeaders();
-    auto connection = String::split(headers->get("Connection", ""), ',');
+    auto connection = String::split(headers->get(HTTPHeaderField::CONNECTION, ""), ',');
     for (auto &v: connection) {
         boost::to_lower(v);
     }
@@ -104,11 +104,11 @@ void WebSocketHandler::execute(TransformsType &transforms, StringVector args) {
         _stream->close();
         return;
     }
-    std::string webSocketVersion = headers->get("Sec-WebSocket-Version");
+    std::string webSocketVersion = headers->get(HTTPHeaderField::SEC_WEBSOCKET_VERSION);
     if (webSocketVersion == "7" || webSocketVersion == "8" || webSocketVersion == "13") {
         _wsConnection = make_unique<WebSocketProtocol13>(this);
         _wsConnection->acceptConnection();
-    } else if (allowDraft76() && !headers->has("Sec-WebSocket-Version")) {
+    } else if (allowDraft76() && !headers->has(HTTPHeaderField::SEC_WEBSOCKET_VERSION)) {
         _wsConnection = make_unique<WebSocketProtocol76>(this);
         _wsConnection->acceptConnection();
     } else {
@@ -137,8 +137,8 @@ void WebSocketProtocol76::acceptConnection() {
     }
     std::string scheme = _handler->getWebSocketScheme();
     std::string subProtocolHeader;
-    if (_request->getHTTPHeaders()->has("Sec-WebSocket-Protocol")) {
-        auto &subProtocol = _request->getHTTPHeaders()->at("Sec-WebSocket-Protocol");
+    if (_request->getHTTPHeaders()->has(HTTPHeaderField::SEC_WEBSOCKET_PROTOCOL)) {
+        auto &subProtocol = _request->getHTTPHeaders()->at(HTTPHeaderField::SEC_WEBSOCKET_PROTOCOL);
         auto selected = _handler->selectSubProtocol({subProtocol});
         if (selected) {
             ASSERT(selected == subProtocol);
@@ -146,7 +146,7 @@ void WebSocketProtocol76::acceptConnection() {
         }
     }
 
-    std::string origin = _request->getHTTPHeaders()->at("Origin");
+    std::string origin = _request->getHTTPHeaders()->at(HTTPHeaderField::ORIGIN);
     std::string initial = String::format("HTTP/1.1 101 Web Socket Protocol Handshake\r\n"
                                                  "Upgrade: WebSocket\r\n"
                                                  "Connection: Upgrade\r\n"
@@ -365,7 +365,8 @@ void WebSocketProtocol13::handleWebSocketHeaders() const {
 
 void WebSocketProtocol13::_acceptConnection() {
     std::string subProtocolHeader;
-    auto subProtocols = String::split(_request->getHTTPHeaders()->get("Sec-WebSocket-Protocol", ""), ',');
+    auto subProtocols = String::split(_request->getHTTPHeaders()->get(HTTPHeaderField::SEC_WEBSOCKET_PROTOCOL, ""),
+                                      ',');
     for (auto &subProtocol: subProtocols) {
         boost::trim(subProtocol);
     }
@@ -654,10 +655,10 @@ void WebSocketClientConnection::prepare() {
 void WebSocketClientConnection::handle1xx(int code) {
     _callback = nullptr;
     ASSERT(code == 101);
-    ASSERT(boost::to_lower_copy(_headers->at("Upgrade")) == "websocket");
-    ASSERT(boost::to_lower_copy(_headers->at("Connection")) == "upgrade");
+    ASSERT(boost::to_lower_copy(_headers->at(HTTPHeaderField::UPGRADE)) == "websocket");
+    ASSERT(boost::to_lower_copy(_headers->at(HTTPHeaderField::CONNECTION)) == "upgrade");
     std::string accept = WebSocketProtocol13::computeAcceptValue(_key);
-    ASSERT(_headers->at("Sec-Websocket-Accept") == accept);
+    ASSERT(_headers->at(HTTPHeaderField::SEC_WEBSOCKET_ACCEPT) == accept);
     _protocol = make_unique<WebSocketClientProtocol>(this, true);
     _protocol->receiveFrame();
     if (!_timeout.expired()) {
@@ -5,6 +5,7 @@
 #include "tinycore/httputils/urlparse.h"
 #include <boost/utility/string_ref.hpp>
 #include <boost/algorithm/string.hpp>
+#include "tinycore/utilities/arena.h"
 #include "tinycore/utilities/string.h"
 #include "tinycore/common/errors.h"
 
@@ -629,14 +630,18 @@ QueryArgListMap URLParse::parseQS(const std::string &queryString, bool keepBlank
 
 QueryArgList URLParse::parseQSL(const std::string &queryString, bool keepBlankValues, bool strictParsing) {
     QueryArgList r;
-    StringVector s1, s2, pairs;
-    s1 = String::split(queryString, '&');
-    for (auto &v1: s1) {
-        s2 = String::split(v1, ';');
-        for (auto &v2: s2) {
-            pairs.push_back(std::move(v2));
+    alignas(std::max_align_t) char scratchBuffer[512];
+    Arena scratch(scratchBuffer, sizeof(scratchBuffer));
+    ArenaVector<boost::string_ref> pairs{ArenaAllocator<boost::string_ref>(&scratch)};
+    size_t start = 0, end;
+    do {
+        end = queryString.find_first_of("&;", start);
+        if (end == std::string::npos) {
+            end = queryString.size();
         }
-    }
+        pairs.emplace_back(queryString.data() + start, end - start);
+        start = end + 1;
+    } while (end != queryString.size());
     size_t pos;
     std::string name, value;
     for (auto &nameValue: pairs) {
@@ -644,26 +649,26 @@ QueryArgList URLParse::parseQSL(const std::string &queryString, bool keepBlankVa
             continue;
         }
         pos = nameValue.find('=');
-        if (pos == std::string::npos) {
+        if (pos == boost::string_ref::npos) {
             if (strictParsing) {
                 std::string error;
-                error = "bad query field:" + nameValue;
+                error = "bad query field:" + nameValue.to_string();
                 ThrowException(ValueError, std::move(error));
             }
             if (keepBlankValues) {
-                name = nameValue;
-                value = "";
+                name.assign(nameValue.data(), nameValue.size());
+                value.clear();
             } else {
                 continue;
             }
         } else {
-            name = nameValue.substr(0, pos);
-            value = nameValue.substr(pos + 1);
+            name.assign(nameValue.data(), pos);
+            value.assign(nameValue.data() + pos + 1, nameValue.size() - pos - 1);
         }
         if (keepBlankValues || !value.empty()) {
-            boost::replace_all(name, "+", " ");
+            std::replace(name.begin(), name.end(), '+', ' ');
             name = unquote(name);
-            boost::replace_all(value, "+", " ");
+            std::replace(value.begin(), value.end(), '+', ' ');
             value = unquote(value);
             r.emplace_back(std::make_pair(std::move(name), std::move(value)));
         }
@@ -5,9 +5,21 @@
 #ifndef TINYCORE_TINYCORE_H
 #define TINYCORE_TINYCORE_H
 
+#include "tinycore/asyncio/assetpack.h"
+#include "tinycore/asyncio/coalescer.h"
+#include "tinycore/asyncio/hpack.h"
+#include "tinycore/asyncio/http2.h"
 #include "tinycore/asyncio/httpclient.h"
+#include "tinycore/asyncio/httpparser.h"
+#include "tinycore/asyncio/memoryaccountant.h"
+#include "tinycore/asyncio/multipart.h"
+#include "tinycore/asyncio/overload.h"
+#include "tinycore/asyncio/responsecache.h"
+#include "tinycore/asyncio/router.h"
 #include "tinycore/asyncio/stackcontext.h"
+#include "tinycore/asyncio/staticfile.h"
 #include "tinycore/asyncio/testing.h"
+#include "tinycore/asyncio/udpendpoint.h"
 #include "tinycore/asyncio/websocket.h"
 #include "tinycore/common/errors.h"
 #include "tinycore/compress/gzip.h"
@@ -21,10 +33,13 @@
 #include "tinycore/httputils/httplib.h"
 #include "tinycore/httputils/urlparse.h"
 #include "tinycore/logging/logging.h"
+#include "tinycore/utilities/arena.h"
 #include "tinycore/utilities/container.h"
+#include "tinycore/utilities/memorypool.h"
 #include "tinycore/utilities/messagebuffer.h"
 #include "tinycore/utilities/objectmanager.h"
 #include "tinycore/utilities/string.h"
+#include "tinycore/utilities/xxhash.h"
 
 
 #endif //TINYCORE_TINYCORE_H
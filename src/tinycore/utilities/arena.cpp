@@ -0,0 +1,37 @@
+//
+// Monotonic arena allocator.
+//
+
+#include "tinycore/utilities/arena.h"
+#include "tinycore/utilities/memorypool.h"
+
+
+void Arena::reset() {
+    releaseBlocks();
+    _current = _initial;
+    _end = _initial + _initialSize;
+    _usedBytes = 0;
+    _allocationCount = 0;
+}
+
+char* Arena::allocateSlow(size_t size, size_t alignment) {
+    size_t blockSize = std::max(_blockSize, sizeof(Block) + size + alignment);
+    auto block = static_cast<Block *>(MemoryPool::allocate(blockSize));
+    block->next = _blocks;
+    block->size = blockSize;
+    _blocks = block;
+    ++_blockCount;
+    char *p = align((char *)block + sizeof(Block), alignment);
+    _current = p + size;
+    _end = (char *)block + blockSize;
+    return p;
+}
+
+void Arena::releaseBlocks() {
+    while (_blocks) {
+        Block *next = _blocks->next;
+        MemoryPool::deallocate(_blocks, _blocks->size);
+        _blocks = next;
+    }
+    _blockCount = 0;
+}
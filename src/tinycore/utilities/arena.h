@@ -0,0 +1,167 @@
+//
+// Monotonic arena allocator.
+//
+
+#ifndef TINYCORE_ARENA_H
+#define TINYCORE_ARENA_H
+
+#include "tinycore/common/common.h"
+
+
+constexpr size_t DEFAULT_ARENA_BLOCK_SIZE = 4096;
+
+
+// Monotonic bump allocator: deallocation is a no-op and everything handed out is released at once by reset() or
+// the destructor. An optional caller provided buffer (typically inline in the owning object) is used first.
+class TC_COMMON_API Arena {
+public:
+    explicit Arena(size_t blockSize=DEFAULT_ARENA_BLOCK_SIZE)
+            : _blockSize(blockSize) {
+
+    }
+
+    Arena(void *buffer, size_t size, size_t blockSize=DEFAULT_ARENA_BLOCK_SIZE)
+            : _initial((char *)buffer)
+            , _initialSize(size)
+            , _blockSize(blockSize)
+            , _current((char *)buffer)
+            , _end((char *)buffer + size) {
+
+    }
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena() {
+        releaseBlocks();
+    }
+
+    void* allocate(size_t size, size_t alignment=alignof(std::max_align_t)) {
+        char *p = align(_current, alignment);
+        if (!p || size > (size_t)(_end - p)) {
+            p = allocateSlow(size, alignment);
+        } else {
+            _current = p + size;
+        }
+        _usedBytes += size;
+        ++_allocationCount;
+        return p;
+    }
+
+    // Copies the bytes into the arena; the copy lives until the next reset
+    char* copy(const char *data, size_t length) {
+        auto p = static_cast<char *>(allocate(length + 1, 1));
+        memcpy(p, data, length);
+        p[length] = '\0';
+        return p;
+    }
+
+    void reset();
+
+    size_t getUsedBytes() const {
+        return _usedBytes;
+    }
+
+    size_t getAllocationCount() const {
+        return _allocationCount;
+    }
+
+    // Blocks taken from the heap since the last reset
+    size_t getBlockCount() const {
+        return _blockCount;
+    }
+protected:
+    struct Block {
+        Block *next;
+        size_t size;
+    };
+
+    static char* align(char *p, size_t alignment) {
+        if (!p) {
+            return nullptr;
+        }
+        auto address = reinterpret_cast<uintptr_t>(p);
+        return p + ((alignment - address % alignment) % alignment);
+    }
+
+    char* allocateSlow(size_t size, size_t alignment);
+
+    void releaseBlocks();
+
+    char *_initial{nullptr};
+    size_t _initialSize{0};
+    size_t _blockSize;
+    char *_current{nullptr};
+    char *_end{nullptr};
+    Block *_blocks{nullptr};
+    size_t _blockCount{0};
+    size_t _usedBytes{0};
+    size_t _allocationCount{0};
+};
+
+
+// Standard allocator over an Arena. A default constructed allocator, and every copy a container makes for its
+// own copies, falls back to the heap so copied containers never point into an arena that may be reset first.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() = default;
+
+    explicit ArenaAllocator(Arena *arena)
+            : _arena(arena) {
+
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &rhs)
+            : _arena(rhs.getArena()) {
+
+    }
+
+    T* allocate(size_t n) {
+        if (_arena) {
+            return static_cast<T *>(_arena->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (!_arena) {
+            ::operator delete(p);
+        }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const {
+        return ArenaAllocator();
+    }
+
+    Arena* getArena() const {
+        return _arena;
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &rhs) const {
+        return _arena == rhs.getArena();
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &rhs) const {
+        return _arena != rhs.getArena();
+    }
+protected:
+    Arena *_arena{nullptr};
+};
+
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+#endif //TINYCORE_ARENA_H
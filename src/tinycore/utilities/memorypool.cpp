@@ -0,0 +1,76 @@
+//
+// Per-thread pool of small fixed-size blocks.
+//
+
+#include "tinycore/utilities/memorypool.h"
+
+
+std::atomic<size_t> MemoryPool::_maxFreeBlocks{DEFAULT_MEMORY_POOL_MAX_FREE_BLOCKS};
+std::atomic<size_t> MemoryPool::_allocatedCount{0};
+std::atomic<size_t> MemoryPool::_reusedCount{0};
+
+// Trivially destructible, so it stays readable after the thread's FreeLists is gone
+static thread_local bool gFreeListsDestroyed = false;
+
+
+MemoryPool::FreeLists::~FreeLists() {
+    gFreeListsDestroyed = true;
+    for (auto head: heads) {
+        while (head) {
+            FreeBlock *next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+}
+
+void* MemoryPool::allocate(size_t size) {
+    if (size == 0 || size > MEMORY_POOL_MAX_BLOCK_SIZE) {
+        _allocatedCount.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+    size_t index = (size - 1) / MEMORY_POOL_GRANULARITY;
+    FreeLists *freeLists = getFreeLists();
+    FreeBlock *block = freeLists ? freeLists->heads[index] : nullptr;
+    if (block) {
+        freeLists->heads[index] = block->next;
+        --freeLists->counts[index];
+        _reusedCount.fetch_add(1, std::memory_order_relaxed);
+        return block;
+    }
+    _allocatedCount.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new((index + 1) * MEMORY_POOL_GRANULARITY);
+}
+
+void MemoryPool::deallocate(void *block, size_t size) {
+    if (size == 0 || size > MEMORY_POOL_MAX_BLOCK_SIZE) {
+        ::operator delete(block);
+        return;
+    }
+    size_t index = (size - 1) / MEMORY_POOL_GRANULARITY;
+    FreeLists *freeLists = getFreeLists();
+    if (!freeLists || freeLists->counts[index] >= _maxFreeBlocks.load(std::memory_order_relaxed)) {
+        ::operator delete(block);
+        return;
+    }
+    auto freeBlock = static_cast<FreeBlock *>(block);
+    freeBlock->next = freeLists->heads[index];
+    freeLists->heads[index] = freeBlock;
+    ++freeLists->counts[index];
+}
+
+size_t MemoryPool::getFreeCount() {
+    FreeLists *freeLists = getFreeLists();
+    if (!freeLists) {
+        return 0;
+    }
+    return std::accumulate(freeLists->counts.begin(), freeLists->counts.end(), (size_t)0);
+}
+
+MemoryPool::FreeLists* MemoryPool::getFreeLists() {
+    if (gFreeListsDestroyed) {
+        return nullptr;
+    }
+    thread_local FreeLists freeLists;
+    return &freeLists;
+}
@@ -0,0 +1,106 @@
+//
+// Per-thread pool of small fixed-size blocks.
+//
+
+#ifndef TINYCORE_MEMORYPOOL_H
+#define TINYCORE_MEMORYPOOL_H
+
+#include "tinycore/common/common.h"
+#include <atomic>
+
+
+constexpr size_t MEMORY_POOL_GRANULARITY = 64;
+constexpr size_t MEMORY_POOL_MAX_BLOCK_SIZE = 4096;
+constexpr size_t DEFAULT_MEMORY_POOL_MAX_FREE_BLOCKS = 64;
+
+
+// Per-thread free lists of small blocks, one list per 64 byte size class. Objects that are created and destroyed
+// once per request on a loop thread keep reusing the same memory instead of going back to the heap.
+class TC_COMMON_API MemoryPool {
+public:
+    static void* allocate(size_t size);
+
+    static void deallocate(void *block, size_t size);
+
+    // Bounds the number of cached blocks per size class on every thread
+    static void setMaxFreeBlocks(size_t maxFreeBlocks) {
+        _maxFreeBlocks = maxFreeBlocks;
+    }
+
+    static size_t getMaxFreeBlocks() {
+        return _maxFreeBlocks;
+    }
+
+    // Blocks obtained from the heap
+    static size_t getAllocatedCount() {
+        return _allocatedCount.load(std::memory_order_relaxed);
+    }
+
+    // Blocks served from a free list
+    static size_t getReusedCount() {
+        return _reusedCount.load(std::memory_order_relaxed);
+    }
+
+    // Blocks cached by the calling thread
+    static size_t getFreeCount();
+protected:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct FreeLists {
+        ~FreeLists();
+
+        std::array<FreeBlock *, MEMORY_POOL_MAX_BLOCK_SIZE / MEMORY_POOL_GRANULARITY> heads{};
+        std::array<size_t, MEMORY_POOL_MAX_BLOCK_SIZE / MEMORY_POOL_GRANULARITY> counts{};
+    };
+
+    // Null once the calling thread's lists have been destroyed, so blocks freed by later thread_local
+    // destructors go straight back to the heap
+    static FreeLists* getFreeLists();
+
+    static std::atomic<size_t> _maxFreeBlocks;
+    static std::atomic<size_t> _allocatedCount;
+    static std::atomic<size_t> _reusedCount;
+};
+
+
+template <typename T>
+class PoolAllocator {
+public:
+    typedef T value_type;
+
+    PoolAllocator() = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) {
+
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T *>(MemoryPool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        MemoryPool::deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const {
+        return false;
+    }
+};
+
+
+template <typename T, typename ...Args>
+std::shared_ptr<T> makePooledShared(Args&& ...args) {
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
+
+#endif //TINYCORE_MEMORYPOOL_H
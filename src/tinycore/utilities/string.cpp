@@ -148,25 +148,175 @@ std::string String::capitalizeCopy(const std::string &s) {
     return result;
 }
 
-std::string String::formatUTCDate(const DateTime &timeval, bool usegmt) {
-    std::string zone;
+static const char *WEEKDAY_NAMES[] = {
+        "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static const char *MONTH_NAMES[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static const char *WEEKDAY_FULL_NAMES[] = {
+        "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"
+};
+
+static inline char* writeDigits(char *p, unsigned value, int width) {
+    for (int i = width - 1; i >= 0; --i) {
+        p[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    return p + width;
+}
+
+static std::string writeUTCDate(int year, unsigned month, unsigned day, unsigned weekday, unsigned hours,
+                                unsigned minutes, unsigned seconds, bool usegmt) {
+    char buffer[32];
+    char *p = buffer;
+    memcpy(p, WEEKDAY_NAMES[weekday], 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    p = writeDigits(p, day, 2);
+    *p++ = ' ';
+    memcpy(p, MONTH_NAMES[month - 1], 3);
+    p += 3;
+    *p++ = ' ';
+    p = writeDigits(p, (unsigned)year, 4);
+    *p++ = ' ';
+    p = writeDigits(p, hours, 2);
+    *p++ = ':';
+    p = writeDigits(p, minutes, 2);
+    *p++ = ':';
+    p = writeDigits(p, seconds, 2);
+    *p++ = ' ';
     if (usegmt) {
-        zone = "GMT";
+        memcpy(p, "GMT", 3);
+        p += 3;
     } else {
-        zone = "-0000";
-    }
-    const char *weekdayNames[] = {
-            "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
-    };
-    const char *monthNames[] = {
-            "Jan", "Feb", "Mar", "Apr", "May", "Jun",
-            "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
-    };
+        memcpy(p, "-0000", 5);
+        p += 5;
+    }
+    return std::string(buffer, p);
+}
+
+std::string String::formatUTCDate(const DateTime &timeval, bool usegmt) {
     const Date date = timeval.date();
     const Time time = timeval.time_of_day();
-    return format("%s, %02d %s %04d %02d:%02d:%02d %s", weekdayNames[date.day_of_week().as_number()],
-                  date.day(), monthNames[date.month() - 1], date.year(), time.hours(), time.minutes(),
-                  time.seconds(), zone.c_str());
+    return writeUTCDate(date.year(), date.month(), date.day(), date.day_of_week().as_number(),
+                        (unsigned)time.hours(), (unsigned)time.minutes(), (unsigned)time.seconds(), usegmt);
+}
+
+std::string String::formatUTCDate(time_t timeval, bool usegmt) {
+    int64_t days = (int64_t)timeval / 86400;
+    int64_t secs = (int64_t)timeval % 86400;
+    if (secs < 0) {
+        secs += 86400;
+        --days;
+    }
+    unsigned weekday = (unsigned)((days % 7 + 11) % 7);
+    // Civil date from days since the epoch (proleptic Gregorian calendar)
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    unsigned day = doy - (153 * mp + 2) / 5 + 1;
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    int year = (int)(yoe + era * 400) + (month <= 2 ? 1 : 0);
+    return writeUTCDate(year, month, day, weekday, (unsigned)(secs / 3600), (unsigned)(secs % 3600 / 60),
+                        (unsigned)(secs % 60), usegmt);
+}
+
+static bool parseDigits(const char *&p, const char *end, int width, int &value) {
+    if (end - p < width) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < width; ++i, ++p) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    return true;
+}
+
+static bool parseLiteral(const char *&p, const char *end, const char *literal, size_t length) {
+    if ((size_t)(end - p) < length || memcmp(p, literal, length) != 0) {
+        return false;
+    }
+    p += length;
+    return true;
+}
+
+static bool parseMonth(const char *&p, const char *end, int &month) {
+    for (int i = 0; i != 12; ++i) {
+        if (parseLiteral(p, end, MONTH_NAMES[i], 3)) {
+            month = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseTimeOfDay(const char *&p, const char *end, int &hours, int &minutes, int &seconds) {
+    return parseDigits(p, end, 2, hours) && parseLiteral(p, end, ":", 1) && parseDigits(p, end, 2, minutes) &&
+           parseLiteral(p, end, ":", 1) && parseDigits(p, end, 2, seconds);
+}
+
+DateTime String::parseUTCDate(const std::string &date) {
+    const char *p = date.data(), *end = p + date.size();
+    int year = 0, month = 0, day = 0, hours = 0, minutes = 0, seconds = 0;
+    bool valid = false;
+    const char *comma = (const char *)memchr(p, ',', date.size());
+    if (comma == p + 3) {
+        // IMF-fixdate: Sun, 06 Nov 1994 08:49:37 GMT
+        p += 3;
+        valid = parseLiteral(p, end, ", ", 2) && parseDigits(p, end, 2, day) && parseLiteral(p, end, " ", 1) &&
+                parseMonth(p, end, month) && parseLiteral(p, end, " ", 1) && parseDigits(p, end, 4, year) &&
+                parseLiteral(p, end, " ", 1) && parseTimeOfDay(p, end, hours, minutes, seconds) &&
+                parseLiteral(p, end, " GMT", 4) && p == end;
+    } else if (comma) {
+        // RFC 850: Sunday, 06-Nov-94 08:49:37 GMT
+        size_t length = (size_t)(comma - p);
+        for (auto name: WEEKDAY_FULL_NAMES) {
+            if (strlen(name) == length && memcmp(name, p, length) == 0) {
+                p = comma;
+                valid = true;
+                break;
+            }
+        }
+        valid = valid && parseLiteral(p, end, ", ", 2) && parseDigits(p, end, 2, day) &&
+                parseLiteral(p, end, "-", 1) && parseMonth(p, end, month) && parseLiteral(p, end, "-", 1) &&
+                parseDigits(p, end, 2, year) && parseLiteral(p, end, " ", 1) &&
+                parseTimeOfDay(p, end, hours, minutes, seconds) && parseLiteral(p, end, " GMT", 4) && p == end;
+        year += year < 70 ? 2000 : 1900;
+    } else if (date.size() == 24) {
+        // asctime: Sun Nov  6 08:49:37 1994
+        p += 3;
+        valid = parseLiteral(p, end, " ", 1) && parseMonth(p, end, month) && parseLiteral(p, end, " ", 1);
+        if (valid && *p == ' ') {
+            ++p;
+            valid = parseDigits(p, end, 1, day);
+        } else {
+            valid = valid && parseDigits(p, end, 2, day);
+        }
+        valid = valid && parseLiteral(p, end, " ", 1) && parseTimeOfDay(p, end, hours, minutes, seconds) &&
+                parseLiteral(p, end, " ", 1) && parseDigits(p, end, 4, year) && p == end;
+    }
+    if (!valid || year < 1400 || day < 1 || hours > 23 || minutes > 59 || seconds > 60) {
+        return DateTime();
+    }
+    static const int daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (day > daysInMonth[month - 1] + (month == 2 && leap ? 1 : 0)) {
+        return DateTime();
+    }
+    return DateTime(Date((unsigned short)year, (unsigned short)month, (unsigned short)day),
+                    boost::posix_time::hours(hours) + boost::posix_time::minutes(minutes) +
+                    boost::posix_time::seconds(std::min(seconds, 59)));
 }
 
 std::string String::translate(const std::string &s, const std::array<char, 256> &table,
@@ -85,20 +85,16 @@ public:
     static std::string capitalizeCopy(const std::string &s);
 
     static std::string formatUTCDate(bool usegmt=false) {
-        DateTime now = boost::posix_time::second_clock::universal_time();
-        return formatUTCDate(now, usegmt);
+        return formatUTCDate(time(nullptr), usegmt);
     }
 
     static std::string formatUTCDate(const DateTime &timeval, bool usegmt=false);
 
-    static DateTime parseUTCDate(const std::string &date) {
-        static std::locale loc(std::cin.getloc(), new boost::posix_time::time_input_facet("%a, %d %b %Y %H:%M:%S GMT"));
-        std::istringstream ss(date);
-        ss.imbue(loc);
-        DateTime dt;
-        ss >> dt;
-        return dt;
-    }
+    static std::string formatUTCDate(time_t timeval, bool usegmt=false);
+
+    // Accepts the three HTTP-date forms of RFC 7231 (IMF-fixdate, RFC 850 and asctime); returns not_a_date_time
+    // when the value is malformed
+    static DateTime parseUTCDate(const std::string &date);
 
     static std::string translate(const std::string &s, const std::array<char, 256> &table,
                                  const std::vector<char> &deleteChars);
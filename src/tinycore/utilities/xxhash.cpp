@@ -0,0 +1,116 @@
+//
+// XXH64 hashing.
+//
+
+#include "tinycore/utilities/xxhash.h"
+
+
+static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const Byte *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const Byte *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t mergeRound64(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+
+void XXHash64::reset(uint64_t seed) {
+    _seed = seed;
+    _acc[0] = seed + PRIME64_1 + PRIME64_2;
+    _acc[1] = seed + PRIME64_2;
+    _acc[2] = seed;
+    _acc[3] = seed - PRIME64_1;
+    _bufferSize = 0;
+    _length = 0;
+}
+
+void XXHash64::update(const Byte *data, size_t length) {
+    _length += length;
+    if (_bufferSize + length < sizeof(_buffer)) {
+        memcpy(_buffer + _bufferSize, data, length);
+        _bufferSize += length;
+        return;
+    }
+    const Byte *end = data + length;
+    if (_bufferSize != 0) {
+        size_t fill = sizeof(_buffer) - _bufferSize;
+        memcpy(_buffer + _bufferSize, data, fill);
+        data += fill;
+        for (size_t i = 0; i != 4; ++i) {
+            _acc[i] = round64(_acc[i], read64(_buffer + i * 8));
+        }
+        _bufferSize = 0;
+    }
+    for (; data + 32 <= end; data += 32) {
+        _acc[0] = round64(_acc[0], read64(data));
+        _acc[1] = round64(_acc[1], read64(data + 8));
+        _acc[2] = round64(_acc[2], read64(data + 16));
+        _acc[3] = round64(_acc[3], read64(data + 24));
+    }
+    _bufferSize = (size_t)(end - data);
+    memcpy(_buffer, data, _bufferSize);
+}
+
+uint64_t XXHash64::digest() const {
+    uint64_t hash;
+    if (_length >= 32) {
+        hash = rotl64(_acc[0], 1) + rotl64(_acc[1], 7) + rotl64(_acc[2], 12) + rotl64(_acc[3], 18);
+        for (size_t i = 0; i != 4; ++i) {
+            hash = mergeRound64(hash, _acc[i]);
+        }
+    } else {
+        hash = _seed + PRIME64_5;
+    }
+    hash += _length;
+    const Byte *p = _buffer, *end = _buffer + _bufferSize;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= round64(0, read64(p));
+        hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)read32(p) * PRIME64_1;
+        hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p != end; ++p) {
+        hash ^= (*p) * PRIME64_5;
+        hash = rotl64(hash, 11) * PRIME64_1;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::string XXHash64::hex() const {
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)digest());
+    return std::string(buffer, 16);
+}
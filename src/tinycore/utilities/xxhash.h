@@ -0,0 +1,47 @@
+//
+// XXH64 hashing.
+//
+
+#ifndef TINYCORE_XXHASH_H
+#define TINYCORE_XXHASH_H
+
+#include "tinycore/common/common.h"
+
+
+// Streaming XXH64: a fast non-cryptographic hash, for checksums and ETags rather than anything an attacker controls
+class TC_COMMON_API XXHash64 {
+public:
+    explicit XXHash64(uint64_t seed=0) {
+        reset(seed);
+    }
+
+    void reset(uint64_t seed=0);
+
+    void update(const Byte *data, size_t length);
+
+    void update(const ByteArray &data) {
+        update(data.data(), data.size());
+    }
+
+    void update(const std::string &data) {
+        update((const Byte *)data.data(), data.size());
+    }
+
+    uint64_t digest() const;
+
+    std::string hex() const;
+
+    // Number of bytes hashed so far
+    uint64_t getLength() const {
+        return _length;
+    }
+protected:
+    uint64_t _seed;
+    uint64_t _acc[4];
+    Byte _buffer[32];
+    size_t _bufferSize;
+    uint64_t _length;
+};
+
+
+#endif //TINYCORE_XXHASH_H
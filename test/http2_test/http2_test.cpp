@@ -0,0 +1,522 @@
+//
+// Tests for HPACK and the HTTP/2 server connection.
+//
+
+#define BOOST_TEST_MODULE http2_test
+#include <boost/test/included/unit_test.hpp>
+#include "tinycore/tinycore.h"
+
+TINYCORE_TEST_INIT()
+
+using HeaderList = HPACKDecoder::HeaderListType;
+BOOST_TEST_DONT_PRINT_LOG_VALUE(HeaderList)
+
+
+static ByteArray fromHex(const std::string &hex) {
+    ByteArray bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back((Byte)std::stoul(hex.substr(i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+
+BOOST_AUTO_TEST_CASE(TestHPACKHuffman) {
+    ByteArray encoded;
+    HPACKHuffman::encode("www.example.com", encoded);
+    BOOST_CHECK(encoded == fromHex("f1e3c2e5f23a6ba0ab90f4ff"));
+    BOOST_CHECK_EQUAL(HPACKHuffman::encodedLength("www.example.com"), encoded.size());
+    std::string decoded;
+    BOOST_CHECK(HPACKHuffman::decode(encoded.data(), encoded.size(), decoded));
+    BOOST_CHECK_EQUAL(decoded, "www.example.com");
+    std::string value;
+    for (int c = 0; c != 256; ++c) {
+        value.push_back((char)c);
+    }
+    encoded.clear();
+    HPACKHuffman::encode(value, encoded);
+    decoded.clear();
+    BOOST_CHECK(HPACKHuffman::decode(encoded.data(), encoded.size(), decoded));
+    BOOST_CHECK(decoded == value);
+    // Padding longer than 7 bits, and padding that isn't all ones
+    ByteArray invalid = fromHex("f1e3c2e5f23a6ba0ab90f4ffff");
+    BOOST_CHECK(!HPACKHuffman::decode(invalid.data(), invalid.size(), decoded));
+    invalid = fromHex("f1e3c2e5f23a6ba0ab90f4fe");
+    BOOST_CHECK(!HPACKHuffman::decode(invalid.data(), invalid.size(), decoded));
+}
+
+BOOST_AUTO_TEST_CASE(TestHPACKDecodeRequests) {
+    // RFC 7541 C.4
+    HPACKDecoder decoder;
+    HeaderList headers;
+    size_t listSize;
+    ByteArray block = fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+    BOOST_REQUIRE(decoder.decode(block.data(), block.size(), headers, listSize));
+    BOOST_CHECK_EQUAL(headers, HeaderList({{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                                           {":authority", "www.example.com"}}));
+    BOOST_CHECK_EQUAL(decoder.getTable().getSize(), 57);
+
+    headers.clear();
+    block = fromHex("828684be5886a8eb10649cbf");
+    BOOST_REQUIRE(decoder.decode(block.data(), block.size(), headers, listSize));
+    BOOST_CHECK_EQUAL(headers, HeaderList({{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                                           {":authority", "www.example.com"}, {"cache-control", "no-cache"}}));
+    BOOST_CHECK_EQUAL(decoder.getTable().getSize(), 110);
+
+    headers.clear();
+    block = fromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf");
+    BOOST_REQUIRE(decoder.decode(block.data(), block.size(), headers, listSize));
+    BOOST_CHECK_EQUAL(headers, HeaderList({{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                                           {":authority", "www.example.com"}, {"custom-key", "custom-value"}}));
+    BOOST_CHECK_EQUAL(decoder.getTable().getSize(), 164);
+    BOOST_CHECK_EQUAL(decoder.getTable().getCount(), 3);
+
+    // Index past the end of the dynamic table
+    HPACKDecoder invalid;
+    block = fromHex("be");
+    BOOST_CHECK(!invalid.decode(block.data(), block.size(), headers, listSize));
+}
+
+BOOST_AUTO_TEST_CASE(TestHPACKRoundTrip) {
+    HPACKEncoder encoder;
+    HPACKDecoder decoder;
+    HeaderList headers = {{":status", "200"}, {"content-type", "text/html; charset=UTF-8"},
+                          {"server", "TinyCore"}, {"content-length", "11"}, {"x-custom", "value"}};
+    ByteArray first, second;
+    encoder.encode(headers, first);
+    encoder.encode(headers, second);
+    BOOST_CHECK_LT(second.size(), first.size());
+    HeaderList decoded;
+    size_t listSize;
+    BOOST_REQUIRE(decoder.decode(first.data(), first.size(), decoded, listSize));
+    BOOST_CHECK_EQUAL(decoded, headers);
+    decoded.clear();
+    BOOST_REQUIRE(decoder.decode(second.data(), second.size(), decoded, listSize));
+    BOOST_CHECK_EQUAL(decoded, headers);
+
+    encoder.setMaxTableSize(0);
+    ByteArray third;
+    encoder.encode(headers, third);
+    decoded.clear();
+    BOOST_REQUIRE(decoder.decode(third.data(), third.size(), decoded, listSize));
+    BOOST_CHECK_EQUAL(decoded, headers);
+    BOOST_CHECK_EQUAL(decoder.getTable().getCount(), 0);
+}
+
+
+class HTTP2Test: public AsyncHTTPTestCase {
+public:
+    class HelloHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            setHeader("X-Protocol", _request->getVersion());
+            finish("Hello world");
+        }
+    };
+
+    class EchoHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onPost(const StringVector &args) override {
+            finish(getArgument("name", "") + ":" + _request->getBody());
+        }
+    };
+
+    class DelayHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            Asynchronous();
+            IOLoop::current()->addTimeout(0.05f, [this, self=shared_from_this()]() {
+                finish("Delayed");
+            });
+        }
+    };
+
+    class LargeHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            finish(std::string(100000, 'x'));
+        }
+    };
+
+    class CookieHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            setCookie("name", "value");
+            setStatus(201);
+            finish("Created");
+        }
+    };
+
+    class PausedHandler: public RequestHandler {
+    public:
+        static constexpr bool streamRequestBody = true;
+
+        using RequestHandler::RequestHandler;
+
+        void dataReceived(ByteArray chunk) override {
+            // Never resumed, so the stream window is never reopened
+            _request->pauseBody();
+        }
+
+        void onPost(const StringVector &args) override {
+            finish("Done");
+        }
+    };
+
+    struct Frame {
+        HTTP2FrameType type;
+        uint8_t flags;
+        uint32_t streamId;
+        ByteArray payload;
+    };
+
+    struct Response {
+        std::string status;
+        HeaderList headers;
+        std::string body;
+        size_t maxDataFrame{0};
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<HelloHandler>("/"),
+                url<EchoHandler>("/echo"),
+                url<DelayHandler>("/delay"),
+                url<LargeHandler>("/large"),
+                url<CookieHandler>("/cookie"),
+                url<PausedHandler>("/paused"),
+        };
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    std::shared_ptr<HTTPServer> getHTTPServer() override {
+        auto server = AsyncHTTPTestCase::getHTTPServer();
+        server->setHTTP2Enabled(true);
+        return server;
+    }
+
+    void tearDown() override {
+        if (_stream) {
+            _stream->close();
+            _stream.reset();
+        }
+        _ioloop.addTimeout(0.001f, [this]() {
+            stop();
+        });
+        wait();
+        AsyncHTTPTestCase::tearDown();
+    }
+
+    virtual void connect() {
+        BaseIOStream::SocketType socket(_ioloop.getService());
+        _stream = IOStream::create(std::move(socket), &_ioloop);
+        _stream->connect("localhost", getHTTPPort(), [this]() {
+            stop();
+        });
+        wait();
+        _stream->setNodelay(true);
+    }
+
+    void sendPreface(const std::vector<std::pair<HTTP2Settings, uint32_t>> &settings={}) {
+        ByteArray data = String::toByteArray(HTTP2_CONNECTION_PREFACE);
+        _stream->write(data.data(), data.size());
+        ByteArray payload;
+        for (auto &setting: settings) {
+            payload.push_back(0);
+            payload.push_back((Byte)setting.first);
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                payload.push_back((Byte)(setting.second >> shift));
+            }
+        }
+        sendFrame(HTTP2FrameType::SETTINGS, 0, 0, payload);
+    }
+
+    void sendFrame(HTTP2FrameType type, uint8_t flags, uint32_t streamId, const ByteArray &payload) {
+        ByteArray frame = {(Byte)(payload.size() >> 16), (Byte)(payload.size() >> 8), (Byte)payload.size(),
+                           (Byte)type, flags, (Byte)(streamId >> 24), (Byte)(streamId >> 16), (Byte)(streamId >> 8),
+                           (Byte)streamId};
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        _stream->write(frame.data(), frame.size());
+    }
+
+    void sendRequest(uint32_t streamId, const std::string &method, const std::string &path, bool endStream,
+                     const HeaderList &extraHeaders={}) {
+        HeaderList headers = {{":method", method}, {":scheme", getProtocol()}, {":path", path},
+                              {":authority", "localhost"}};
+        headers.insert(headers.end(), extraHeaders.begin(), extraHeaders.end());
+        ByteArray block;
+        _encoder.encode(headers, block);
+        uint8_t flags = HTTP2Connection::FLAG_END_HEADERS | (endStream ? HTTP2Connection::FLAG_END_STREAM : 0);
+        sendFrame(HTTP2FrameType::HEADERS, flags, streamId, block);
+    }
+
+    void sendWindowUpdate(uint32_t streamId, size_t increment) {
+        sendFrame(HTTP2FrameType::WINDOW_UPDATE, 0, streamId, {(Byte)(increment >> 24), (Byte)(increment >> 16),
+                                                               (Byte)(increment >> 8), (Byte)increment});
+    }
+
+    Frame readFrame() {
+        _stream->readBytes(HTTP2_FRAME_HEADER_SIZE, [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        ByteArray header = wait<ByteArray>();
+        Frame frame;
+        size_t length = ((size_t)header[0] << 16) | ((size_t)header[1] << 8) | header[2];
+        frame.type = (HTTP2FrameType)header[3];
+        frame.flags = header[4];
+        frame.streamId = (((uint32_t)header[5] << 24) | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 8)
+                          | header[8]) & 0x7FFFFFFF;
+        if (length) {
+            _stream->readBytes(length, [this](ByteArray data) {
+                stop(std::move(data));
+            });
+            frame.payload = wait<ByteArray>();
+        }
+        return frame;
+    }
+
+    std::map<uint32_t, Response> readResponses(size_t count, std::vector<uint32_t> *order=nullptr) {
+        std::map<uint32_t, Response> responses;
+        while (count) {
+            Frame frame = readFrame();
+            if (frame.type == HTTP2FrameType::HEADERS) {
+                BOOST_REQUIRE(frame.flags & HTTP2Connection::FLAG_END_HEADERS);
+                HeaderList headers;
+                size_t listSize;
+                BOOST_REQUIRE(_decoder.decode(frame.payload.data(), frame.payload.size(), headers, listSize));
+                Response &response = responses[frame.streamId];
+                for (auto &header: headers) {
+                    if (header.first == ":status") {
+                        response.status = header.second;
+                    } else {
+                        response.headers.push_back(header);
+                    }
+                }
+            } else if (frame.type == HTTP2FrameType::DATA) {
+                Response &response = responses[frame.streamId];
+                response.body.append((const char *)frame.payload.data(), frame.payload.size());
+                response.maxDataFrame = std::max(response.maxDataFrame, frame.payload.size());
+                if (!frame.payload.empty()) {
+                    sendWindowUpdate(0, frame.payload.size());
+                    sendWindowUpdate(frame.streamId, frame.payload.size());
+                }
+            } else if (frame.type == HTTP2FrameType::SETTINGS) {
+                if (!(frame.flags & HTTP2Connection::FLAG_ACK)) {
+                    sendFrame(HTTP2FrameType::SETTINGS, HTTP2Connection::FLAG_ACK, 0, {});
+                }
+            } else if (frame.type == HTTP2FrameType::WINDOW_UPDATE) {
+                ++_windowUpdates;
+            } else if (frame.type == HTTP2FrameType::GOAWAY || frame.type == HTTP2FrameType::RST_STREAM) {
+                BOOST_FAIL("Unexpected frame type " << (int)frame.type);
+            }
+            if ((frame.type == HTTP2FrameType::HEADERS || frame.type == HTTP2FrameType::DATA)
+                && (frame.flags & HTTP2Connection::FLAG_END_STREAM)) {
+                if (order) {
+                    order->push_back(frame.streamId);
+                }
+                --count;
+            }
+        }
+        return responses;
+    }
+
+    Frame readUntil(HTTP2FrameType type) {
+        while (true) {
+            Frame frame = readFrame();
+            if (frame.type == type) {
+                return frame;
+            }
+        }
+    }
+
+    static uint32_t errorCode(const Frame &frame, size_t offset) {
+        BOOST_REQUIRE_GE(frame.payload.size(), offset + 4);
+        return ((uint32_t)frame.payload[offset] << 24) | ((uint32_t)frame.payload[offset + 1] << 16)
+               | ((uint32_t)frame.payload[offset + 2] << 8) | frame.payload[offset + 3];
+    }
+
+    static std::string findHeader(const Response &response, const std::string &name) {
+        for (auto &header: response.headers) {
+            if (header.first == name) {
+                return header.second;
+            }
+        }
+        return {};
+    }
+
+    void testGet() {
+        connect();
+        sendPreface();
+        sendRequest(1, "GET", "/", true);
+        auto responses = readResponses(1);
+        BOOST_CHECK_EQUAL(responses[1].status, "200");
+        BOOST_CHECK_EQUAL(responses[1].body, "Hello world");
+        BOOST_CHECK_EQUAL(findHeader(responses[1], "x-protocol"), "HTTP/2.0");
+        BOOST_CHECK_EQUAL(findHeader(responses[1], "content-length"), "11");
+        BOOST_CHECK_EQUAL(findHeader(responses[1], "connection"), "");
+    }
+
+    void testMultiplexing() {
+        connect();
+        sendPreface();
+        sendRequest(1, "GET", "/delay", true);
+        sendRequest(3, "GET", "/", true);
+        sendRequest(5, "POST", "/echo?name=post", false, {{"content-type", "application/x-www-form-urlencoded"}});
+        sendFrame(HTTP2FrameType::DATA, HTTP2Connection::FLAG_END_STREAM, 5, String::toByteArray("a=b"));
+        std::vector<uint32_t> order;
+        auto responses = readResponses(3, &order);
+        BOOST_CHECK_EQUAL(responses[1].body, "Delayed");
+        BOOST_CHECK_EQUAL(responses[3].body, "Hello world");
+        BOOST_CHECK_EQUAL(responses[5].body, "post:a=b");
+        BOOST_REQUIRE_EQUAL(order.size(), 3);
+        BOOST_CHECK_EQUAL(order.back(), 1);
+    }
+
+    void testFlowControl() {
+        connect();
+        sendPreface({{HTTP2Settings::INITIAL_WINDOW_SIZE, 1000}});
+        sendRequest(1, "GET", "/large", true);
+        auto responses = readResponses(1);
+        BOOST_CHECK_EQUAL(responses[1].status, "200");
+        BOOST_CHECK_EQUAL(responses[1].body, std::string(100000, 'x'));
+        BOOST_CHECK_LE(responses[1].maxDataFrame, 1000);
+    }
+
+    void testBatchedWindowUpdates() {
+        connect();
+        sendPreface();
+        sendRequest(1, "POST", "/echo?name=post", false);
+        for (int i = 0; i != 10; ++i) {
+            sendFrame(HTTP2FrameType::DATA, 0, 1, ByteArray(100, 'a'));
+        }
+        sendFrame(HTTP2FrameType::DATA, HTTP2Connection::FLAG_END_STREAM, 1, ByteArray(100, 'a'));
+        auto responses = readResponses(1);
+        BOOST_CHECK_EQUAL(responses[1].body, "post:" + std::string(1100, 'a'));
+        BOOST_CHECK_EQUAL(_windowUpdates, 0);
+    }
+
+    void testWindowOverrun() {
+        connect();
+        sendPreface();
+        sendRequest(1, "POST", "/paused", false);
+        // Four full frames are one byte more than the default stream window
+        for (int i = 0; i != 4; ++i) {
+            sendFrame(HTTP2FrameType::DATA, 0, 1, ByteArray(HTTP2_DEFAULT_MAX_FRAME_SIZE, 'a'));
+        }
+        Frame frame = readUntil(HTTP2FrameType::RST_STREAM);
+        BOOST_CHECK_EQUAL(frame.streamId, 1);
+        BOOST_CHECK_EQUAL(errorCode(frame, 0), (uint32_t)HTTP2ErrorCode::FLOW_CONTROL_ERROR);
+    }
+
+    void testHandlerHeaders() {
+        connect();
+        sendPreface();
+        sendRequest(1, "GET", "/cookie", true);
+        auto responses = readResponses(1);
+        BOOST_CHECK_EQUAL(responses[1].status, "201");
+        BOOST_CHECK_EQUAL(responses[1].body, "Created");
+        BOOST_CHECK_EQUAL(findHeader(responses[1], "set-cookie"), "name=value; Path=/");
+        BOOST_CHECK_EQUAL(findHeader(responses[1], "content-length"), "7");
+    }
+
+    void testHTTP1() {
+        auto response = fetch("/");
+        response.rethrow();
+        BOOST_CHECK_EQUAL(*response.getBody(), "Hello world");
+        BOOST_CHECK_EQUAL(response.getHeaders().get("X-Protocol"), "HTTP/1.1");
+    }
+
+    void testBadPreface() {
+        connect();
+        ByteArray data = String::toByteArray("PRI * HTTP/2.0\r\n\r\nXX\r\n\r\n");
+        _stream->write(data.data(), data.size());
+        _stream->readUntilClose([this](ByteArray data) {
+            stop(std::move(data));
+        });
+        ByteArray response = wait<ByteArray>();
+        // Only the server's SETTINGS frame precedes the close
+        BOOST_REQUIRE_GE(response.size(), HTTP2_FRAME_HEADER_SIZE);
+        BOOST_CHECK_EQUAL(response[3], (Byte)HTTP2FrameType::SETTINGS);
+        BOOST_CHECK_EQUAL(response.size(), HTTP2_FRAME_HEADER_SIZE + 12);
+    }
+protected:
+    std::shared_ptr<BaseIOStream> _stream;
+    HPACKEncoder _encoder;
+    HPACKDecoder _decoder;
+    size_t _windowUpdates{0};
+};
+
+
+class HTTP2SettingsTimeoutTest: public HTTP2Test {
+public:
+    std::shared_ptr<HTTPServer> getHTTPServer() override {
+        auto server = HTTP2Test::getHTTPServer();
+        server->setHTTP2SettingsTimeout(0.1f);
+        return server;
+    }
+
+    void testSettingsTimeout() {
+        connect();
+        sendPreface();
+        Frame frame = readUntil(HTTP2FrameType::GOAWAY);
+        BOOST_CHECK_EQUAL(errorCode(frame, 4), (uint32_t)HTTP2ErrorCode::SETTINGS_TIMEOUT);
+    }
+};
+
+
+class HTTP2SSLTest: public HTTP2Test {
+public:
+    std::shared_ptr<SSLOption> getHTTPServerSSLOption() const override {
+        SSLParams sslParams(true);
+        sslParams.setKeyFile("test.key");
+        sslParams.setCertFile("test.crt");
+        return SSLOption::create(sslParams);
+    }
+
+    std::string getProtocol() const override {
+        return "https";
+    }
+
+    HTTPResponse fetchImpl(std::shared_ptr<HTTPRequest> request) override {
+        request->setValidateCert(false);
+        return AsyncHTTPTestCase::fetchImpl(std::move(request));
+    }
+
+    void connect() override {
+        SSLParams sslParams(false);
+        sslParams.setALPNProtocols({"h2"});
+        auto sslStream = SSLIOStream::create(BaseIOStream::SocketType(_ioloop.getService()),
+                                             SSLOption::create(sslParams), &_ioloop);
+        _stream = sslStream;
+        _stream->connect("localhost", getHTTPPort(), [this]() {
+            stop();
+        });
+        wait();
+        _stream->setNodelay(true);
+        BOOST_CHECK_EQUAL(sslStream->getSelectedProtocol(), "h2");
+    }
+};
+
+
+TINYCORE_TEST_CASE(HTTP2Test, testGet)
+TINYCORE_TEST_CASE(HTTP2Test, testMultiplexing)
+TINYCORE_TEST_CASE(HTTP2Test, testFlowControl)
+TINYCORE_TEST_CASE(HTTP2Test, testBatchedWindowUpdates)
+TINYCORE_TEST_CASE(HTTP2Test, testWindowOverrun)
+TINYCORE_TEST_CASE(HTTP2Test, testHandlerHeaders)
+TINYCORE_TEST_CASE(HTTP2Test, testHTTP1)
+TINYCORE_TEST_CASE(HTTP2Test, testBadPreface)
+TINYCORE_TEST_CASE(HTTP2SSLTest, testGet)
+TINYCORE_TEST_CASE(HTTP2SSLTest, testMultiplexing)
+TINYCORE_TEST_CASE(HTTP2SSLTest, testHTTP1)
+TINYCORE_TEST_CASE(HTTP2SettingsTimeoutTest, testSettingsTimeout)
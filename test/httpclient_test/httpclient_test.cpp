@@ -878,4 +878,40 @@ public:
     }
 };
 
-TINYCORE_TEST_CASE(HostnameMappingTestCase, testHostnameMapping)
\ No newline at end of file
+TINYCORE_TEST_CASE(HostnameMappingTestCase, testHostnameMapping)
+
+
+class UnixSocketTestCase: public AsyncHTTPTestCase {
+public:
+    std::shared_ptr<HTTPClient> getHTTPClient() override {
+        StringMap hostnameMapping = {{"www.example.com", getUnixAddress()}};
+        return HTTPClient::create(&_ioloop, hostnameMapping);
+    }
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<HelloWorldHandler>("/hello"),
+        };
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    void testUnixSocket() {
+        auto server = getHTTPServer();
+        server->listenUnix(getUnixAddress());
+        _httpClient->fetch("http://www.example.com/hello", [this](HTTPResponse response) {
+            stop(std::move(response));
+        });
+        HTTPResponse response = wait<HTTPResponse>();
+        server->stop();
+        response.rethrow();
+        const std::string *body = response.getBody();
+        BOOST_REQUIRE_NE(body, static_cast<const std::string *>(nullptr));
+        BOOST_CHECK_EQUAL(*body, "Hello world!");
+    }
+protected:
+    static std::string getUnixAddress() {
+        return "unix:@tinycore_httpclient_test_" + std::to_string(getpid());
+    }
+};
+
+TINYCORE_TEST_CASE(UnixSocketTestCase, testUnixSocket)
\ No newline at end of file
@@ -573,6 +573,41 @@ public:
         }
     };
 
+    class DelayHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            Asynchronous();
+            IOLoop::current()->addTimeout(0.05f, [this, self=shared_from_this()]() {
+                finish("Delayed");
+            });
+        }
+    };
+
+    class SerialHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            Asynchronous();
+            active() = true;
+            IOLoop::current()->addTimeout(0.05f, [this, self=shared_from_this()]() {
+                active() = false;
+                finish("Delayed");
+            });
+        }
+
+        void onPost(const StringVector &args) override {
+            write(active() ? "Overlapped" : "Serial");
+        }
+
+        static bool& active() {
+            static bool value = false;
+            return value;
+        }
+    };
+
     class FinishOnCloseHandler: public RequestHandler {
     public:
         using RequestHandler::RequestHandler;
@@ -591,6 +626,8 @@ public:
         Application::HandlersType handlers = {
                 url<HelloHandler>("/"),
                 url<LargeHandler>("/large"),
+                url<DelayHandler>("/delay"),
+                url<SerialHandler>("/serial"),
                 url<FinishOnCloseHandler>("/finish_on_close"),
         };
         return make_unique<Application>(std::move(handlers));
@@ -634,13 +671,13 @@ public:
         return HTTPHeaders::parse(String::toString(headerBytes));
     }
 
-    void readResponse() {
+    void readResponse(const std::string &expected="Hello world") {
         auto headers = readHeaders();
         _stream->readBytes(std::stoul(headers->at("Content-Length")), [this](ByteArray data) {
             stop(std::move(data));
         });
         std::string body = String::toString(wait<ByteArray>());
-        BOOST_CHECK_EQUAL("Hello world", body);
+        BOOST_CHECK_EQUAL(expected, body);
     }
 
     void close() {
@@ -713,6 +750,45 @@ public:
         close();
     }
 
+    void testPipelinedOrder() {
+        connect();
+        ByteArray request = String::toByteArray("GET /delay HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n"
+                                                "GET /delay HTTP/1.1\r\n\r\n");
+        _stream->write(request.data(), request.size());
+        readResponse("Delayed");
+        readResponse();
+        readResponse("Delayed");
+        close();
+    }
+
+    void testPipelinedUnsafeMethod() {
+        connect();
+        ByteArray request = String::toByteArray("GET /serial HTTP/1.1\r\n\r\n"
+                                                "POST /serial HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+        _stream->write(request.data(), request.size());
+        readResponse("Delayed");
+        readResponse("Serial");
+        close();
+    }
+
+    void testPipelinedExpectContinue() {
+        connect();
+        ByteArray request = String::toByteArray("GET /delay HTTP/1.1\r\n\r\n"
+                                                "POST /serial HTTP/1.1\r\nContent-Length: 4\r\n"
+                                                "Expect: 100-continue\r\n\r\n");
+        _stream->write(request.data(), request.size());
+        readResponse("Delayed");
+        _stream->readUntil("\r\n\r\n", [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        std::string continueLine = String::toString(wait<ByteArray>());
+        BOOST_CHECK(boost::starts_with(continueLine, "HTTP/1.1 100"));
+        ByteArray body = String::toByteArray("body");
+        _stream->write(body.data(), body.size());
+        readResponse("Serial");
+        close();
+    }
+
     void testCancelDuringDownload() {
         connect();
         ByteArray request = String::toByteArray("GET /large HTTP/1.1\r\n\r\n");
@@ -740,6 +816,298 @@ protected:
 };
 
 
+class StreamingBodyTest: public AsyncHTTPTestCase {
+public:
+    class StreamHandler: public RequestHandler {
+    public:
+        static constexpr bool streamRequestBody = true;
+
+        using RequestHandler::RequestHandler;
+
+        void dataReceived(ByteArray chunk) override {
+            ++_chunks;
+            _body.append((const char *)chunk.data(), chunk.size());
+            _request->pauseBody();
+            IOLoop::current()->addTimeout(0.001f, [this, self=shared_from_this()]() {
+                _request->resumeBody();
+            });
+        }
+
+        void onPost(const StringVector &args) override {
+            BOOST_CHECK(_request->getBody().empty());
+            write(String::format("%u:%u:", (unsigned)_body.size(), (unsigned)_chunks));
+            finish(_body.substr(0, 16));
+        }
+    protected:
+        size_t _chunks{0};
+        std::string _body;
+    };
+
+    class BufferedHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onPost(const StringVector &args) override {
+            finish(_request->getBody());
+        }
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<StreamHandler>("/stream"),
+                url<BufferedHandler>("/buffered"),
+        };
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    std::shared_ptr<HTTPServer> getHTTPServer() override {
+        auto server = AsyncHTTPTestCase::getHTTPServer();
+        server->setBodyChunkSize(4096);
+        return server;
+    }
+
+    std::string fetchRaw(const std::string &request) {
+        BaseIOStream::SocketType socket(_ioloop.getService());
+        auto stream = IOStream::create(std::move(socket), &_ioloop);
+        stream->connect("localhost", getHTTPPort(), [this]() {
+            stop();
+        });
+        wait();
+        stream->write((const Byte *)request.data(), request.size());
+        stream->readUntil("\r\n\r\n", [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        std::string headerData = String::toString(wait<ByteArray>());
+        BOOST_CHECK(boost::starts_with(headerData, "HTTP/1.1 200"));
+        auto headers = HTTPHeaders::parse(headerData.substr(headerData.find("\r\n") + 2));
+        stream->readBytes(std::stoul(headers->at("Content-Length")), [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        std::string body = String::toString(wait<ByteArray>());
+        stream->close();
+        return body;
+    }
+
+    void testStreamContentLength() {
+        HTTPResponse response = fetch("/stream", ARG_method="POST", ARG_body=std::string(40000, 'A'));
+        response.rethrow();
+        std::string body = *response.getBody();
+        BOOST_CHECK(boost::starts_with(body, "40000:10:AAAA"));
+    }
+
+    void testStreamChunked() {
+        std::string body = fetchRaw("POST /stream HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                    "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n");
+        BOOST_CHECK_EQUAL(body, "11:2:hello world");
+    }
+
+    void testBufferedChunked() {
+        std::string body = fetchRaw("POST /buffered HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                    "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n");
+        BOOST_CHECK_EQUAL(body, "hello world");
+    }
+};
+
+
+class ConnectionLimitTest: public AsyncHTTPTestCase {
+public:
+    class HelloHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            finish("Hello world");
+        }
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<HelloHandler>("/"),
+        };
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    std::shared_ptr<BaseIOStream> connect() {
+        BaseIOStream::SocketType socket(_ioloop.getService());
+        auto stream = IOStream::create(std::move(socket), &_ioloop);
+        stream->connect("localhost", getHTTPPort(), [this]() {
+            stop();
+        });
+        wait();
+        return stream;
+    }
+
+    std::string fetchRaw(const std::shared_ptr<BaseIOStream> &stream) {
+        const char *request = "GET / HTTP/1.1\r\n\r\n";
+        stream->write((const Byte *)request, strlen(request));
+        stream->readUntil("\r\n\r\n", [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        std::string headerData = String::toString(wait<ByteArray>());
+        BOOST_CHECK(boost::starts_with(headerData, "HTTP/1.1 200"));
+        auto headers = HTTPHeaders::parse(headerData.substr(headerData.find("\r\n") + 2));
+        stream->readBytes(std::stoul(headers->at("Content-Length")), [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        return String::toString(wait<ByteArray>());
+    }
+
+    void waitForClose(const std::shared_ptr<BaseIOStream> &stream) {
+        stream->readUntilClose([this](ByteArray data) {
+            stop();
+        });
+        wait();
+    }
+
+    void testIdleTimeout() {
+        _httpServer->setIdleTimeout(0.05f);
+        auto stream = connect();
+        BOOST_CHECK_EQUAL(fetchRaw(stream), "Hello world");
+        waitForClose(stream);
+        BOOST_CHECK_EQUAL(_httpServer->getConnectionTracker().getTimedOutCount(), 1u);
+    }
+
+    void testHeaderTimeout() {
+        _httpServer->setIdleTimeout(0.05f);
+        _httpServer->setHeaderTimeout(0.05f);
+        auto stream = connect();
+        const char *partial = "GET / HTTP/1.1\r\nHost: ";
+        stream->write((const Byte *)partial, strlen(partial));
+        waitForClose(stream);
+        auto &tracker = _httpServer->getConnectionTracker();
+        BOOST_CHECK_EQUAL(tracker.getTimedOutCount(), 1u);
+        // The server only half-closes after its 408 and drops the connection once the client closes its side
+        stream->close();
+        _ioloop.addTimeout(0.05f, [this]() {
+            stop();
+        });
+        wait();
+        BOOST_CHECK_EQUAL(tracker.getConnectionCount(), 0u);
+    }
+
+    void testHeaderTimeoutWithoutIdleTimeout() {
+        _httpServer->setHeaderTimeout(0.05f);
+        auto stream = connect();
+        const char *partial = "GET / HTTP/1.1\r\nHost: ";
+        stream->write((const Byte *)partial, strlen(partial));
+        waitForClose(stream);
+        BOOST_CHECK_EQUAL(_httpServer->getConnectionTracker().getTimedOutCount(), 1u);
+    }
+
+    void testStopAccepting() {
+        _httpServer->setMaxConnections(1);
+        auto first = connect();
+        BOOST_CHECK_EQUAL(fetchRaw(first), "Hello world");
+        BOOST_CHECK(_httpServer->isAcceptPaused());
+        auto second = connect();
+        _ioloop.addTimeout(0.05f, [this]() {
+            stop();
+        });
+        wait();
+        BOOST_CHECK_EQUAL(_httpServer->getConnectionTracker().getConnectionCount(), 1u);
+        first->close();
+        BOOST_CHECK_EQUAL(fetchRaw(second), "Hello world");
+        second->close();
+    }
+
+    void testCloseIdle() {
+        _httpServer->setMaxConnections(1);
+        _httpServer->setOverflowPolicy(ConnectionOverflowPolicy::CLOSE_IDLE);
+        auto first = connect();
+        BOOST_CHECK_EQUAL(fetchRaw(first), "Hello world");
+        auto second = connect();
+        BOOST_CHECK_EQUAL(fetchRaw(second), "Hello world");
+        waitForClose(first);
+        auto &tracker = _httpServer->getConnectionTracker();
+        BOOST_CHECK_EQUAL(tracker.getEvictedCount(), 1u);
+        BOOST_CHECK_EQUAL(tracker.getConnectionCount(), 1u);
+        second->close();
+    }
+
+    void testCloseIdleWithoutIdle() {
+        _httpServer->setMaxConnections(1);
+        _httpServer->setOverflowPolicy(ConnectionOverflowPolicy::CLOSE_IDLE);
+        auto first = connect();
+        const char *partial = "GET / HTTP/1.1\r\n";
+        first->write((const Byte *)partial, strlen(partial));
+        _ioloop.addTimeout(0.02f, [this]() {
+            stop();
+        });
+        wait();
+        auto second = connect();
+        waitForClose(second);
+        auto &tracker = _httpServer->getConnectionTracker();
+        BOOST_CHECK_EQUAL(tracker.getRejectedCount(), 1u);
+        BOOST_CHECK(!_httpServer->isAcceptPaused());
+        const char *rest = "\r\n";
+        first->write((const Byte *)rest, strlen(rest));
+        first->readUntil("\r\n", [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        BOOST_CHECK(boost::starts_with(String::toString(wait<ByteArray>()), "HTTP/1.1 200"));
+        first->close();
+    }
+};
+
+
+class RequestLimitTest: public ConnectionLimitTest {
+public:
+    std::string rejectedWith(const std::string &request) {
+        auto stream = connect();
+        stream->write((const Byte *)request.data(), request.size());
+        stream->readUntilClose([this](ByteArray data) {
+            stop(std::move(data));
+        });
+        std::string response = String::toString(wait<ByteArray>());
+        return response.substr(0, response.find("\r\n"));
+    }
+
+    void testHeaderTooLarge() {
+        _httpServer->setMaxHeaderSize(1024);
+        std::string request = "GET / HTTP/1.1\r\nX-Padding: " + std::string(4096, 'a');
+        BOOST_CHECK_EQUAL(rejectedWith(request), "HTTP/1.1 431 Request Header Fields Too Large");
+    }
+
+    void testTooManyHeaders() {
+        _httpServer->setMaxHeaderCount(2);
+        BOOST_CHECK_EQUAL(rejectedWith("GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n"),
+                          "HTTP/1.1 431 Request Header Fields Too Large");
+    }
+
+    void testStartLineTooLong() {
+        _httpServer->setMaxStartLineSize(64);
+        BOOST_CHECK_EQUAL(rejectedWith("GET /" + std::string(256, 'a')), "HTTP/1.1 414 Request-URI Too Long");
+    }
+
+    void testBodyTooLarge() {
+        _httpServer->setMaxBodySize(16);
+        BOOST_CHECK_EQUAL(rejectedWith("POST / HTTP/1.1\r\nContent-Length: 100\r\n\r\n"),
+                          "HTTP/1.1 413 Request Entity Too Large");
+        BOOST_CHECK_EQUAL(rejectedWith("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n20\r\n"),
+                          "HTTP/1.1 413 Request Entity Too Large");
+    }
+
+    void testRejectWhileSending() {
+        _httpServer->setMaxBodySize(16);
+        std::string request = "POST / HTTP/1.1\r\nContent-Length: 1048576\r\n\r\n" + std::string(262144, 'a');
+        BOOST_CHECK_EQUAL(rejectedWith(request), "HTTP/1.1 413 Request Entity Too Large");
+    }
+
+    void testRejectHTTP10() {
+        _httpServer->setMaxBodySize(16);
+        BOOST_CHECK_EQUAL(rejectedWith("POST / HTTP/1.0\r\nContent-Length: 100\r\n\r\n"),
+                          "HTTP/1.0 413 Request Entity Too Large");
+    }
+
+    void testSlowBody() {
+        _httpServer->setMinBodyDataRate(1000, 0.05f);
+        BOOST_CHECK_EQUAL(rejectedWith("POST / HTTP/1.1\r\nContent-Length: 100\r\n\r\nx"),
+                          "HTTP/1.1 408 Request Timeout");
+        BOOST_CHECK_EQUAL(_httpServer->getConnectionTracker().getTimedOutCount(), 1u);
+    }
+};
+
+
 TINYCORE_TEST_INIT()
 TINYCORE_TEST_CASE(SSLTest, testSSL)
 TINYCORE_TEST_CASE(SSLTest, testLargePost)
@@ -762,5 +1130,24 @@ TINYCORE_TEST_CASE(KeepAliveTest, testHTTP10)
 TINYCORE_TEST_CASE(KeepAliveTest, testHTTP10KeepAlive)
 TINYCORE_TEST_CASE(KeepAliveTest, testPipelinedRequests)
 TINYCORE_TEST_CASE(KeepAliveTest, testPipelinedCancel)
+TINYCORE_TEST_CASE(KeepAliveTest, testPipelinedOrder)
+TINYCORE_TEST_CASE(KeepAliveTest, testPipelinedUnsafeMethod)
+TINYCORE_TEST_CASE(KeepAliveTest, testPipelinedExpectContinue)
 TINYCORE_TEST_CASE(KeepAliveTest, testCancelDuringDownload)
-TINYCORE_TEST_CASE(KeepAliveTest, testFinishWhileClosed)
\ No newline at end of file
+TINYCORE_TEST_CASE(KeepAliveTest, testFinishWhileClosed)
+TINYCORE_TEST_CASE(StreamingBodyTest, testStreamContentLength)
+TINYCORE_TEST_CASE(StreamingBodyTest, testStreamChunked)
+TINYCORE_TEST_CASE(StreamingBodyTest, testBufferedChunked)
+TINYCORE_TEST_CASE(ConnectionLimitTest, testIdleTimeout)
+TINYCORE_TEST_CASE(ConnectionLimitTest, testHeaderTimeout)
+TINYCORE_TEST_CASE(ConnectionLimitTest, testHeaderTimeoutWithoutIdleTimeout)
+TINYCORE_TEST_CASE(ConnectionLimitTest, testStopAccepting)
+TINYCORE_TEST_CASE(ConnectionLimitTest, testCloseIdle)
+TINYCORE_TEST_CASE(ConnectionLimitTest, testCloseIdleWithoutIdle)
+TINYCORE_TEST_CASE(RequestLimitTest, testHeaderTooLarge)
+TINYCORE_TEST_CASE(RequestLimitTest, testTooManyHeaders)
+TINYCORE_TEST_CASE(RequestLimitTest, testStartLineTooLong)
+TINYCORE_TEST_CASE(RequestLimitTest, testBodyTooLarge)
+TINYCORE_TEST_CASE(RequestLimitTest, testRejectWhileSending)
+TINYCORE_TEST_CASE(RequestLimitTest, testRejectHTTP10)
+TINYCORE_TEST_CASE(RequestLimitTest, testSlowBody)
\ No newline at end of file
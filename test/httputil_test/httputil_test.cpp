@@ -4,6 +4,7 @@
 
 #define BOOST_TEST_MODULE httputil_test
 #include <boost/test/included/unit_test.hpp>
+#include <sys/stat.h>
 #include "tinycore/tinycore.h"
 
 TINYCORE_TEST_INIT()
@@ -150,6 +151,68 @@ BOOST_AUTO_TEST_CASE(TestDataAfterFinalBoundary) {
     BOOST_CHECK_EQUAL(file.getBody(), "Foo");
 }
 
+BOOST_AUTO_TEST_CASE(TestMultipartParserIncremental) {
+    std::string data = "preamble\r\n--1234\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\nvalue\r\n--12\r\n"
+            "--1234\r\nContent-Disposition: form-data; name=\"files\"; filename=\"ab.txt\"\r\n"
+            "Content-Type: text/plain\r\n\r\nFoo\r\n--123\r\n--1234--\r\nepilogue";
+    QueryArgListMap args;
+    HTTPFileListMap files;
+    MultipartParser parser("1234", args, files);
+    for (char c: data) {
+        parser.feed(&c, 1);
+    }
+    BOOST_CHECK(parser.finish());
+    BOOST_CHECK_EQUAL(args["a"], StringVector{"value\r\n--12"});
+    auto &file = files["files"][0];
+    BOOST_CHECK_EQUAL(file.getFileName(), "ab.txt");
+    BOOST_CHECK_EQUAL(file.getContentType(), "text/plain");
+    BOOST_CHECK(file.isInMemory());
+    BOOST_CHECK_EQUAL(file.getBody(), "Foo\r\n--123");
+}
+
+BOOST_AUTO_TEST_CASE(TestMultipartParserSpill) {
+    std::string content(10000, 'x');
+    std::string data = "--1234\r\nContent-Disposition: form-data; name=\"files\"; filename=\"big.bin\"\r\n\r\n" +
+            content + "\r\n--1234--";
+    std::string path;
+    {
+        QueryArgListMap args;
+        HTTPFileListMap files;
+        MultipartParser parser("1234", args, files, 1024);
+        for (size_t i = 0; i < data.size(); i += 700) {
+            parser.feed(data.data() + i, std::min<size_t>(700, data.size() - i));
+        }
+        BOOST_CHECK(parser.finish());
+        auto &file = files["files"][0];
+        BOOST_REQUIRE(!file.isInMemory());
+        BOOST_CHECK(file.getBody().empty());
+        BOOST_CHECK_EQUAL(file.getSize(), content.size());
+        path = file.getTempPath();
+        struct stat st;
+        BOOST_REQUIRE_EQUAL(::stat(path.c_str(), &st), 0);
+        BOOST_CHECK_EQUAL(st.st_mode & 0777, 0600);
+        std::ifstream stream(path, std::ios::binary);
+        std::string saved((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        BOOST_CHECK(saved == content);
+    }
+    BOOST_CHECK(!std::ifstream(path).good());
+    size_t received = 0;
+    bool finished = false;
+    QueryArgListMap args;
+    HTTPFileListMap files;
+    MultipartParser parser("1234", args, files);
+    parser.setFileSink([&](const std::string &name, const HTTPFile &file, const char *data, size_t length) {
+        BOOST_CHECK_EQUAL(name, "files");
+        BOOST_CHECK_EQUAL(file.getFileName(), "big.bin");
+        received += length;
+        finished = data == nullptr;
+    });
+    parser.feed(data);
+    BOOST_CHECK(parser.finish());
+    BOOST_CHECK_EQUAL(received, content.size());
+    BOOST_CHECK(finished);
+}
+
 BOOST_AUTO_TEST_CASE(TestMultiLine) {
     const char *data = "Foo: bar\r\n baz\r\nAsdf: qwer\r\n\tzxcv\r\nFoo: even\r\n     more\r\n     lines\r\n";
     auto headers = HTTPHeaders::parse(data);
@@ -169,7 +232,150 @@ BOOST_AUTO_TEST_CASE(TestMultiLine) {
     BOOST_CHECK_EQUAL(collectValues, targetValues);
 }
 
+BOOST_AUTO_TEST_CASE(TestHeaderFields) {
+    HTTPHeaders headers;
+    headers.add("content-length", "5");
+    headers.add("x-custom-header", "a");
+    headers.add("X-CUSTOM-HEADER", "b");
+    headers[HTTPHeaderField::HOST] = "example.com";
+    BOOST_CHECK_EQUAL(headers.size(), 3);
+    BOOST_CHECK(headers.has(HTTPHeaderField::CONTENT_LENGTH));
+    BOOST_CHECK_EQUAL(headers.at("CONTENT-LENGTH"), "5");
+    BOOST_CHECK_EQUAL(headers.get("Host"), "example.com");
+    BOOST_CHECK_EQUAL(headers.at("X-Custom-Header"), "a,b");
+    BOOST_CHECK_EQUAL(headers.getList("x-custom-header"), (StringVector{"a", "b"}));
+    BOOST_CHECK_EQUAL(headers.get(HTTPHeaderField::COOKIE, "none"), "none");
+    BOOST_CHECK(HTTPHeaders::lookupField("sec-websocket-key") == HTTPHeaderField::SEC_WEBSOCKET_KEY);
+    BOOST_CHECK(HTTPHeaders::lookupField("X-Unknown") == HTTPHeaderField::UNKNOWN);
+    headers["x-custom-header"] = "c";
+    BOOST_CHECK_EQUAL(headers.getList("X-Custom-Header"), StringVector{"c"});
+    StringPairs collectValues;
+    headers.getAll([&collectValues](const std::string &key, const std::string &value){
+        collectValues.emplace_back(key, value);
+    });
+    const StringPairs targetValues = {{"Content-Length", "5"},
+                                      {"X-Custom-Header", "c"},
+                                      {"Host", "example.com"}};
+    BOOST_CHECK_EQUAL(collectValues, targetValues);
+    headers.erase("content-length");
+    BOOST_CHECK(!headers.has("Content-Length"));
+    BOOST_CHECK_THROW(headers.at(HTTPHeaderField::CONTENT_LENGTH), KeyError);
+    HTTPHeaders copied(headers);
+    BOOST_CHECK_EQUAL(copied.get(HTTPHeaderField::HOST), "example.com");
+}
+
+BOOST_AUTO_TEST_CASE(TestRequestParser) {
+    std::string data = "\r\nGET /path?a=1 HTTP/1.1\r\nHost: example.com\r\ncontent-length:  12 \r\nX-Empty:\r\n\r\nbody";
+    HTTPRequestParser parser;
+    for (size_t i = 1; i < data.size() - 5; ++i) {
+        BOOST_CHECK(parser.parse(data.data(), i) == HTTPRequestParser::Result::INCOMPLETE);
+    }
+    BOOST_CHECK(parser.parse(data.data(), data.size()) == HTTPRequestParser::Result::COMPLETE);
+    BOOST_CHECK_EQUAL(parser.getConsumed(), data.size() - 4);
+    BOOST_CHECK_EQUAL(parser.getMethod(), "GET");
+    BOOST_CHECK_EQUAL(parser.getURI(), "/path?a=1");
+    BOOST_CHECK_EQUAL(parser.getVersion(), "HTTP/1.1");
+    BOOST_CHECK_EQUAL(parser.getHeaderCount(), 3);
+    BOOST_CHECK_EQUAL(parser.getHeader("Content-Length"), "12");
+    BOOST_CHECK_EQUAL(parser.getHeader("HOST"), "example.com");
+    BOOST_CHECK(parser.hasHeader("x-empty"));
+    BOOST_CHECK(!parser.hasHeader("Cookie"));
+    auto headers = parser.getHTTPHeaders();
+    BOOST_CHECK_EQUAL(headers->at("Content-Length"), "12");
+    BOOST_CHECK_EQUAL(headers->at("X-Empty"), "");
+}
+
+BOOST_AUTO_TEST_CASE(TestRequestParserMultiLine) {
+    std::string data = "POST / HTTP/1.0\nFoo: bar  \r\n baz\r\nAsdf: qwer\r\n\tzxcv\r\nFoo: even\r\n     more\r\n"
+            "     lines\r\n\r\n";
+    HTTPRequestParser parser;
+    BOOST_CHECK(parser.parse(data.data(), data.size()) == HTTPRequestParser::Result::COMPLETE);
+    auto headers = parser.getHTTPHeaders();
+    BOOST_CHECK_EQUAL(headers->at("asdf"), "qwer zxcv");
+    BOOST_CHECK_EQUAL(headers->at("Foo"), "bar baz,even more lines");
+}
+
+BOOST_AUTO_TEST_CASE(TestRequestParserErrors) {
+    auto parse = [](const std::string &data, size_t maxHeaderCount=DEFAULT_MAX_HEADER_COUNT,
+                    size_t maxHeaderSize=DEFAULT_MAX_HEADER_SIZE) {
+        HTTPRequestParser parser(maxHeaderCount, maxHeaderSize);
+        parser.parse(data.data(), data.size());
+        return parser.getError();
+    };
+    BOOST_CHECK(parse("GET /\r\n\r\n") == HTTPParseError::BAD_REQUEST_LINE);
+    BOOST_CHECK(parse("GET / HTTP/1.1 x\r\n\r\n") == HTTPParseError::BAD_REQUEST_LINE);
+    BOOST_CHECK(parse("GET / FTP/1.1\r\n\r\n") == HTTPParseError::BAD_VERSION);
+    BOOST_CHECK(parse("GET / HTTP/1.1\r\n folded\r\n\r\n") == HTTPParseError::BAD_HEADER);
+    BOOST_CHECK(parse("GET / HTTP/1.1\r\nNo colon\r\n\r\n") == HTTPParseError::BAD_HEADER);
+    BOOST_CHECK(parse("GET / HTTP/1.1\r\nBad name: 1\r\n\r\n") == HTTPParseError::BAD_HEADER);
+    BOOST_CHECK(parse("GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n", 2) == HTTPParseError::TOO_MANY_HEADERS);
+    BOOST_CHECK(parse("GET / HTTP/1.1\r\nA: " + std::string(100, 'a') + "\r\n\r\n", 10, 64) ==
+                HTTPParseError::HEADER_TOO_LARGE);
+    BOOST_CHECK(parse("GET / HTTP/1.1\r\nA: " + std::string(100, 'a'), 10, 64) == HTTPParseError::HEADER_TOO_LARGE);
+    BOOST_CHECK(parse("GET / HTTP/1.1\r\nA: 1\r\n\r\n", 1, 64) == HTTPParseError::NONE);
+
+    HTTPRequestParser parser;
+    parser.setMaxStartLineSize(32);
+    std::string data = "GET /" + std::string(64, 'a');
+    BOOST_CHECK(parser.parse(data.data(), data.size()) == HTTPRequestParser::Result::FAILED);
+    BOOST_CHECK(parser.getError() == HTTPParseError::START_LINE_TOO_LONG);
+    parser.reset();
+    data = "GET /" + std::string(64, 'a') + " HTTP/1.1\r\n\r\n";
+    BOOST_CHECK(parser.parse(data.data(), data.size()) == HTTPRequestParser::Result::FAILED);
+    BOOST_CHECK(parser.getError() == HTTPParseError::START_LINE_TOO_LONG);
+}
+
 BOOST_AUTO_TEST_CASE(TestUnixTime) {
     time_t timestamp = 1359312200;
     BOOST_CHECK_EQUAL(HTTPUtil::formatTimestamp(timestamp), "Sun, 27 Jan 2013 18:43:20 GMT");
-}
\ No newline at end of file
+    BOOST_CHECK_EQUAL(HTTPUtil::formatTimestamp(boost::posix_time::from_time_t(timestamp)),
+                      "Sun, 27 Jan 2013 18:43:20 GMT");
+    BOOST_CHECK_EQUAL(HTTPUtil::formatTimestamp((time_t)951782400), "Tue, 29 Feb 2000 00:00:00 GMT");
+    BOOST_CHECK_EQUAL(String::formatUTCDate((time_t)0), "Thu, 01 Jan 1970 00:00:00 -0000");
+}
+
+BOOST_AUTO_TEST_CASE(TestParseHTTPDate) {
+    DateTime expected = boost::posix_time::from_time_t(784111777);
+    BOOST_CHECK_EQUAL(String::parseUTCDate("Sun, 06 Nov 1994 08:49:37 GMT"), expected);
+    BOOST_CHECK_EQUAL(String::parseUTCDate("Sunday, 06-Nov-94 08:49:37 GMT"), expected);
+    BOOST_CHECK_EQUAL(String::parseUTCDate("Sun Nov  6 08:49:37 1994"), expected);
+    BOOST_CHECK_EQUAL(String::parseUTCDate(HTTPUtil::formatTimestamp((time_t)1359312200)),
+                      boost::posix_time::from_time_t(1359312200));
+    BOOST_CHECK(String::parseUTCDate("").is_not_a_date_time());
+    BOOST_CHECK(String::parseUTCDate("Sun, 06 Nov 1994 08:49:37").is_not_a_date_time());
+    BOOST_CHECK(String::parseUTCDate("Sun, 31 Feb 1994 08:49:37 GMT").is_not_a_date_time());
+    BOOST_CHECK(String::parseUTCDate("Sun, 06 Nov 1994 25:49:37 GMT").is_not_a_date_time());
+    BOOST_CHECK(String::parseUTCDate("Someday, 06-Nov-94 08:49:37 GMT").is_not_a_date_time());
+}
+
+BOOST_AUTO_TEST_CASE(TestParseQSL) {
+    QueryArgList expected = {{"a", "1"}, {"b c", "2"}, {"d", ""}, {"a", "x&y"}};
+    BOOST_CHECK(URLParse::parseQSL("a=1&b+c=2;d=&&a=x%26y", true) == expected);
+    expected = {{"a", "1"}};
+    BOOST_CHECK(URLParse::parseQSL("a=1&d=&e") == expected);
+    BOOST_CHECK(URLParse::parseQSL("").empty());
+    BOOST_CHECK_THROW(URLParse::parseQSL("a=1&e", false, true), ValueError);
+}
+
+BOOST_AUTO_TEST_CASE(TestArena) {
+    alignas(std::max_align_t) char buffer[256];
+    Arena arena(buffer, sizeof(buffer), 1024);
+    void *p = arena.allocate(100);
+    BOOST_CHECK(p >= buffer && p < buffer + sizeof(buffer));
+    BOOST_CHECK_EQUAL(arena.getBlockCount(), 0u);
+    ArenaString s("a string long enough to skip the small string buffer", ArenaAllocator<char>(&arena));
+    ArenaVector<int> v{ArenaAllocator<int>(&arena)};
+    for (int i = 0; i != 1000; ++i) {
+        v.push_back(i);
+    }
+    BOOST_CHECK_EQUAL(v[999], 999);
+    BOOST_CHECK_GE(arena.getBlockCount(), 1u);
+    ArenaVector<int> copied(v);
+    BOOST_CHECK(copied.get_allocator().getArena() == nullptr);
+    BOOST_CHECK_EQUAL(std::string(arena.copy("hello", 5)), "hello");
+    arena.reset();
+    BOOST_CHECK_EQUAL(arena.getBlockCount(), 0u);
+    BOOST_CHECK_EQUAL(arena.getUsedBytes(), 0u);
+    BOOST_CHECK(arena.allocate(16) == buffer);
+    BOOST_CHECK_EQUAL(copied[999], 999);
+}
@@ -109,6 +109,111 @@ protected:
 };
 
 
+
+class UDPEndpointTest: public AsyncTestCase {
+public:
+    void testBatchedSendReceive() {
+        auto server = UDPEndpoint::create(&_ioloop);
+        server->bind(0, "127.0.0.1");
+        auto client = UDPEndpoint::create(&_ioloop);
+        client->bind(0, "127.0.0.1");
+        UDPEndpoint::EndPointType destination(boost::asio::ip::address::from_string("127.0.0.1"),
+                                              server->getLocalPort());
+        std::vector<std::string> received;
+        server->startReading([this, &received, &client](const UDPEndpoint::BatchType &batch) {
+            for (auto &datagram: batch) {
+                BOOST_CHECK_EQUAL(datagram.getSender().port(), client->getLocalPort());
+                received.emplace_back((const char *)datagram.getData(), datagram.getLength());
+            }
+            if (received.size() == 100) {
+                stop();
+            }
+        });
+        for (int i = 0; i != 100; ++i) {
+            std::string message = "message-" + std::to_string(i);
+            client->sendTo((const Byte *)message.data(), message.size(), destination);
+        }
+        wait();
+        BOOST_REQUIRE_EQUAL(received.size(), 100);
+        for (int i = 0; i != 100; ++i) {
+            BOOST_CHECK_EQUAL(received[i], "message-" + std::to_string(i));
+        }
+        BOOST_CHECK_EQUAL(client->getSentCount(), 100);
+        BOOST_CHECK_LT(client->getSendBatchCount(), 100);
+        BOOST_CHECK_EQUAL(server->getReceivedCount(), 100);
+        server->close();
+        client->close();
+    }
+
+    void testSegmentationOffload() {
+        auto server = UDPEndpoint::create(&_ioloop);
+        server->bind(0, "127.0.0.1");
+        bool gro = server->setGRO(true);
+        auto client = UDPEndpoint::create(&_ioloop);
+        client->bind(0, "127.0.0.1");
+        bool gso = client->setGSO(true);
+        if (!gro || !gso) {
+            BOOST_TEST_MESSAGE("UDP segmentation offload unavailable, gro=" << gro << " gso=" << gso);
+        }
+        BOOST_CHECK_EQUAL(server->isGROEnabled(), gro);
+        BOOST_CHECK_EQUAL(client->isGSOEnabled(), gso);
+        UDPEndpoint::EndPointType destination(boost::asio::ip::address::from_string("127.0.0.1"),
+                                              server->getLocalPort());
+        size_t count = 0;
+        server->startReading([this, &count](const UDPEndpoint::BatchType &batch) {
+            for (auto &datagram: batch) {
+                BOOST_CHECK_EQUAL(datagram.getLength(), count == 31 ? 500 : 1000);
+                ++count;
+            }
+            if (count == 32) {
+                stop();
+            }
+        });
+        ByteArray data(1000, (Byte)'x');
+        for (int i = 0; i != 31; ++i) {
+            client->sendTo(data.data(), data.size(), destination);
+        }
+        client->sendTo(data.data(), 500, destination);
+        wait();
+        BOOST_CHECK_EQUAL(count, 32);
+        BOOST_CHECK_EQUAL(client->getSentCount(), 32);
+        server->close();
+        client->close();
+    }
+
+    void testSendHighWaterMark() {
+        auto server = UDPEndpoint::create(&_ioloop);
+        server->bind(0, "127.0.0.1");
+        auto client = UDPEndpoint::create(&_ioloop);
+        client->bind(0, "127.0.0.1");
+        client->setSendHighWaterMark(4000);
+        UDPEndpoint::EndPointType destination(boost::asio::ip::address::from_string("127.0.0.1"),
+                                              server->getLocalPort());
+        size_t count = 0;
+        server->startReading([&count](const UDPEndpoint::BatchType &batch) {
+            count += batch.size();
+        });
+        bool writable = false;
+        client->setWritableCallback([this, &writable]() {
+            writable = true;
+            stop();
+        });
+        ByteArray data(1000, (Byte)'x');
+        for (int i = 0; i != 4; ++i) {
+            BOOST_CHECK(client->sendTo(data.data(), data.size(), destination));
+        }
+        BOOST_CHECK(!client->sendTo(data.data(), data.size(), destination));
+        BOOST_CHECK_EQUAL(client->getPendingSendBytes(), 4000);
+        BOOST_CHECK_EQUAL(client->getSendBlockedCount(), 1);
+        wait();
+        BOOST_CHECK(writable);
+        BOOST_CHECK_EQUAL(client->getPendingSendBytes(), 0);
+        BOOST_CHECK_EQUAL(client->getSentCount(), 4);
+        server->close();
+        client->close();
+    }
+};
+
 TINYCORE_TEST_INIT()
 TINYCORE_TEST_CASE(IOLoopTest, testAddCallbackWakeup)
 TINYCORE_TEST_CASE(IOLoopTest, testAddCallbackWakeupOtherThread)
@@ -117,3 +222,6 @@ TINYCORE_TEST_CASE(IOLoopTest, testRemoveTimeoutAfterFire)
 TINYCORE_TEST_CASE(IOLoopTest, testRemoveTimeoutCleanup)
 TINYCORE_TEST_CASE(IOLoopCurrentTest, testCurrent)
 TINYCORE_TEST_CASE(IOLoopRunSyncTest, testSyncResult)
+TINYCORE_TEST_CASE(UDPEndpointTest, testBatchedSendReceive)
+TINYCORE_TEST_CASE(UDPEndpointTest, testSegmentationOffload)
+TINYCORE_TEST_CASE(UDPEndpointTest, testSendHighWaterMark)
@@ -4,6 +4,7 @@
 
 #define BOOST_TEST_MODULE iostream_test
 #include <boost/test/included/unit_test.hpp>
+#include <sys/stat.h>
 #include "tinycore/tinycore.h"
 
 
@@ -526,8 +527,289 @@ public:
 };
 
 
+class TestIOStreamSSLOffloadImpl: public TestIOStreamSSLImpl {
+public:
+    std::shared_ptr<BaseIOStream> makeClientIOStream(size_t readChunkSize=0) {
+        BaseIOStream::SocketType socket(_ioloop.getService());
+        SSLParams sslParams(false);
+        sslParams.setVerifyMode(SSLVerifyMode::CERT_NONE);
+        sslParams.setHandshakeThreads(1);
+        auto sslOption = SSLOption::create(sslParams);
+        return SSLIOStream::create(std::move(socket), std::move(sslOption), &_ioloop, DEFAULT_MAX_BUFFER_SIZE,
+                                   readChunkSize != 0 ? readChunkSize : DEFAULT_READ_CHUNK_SIZE);
+    }
+
+    std::shared_ptr<SSLOption> getServerSSLOption() const {
+        SSLParams sslParams(true);
+        sslParams.setKeyFile("test.key");
+        sslParams.setCertFile("test.crt");
+        sslParams.setHandshakeThreads(2);
+        sslParams.setMaxPendingHandshakes(16);
+        auto sslOption = SSLOption::create(sslParams);
+        return sslOption;
+    }
+};
+
+
 using TestIOStream = TestIOStreamMixin<TestIOStreamImpl>;
 using TestIOStreamSSL = TestIOStreamMixin<TestIOStreamSSLImpl>;
+using TestIOStreamSSLOffload = TestIOStreamMixin<TestIOStreamSSLOffloadImpl>;
+
+
+class TestIOStreamUnix: public TestIOStreamImpl {
+public:
+    using IOStreamPair = std::pair<std::shared_ptr<BaseIOStream>, std::shared_ptr<BaseIOStream>>;
+
+    class _Server: public TCPServer {
+    public:
+        _Server(IOLoop *ioloop, AsyncTestCase *test, IOStreamPair &streams)
+                : TCPServer(ioloop)
+                , _test(test)
+                , _streams(streams) {
+
+        }
+
+        void handleStream(std::shared_ptr<BaseIOStream> stream, std::string address) override {
+            BOOST_CHECK_EQUAL(address, "0.0.0.0");
+            _streams.first = std::move(stream);
+            _test->stop();
+        }
+
+    protected:
+        AsyncTestCase *_test;
+        IOStreamPair &_streams;
+    };
+
+    void testUnixSocket() {
+        std::string path = "/tmp/tinycore_iostream_test_" + std::to_string(getpid()) + ".sock";
+        auto server = std::make_shared<_Server>(ioloop(), this, _streams);
+        server->listenUnix("unix://" + path, 0640);
+        struct stat st;
+        BOOST_REQUIRE_EQUAL(::stat(path.c_str(), &st), 0);
+        BOOST_CHECK(S_ISSOCK(st.st_mode));
+        BOOST_CHECK_EQUAL(st.st_mode & 0777, 0640);
+        checkEcho("unix://" + path);
+        server->stop();
+        BOOST_CHECK_NE(::stat(path.c_str(), &st), 0);
+    }
+
+    void testAbstractUnixSocket() {
+        std::string address = "unix:@tinycore_iostream_test_" + std::to_string(getpid());
+        auto server = std::make_shared<_Server>(ioloop(), this, _streams);
+        server->listenUnix(address);
+        checkEcho(address);
+        server->stop();
+    }
+protected:
+    void checkEcho(const std::string &address) {
+        auto client = makeClientIOStream();
+        client->connect(address, 0, [this, &client]() {
+            _streams.second = client;
+            stop();
+        });
+        wait(5, [this]() {
+            return _streams.first && _streams.second;
+        });
+        std::shared_ptr<BaseIOStream> server = _streams.first;
+        const char *line = "hello\r\n";
+        client->write((const Byte *)line, strlen(line));
+        server->readUntil("\r\n", [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        BOOST_CHECK_EQUAL(String::toString(wait<ByteArray>()), line);
+        server->close();
+        client->close();
+        _streams = IOStreamPair();
+    }
+
+    IOStreamPair _streams;
+};
+
+
+class TestTCPServer: public TestIOStreamImpl {
+public:
+    class _Server: public TCPServer {
+    public:
+        _Server(IOLoop *ioloop, AsyncTestCase *test, size_t expected)
+                : TCPServer(ioloop)
+                , _test(test)
+                , _expected(expected) {
+
+        }
+
+        void handleStream(std::shared_ptr<BaseIOStream> stream, std::string address) override {
+            _streams.emplace_back(std::move(stream));
+            if (_streams.size() == _expected) {
+                _test->stop();
+            }
+        }
+
+        std::vector<std::shared_ptr<BaseIOStream>>& streams() {
+            return _streams;
+        }
+    protected:
+        AsyncTestCase *_test;
+        size_t _expected;
+        std::vector<std::shared_ptr<BaseIOStream>> _streams;
+    };
+
+    void testBurstAccept() {
+        auto server = std::make_shared<_Server>(ioloop(), this, 20);
+        server->setBacklog(64);
+        server->setAcceptBudget(4);
+        server->setDeferAccept(1);
+        server->setFastOpen(16);
+        server->listen(0, "127.0.0.1");
+        std::vector<std::shared_ptr<BaseIOStream>> clients;
+        for (size_t i = 0; i != 20; ++i) {
+            auto client = makeClientIOStream();
+            client->connect("127.0.0.1", server->getLocalPort());
+            client->write((const Byte *)"x", 1);
+            clients.emplace_back(std::move(client));
+        }
+        wait();
+        BOOST_CHECK_EQUAL(server->streams().size(), 20);
+        for (auto &stream: server->streams()) {
+            stream->close();
+        }
+        for (auto &client: clients) {
+            client->close();
+        }
+        server->stop();
+    }
+
+    void testReusePort() {
+        auto server1 = std::make_shared<_Server>(ioloop(), this, 1);
+        server1->setReusePort(true);
+        server1->listen(0, "127.0.0.1");
+        auto server2 = std::make_shared<_Server>(ioloop(), this, 1);
+        server2->setReusePort(true);
+        server2->listen(server1->getLocalPort(), "127.0.0.1");
+        BOOST_CHECK_EQUAL(server1->getLocalPort(), server2->getLocalPort());
+        server1->stop();
+        server2->stop();
+    }
+};
+
+
+class TestIOStreamSSLRecordSizing: public TestIOStreamSSL {
+public:
+    void testDynamicRecordSizing() {
+        std::shared_ptr<BaseIOStream> server, client;
+        std::tie(server, client) = makeIOStreamPair();
+        auto sslServer = std::static_pointer_cast<SSLIOStream>(server);
+        SSLRecordSizing recordSizing;
+        recordSizing.setBoostThreshold(8192);
+        recordSizing.setIdleTimeout(std::chrono::milliseconds(50));
+        sslServer->setRecordSizing(recordSizing);
+
+        ByteArray data(65536, (Byte)'A');
+        auto transfer = [this, &server, &client, &data]() {
+            server->write(data.data(), data.size());
+            client->readBytes(data.size(), [this](ByteArray data) {
+                stop(std::move(data));
+            });
+            BOOST_CHECK_EQUAL(wait<ByteArray>().size(), data.size());
+        };
+        transfer();
+        BOOST_CHECK_EQUAL(sslServer->getSmallRecordCount(), 6);
+        BOOST_CHECK_GE(sslServer->getLargeRecordCount(), 4);
+        BOOST_CHECK_EQUAL(sslServer->getRecordSizeResetCount(), 0);
+
+        ioloop()->addTimeout(0.1f, [this]() {
+            stop();
+        });
+        wait();
+        transfer();
+        BOOST_CHECK_EQUAL(sslServer->getSmallRecordCount(), 12);
+        BOOST_CHECK_EQUAL(sslServer->getRecordSizeResetCount(), 1);
+        server->close();
+        client->close();
+    }
+};
+
+
+class TestIOStreamMemoryAccountant: public TestIOStream {
+public:
+    void setUp() override {
+        TestIOStream::setUp();
+        _accountant = std::make_shared<MemoryAccountant>(16384);
+        ioloop()->setMemoryAccountant(_accountant);
+    }
+
+    void testPauseAndResume() {
+        std::shared_ptr<BaseIOStream> server, client;
+        std::tie(server, client) = makeIOStreamPair();
+        server->chargeMemory(32768);
+        BOOST_CHECK(_accountant->isOverBudget());
+        client->write((const Byte *)"hello", 5);
+        server->readBytes(5, [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        ByteArray data = wait<ByteArray>();
+        BOOST_CHECK_EQUAL(String::toString(data), "hello");
+        BOOST_CHECK_EQUAL(_accountant->getPausedCount(), 1);
+        bool readCalled = false;
+        server->readBytes(5, [this, &readCalled](ByteArray data) {
+            readCalled = true;
+            stop(std::move(data));
+        });
+        client->write((const Byte *)"world", 5);
+        ioloop()->addTimeout(0.05f, [this]() {
+            stop();
+        });
+        wait();
+        BOOST_CHECK(!readCalled);
+        server->releaseMemory(32768);
+        BOOST_CHECK_EQUAL(_accountant->getPausedCount(), 0);
+        data = wait<ByteArray>();
+        BOOST_CHECK_EQUAL(String::toString(data), "world");
+        BOOST_CHECK_EQUAL(_accountant->getPauseCount(), 1);
+        BOOST_CHECK_GE(_accountant->getPeakUsage(), 32768);
+        server->close();
+        client->close();
+    }
+
+    void testShed() {
+        std::shared_ptr<BaseIOStream> server, client;
+        std::tie(server, client) = makeIOStreamPair();
+        _accountant->setShedLimit(16384);
+        server->setCloseCallback([this]() {
+            stop();
+        });
+        client->chargeMemory(1024);
+        server->chargeMemory(16384);
+        wait();
+        BOOST_CHECK_EQUAL(_accountant->getShedCount(), 1);
+        BOOST_CHECK(server->closed());
+        BOOST_CHECK(server->getError());
+        client->releaseMemory(1024);
+        client->close();
+    }
+
+    void testShedOnStall() {
+        std::shared_ptr<BaseIOStream> server, client;
+        std::tie(server, client) = makeIOStreamPair();
+        _accountant->setStallTimeout(0.05f);
+        server->chargeMemory(32768);
+        client->write((const Byte *)"hello", 5);
+        server->readBytes(5, [this](ByteArray data) {
+            stop(std::move(data));
+        });
+        BOOST_CHECK_EQUAL(String::toString(wait<ByteArray>()), "hello");
+        BOOST_CHECK_EQUAL(_accountant->getPausedCount(), 1);
+        server->setCloseCallback([this]() {
+            stop();
+        });
+        wait();
+        BOOST_CHECK_EQUAL(_accountant->getStallShedCount(), 1);
+        BOOST_CHECK(server->closed());
+        BOOST_CHECK(server->getError());
+        client->close();
+    }
+protected:
+    std::shared_ptr<MemoryAccountant> _accountant;
+};
 
 
 TINYCORE_TEST_INIT()
@@ -569,4 +851,24 @@ TINYCORE_TEST_CASE(TestIOStreamSSL, testStreamingReadUntilCloseAfterClose)
 TINYCORE_TEST_CASE(TestIOStreamSSL, testLargeReadUntil)
 TINYCORE_TEST_CASE(TestIOStreamSSL, testCloseCallbackWithPendingRead)
 
+TINYCORE_TEST_CASE(TestIOStreamSSLOffload, testStreamingCallbackWithDataInBuffer)
+TINYCORE_TEST_CASE(TestIOStreamSSLOffload, testWriteZeroBytes)
+TINYCORE_TEST_CASE(TestIOStreamSSLOffload, testConnectionRefused)
+TINYCORE_TEST_CASE(TestIOStreamSSLOffload, testStreamingCallback)
+TINYCORE_TEST_CASE(TestIOStreamSSLOffload, testCloseBufferedData)
+TINYCORE_TEST_CASE(TestIOStreamSSLOffload, testLargeReadUntil)
+TINYCORE_TEST_CASE(TestIOStreamSSLOffload, testCloseCallbackWithPendingRead)
+
+TINYCORE_TEST_CASE(TestIOStreamUnix, testUnixSocket)
+TINYCORE_TEST_CASE(TestIOStreamUnix, testAbstractUnixSocket)
+
+TINYCORE_TEST_CASE(TestTCPServer, testBurstAccept)
+TINYCORE_TEST_CASE(TestTCPServer, testReusePort)
+
+TINYCORE_TEST_CASE(TestIOStreamSSLRecordSizing, testDynamicRecordSizing)
+
+TINYCORE_TEST_CASE(TestIOStreamMemoryAccountant, testPauseAndResume)
+TINYCORE_TEST_CASE(TestIOStreamMemoryAccountant, testShed)
+TINYCORE_TEST_CASE(TestIOStreamMemoryAccountant, testShedOnStall)
+
 
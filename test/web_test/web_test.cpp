@@ -4,6 +4,8 @@
 
 #define BOOST_TEST_MODULE web_test
 #include <boost/test/included/unit_test.hpp>
+#include <fstream>
+#include <boost/filesystem.hpp>
 #include "tinycore/tinycore.h"
 
 
@@ -699,6 +701,13 @@ public:
             BOOST_CHECK_EQUAL(*body, "hello");
         } while (false);
 
+        do {
+            HTTPResponse response = fetch("/get_argument?foo=a%01b%1F%09c");
+            const std::string *body = response.getBody();
+            BOOST_REQUIRE_NE(body, static_cast<const std::string *>(nullptr));
+            BOOST_CHECK_EQUAL(*body, "a b \tc");
+        } while (false);
+
         do {
             StringMap args = {{"foo", "hello"}};
             HTTPResponse response = fetch("/get_arguments?foo=bar", ARG_method="POST",
@@ -1809,6 +1818,653 @@ public:
 };
 
 
+class RecyclingTest: public AsyncHTTPTestCase {
+public:
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<HelloHandler>("/"),
+        };
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    void testRecycle() {
+        for (int i = 0; i != 3; ++i) {
+            BOOST_CHECK_EQUAL(*fetch("/").getBody(), "hello");
+        }
+        size_t allocated = MemoryPool::getAllocatedCount(), reused = MemoryPool::getReusedCount();
+        for (int i = 0; i != 5; ++i) {
+            BOOST_CHECK_EQUAL(*fetch("/").getBody(), "hello");
+        }
+        BOOST_CHECK_EQUAL(MemoryPool::getAllocatedCount(), allocated);
+        BOOST_CHECK_GE(MemoryPool::getReusedCount(), reused + 5 * 3);
+    }
+
+    void testThreadExit() {
+        struct Holder {
+            ~Holder() {
+                // Runs after the thread's free lists, which were first used after this was constructed
+                MemoryPool::deallocate(block, 64);
+            }
+
+            void *block{nullptr};
+        };
+        std::thread thread([]() {
+            thread_local Holder holder;
+            holder.block = MemoryPool::allocate(64);
+            MemoryPool::deallocate(MemoryPool::allocate(64), 64);
+            BOOST_CHECK_EQUAL(MemoryPool::getFreeCount(), 1);
+        });
+        thread.join();
+    }
+};
+
+
+class OverloadTest: public AsyncHTTPTestCase {
+public:
+    class HealthHandler: public RequestHandler {
+    public:
+        static constexpr RequestPriority priority = RequestPriority::CRITICAL;
+
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            write("ok");
+        }
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<HelloHandler>("/"),
+                url<HelloHandler>("/batch"),
+                url<HealthHandler>("/health"),
+        };
+        handlers[1].setPriority(RequestPriority::LOW);
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    void testShedding() {
+        auto controller = OverloadController::create(&_ioloop);
+        controller->setInterval(0.0f);
+        _app->setOverloadController(controller);
+        BOOST_CHECK(controller->isRunning());
+        // Samples are fed by hand below
+        controller->stop();
+        BOOST_CHECK_EQUAL(fetch("/").getCode(), 200);
+
+        controller->addSample(0.1f);
+        BOOST_CHECK_EQUAL(fetch("/batch").getCode(), 503);
+        BOOST_CHECK_EQUAL(fetch("/").getCode(), 200);
+
+        controller->addSample(0.1f);
+        BOOST_CHECK(controller->isOverloaded());
+        BOOST_CHECK_EQUAL(fetch("/").getCode(), 503);
+        HTTPResponse response = fetch("/health");
+        BOOST_CHECK_EQUAL(response.getCode(), 200);
+        BOOST_CHECK_EQUAL(*response.getBody(), "ok");
+
+        controller->addSample(0.0f);
+        BOOST_CHECK_EQUAL(fetch("/").getCode(), 200);
+        BOOST_CHECK_EQUAL(controller->getShedCount(), 2u);
+        BOOST_CHECK_EQUAL(controller->getInFlight(), 0u);
+    }
+};
+
+
+class ResponseCacheTest: public AsyncHTTPTestCase {
+public:
+    class Handler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            ++executed;
+            if (hasArgument("vary")) {
+                setHeader("Vary", "Accept-Language");
+            }
+            if (hasArgument("varycookie")) {
+                setHeader("Vary", "Cookie");
+            }
+            if (hasArgument("nostore")) {
+                setHeader("Cache-Control", "no-store");
+            }
+            write("hello " + getRequest()->getHTTPHeaders()->get("Accept-Language", "world"));
+        }
+
+        static int executed;
+    };
+
+    class MixinHandler: public ResponseCacheMixin<MixinHandler> {
+    public:
+        using ResponseCacheMixin<MixinHandler>::ResponseCacheMixin;
+
+        void onGet(const StringVector &args) override {
+            write("mixin");
+        }
+    };
+
+    class OtherMixinHandler: public ResponseCacheMixin<OtherMixinHandler> {
+    public:
+        using ResponseCacheMixin<OtherMixinHandler>::ResponseCacheMixin;
+
+        void onGet(const StringVector &args) override {
+            write("other");
+        }
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<Handler>("/"),
+                url<MixinHandler>("/mixin"),
+                url<OtherMixinHandler>("/other"),
+        };
+        std::string defaultHost;
+        Application::TransformsType transforms;
+        Application::SettingsType settings = {
+                {"gzip", true},
+                {"responseCache", ResponseCache::create()},
+        };
+        return make_unique<Application>(std::move(handlers), std::move(defaultHost), std::move(transforms),
+                                        std::move(settings));
+    }
+
+    void testCache() {
+        Handler::executed = 0;
+        HTTPResponse response1 = fetch("/?a=1");
+        BOOST_CHECK_EQUAL(*response1.getBody(), "hello world");
+        BOOST_CHECK_EQUAL(response1.getHeaders().at("Content-Encoding"), "gzip");
+        HTTPResponse response2 = fetch("/?a=1");
+        BOOST_CHECK_EQUAL(*response2.getBody(), "hello world");
+        BOOST_CHECK_EQUAL(response2.getHeaders().at("Content-Encoding"), "gzip");
+        BOOST_CHECK_EQUAL(response2.getHeaders().at("Etag"), response1.getHeaders().at("Etag"));
+        BOOST_CHECK(response2.getHeaders().has("Age"));
+        BOOST_CHECK_EQUAL(Handler::executed, 1);
+
+        HTTPResponse response3 = fetch("/?a=1", ARG_useGzip=false);
+        BOOST_CHECK_EQUAL(*response3.getBody(), "hello world");
+        BOOST_CHECK(!response3.getHeaders().has("Content-Encoding"));
+        BOOST_CHECK_EQUAL(response3.getHeaders().at("Content-Length"), "11");
+        BOOST_CHECK_EQUAL(Handler::executed, 1);
+
+        HTTPHeaders headers;
+        headers["If-None-Match"] = response1.getHeaders().at("Etag");
+        HTTPResponse response4 = fetch("/?a=1", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(response4.getCode(), 304);
+        BOOST_CHECK(!response4.getHeaders().has("Content-Length"));
+        BOOST_CHECK_EQUAL(Handler::executed, 1);
+
+        fetch("/?a=2");
+        BOOST_CHECK_EQUAL(Handler::executed, 2);
+        fetch("/?nostore=1");
+        fetch("/?nostore=1");
+        BOOST_CHECK_EQUAL(Handler::executed, 4);
+
+        BOOST_CHECK_EQUAL(_app->getResponseCache()->getCount(), 2u);
+        BOOST_CHECK_EQUAL(*fetch("/mixin").getBody(), "mixin");
+        BOOST_CHECK_EQUAL(*fetch("/mixin").getBody(), "mixin");
+        BOOST_CHECK_EQUAL(MixinHandler::responseCache()->getHitCount(), 1u);
+        BOOST_CHECK_EQUAL(_app->getResponseCache()->getCount(), 2u);
+        BOOST_CHECK_NE(MixinHandler::responseCache(), OtherMixinHandler::responseCache());
+        BOOST_CHECK_EQUAL(*fetch("/other").getBody(), "other");
+        BOOST_CHECK_EQUAL(MixinHandler::responseCache()->getCount(), 1u);
+        BOOST_CHECK_EQUAL(OtherMixinHandler::responseCache()->getCount(), 1u);
+    }
+
+    void testIfNoneMatchList() {
+        HTTPResponse response = fetch("/?inm=1");
+        std::string etag = response.getHeaders().at("Etag");
+        HTTPHeaders headers;
+        headers["If-None-Match"] = "\"other\", W/" + etag;
+        BOOST_CHECK_EQUAL(fetch("/?inm=1", ARG_headers=headers).getCode(), 304);
+        headers["If-None-Match"] = "\"x" + etag.substr(1) + "\"";
+        BOOST_CHECK_EQUAL(fetch("/?inm=1", ARG_headers=headers).getCode(), 200);
+    }
+
+    void testCookie() {
+        Handler::executed = 0;
+        HTTPHeaders headers;
+        headers["Cookie"] = "session=alice";
+        fetch("/?cookie=1", ARG_headers=headers);
+        fetch("/?cookie=1", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(Handler::executed, 2);
+        fetch("/?cookie=1");
+        fetch("/?cookie=1");
+        BOOST_CHECK_EQUAL(Handler::executed, 3);
+        fetch("/?cookie=1", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(Handler::executed, 4);
+
+        fetch("/?varycookie=1", ARG_headers=headers);
+        fetch("/?varycookie=1", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(Handler::executed, 5);
+        headers["Cookie"] = "session=bob";
+        fetch("/?varycookie=1", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(Handler::executed, 6);
+    }
+
+    void testVary() {
+        Handler::executed = 0;
+        HTTPHeaders headers;
+        headers["Accept-Language"] = "en";
+        BOOST_CHECK_EQUAL(*fetch("/?vary=1", ARG_headers=headers).getBody(), "hello en");
+        headers["Accept-Language"] = "fr";
+        BOOST_CHECK_EQUAL(*fetch("/?vary=1", ARG_headers=headers).getBody(), "hello fr");
+        BOOST_CHECK_EQUAL(*fetch("/?vary=1", ARG_headers=headers).getBody(), "hello fr");
+        headers["Accept-Language"] = "en";
+        BOOST_CHECK_EQUAL(*fetch("/?vary=1", ARG_headers=headers).getBody(), "hello en");
+        BOOST_CHECK_EQUAL(Handler::executed, 2);
+    }
+};
+
+int ResponseCacheTest::Handler::executed = 0;
+
+
+class CoalesceTest: public AsyncHTTPTestCase {
+public:
+    class SlowHandler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            int count = ++executed;
+            if (hasArgument("cookie")) {
+                setCookie("count", std::to_string(count));
+            }
+            Asynchronous();
+            IOLoop::current()->addTimeout(0.05f, [this, self=shared_from_this(), count]() {
+                finish("slow " + std::to_string(count));
+            });
+        }
+
+        static int executed;
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<SlowHandler>("/slow"),
+        };
+        std::string defaultHost;
+        Application::TransformsType transforms;
+        Application::SettingsType settings = {
+                {"requestCoalescer", RequestCoalescer::create()},
+        };
+        return make_unique<Application>(std::move(handlers), std::move(defaultHost), std::move(transforms),
+                                        std::move(settings));
+    }
+
+    std::vector<HTTPResponse> fetchConcurrently(const std::string &path, size_t count) {
+        std::vector<HTTPResponse> responses;
+        for (size_t i = 0; i != count; ++i) {
+            _httpClient->fetch(HTTPRequest::create(getURL(path)), [this, &responses, count](HTTPResponse response) {
+                responses.push_back(std::move(response));
+                if (responses.size() == count) {
+                    stop();
+                }
+            });
+        }
+        wait();
+        return responses;
+    }
+
+    void testCoalesce() {
+        SlowHandler::executed = 0;
+        const auto &coalescer = _app->getRequestCoalescer();
+        for (auto &response: fetchConcurrently("/slow", 4)) {
+            BOOST_CHECK_EQUAL(response.getCode(), 200);
+            BOOST_CHECK_EQUAL(*response.getBody(), "slow 1");
+        }
+        BOOST_CHECK_EQUAL(SlowHandler::executed, 1);
+        BOOST_CHECK_EQUAL(coalescer->getCoalescedCount(), 3u);
+        BOOST_CHECK_EQUAL(coalescer->getFlightCount(), 0u);
+
+        StringSet bodies;
+        for (auto &response: fetchConcurrently("/slow?cookie=1", 3)) {
+            BOOST_CHECK_EQUAL(response.getCode(), 200);
+            bodies.insert(*response.getBody());
+        }
+        BOOST_CHECK_EQUAL(SlowHandler::executed, 4);
+        BOOST_CHECK_EQUAL(bodies.size(), 3u);
+        BOOST_CHECK_EQUAL(coalescer->getCoalescedCount(), 3u);
+
+        HTTPHeaders headers;
+        headers["Authorization"] = "Basic Zm9vOmJhcg==";
+        fetch("/slow", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(SlowHandler::executed, 5);
+    }
+};
+
+int CoalesceTest::SlowHandler::executed = 0;
+
+
+class StaticFileTest: public AsyncHTTPTestCase {
+public:
+    void setUp() override {
+        _base = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("tinycore-static-%%%%%%%%");
+        boost::filesystem::path root = _base / "root", outside = _base / "outside";
+        boost::filesystem::create_directories(root);
+        boost::filesystem::create_directories(outside);
+        std::ofstream((root / "hello.txt").string()) << "Hello, static world!";
+        std::ofstream((root / "hello.txt.br").string()) << "BROTLI";
+        std::ofstream((root / "large.bin").string()) << std::string(1024 * 1024, 'x');
+        std::ofstream((outside / "secret.txt").string()) << "secret";
+        boost::filesystem::create_symlink(outside / "secret.txt", root / "escape.txt");
+        StaticFileHandler::getFileCache().clear();
+        AsyncHTTPTestCase::setUp();
+    }
+
+    void tearDown() override {
+        AsyncHTTPTestCase::tearDown();
+        StaticFileHandler::getFileCache().clear();
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(_base, ec);
+    }
+
+    std::unique_ptr<Application> getApp() const override {
+        RequestHandler::ArgsType args = {
+                {"path", (_base / "root").string()}
+        };
+        Application::HandlersType handlers = {
+                url<StaticFileHandler>("/static/(.*)", args),
+        };
+        std::string defaultHost;
+        Application::TransformsType transforms;
+        Application::SettingsType settings = {
+                {"gzip", true},
+        };
+        return make_unique<Application>(std::move(handlers), std::move(defaultHost), std::move(transforms),
+                                        std::move(settings));
+    }
+
+    void testStaticFile() {
+        HTTPResponse response = fetch("/static/hello.txt");
+        BOOST_CHECK_EQUAL(response.getCode(), 200);
+        BOOST_CHECK_EQUAL(*response.getBody(), "Hello, static world!");
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Content-Type"), "text/plain");
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Accept-Ranges"), "bytes");
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Vary"), "Accept-Encoding");
+        std::string etag = response.getHeaders().at("Etag");
+
+        HTTPHeaders headers;
+        headers["If-None-Match"] = etag;
+        BOOST_CHECK_EQUAL(fetch("/static/hello.txt", ARG_headers=headers).getCode(), 304);
+
+        response = fetch("/static/large.bin");
+        BOOST_CHECK_EQUAL(response.getCode(), 200);
+        BOOST_CHECK_EQUAL(response.getBody()->size(), 1024u * 1024u);
+
+        BOOST_CHECK_EQUAL(fetch("/static/missing.txt").getCode(), 404);
+        BOOST_CHECK_EQUAL(fetch("/static/%2E%2E/hello.txt").getCode(), 403);
+        BOOST_CHECK_EQUAL(fetch("/static/escape.txt").getCode(), 403);
+    }
+
+    void testRange() {
+        HTTPHeaders headers;
+        headers["Range"] = "bytes=0-4";
+        HTTPResponse response = fetch("/static/hello.txt", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(response.getCode(), 206);
+        BOOST_CHECK_EQUAL(*response.getBody(), "Hello");
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Content-Range"), "bytes 0-4/20");
+
+        headers["Range"] = "bytes=-6";
+        BOOST_CHECK_EQUAL(*fetch("/static/hello.txt", ARG_headers=headers).getBody(), "world!");
+
+        headers["Range"] = "bytes=100-";
+        response = fetch("/static/hello.txt", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(response.getCode(), 416);
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Content-Range"), "bytes */20");
+
+        headers["Range"] = "bytes=7-";
+        headers["If-Range"] = "\"stale\"";
+        response = fetch("/static/hello.txt", ARG_headers=headers);
+        BOOST_CHECK_EQUAL(response.getCode(), 200);
+        BOOST_CHECK_EQUAL(*response.getBody(), "Hello, static world!");
+    }
+
+    void testPrecompressed() {
+        HTTPHeaders headers;
+        headers["Accept-Encoding"] = "br";
+        HTTPResponse response = fetch("/static/hello.txt", ARG_headers=headers, ARG_useGzip=false);
+        BOOST_CHECK_EQUAL(response.getCode(), 200);
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Content-Encoding"), "br");
+        BOOST_CHECK_EQUAL(*response.getBody(), "BROTLI");
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Vary"), "Accept-Encoding");
+    }
+protected:
+    boost::filesystem::path _base;
+};
+
+
+class EtagTest: public AsyncHTTPTestCase {
+public:
+    class Handler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void onGet(const StringVector &args) override {
+            if (hasArgument("off")) {
+                setAutoEtag(false);
+            }
+            write("hello");
+            write(getArgument("extra", ""));
+        }
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<Handler>("/"),
+        };
+        std::string defaultHost;
+        Application::TransformsType transforms;
+        Application::SettingsType settings = {
+                {"etagMaxSize", (size_t)16},
+        };
+        return make_unique<Application>(std::move(handlers), std::move(defaultHost), std::move(transforms),
+                                        std::move(settings));
+    }
+
+    void testFastHash() {
+        XXHash64 hasher;
+        BOOST_CHECK_EQUAL(hasher.hex(), "ef46db3751d8e999");
+        hasher.update(std::string("abc"));
+        BOOST_CHECK_EQUAL(hasher.hex(), "44bc2cf5ad770999");
+        hasher.reset();
+        hasher.update(std::string("Nobody inspects"));
+        hasher.update(std::string(" the spammish repetition"));
+        BOOST_CHECK_EQUAL(hasher.hex(), "fbcea83c8a378bf1");
+    }
+
+    void testAutoEtag() {
+        XXHash64 hasher;
+        hasher.update(std::string("hello,world"));
+        HTTPResponse response = fetch("/?extra=,world");
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Etag"), "\"" + hasher.hex() + "\"");
+
+        HTTPHeaders headers;
+        headers["If-None-Match"] = response.getHeaders().at("Etag");
+        BOOST_CHECK_EQUAL(fetch("/?extra=,world", ARG_headers=headers).getCode(), 304);
+
+        BOOST_CHECK(!fetch("/?off=1").getHeaders().has("Etag"));
+
+        std::string extra = "?extra=" + std::string(32, 'x');
+        BOOST_CHECK(!fetch("/" + extra).getHeaders().has("Etag"));
+        hasher.reset();
+        hasher.update("hello" + std::string(32, 'x'));
+        headers["If-None-Match"] = "\"" + hasher.hex() + "\"";
+        BOOST_CHECK_EQUAL(fetch("/" + extra, ARG_headers=headers).getCode(), 304);
+    }
+};
+
+class RouterTest: public AsyncHTTPTestCase {
+public:
+    class Handler: public RequestHandler {
+    public:
+        using RequestHandler::RequestHandler;
+
+        void initialize(ArgsType &args) override {
+            _route = boost::any_cast<const char *>(args.at("route"));
+        }
+
+        void onGet(const StringVector &args) override {
+            write(_route + ":" + boost::join(args, ","));
+        }
+    protected:
+        std::string _route;
+    };
+
+    std::unique_ptr<Application> getApp() const override {
+        Application::HandlersType handlers = {
+                url<Handler>("/users/([0-9]+)", RequestHandler::ArgsType{{"route", "id"}}),
+                url<Handler>("/users/(me|self)", RequestHandler::ArgsType{{"route", "me"}}),
+                url<Handler>("/users/([^/]+)/posts/([0-9]+)", RequestHandler::ArgsType{{"route", "post"}}),
+                url<Handler>("/files/(.*)", RequestHandler::ArgsType{{"route", "file"}}),
+                url<Handler>("/users/(.+)", RequestHandler::ArgsType{{"route", "rest"}}),
+        };
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    void testDispatch() {
+        BOOST_CHECK_EQUAL(*fetch("/users/42").getBody(), "id:42");
+        BOOST_CHECK_EQUAL(*fetch("/users/me").getBody(), "me:me");
+        BOOST_CHECK_EQUAL(*fetch("/users/bob/posts/7").getBody(), "post:bob,7");
+        BOOST_CHECK_EQUAL(*fetch("/users/a%20b").getBody(), "rest:a b");
+        BOOST_CHECK_EQUAL(*fetch("/users/bob/posts/x").getBody(), "rest:bob/posts/x");
+        BOOST_CHECK_EQUAL(*fetch("/files/").getBody(), "file:");
+        BOOST_CHECK_EQUAL(*fetch("/files/js/app.js").getBody(), "file:js/app.js");
+        BOOST_CHECK_EQUAL(fetch("/users/").getCode(), 404);
+    }
+
+    void testFirstMatch() {
+        Application::HandlersType specs = {
+                url<RequestHandler>("/a/(.*)"),
+                url<RequestHandler>("/a/([0-9]+)"),
+                url<RequestHandler>("^/b/x$"),
+                url<RequestHandler>("/b/(x|y)"),
+                url<RequestHandler>("/b/([^/]+)"),
+                url<RequestHandler>("/c/([0-9]+)/d"),
+                url<RequestHandler>("/c/(\\d+)"),
+                url<RequestHandler>("/c/([^/]+)"),
+                url<RequestHandler>("/e\\.json"),
+                url<RequestHandler>("/e.json"),
+                url<RequestHandler>("/(.+)"),
+        };
+        URLRouter router;
+        for (auto &spec: specs) {
+            router.add(&spec);
+        }
+        BOOST_CHECK_EQUAL(router.getRegexRouteCount(), 2u);
+        for (const char *path: {"/a/1", "/a/", "/b/x", "/b/y", "/b/z", "/c/1/d", "/c/1", "/c/1x", "/c/1/e",
+                                "/e.json", "/eXjson", "/", "", "/c/%2F"}) {
+            std::string requestPath = path;
+            StringVector args, expectedArgs;
+            URLSpec *expected = nullptr;
+            boost::xpressive::smatch match;
+            for (auto &spec: specs) {
+                if (boost::xpressive::regex_match(requestPath, match, spec.getRegex())) {
+                    expected = &spec;
+                    for (size_t i = 1; i < match.size(); ++i) {
+                        expectedArgs.push_back(URLParse::unquote(match[i].str()));
+                    }
+                    break;
+                }
+            }
+            BOOST_CHECK_MESSAGE(router.match(requestPath, args) == expected, requestPath);
+            BOOST_CHECK(args == expectedArgs);
+        }
+    }
+};
+
+class AssetPackTest: public AsyncHTTPTestCase {
+public:
+    void setUp() override {
+        _base = boost::filesystem::temp_directory_path()
+                / boost::filesystem::unique_path("tinycore-assetpack-%%%%%%%%");
+        boost::filesystem::path root = _base / "root";
+        boost::filesystem::create_directories(root / "js");
+        std::ofstream((root / "index.html").string()) << std::string(4096, 'a');
+        std::ofstream((root / "js/app.js").string()) << "var app = 1;";
+        std::ofstream((root / "js/app.js.br").string()) << "BROTLI";
+        AssetPackBuilder builder;
+        builder.addDirectory(root.string());
+        for (int i = 0; i != 500; ++i) {
+            std::string body = std::to_string(i);
+            builder.add("generated/" + body, "text/plain", ByteArray(body.begin(), body.end()));
+        }
+        builder.write(getPackName());
+        AsyncHTTPTestCase::setUp();
+    }
+
+    void tearDown() override {
+        AsyncHTTPTestCase::tearDown();
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(_base, ec);
+    }
+
+    std::string getPackName() const {
+        return (_base / "assets.pack").string();
+    }
+
+    std::unique_ptr<Application> getApp() const override {
+        RequestHandler::ArgsType args = {
+                {"pack", AssetPack::create(getPackName())}
+        };
+        Application::HandlersType handlers = {
+                url<AssetPackHandler>("/assets/(.*)", args),
+        };
+        return make_unique<Application>(std::move(handlers));
+    }
+
+    void testIndex() {
+        auto pack = AssetPack::create(getPackName());
+        BOOST_CHECK_EQUAL(pack->getCount(), 502u);
+        for (int i = 0; i != 500; ++i) {
+            std::string body = std::to_string(i);
+            const AssetPackEntry *entry = pack->find("generated/" + body);
+            BOOST_REQUIRE(entry != nullptr);
+            BOOST_CHECK_EQUAL(pack->getString(entry->bodies[AssetPack::IDENTITY]), body);
+        }
+        BOOST_CHECK(pack->find("generated/500") == nullptr);
+        BOOST_CHECK(pack->find("js/app.js.br") == nullptr);
+
+        // Rebuilding replaces the file, so a pack that is still mapped keeps its contents
+        AssetPackBuilder builder;
+        builder.add("other.txt", "text/plain", ByteArray(8, 'o'));
+        builder.write(getPackName());
+        const AssetPackEntry *entry = pack->find("generated/42");
+        BOOST_REQUIRE(entry != nullptr);
+        BOOST_CHECK_EQUAL(pack->getString(entry->bodies[AssetPack::IDENTITY]), "42");
+        BOOST_CHECK_EQUAL(AssetPack::create(getPackName())->getCount(), 1u);
+    }
+
+    void testServe() {
+        HTTPResponse response = fetch("/assets/index.html");
+        BOOST_CHECK_EQUAL(response.getCode(), 200);
+        BOOST_CHECK_EQUAL(*response.getBody(), std::string(4096, 'a'));
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Content-Type"), "text/html");
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Vary"), "Accept-Encoding");
+        std::string etag = response.getHeaders().at("Etag");
+
+        HTTPHeaders headers;
+        headers["If-None-Match"] = etag;
+        BOOST_CHECK_EQUAL(fetch("/assets/index.html", ARG_headers=headers).getCode(), 304);
+
+        headers.clear();
+        headers["Accept-Encoding"] = "gzip";
+        response = fetch("/assets/index.html", ARG_headers=headers, ARG_useGzip=false);
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Content-Encoding"), "gzip");
+        BOOST_CHECK_LT(response.getBody()->size(), 4096u);
+        BOOST_CHECK_NE(response.getHeaders().at("Etag"),
+                       fetch("/assets/index.html", ARG_useGzip=false).getHeaders().at("Etag"));
+
+        headers["Accept-Encoding"] = "gzip, br";
+        response = fetch("/assets/js/app.js", ARG_headers=headers, ARG_useGzip=false);
+        BOOST_CHECK_EQUAL(response.getHeaders().at("Content-Encoding"), "br");
+        BOOST_CHECK_EQUAL(*response.getBody(), "BROTLI");
+
+        BOOST_CHECK_EQUAL(fetch("/assets/missing.js").getCode(), 404);
+    }
+protected:
+    boost::filesystem::path _base;
+};
+
+
 TINYCORE_TEST_INIT()
 TINYCORE_TEST_CASE(CookieTest, testSetCookie)
 TINYCORE_TEST_CASE(CookieTest, testGetCookie)
@@ -1856,3 +2512,20 @@ TINYCORE_TEST_CASE(FinishInPrepareTest, testFinishInPrepare)
 TINYCORE_TEST_CASE(Default404Test, test404)
 TINYCORE_TEST_CASE(Custom404Test, test404)
 TINYCORE_TEST_CASE(DefaultHandlerArgumentsTest, test404)
+TINYCORE_TEST_CASE(RecyclingTest, testRecycle)
+TINYCORE_TEST_CASE(RecyclingTest, testThreadExit)
+TINYCORE_TEST_CASE(OverloadTest, testShedding)
+TINYCORE_TEST_CASE(ResponseCacheTest, testCache)
+TINYCORE_TEST_CASE(ResponseCacheTest, testVary)
+TINYCORE_TEST_CASE(ResponseCacheTest, testIfNoneMatchList)
+TINYCORE_TEST_CASE(ResponseCacheTest, testCookie)
+TINYCORE_TEST_CASE(CoalesceTest, testCoalesce)
+TINYCORE_TEST_CASE(StaticFileTest, testStaticFile)
+TINYCORE_TEST_CASE(StaticFileTest, testRange)
+TINYCORE_TEST_CASE(StaticFileTest, testPrecompressed)
+TINYCORE_TEST_CASE(EtagTest, testFastHash)
+TINYCORE_TEST_CASE(EtagTest, testAutoEtag)
+TINYCORE_TEST_CASE(RouterTest, testDispatch)
+TINYCORE_TEST_CASE(RouterTest, testFirstMatch)
+TINYCORE_TEST_CASE(AssetPackTest, testIndex)
+TINYCORE_TEST_CASE(AssetPackTest, testServe)